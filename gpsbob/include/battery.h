@@ -0,0 +1,43 @@
+/*
+ * Battery state from background voltage samples.
+ *
+ * Samples are smoothed with an exponential moving average. Under load the
+ * terminal voltage sags by the current times the cell's internal
+ * resistance, so the open-circuit voltage is estimated from the caller's
+ * load figure before it is mapped to a charge level. The mapping
+ * interpolates a single-cell LiPo discharge table.
+ *
+ * Remaining runtime comes from the measured drain: the charge level is
+ * compared every BATTERY_RATE_WINDOW_MS and the rate averaged. While the
+ * level rises (charging) or before a full window, runtime is unknown.
+ */
+
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <stdint.h>
+
+#define BATTERY_EMA_ALPHA 0.1f     /* Per sample, ~10 samples time constant */
+#define BATTERY_R_INTERNAL 0.15f   /* Ohm, cell plus protection circuit */
+#define BATTERY_MIN_V 3.0f         /* Below this there is no cell reading */
+#define BATTERY_RATE_WINDOW_MS 300000
+#define BATTERY_CHARGE_PCT_H 2.0f  /* Rising faster than this is charging */
+
+struct battery_model {
+	bool primed;
+	float v_ema;    /* Terminal voltage, V */
+	float load_ma;  /* Load at the last sample */
+	bool have_ref;
+	float ref_pct;
+	uint32_t ref_ms;
+	float drain_pct_h; /* 0 when unknown */
+};
+
+void battery_model_init(struct battery_model *m);
+void battery_model_sample(struct battery_model *m, float volts, float load_ma, uint32_t ms);
+float battery_model_ocv(const struct battery_model *m);
+float battery_model_percent(const struct battery_model *m);
+float battery_model_runtime_h(const struct battery_model *m);
+float battery_percent_from_v(float ocv);
+
+#endif /* BATTERY_H */
@@ -0,0 +1,65 @@
+/*
+ * Board variant, chosen by the PlatformIO environment:
+ *
+ *   esp32dev  -DGPSBOB_BOARD_XIAO_S3  Seeed XIAO ESP32-S3, SH1106 OLED
+ *   wroom     -DGPSBOB_BOARD_WROOM    ESP32 WROOM devkit, SSD1306 OLED
+ *   native    -DGPSBOB_NATIVE         host build of the portable modules
+ *
+ * Everything is constexpr, so pin numbers fold into the code exactly as
+ * the old #defines did. Without a flag the XIAO S3 is assumed.
+ *
+ * Both boards have the card on SPI. A variant that wires it to the SDMMC
+ * host defines GPSBOB_SDMMC_WIDTH (1 or 4) and sdmmc_clk, sdmmc_cmd and
+ * sdmmc_d0..d3; storage.cpp then uses it when sd_mmc is set.
+ */
+
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stdint.h>
+
+#if defined(GPSBOB_NATIVE)
+
+struct board {
+	static constexpr const char *name = "native";
+};
+
+#elif defined(GPSBOB_BOARD_WROOM)
+
+#include <Arduino.h>
+
+#define GPSBOB_DISPLAY_SSD1306 1
+
+/* See "Wiring Summary.md" */
+struct board {
+	static constexpr const char *name = "ESP32 WROOM";
+	static constexpr uint8_t sd_cs = 5;
+	static constexpr uint8_t gps_uart = 2;
+	static constexpr uint8_t gps_rx = 16;
+	static constexpr uint8_t gps_tx = 17;
+	static constexpr gpio_num_t button = GPIO_NUM_32; /* Reed switch 1 */
+	static constexpr uint8_t battery_adc = 36;        /* GPIO36 (VP) */
+	static constexpr uint8_t oled_addr = 0x3C;
+};
+
+#else /* GPSBOB_BOARD_XIAO_S3 */
+
+#include <Arduino.h>
+
+#define GPSBOB_DISPLAY_SH1106 1
+
+/* SDA D4, SCL D5: the Wire defaults */
+struct board {
+	static constexpr const char *name = "XIAO ESP32-S3";
+	static constexpr uint8_t sd_cs = D3;
+	static constexpr uint8_t gps_uart = 0;
+	static constexpr uint8_t gps_rx = D7;
+	static constexpr uint8_t gps_tx = D6;
+	static constexpr gpio_num_t button = GPIO_NUM_2;
+	static constexpr uint8_t battery_adc = 36;
+	static constexpr uint8_t oled_addr = 0x3C;
+};
+
+#endif
+
+#endif /* BOARD_H */
@@ -0,0 +1,70 @@
+/*
+ * Button gestures from debounced edges.
+ *
+ * The firmware timestamps the first edge of every bounce in a GPIO
+ * interrupt and samples the settled level from a one-shot timer
+ * debounce_ms later; button_sample() takes that level together with the
+ * edge's time. Durations therefore come from the interrupt, not from when
+ * loop() got round to looking, and a press made while loop() is blocked
+ * is still seen and measured correctly.
+ *
+ * Gestures, reported once the button is released:
+ *   single  one press, when no second one followed within double_ms
+ *   double  two presses, each second press ends the gesture
+ *   long    held for long_ms or more; also ends a pending single
+ * Long presses are reported on release rather than after long_ms so that
+ * deep sleep, which wakes on the button level, is never entered while it
+ * is still held down.
+ *
+ * A single press is only known once double_ms have passed without another
+ * one. button_sample() returns how long the caller should wait before
+ * calling it again with the unchanged level, 0 when nothing is pending.
+ *
+ * Events go through a small single-producer, single-consumer ring: the
+ * timer callbacks produce, loop() consumes with button_get(). Nothing in
+ * here depends on Arduino.
+ */
+
+#ifndef BUTTON_H
+#define BUTTON_H
+
+#include <atomic>
+#include <stdint.h>
+
+#define BUTTON_QUEUE 8 /* Power of two */
+
+enum button_gesture {
+	BUTTON_SINGLE,
+	BUTTON_DOUBLE,
+	BUTTON_LONG
+};
+
+struct button_event {
+	enum button_gesture gesture;
+	uint32_t held_ms;  /* Of the last press */
+	uint32_t start_us; /* First edge of the gesture */
+	uint32_t done_us;  /* When it was recognized */
+};
+
+struct button {
+	uint32_t double_us;
+	uint32_t long_us;
+	bool down;          /* Debounced level */
+	uint8_t presses;    /* Of the gesture in progress */
+	uint32_t start_us;
+	uint32_t down_us;
+	uint32_t up_us;
+	uint32_t held_us;
+	struct button_event ring[BUTTON_QUEUE];
+	std::atomic<uint32_t> head; /* Written by the producer */
+	std::atomic<uint32_t> tail; /* Written by the consumer */
+	uint32_t dropped;
+};
+
+void button_init(struct button *b, uint32_t double_ms, uint32_t long_ms);
+/* Settled level, the time of the edge that led to it, and the time now */
+uint32_t button_sample(struct button *b, bool pressed, uint32_t edge_us, uint32_t now_us);
+bool button_get(struct button *b, struct button_event *ev);
+const char *button_gesture_name(enum button_gesture g);
+
+#endif /* BUTTON_H */
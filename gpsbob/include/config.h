@@ -0,0 +1,73 @@
+/*
+ * Device settings, kept in RAM and backed by the NVS partition.
+ *
+ * Boot reads a versioned binary record from NVS, which takes microseconds
+ * and does not need the SD card. config.txt stays the user-facing copy:
+ * once the card is up, config_sync() imports it if it changed since the
+ * last sync and writes it out if it is missing.
+ *
+ * Web handlers change a copy with config_set() and then call config_save()
+ * on it once. That writes the whole file to a temporary name, renames it
+ * over config.txt and updates NVS. The copy is handed to loop(), which is
+ * the only writer of config.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <FS.h>
+
+#define CONFIG_PATH "/config.txt"
+#define CONFIG_TEMP_PATH "/config.tmp"
+#define CONFIG_LINE_MAX 96
+#define CONFIG_NVS_NAMESPACE "gpsbob"
+#define CONFIG_NVS_KEY "cfg"
+#define CONFIG_VERSION 7 /* Bump when the meaning of a field changes */
+
+struct gps_config {
+	int timezone_offset_hours; /* Local time = UTC + offset */
+	int log_interval;          /* ms, used when log_distance is 0 */
+	int log_distance;          /* m, 0 = fixed log_interval instead */
+	int log_heading;           /* deg of turn that forces a point */
+	int log_max_gap;           /* ms without a point at most */
+	int live_interval;         /* ms */
+	int gps_baud;              /* Must match the receiver's own setting */
+	int sd_mhz;                /* Card clock, see storage.h */
+	bool sd_mmc;               /* SDMMC host instead of SPI, where wired */
+	int gate_sats;             /* Fix quality gate, see fix_gate.h */
+	float gate_hdop;
+	int gate_age;              /* ms */
+	bool gate_fixq;
+	int gate_kmh;              /* 0 = no jump check */
+	char wifi_ssid[33];
+	char wifi_pass[65];
+	double waypoint_A_lat;
+	double waypoint_A_lng;
+	double waypoint_B_lat;
+	double waypoint_B_lng;
+	char route_file[48]; /* GPX or CSV route for NAV_MODE */
+	int arrive_radius;   /* m, waypoint counts as reached inside this */
+	bool filter_display; /* Kalman-filtered position instead of raw fixes */
+	bool filter_log;
+	bool filter_nav;
+};
+
+/* NVS record, rejected on a version or size mismatch */
+struct config_record {
+	uint16_t version;
+	uint16_t size;
+	uint32_t src_mtime; /* config.txt this record was synced with */
+	uint32_t src_size;
+	struct gps_config cfg;
+};
+
+extern struct gps_config config;
+
+void config_defaults(struct gps_config *c);
+bool config_set(struct gps_config *c, const char *key, const char *value);
+bool config_begin(void);
+bool config_sync(fs::FS &fs);
+bool config_load(fs::FS &fs);
+bool config_save(fs::FS &fs, const struct gps_config *c);
+
+#endif /* CONFIG_H */
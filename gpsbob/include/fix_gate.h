@@ -0,0 +1,89 @@
+/*
+ * Fix quality gate.
+ *
+ * Every fix the receiver completes (a GGA and RMC pair) is judged once,
+ * before anything uses it. A rejected fix is counted and otherwise treated
+ * as if no new fix had arrived: the display, the log, the filter and the
+ * trip computer keep the last good one.
+ *
+ * The checks, in order, each counted under its own reason:
+ *   no fix    the sentence pair carried no position
+ *   quality   GGA fix quality is not a real fix (estimated, manual,
+ *             simulated), when enabled
+ *   sats      fewer satellites than min_sats
+ *   hdop      HDOP above max_hdop, or not reported
+ *   age       the position is older than max_age_ms
+ *   jump      reaching it from the last accepted fix needs more than
+ *             max_kmh, when enabled
+ *
+ * A single outlier accepted at cold start would make every real fix after
+ * it look like a jump, so after FIX_GATE_RESEED jumps in a row the gate
+ * takes the fix as its new reference instead.
+ */
+
+#ifndef FIX_GATE_H
+#define FIX_GATE_H
+
+#include <stdint.h>
+
+#define FIX_GATE_RESEED 5
+
+/* GGA field 6, as a digit */
+enum fix_quality {
+	FIX_QUALITY_INVALID = 0,
+	FIX_QUALITY_GPS,
+	FIX_QUALITY_DGPS,
+	FIX_QUALITY_PPS,
+	FIX_QUALITY_RTK,
+	FIX_QUALITY_FLOAT_RTK,
+	FIX_QUALITY_ESTIMATED,
+	FIX_QUALITY_MANUAL,
+	FIX_QUALITY_SIMULATED
+};
+
+enum fix_verdict {
+	FIX_ACCEPTED,
+	FIX_NO_FIX,
+	FIX_QUALITY,
+	FIX_SATS,
+	FIX_HDOP,
+	FIX_AGE,
+	FIX_JUMP,
+	FIX_VERDICTS
+};
+
+struct fix_gate_limits {
+	uint8_t min_sats;
+	float max_hdop;
+	uint32_t max_age_ms;
+	bool check_quality;
+	float max_kmh; /* 0 turns the jump check off */
+};
+
+struct fix_sample {
+	bool has_fix;
+	double lat;
+	double lng;
+	uint8_t quality; /* enum fix_quality */
+	uint32_t sats;
+	float hdop;      /* 0 when not reported */
+	uint32_t age_ms;
+	uint32_t ms;     /* Monotonic clock when judged */
+};
+
+struct fix_gate {
+	uint32_t count[FIX_VERDICTS];
+	bool have_ref;
+	double ref_lat; /* Last accepted fix */
+	double ref_lng;
+	uint32_t ref_ms;
+	uint8_t jumps;  /* Jump rejections in a row */
+};
+
+void fix_gate_reset(struct fix_gate *g);
+enum fix_verdict fix_gate_check(struct fix_gate *g, const struct fix_gate_limits *lim,
+				const struct fix_sample *s);
+uint32_t fix_gate_rejected(const struct fix_gate *g);
+const char *fix_verdict_name(enum fix_verdict v);
+
+#endif /* FIX_GATE_H */
@@ -0,0 +1,49 @@
+/*
+ * Latest fix, shared between the loop and the web server.
+ *
+ * The loop task is the only writer: update_gps_data() publishes every fix
+ * it takes. Web handlers run on the AsyncTCP task, possibly on the other
+ * core, and read it without taking a lock. This is a sequence lock: the
+ * counter is odd while a write is in progress, and a reader that saw an
+ * odd or changed counter around its copy simply copies again, after
+ * sleeping a tick so that it cannot starve a writer it preempted. The
+ * writer never waits, so a slow client cannot hold up GPS parsing or the
+ * log.
+ *
+ * The payload is copied word by word through relaxed atomics, which keeps
+ * torn copies (always discarded) well-defined C++.
+ */
+
+#ifndef FIX_SNAPSHOT_H
+#define FIX_SNAPSHOT_H
+
+#include <atomic>
+#include <stdint.h>
+
+struct fix_data {
+	char utc[24];   /* ISO 8601, UTC */
+	char local[24]; /* ISO 8601, configured time zone */
+	double lat;
+	double lng;
+	double kf_lat; /* Kalman filtered */
+	double kf_lng;
+	float hdop;
+	int32_t sats;
+	uint32_t sentence_ms; /* millis() at the end of the NMEA sentence */
+	uint32_t count;       /* Fixes published since boot */
+};
+
+#define FIX_SNAPSHOT_WORDS ((sizeof(struct fix_data) + 3) / 4)
+
+struct fix_snapshot {
+	std::atomic<uint32_t> seq;
+	std::atomic<uint32_t> words[FIX_SNAPSHOT_WORDS];
+};
+
+void fix_snapshot_init(struct fix_snapshot *s);
+/* Single writer only */
+void fix_publish(struct fix_snapshot *s, const struct fix_data *d);
+/* Any number of readers, false until something was published */
+bool fix_read(const struct fix_snapshot *s, struct fix_data *d);
+
+#endif /* FIX_SNAPSHOT_H */
@@ -0,0 +1,83 @@
+/*
+ * Circle and polygon geofences with entry/exit detection.
+ *
+ * Fences are read from a text file, one definition per line:
+ *
+ *   circle,<name>,<lat>,<lng>,<radius m>
+ *   poly,<name>
+ *   <lat>,<lng>        at least three vertices, one per line
+ *   end
+ *
+ * Blank lines and lines starting with '#' are skipped. Every fence keeps
+ * an integer bounding box, so a fix is only tested against the few fences
+ * whose box contains it: a distance check for circles and an even-odd ray
+ * cast for polygons. Edges are treated as planar in degrees, which is fine
+ * for site-sized polygons; fences across +-180 degrees are not supported.
+ *
+ * A fence changes state only after GEOFENCE_CONFIRM consecutive fixes
+ * agree, so jitter on the boundary does not produce event storms.
+ */
+
+#ifndef GEOFENCE_H
+#define GEOFENCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "track_format.h"
+
+#define GEOFENCE_NAME_MAX 16
+#define GEOFENCE_MAX 1000
+#define GEOFENCE_MAX_VERTS 16000
+#define GEOFENCE_CONFIRM 3
+
+enum geofence_type {
+	GEOFENCE_CIRCLE,
+	GEOFENCE_POLY,
+};
+
+struct geofence_vertex {
+	int32_t lat_e7;
+	int32_t lng_e7;
+};
+
+struct geofence {
+	int32_t min_lat, max_lat; /* Bounding box, degrees * 1e7 */
+	int32_t min_lng, max_lng;
+	uint32_t first;    /* Polygon: index of the first vertex */
+	uint16_t count;    /* Polygon: vertices */
+	float radius_m;    /* Circle */
+	struct geofence_vertex centre;
+	uint8_t type;
+	bool inside;
+	uint8_t pending;   /* Consecutive fixes disagreeing with inside */
+	char name[GEOFENCE_NAME_MAX];
+};
+
+struct geofence_set {
+	struct geofence *fence;
+	uint16_t count;
+	uint16_t cap;
+	struct geofence_vertex *vert;
+	uint32_t nvert;
+	uint32_t vcap;
+	uint32_t bbox_hits; /* Fences tested beyond the box, for profiling */
+};
+
+struct geofence_event {
+	uint16_t fence;
+	bool entered;
+};
+
+void geofence_init(struct geofence_set *s);
+void geofence_free(struct geofence_set *s);
+bool geofence_add_circle(struct geofence_set *s, const char *name, double lat, double lng,
+			 float radius_m);
+bool geofence_add_poly(struct geofence_set *s, const char *name,
+		       const struct geofence_vertex *v, uint16_t count);
+uint16_t geofence_parse(struct geofence_set *s, track_read_fn read, void *ctx);
+bool geofence_contains(const struct geofence_set *s, const struct geofence *f,
+		       int32_t lat_e7, int32_t lng_e7);
+int geofence_update(struct geofence_set *s, double lat, double lng,
+		    struct geofence_event *ev, int max);
+
+#endif /* GEOFENCE_H */
@@ -0,0 +1,47 @@
+/*
+ * Constant-velocity Kalman filter for position smoothing.
+ *
+ * Fixes are projected to east/north metres around a local origin, and
+ * each axis runs its own two-state (position, velocity) filter. Process
+ * noise is white acceleration of KALMAN_ACCEL_MPS2, and the measurement
+ * noise follows the receiver: HDOP times KALMAN_UERE_M. At rest the
+ * estimate settles instead of jumping with every fix, while a change of
+ * pace is followed within a few fixes.
+ *
+ * An update is a few dozen float operations, so it runs on every fix
+ * even at 10 Hz. The filter restarts after a gap of KALMAN_MAX_GAP_MS.
+ */
+
+#ifndef KALMAN_H
+#define KALMAN_H
+
+#include <stdint.h>
+
+#define KALMAN_ACCEL_MPS2 1.0f
+#define KALMAN_UERE_M 4.0f     /* Position error per unit of HDOP */
+#define KALMAN_INIT_MPS 10.0f  /* Velocity uncertainty at start */
+#define KALMAN_MAX_GAP_MS 30000
+#define KALMAN_RECENTRE_M 5000.0f
+
+struct kalman_axis {
+	float pos; /* m from the origin */
+	float vel; /* m/s */
+	float p00, p01, p11;
+};
+
+struct kalman {
+	bool valid;
+	double lat0;
+	double lng0;
+	float m_per_deg_lng;
+	struct kalman_axis east;
+	struct kalman_axis north;
+	uint32_t last_ms;
+};
+
+void kalman_reset(struct kalman *k);
+void kalman_update(struct kalman *k, double lat, double lng, float hdop, uint32_t ms);
+void kalman_position(const struct kalman *k, double *lat, double *lng);
+float kalman_speed_mps(const struct kalman *k);
+
+#endif /* KALMAN_H */
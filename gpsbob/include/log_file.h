@@ -0,0 +1,33 @@
+/*
+ * Preallocated log files.
+ *
+ * Appending to a FAT file and flushing after every record rewrites the
+ * directory entry each time for the new size, and the FAT and FSInfo
+ * sectors whenever a cluster is added. The logger instead grows the day's
+ * file in zero-filled extents of LOG_FILE_EXTENT bytes, synced once, and
+ * writes records into them in place. The allocation and the size on the
+ * card then already cover every record to come, so a record is safe as
+ * soon as its data sector is written and the file only needs a sync every
+ * LOG_FILE_SYNC_MS rather than one per record.
+ *
+ * Records never contain NUL and the unused tail is all NUL, so the
+ * logical end is the first NUL byte. It is found by bisection when a file
+ * is reopened; nothing else has to be kept up to date. Closing the file,
+ * or the recovery pass at the next boot, truncates it to that length.
+ */
+
+#ifndef LOG_FILE_H
+#define LOG_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOG_FILE_EXTENT 65536 /* 2 clusters on a 32 KB-cluster SDHC card */
+#define LOG_FILE_SYNC_MS 10000
+
+typedef size_t (*log_read_at_fn)(void *ctx, uint32_t offset, void *buf, size_t len);
+
+uint32_t log_file_end(log_read_at_fn read_at, void *ctx, uint32_t size);
+uint32_t log_file_size_for(uint32_t end, uint32_t size, size_t len);
+
+#endif /* LOG_FILE_H */
@@ -0,0 +1,36 @@
+/*
+ * Motion-aware log sampling.
+ *
+ * Instead of one point every log_interval, a fix is logged when it is
+ * log_distance metres away from the last logged point, when the direction
+ * of travel has turned by log_heading degrees since the last logged
+ * segment, or when log_max_gap has passed without a point. A parked device
+ * therefore only writes the heartbeat, while a winding road gets a point
+ * at every bend.
+ *
+ * Turns are only judged once the device is LOG_POLICY_TURN_M away from the
+ * last point, so that jitter at rest cannot look like a change of heading.
+ */
+
+#ifndef LOG_POLICY_H
+#define LOG_POLICY_H
+
+#include <stdint.h>
+
+#define LOG_POLICY_TURN_M 5.0f
+
+struct log_policy {
+	bool have_last;
+	bool have_course;
+	double lat; /* Last logged point */
+	double lng;
+	float course_deg; /* Of the segment that ended at it */
+	uint32_t ms;
+};
+
+void log_policy_reset(struct log_policy *p);
+bool log_policy_due(const struct log_policy *p, double lat, double lng, uint32_t ms,
+		    float dist_m, float heading_deg, uint32_t max_gap_ms);
+void log_policy_commit(struct log_policy *p, double lat, double lng, uint32_t ms);
+
+#endif /* LOG_POLICY_H */
@@ -0,0 +1,47 @@
+/*
+ * Integrity check and repair of log files pulled off a card.
+ *
+ * Works on a whole file in memory (the host tool maps it) and knows the
+ * two layouts the firmware has written:
+ *
+ *   CSV  the current log, see log_file.h. Damage is a NUL tail left by
+ *        preallocation when the file was never closed, a torn last record
+ *        and, from firmware that appended without preallocating, torn
+ *        records in the middle where a later boot carried on.
+ *   GPX  older firmware wrote tracks directly, closing them with the
+ *        footer on every mode change. A reopen appended after that footer,
+ *        a power cut left the file without one or in the middle of a
+ *        <trkpt> block.
+ *
+ * Repair keeps the header and every record that parses, byte for byte,
+ * and drops the rest. The CSV header and GPX footer come from
+ * track_format, so a repaired file is what the firmware would have
+ * written had nothing gone wrong.
+ */
+
+#ifndef LOG_SCAN_H
+#define LOG_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "track_format.h"
+
+struct log_scan {
+	uint32_t records;  /* Records kept */
+	uint32_t bad;      /* Malformed lines or blocks dropped */
+	uint32_t footers;  /* GPX footers before the last record */
+	size_t end;        /* End of the last complete line */
+	size_t torn;       /* Bytes of an incomplete last record */
+	bool header_ok;
+	bool closed;       /* GPX ends in its footer */
+	bool dirty;        /* Repair would change the file */
+};
+
+/* Takes all len bytes or reports failure with a short count */
+typedef size_t (*log_write_fn)(void *ctx, const void *buf, size_t len);
+
+bool log_scan_fmt(const char *name, enum track_fmt *fmt);
+bool log_scan_buf(enum track_fmt fmt, const uint8_t *data, size_t len,
+		  struct log_scan *s, log_write_fn write, void *ctx);
+
+#endif /* LOG_SCAN_H */
@@ -0,0 +1,33 @@
+/*
+ * Heading arrow for the NAV screen.
+ *
+ * The arrow is never rotated at run time. scripts/nav_arrows.py rasterizes
+ * it at build time into NAV_ARROW_DIRS sprites, one per 11.25 degrees, in
+ * the page layout of the OLED frame buffer (8-pixel-high columns, top row
+ * in bit 0). Drawing picks the nearest sprite and ORs its column bytes
+ * into the buffer: 72 bytes, shifted when y is not on a page boundary, and
+ * no trig or per-pixel calls.
+ *
+ * Nothing in here depends on Arduino; the caller passes the buffer.
+ */
+
+#ifndef NAV_ARROW_H
+#define NAV_ARROW_H
+
+#include <stdint.h>
+
+#define NAV_ARROW_SIZE 24 /* Pixels, square and a multiple of 8 */
+#define NAV_ARROW_DIRS 32
+#define NAV_ARROW_BYTES (NAV_ARROW_SIZE * NAV_ARROW_SIZE / 8)
+
+/* Sprite for a direction in degrees clockwise from up, any range */
+int nav_arrow_index(float deg);
+const uint8_t *nav_arrow_sprite(int index);
+
+/*
+ * ORs the arrow into a width x height page-layout buffer with its top left
+ * corner at x, y. Parts outside the buffer are clipped.
+ */
+void nav_arrow_draw(uint8_t *buf, int width, int height, int x, int y, float deg);
+
+#endif /* NAV_ARROW_H */
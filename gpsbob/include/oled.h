@@ -0,0 +1,121 @@
+/*
+ * OLED panel picked by board.h, drawn through the Adafruit driver and
+ * flushed page by page.
+ *
+ * Both controllers store the frame as 8 pages of 8-pixel-high columns,
+ * which is also the layout of the Adafruit buffer. flush() keeps a copy
+ * of what the panel shows and only sends pages that changed, each as one
+ * page-address command and its column bytes. A NAV refresh that only
+ * changes a few digits then costs a couple of pages instead of the whole
+ * 1 KB frame. The panel type is a template parameter, so nothing here
+ * adds virtual calls on top of the driver's own.
+ */
+
+#ifndef OLED_H
+#define OLED_H
+
+#include <Wire.h>
+#include "board.h"
+
+#if GPSBOB_DISPLAY_SSD1306
+#include <Adafruit_SSD1306.h>
+#else
+#include <Adafruit_SH110X.h>
+#endif
+
+#define OLED_I2C_HZ 400000
+#define OLED_CHUNK 32 /* Data bytes per I2C transaction */
+
+template <class Panel> struct oled_traits;
+
+#if GPSBOB_DISPLAY_SSD1306
+template <> struct oled_traits<Adafruit_SSD1306> {
+	static constexpr uint8_t col_offset = 0;
+
+	static bool begin(Adafruit_SSD1306 &p, uint8_t addr)
+	{
+		if (!p.begin(SSD1306_SWITCHCAPVCC, addr))
+			return false;
+		p.ssd1306_command(0x20); /* Memory addressing mode: */
+		p.ssd1306_command(0x02); /* page */
+		return true;
+	}
+};
+typedef Adafruit_SSD1306 oled_panel;
+#else
+template <> struct oled_traits<Adafruit_SH1106G> {
+	static constexpr uint8_t col_offset = 2; /* 128 of the 132 columns are visible */
+
+	static bool begin(Adafruit_SH1106G &p, uint8_t addr)
+	{
+		return p.begin(addr, true);
+	}
+};
+typedef Adafruit_SH1106G oled_panel;
+#endif
+
+template <class Panel, uint16_t W, uint16_t H>
+class paged_oled : public Panel {
+public:
+	paged_oled(TwoWire *wire) : Panel(W, H, wire, -1), wire(wire) {}
+
+	bool start(uint8_t addr)
+	{
+		i2c_addr = addr;
+		shadow_valid = false;
+		return oled_traits<Panel>::begin(*this, addr);
+	}
+
+	/* Sends the pages that differ from the last flush */
+	void flush(void)
+	{
+		const uint8_t *buf = this->getBuffer();
+
+		if (!buf)
+			return;
+		wire->setClock(OLED_I2C_HZ);
+		for (uint8_t page = 0; page < H / 8; page++) {
+			const uint8_t *row = buf + page * W;
+			uint8_t *seen = shadow + page * W;
+
+			if (shadow_valid && !memcmp(row, seen, W))
+				continue;
+			write_page(page, row);
+			memcpy(seen, row, W);
+		}
+		shadow_valid = true;
+	}
+
+	/* Next flush sends everything, e.g. after the panel lost its RAM */
+	void invalidate(void)
+	{
+		shadow_valid = false;
+	}
+
+private:
+	TwoWire *wire;
+	uint8_t i2c_addr = 0;
+	bool shadow_valid = false;
+	uint8_t shadow[W * H / 8];
+
+	void write_page(uint8_t page, const uint8_t *row)
+	{
+		uint8_t col = oled_traits<Panel>::col_offset;
+
+		wire->beginTransmission(i2c_addr);
+		wire->write((uint8_t)0x00); /* Command stream */
+		wire->write((uint8_t)(0xB0 | page));
+		wire->write((uint8_t)(col & 0x0F));
+		wire->write((uint8_t)(0x10 | (col >> 4)));
+		wire->endTransmission();
+
+		for (uint16_t x = 0; x < W; x += OLED_CHUNK) {
+			wire->beginTransmission(i2c_addr);
+			wire->write((uint8_t)0x40); /* Data stream */
+			wire->write(row + x, OLED_CHUNK);
+			wire->endTransmission();
+		}
+	}
+};
+
+#endif /* OLED_H */
@@ -0,0 +1,78 @@
+/*
+ * On-card spatial index for points of interest.
+ *
+ * poi.csv ("lat,lng[,name]" per line) is turned into poi.idx: records
+ * sorted by a 32-bit Morton (Z-order) key of the quantised position,
+ * grouped into fixed blocks, with the first key of every block kept in a
+ * small table at the front of the file. Only that table lives in RAM.
+ *
+ * A nearest-N query covers a box around the position with at most 2x2
+ * aligned Z-order cells, each of which is one contiguous key range, and
+ * reads just the blocks overlapping those ranges. The box grows until N
+ * points are found inside its inscribed radius.
+ *
+ * The lowest cell is about 300 m x 600 m at the equator, and longitude
+ * wrap-around at +-180 degrees is not searched across.
+ */
+
+#ifndef POI_INDEX_H
+#define POI_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define POI_MAGIC "GPOI"
+#define POI_VERSION 1
+#define POI_BLOCK_RECS 64
+#define POI_NAME_MAX 12
+
+struct poi_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t rec_size;
+	uint32_t count;
+	uint32_t blocks;
+	uint32_t src_mtime; /* poi.csv the index was built from */
+	uint32_t src_size;
+};
+
+struct poi_record {
+	uint32_t key;
+	int32_t lat_e7;
+	int32_t lng_e7;
+	char name[POI_NAME_MAX]; /* Not always NUL terminated */
+};
+
+struct poi_hit {
+	struct poi_record rec;
+	float dist_m;
+};
+
+/* Positional read/sequential write over whatever holds poi.idx */
+typedef size_t (*poi_read_at_fn)(void *ctx, uint32_t offset, void *buf, size_t len);
+typedef size_t (*poi_write_fn)(void *ctx, const void *buf, size_t len);
+
+struct poi_index {
+	struct poi_header hdr;
+	uint32_t *block_key;
+	uint32_t data_offset;
+	poi_read_at_fn read_at;
+	void *ctx;
+	struct poi_record cache[POI_BLOCK_RECS];
+	uint32_t cache_block;
+	bool cache_valid;
+	uint32_t blocks_read; /* Since open, for profiling */
+};
+
+uint32_t poi_key(double lat, double lng);
+bool poi_parse_csv(const char *line, size_t len, struct poi_record *rec);
+void poi_sort(struct poi_record *recs, uint32_t count);
+bool poi_write(const struct poi_record *recs, uint32_t count, uint32_t src_mtime,
+	       uint32_t src_size, poi_write_fn write, void *ctx);
+
+bool poi_open(struct poi_index *idx, poi_read_at_fn read_at, void *ctx);
+void poi_close(struct poi_index *idx);
+int poi_nearest(struct poi_index *idx, double lat, double lng, struct poi_hit *hits,
+		int n, float max_m);
+
+#endif /* POI_INDEX_H */
@@ -0,0 +1,99 @@
+/*
+ * Runtime profiling counters.
+ *
+ * Built only with -DGPSBOB_PROFILE=1 (the esp32dev_profile environment).
+ * Otherwise PROF_SCOPE() and PROF_LOOP() expand to empty statements and
+ * none of the code below is compiled in.
+ *
+ * PROF_SCOPE(id) charges the CPU cycles until the end of the enclosing
+ * block to one subsystem. Render is measured around the display_*
+ * functions and so includes their flush. Web handlers run on the AsyncTCP
+ * task, so their numbers may be off by the odd race; they are statistics,
+ * not accounting. PROF_LOOP() feeds a log2 histogram of loop() times.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#ifndef GPSBOB_PROFILE
+#define GPSBOB_PROFILE 0
+#endif
+
+#if GPSBOB_PROFILE
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROF_LOOP_BUCKETS 16 /* Bucket i holds loops under 2^(i+1) us, the last the rest */
+#define PROF_TEXT_MAX 3072
+
+enum prof_id {
+	PROF_GPS,
+	PROF_RENDER,
+	PROF_FLUSH,
+	PROF_SD,
+	PROF_WEB,
+	PROF_COUNT
+};
+
+struct prof_counter {
+	uint32_t calls;
+	uint64_t cycles;
+	uint32_t max; /* cycles */
+};
+
+struct prof_stats {
+	struct prof_counter counter[PROF_COUNT];
+	uint32_t loop_hist[PROF_LOOP_BUCKETS];
+	uint32_t loops;
+	uint64_t loop_cycles;
+	uint32_t loop_max;
+	uint32_t cpu_mhz;
+};
+
+/* Filled in by the caller, the heap API is not portable */
+struct prof_mem {
+	uint32_t heap_free;
+	uint32_t heap_min;
+	uint32_t psram_free;
+	uint32_t psram_min;
+};
+
+extern struct prof_stats prof;
+
+uint32_t prof_cycles(void);
+void prof_init(uint32_t cpu_mhz);
+void prof_add(enum prof_id id, uint32_t cycles);
+void prof_loop(uint32_t cycles);
+const char *prof_name(enum prof_id id);
+float prof_us(uint64_t cycles);
+size_t prof_prometheus(char *buf, size_t len, const struct prof_mem *mem);
+
+struct prof_scope {
+	enum prof_id id;
+	uint32_t start;
+
+	prof_scope(enum prof_id i) : id(i), start(prof_cycles()) {}
+	~prof_scope() { prof_add(id, prof_cycles() - start); }
+};
+
+struct prof_loop_scope {
+	uint32_t start;
+
+	prof_loop_scope() : start(prof_cycles()) {}
+	~prof_loop_scope() { prof_loop(prof_cycles() - start); }
+};
+
+#define PROF_CONCAT_(a, b) a##b
+#define PROF_CONCAT(a, b) PROF_CONCAT_(a, b)
+#define PROF_SCOPE(id) struct prof_scope PROF_CONCAT(prof_scope_, __LINE__)(id)
+#define PROF_LOOP() struct prof_loop_scope prof_loop_scope_
+
+#else
+
+#define PROF_SCOPE(id) do { } while (0)
+#define PROF_LOOP() do { } while (0)
+
+#endif /* GPSBOB_PROFILE */
+
+#endif /* PROFILE_H */
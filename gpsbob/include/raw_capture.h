@@ -0,0 +1,78 @@
+/*
+ * Raw receiver capture for RAW_MODE.
+ *
+ * UART bytes are copied unchanged into one of two blocks while the other
+ * is being written to the card. A block is handed over when it is full or
+ * RAW_FLUSH_MS after its first byte, so a slow receiver still reaches the
+ * card about once a second. Nothing looks at sentence boundaries.
+ *
+ * On the card each block is a raw_block_header followed by len bytes of
+ * receiver output. The header stamps the device clock at the block's
+ * first byte and counts the UART overruns (bytes dropped by the driver)
+ * since the previous block:
+ *
+ *   "GRAW" | ms (u32) | seq (u32) | len (u16) | overruns (u16), little endian
+ *
+ * raw_unpack() strips the headers again.
+ */
+
+#ifndef RAW_CAPTURE_H
+#define RAW_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAW_MAGIC "GRAW"
+#define RAW_BLOCK_SIZE 8192 /* Header included */
+#define RAW_FLUSH_MS 1000
+
+struct raw_block_header {
+	char magic[4];
+	uint32_t ms;
+	uint32_t seq;
+	uint16_t len;
+	uint16_t overruns;
+};
+
+#define RAW_PAYLOAD_MAX (RAW_BLOCK_SIZE - sizeof(struct raw_block_header))
+
+struct raw_block {
+	uint8_t data[RAW_BLOCK_SIZE];
+	size_t used; /* Header included */
+};
+
+struct raw_capture {
+	struct raw_block block[2];
+	int fill;    /* Being filled */
+	int pending; /* Handed out and not yet written, or -1 */
+	uint32_t seq;
+	uint16_t overruns; /* Since the last block handed out */
+	uint32_t first_ms;
+	uint32_t bytes; /* Totals */
+	uint32_t blocks;
+	uint32_t overruns_total;
+};
+
+void raw_capture_init(struct raw_capture *c);
+uint8_t *raw_capture_buf(struct raw_capture *c, size_t *room);
+void raw_capture_put(struct raw_capture *c, size_t n, uint32_t ms);
+void raw_capture_overrun(struct raw_capture *c, uint32_t n);
+const uint8_t *raw_capture_take(struct raw_capture *c, uint32_t ms, bool force, size_t *len);
+void raw_capture_written(struct raw_capture *c);
+
+/* Reads up to len bytes into buf, returns 0 at end of input */
+typedef size_t (*raw_read_fn)(void *ctx, uint8_t *buf, size_t len);
+typedef size_t (*raw_write_fn)(void *ctx, const uint8_t *buf, size_t len);
+
+struct raw_unpack_stats {
+	uint32_t blocks;
+	uint32_t bytes;
+	uint32_t overruns; /* As reported by the headers */
+	uint32_t gaps;     /* Missing sequence numbers */
+	uint32_t skipped;  /* Bytes outside any valid block */
+};
+
+void raw_unpack(raw_read_fn read, void *in, raw_write_fn write, void *out,
+		struct raw_unpack_stats *st);
+
+#endif /* RAW_CAPTURE_H */
@@ -0,0 +1,65 @@
+/*
+ * Multi-waypoint route for NAV_MODE.
+ *
+ * A route is loaded from a GPX (<rtept>, <wpt> or <trkpt>) or CSV file
+ * into a compact fixed-size array. Leg lengths, cumulative distances and
+ * leg bearings are computed once at load time, so the per-fix update only
+ * measures the distance and bearing to the active waypoint and to the
+ * final one, regardless of the route length.
+ *
+ * Nothing in here depends on Arduino; the caller supplies a reader.
+ */
+
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "track_format.h"
+
+#define ROUTE_MAX_POINTS 1000
+#define ROUTE_TAG_MAX 192 /* Longest GPX tag inspected, longer ones are skipped */
+
+struct route_point {
+	int32_t lat_e7; /* Degrees * 1e7 */
+	int32_t lng_e7;
+};
+
+struct route {
+	struct route_point pt[ROUTE_MAX_POINTS];
+	float cum_m[ROUTE_MAX_POINTS];   /* Distance from the first point */
+	float leg_deg[ROUTE_MAX_POINTS]; /* Bearing of the leg into each point */
+	uint16_t count;
+	uint16_t active;
+	bool truncated; /* File held more than ROUTE_MAX_POINTS */
+};
+
+struct route_status {
+	uint16_t active;
+	uint16_t count;
+	double active_lat;
+	double active_lng;
+	double active_dist_m;
+	double active_deg;
+	double final_dist_m;  /* Along the route, through every waypoint left */
+	double final_deg;     /* Straight line to the last waypoint */
+	bool advanced;        /* Active waypoint moved on with this update */
+	bool arrived;         /* Inside the arrival radius of the last waypoint */
+};
+
+enum route_source {
+	ROUTE_SRC_GPX,
+	ROUTE_SRC_CSV
+};
+
+extern struct route route;
+
+void route_clear(struct route *r);
+bool route_add(struct route *r, double lat, double lng);
+void route_finish(struct route *r);
+uint16_t route_parse(struct route *r, enum route_source src, track_read_fn read, void *ctx);
+double route_total_m(const struct route *r);
+bool route_update(struct route *r, double lat, double lng, double arrive_m,
+		  struct route_status *st);
+
+#endif /* ROUTE_H */
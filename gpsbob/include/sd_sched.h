@@ -0,0 +1,91 @@
+/*
+ * SD card access scheduler.
+ *
+ * The card and its SPI bus are used from two tasks: loop() writes the log
+ * and reads the route and POI files, the AsyncTCP task serves downloads,
+ * the directory listing and config saves. The SD library does not
+ * serialise them. Here one worker task owns the card and runs every
+ * access as a job, highest class first:
+ *
+ *   SD_LOG   log and fence event commits
+ *   SD_LOOP  other reads from loop(), POI lookups, route and fence files
+ *   SD_WEB   web handlers, one bounded slice (a response chunk) per job
+ *
+ * A log commit therefore waits for at most the web slice in progress,
+ * however many downloads are queued behind it. sd_sched_call() blocks
+ * until its job has run; sd_sched_submit() queues a job the caller keeps
+ * alive and polls with sd_sched_done(). Jobs submitted before the worker
+ * is started, or from inside a job, run directly.
+ *
+ * Locking uses std::mutex and std::condition_variable, which ESP-IDF maps
+ * onto FreeRTOS, so the same code runs in the native build.
+ */
+
+#ifndef SD_SCHED_H
+#define SD_SCHED_H
+
+#include <condition_variable>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SD_WEB_SLICE 4096  /* Largest read a web job may do */
+#define SD_HIST_BUCKETS 20 /* Bucket i holds waits under 2^(i+1) us, the last the rest */
+
+enum sd_class {
+	SD_LOG,
+	SD_LOOP,
+	SD_WEB,
+	SD_CLASS_COUNT
+};
+
+typedef void (*sd_job_fn)(void *ctx);
+
+struct sd_job {
+	sd_job_fn fn;
+	void *ctx;
+	enum sd_class cls;
+	uint32_t queued_us;
+	bool done;
+	struct sd_job *next;
+};
+
+struct sd_class_stats {
+	uint32_t jobs;
+	uint32_t wait_hist[SD_HIST_BUCKETS]; /* Queued until started */
+	uint64_t wait_us;
+	uint32_t wait_max_us;
+	uint64_t busy_us; /* Time on the card */
+	uint32_t busy_max_us;
+};
+
+struct sd_sched {
+	std::mutex lock;
+	std::condition_variable work;
+	std::condition_variable done;
+	struct sd_job *head[SD_CLASS_COUNT];
+	struct sd_job *tail[SD_CLASS_COUNT];
+	bool running;
+	bool stopping;
+	struct sd_class_stats stats[SD_CLASS_COUNT];
+};
+
+uint32_t sd_sched_now_us(void);
+void sd_sched_init(struct sd_sched *s);
+void sd_sched_call(struct sd_sched *s, enum sd_class cls, sd_job_fn fn, void *ctx);
+void sd_sched_submit(struct sd_sched *s, struct sd_job *job);
+bool sd_sched_done(struct sd_sched *s, const struct sd_job *job);
+void sd_sched_worker(struct sd_sched *s);
+void sd_sched_stop(struct sd_sched *s);
+const char *sd_class_name(enum sd_class cls);
+uint32_t sd_sched_wait_pct_us(const struct sd_class_stats *st, float pct);
+size_t sd_sched_report(struct sd_sched *s, char *buf, size_t len);
+
+/* sd_sched_call() for a lambda or any other callable */
+template <class F>
+void sd_sched_run(struct sd_sched *s, enum sd_class cls, F f)
+{
+	sd_sched_call(s, cls, [](void *ctx) { (*(F *)ctx)(); }, &f);
+}
+
+#endif /* SD_SCHED_H */
@@ -0,0 +1,61 @@
+/*
+ * SD card backend.
+ *
+ * The card is mounted either on SPI, at the clock set by sd_mhz, or on
+ * the SDMMC host when the board has the card wired to it (see board.h)
+ * and sd_mmc is set. Everything else reaches the files through
+ * storage_fs() and never names SD or SD_MMC itself. A clock the wiring
+ * cannot take falls back to the SPI library's 4 MHz default.
+ *
+ * storage_selftest() measures the mounted card: sequential 4 KB writes,
+ * random 512-byte reads and 64-byte append + flush, the pattern of the
+ * logger before preallocation. Every step is a job on the SD scheduler,
+ * so the test yields to log commits and runs on its own task.
+ */
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <FS.h>
+#include "config.h"
+#include "sd_sched.h"
+
+#define STORAGE_SPI_SAFE_HZ 4000000 /* SD library default */
+#define STORAGE_TEST_PATH "/selftest.bin"
+#define STORAGE_TEST_BYTES (512 * 1024)
+#define STORAGE_TEST_CHUNK 4096
+#define STORAGE_TEST_READS 256
+#define STORAGE_TEST_APPENDS 100
+
+enum storage_bus {
+	STORAGE_SPI,
+	STORAGE_SDMMC,
+};
+
+struct storage_info {
+	enum storage_bus bus;
+	uint8_t width;     /* Data lines */
+	uint32_t freq_khz; /* As requested from the driver */
+	uint64_t card_bytes;
+	bool fallback; /* The configured clock failed */
+};
+
+struct storage_test {
+	volatile bool running;
+	bool done;
+	bool ok;
+	float write_kbs;    /* Sequential write */
+	float read_iops;    /* Random 512-byte reads */
+	float read_kbs;
+	float append_per_s; /* 64-byte append + flush */
+	float append_max_ms;
+};
+
+bool storage_begin(const struct gps_config *c);
+fs::FS &storage_fs(void);
+const char *storage_mount(void);
+const struct storage_info *storage_info(void);
+const char *storage_bus_name(void);
+void storage_selftest(struct sd_sched *s, struct storage_test *t);
+
+#endif /* STORAGE_H */
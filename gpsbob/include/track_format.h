@@ -0,0 +1,87 @@
+/*
+ * Track record formats shared by the logger, the /export handler and any
+ * host-side tooling. Nothing in here depends on Arduino so it can be built
+ * for the device and for a PC alike.
+ *
+ * The CSV log is the only format written to the card. GPX, GeoJSON and KML
+ * are produced on request by streaming the CSV through a transcoder that
+ * uses a fixed amount of memory no matter how large the log is.
+ */
+
+#ifndef TRACK_FORMAT_H
+#define TRACK_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACK_CSV_HEADER "_timestamp(_local),Latitude,Longitude,Satilites,HDOP,OffsetUTC"
+#define TRACK_CSV_MAX 96   /* Longest CSV record produced by the logger */
+#define TRACK_LINE_MAX 128 /* Longest input line accepted, longer ones are dropped */
+#define TRACK_IN_CHUNK 512 /* Bytes pulled from the source per read */
+#define TRACK_OUT_MAX 320  /* Room for the largest single formatted element */
+
+enum track_fmt {
+	TRACK_FMT_CSV,
+	TRACK_FMT_GPX,
+	TRACK_FMT_GEOJSON,
+	TRACK_FMT_KML,
+	TRACK_FMT_INVALID
+};
+
+struct track_point {
+	char local[20]; /* "YYYY-MM-DD HH:MM:SS" as logged */
+	double lat;
+	double lng;
+	int sats;
+	float hdop;
+	int offset_hours; /* Local time = UTC + offset */
+};
+
+struct track_simplify;
+
+/* Reads up to len bytes into buf, returns 0 at end of input */
+typedef size_t (*track_read_fn)(void *ctx, uint8_t *buf, size_t len);
+
+struct track_transcoder {
+	enum track_fmt fmt;
+	track_read_fn read;
+	void *ctx;
+	struct track_simplify *simplify; /* Optional, NULL keeps every point */
+	uint8_t in[TRACK_IN_CHUNK];
+	size_t in_len;
+	size_t in_pos;
+	bool in_eof;
+	char line[TRACK_LINE_MAX];
+	size_t line_len;
+	bool line_overflow;
+	char out[TRACK_OUT_MAX];
+	size_t out_len;
+	size_t out_pos;
+	uint32_t points;
+	uint8_t stage;
+};
+
+// === Format names ===
+enum track_fmt track_fmt_from_name(const char *name);
+const char *track_fmt_name(enum track_fmt fmt);
+const char *track_fmt_mime(enum track_fmt fmt);
+const char *track_fmt_ext(enum track_fmt fmt);
+const char *track_fmt_header(enum track_fmt fmt);
+const char *track_fmt_footer(enum track_fmt fmt);
+
+// === Records ===
+int track_csv_line(const struct track_point *pt, char *buf, size_t len);
+bool track_parse_csv(const char *line, size_t len, struct track_point *pt);
+bool track_utc_time(const struct track_point *pt, int64_t *utc);
+void track_set_local(struct track_point *pt, int64_t utc);
+bool track_utc_iso8601(const struct track_point *pt, char *buf, size_t len);
+size_t track_format_point(enum track_fmt fmt, const struct track_point *pt,
+			  uint32_t index, char *buf, size_t len);
+
+// === Streaming conversion ===
+void track_transcoder_init(struct track_transcoder *t, enum track_fmt fmt,
+			   track_read_fn read, void *ctx);
+void track_transcoder_simplify(struct track_transcoder *t, struct track_simplify *s);
+size_t track_transcode(struct track_transcoder *t, uint8_t *dst, size_t max);
+
+#endif /* TRACK_FORMAT_H */
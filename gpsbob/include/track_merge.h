@@ -0,0 +1,75 @@
+/*
+ * Merging CSV logs from many units into one time-ordered track, with trip
+ * statistics per unit and day. Used by the host tool (gpsbob merge).
+ *
+ * A record is kept as a 24-byte merge_point: UTC seconds and microdegree
+ * integers, which is exactly what the logger's "%.6f" columns carry, so
+ * formatting a merged point gives back the logged digits. Parsing takes
+ * the fixed layout the logger writes in one pass over the bytes, and
+ * hands anything else to track_parse_csv() so that a line is accepted
+ * here exactly when /export accepts it.
+ *
+ * Statistics follow the trip computer's thresholds. A step between two
+ * points of the same unit counts when both have HDOP up to TRIP_MAX_HDOP,
+ * no more than MERGE_MAX_GAP_S passed and the average speed over it is at
+ * least TRIP_START_KMH. Steps are averages over however long the logger
+ * waited, so max_kmh is a lower bound on the true peak.
+ */
+
+#ifndef TRACK_MERGE_H
+#define TRACK_MERGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "track_format.h"
+
+#define MERGE_MAX_GAP_S 600 /* Longer gaps are not bridged */
+
+struct merge_point {
+	int64_t utc;
+	int32_t lat_e6;
+	int32_t lng_e6;
+	uint16_t unit;   /* Index of the source unit, see the caller */
+	uint16_t hdop_c; /* HDOP * 100 */
+	uint8_t sats;
+	int8_t offset_hours;
+};
+
+struct merge_day {
+	int32_t day; /* Local date, days since 1970-01-01 */
+	uint16_t unit;
+	uint32_t points;
+	uint32_t moving_s;
+	double distance_m;
+	float max_kmh;
+};
+
+bool merge_parse_csv(const char *line, size_t len, uint16_t unit, struct merge_point *m);
+void merge_track_point(const struct merge_point *m, struct track_point *pt);
+int32_t merge_local_day(const struct merge_point *m);
+
+/*
+ * Time order; points equal but for the unit end up next to each other.
+ * Inline as it is the sort comparator.
+ */
+static inline bool merge_before(const struct merge_point *a, const struct merge_point *b)
+{
+	if (a->utc != b->utc)
+		return a->utc < b->utc;
+	if (a->lat_e6 != b->lat_e6)
+		return a->lat_e6 < b->lat_e6;
+	if (a->lng_e6 != b->lng_e6)
+		return a->lng_e6 < b->lng_e6;
+	return a->unit < b->unit;
+}
+
+/* Same fix pulled off the card twice */
+static inline bool merge_same(const struct merge_point *a, const struct merge_point *b)
+{
+	return a->utc == b->utc && a->lat_e6 == b->lat_e6 && a->lng_e6 == b->lng_e6;
+}
+
+void merge_day_add(struct merge_day *d, const struct merge_point *prev,
+		   const struct merge_point *p);
+
+#endif /* TRACK_MERGE_H */
@@ -0,0 +1,41 @@
+/*
+ * One-pass track simplification for /export.
+ *
+ * This is an opening-window variant of Douglas-Peucker: points are
+ * accumulated after the last kept point (the anchor) until one of them is
+ * further than the tolerance from the straight line anchor -> newest point.
+ * The point before the newest then becomes the new anchor. The window is
+ * capped, so memory is fixed and every point is seen exactly once.
+ *
+ * Distances use an equirectangular projection around the anchor, which is
+ * well under 0.1% off the great-circle figure over the few hundred metres a
+ * window covers.
+ */
+
+#ifndef TRACK_SIMPLIFY_H
+#define TRACK_SIMPLIFY_H
+
+#include "track_format.h"
+
+#define TRACK_SIMPLIFY_WINDOW 64 /* Max points between two kept points */
+
+struct track_simplify {
+	float tol_m;
+	bool have_anchor;
+	bool have_last;
+	struct track_point anchor;
+	struct track_point last;
+	float cos_lat;
+	float wx[TRACK_SIMPLIFY_WINDOW];
+	float wy[TRACK_SIMPLIFY_WINDOW];
+	uint8_t count;
+	uint32_t points_in;
+	uint32_t points_out;
+};
+
+void track_simplify_init(struct track_simplify *s, float tol_m);
+bool track_simplify_push(struct track_simplify *s, const struct track_point *pt,
+			 struct track_point *out);
+bool track_simplify_finish(struct track_simplify *s, struct track_point *out);
+
+#endif /* TRACK_SIMPLIFY_H */
@@ -0,0 +1,67 @@
+/*
+ * Trip computer: odometer, moving/stopped time, average and max speed and
+ * elevation gain, updated incrementally from each fix.
+ *
+ * GPS jitter is rejected with hysteresis. A fix only adds distance once it
+ * is further from the last accepted position than the expected position
+ * error (HDOP times TRIP_UERE_M, at least TRIP_MIN_STEP_M), and altitude
+ * works the same way with a wider vertical gate. Moving starts above
+ * TRIP_START_KMH and stops below TRIP_STOP_KMH. Fixes with HDOP above
+ * TRIP_MAX_HDOP still count time but nothing else.
+ *
+ * The state is plain data so the caller can keep it in RTC memory across
+ * deep sleep; time gaps longer than TRIP_MAX_GAP_MS are not bridged.
+ */
+
+#ifndef TRIP_H
+#define TRIP_H
+
+#include <stdint.h>
+
+#define TRIP_MAGIC 0x54524950 /* "TRIP" */
+#define TRIP_VERSION 1
+#define TRIP_UERE_M 4.0f       /* Horizontal error per unit of HDOP */
+#define TRIP_MIN_STEP_M 5.0f
+#define TRIP_VERT_FACTOR 1.5f  /* Vertical error relative to horizontal */
+#define TRIP_START_KMH 3.0f
+#define TRIP_STOP_KMH 1.5f
+#define TRIP_MAX_HDOP 5.0f
+#define TRIP_MAX_GAP_MS 10000
+
+struct trip_fix {
+	double lat;
+	double lng;
+	float alt_m;
+	bool alt_valid;
+	float speed_kmh;
+	float hdop;
+	uint32_t ms; /* Monotonic clock at the fix */
+};
+
+struct trip {
+	uint32_t magic;
+	uint16_t version;
+	float distance_m;
+	uint32_t moving_ms;
+	uint32_t stopped_ms;
+	float max_kmh;
+	float ascent_m;
+	float descent_m;
+
+	/* Hysteresis state */
+	double anchor_lat;
+	double anchor_lng;
+	float alt_ref;
+	bool alt_valid;
+	bool have_anchor;
+	bool moving;
+	uint32_t last_ms;
+};
+
+bool trip_valid(const struct trip *t);
+void trip_reset(struct trip *t);
+void trip_resume(struct trip *t);
+void trip_update(struct trip *t, const struct trip_fix *f);
+float trip_avg_kmh(const struct trip *t);
+
+#endif /* TRIP_H */
@@ -0,0 +1,104 @@
+"""
+Pre-rasterized NAV arrows, see include/nav_arrow.h
+
+Run by PlatformIO before each build (extra_scripts in platformio.ini). It
+writes nav_arrows_data.h into the build directory and puts that directory
+on the include path. Outside PlatformIO:
+
+    python3 scripts/nav_arrows.py <output.h>
+
+Each of the NAV_ARROW_DIRS sprites is the arrow turned clockwise by
+360 / NAV_ARROW_DIRS degrees more than the one before, sprite 0 pointing
+up. A pixel is set when at least half of it lies inside the arrow, judged
+on a 4 x 4 grid of samples. Sprites are stored in the OLED page layout:
+SIZE / 8 pages, each SIZE column bytes with the top row in bit 0.
+"""
+
+import math
+import os
+import sys
+
+SIZE = 24
+DIRS = 32
+SAMPLES = 4
+
+# Dart pointing up, centred in the cell, y down
+ARROW = [(0.0, -11.0), (8.5, 10.0), (0.0, 4.5), (-8.5, 10.0)]
+
+
+def inside(poly, x, y):
+    hit = False
+    j = len(poly) - 1
+    for i in range(len(poly)):
+        xi, yi = poly[i]
+        xj, yj = poly[j]
+        if (yi > y) != (yj > y) and x < (xj - xi) * (y - yi) / (yj - yi) + xi:
+            hit = not hit
+        j = i
+    return hit
+
+
+def sprite(k):
+    a = math.radians(k * 360.0 / DIRS)
+    c, s = math.cos(a), math.sin(a)
+    half = SIZE / 2.0
+    pages = [[0] * SIZE for _ in range(SIZE // 8)]
+
+    for y in range(SIZE):
+        for x in range(SIZE):
+            n = 0
+            for sy in range(SAMPLES):
+                for sx in range(SAMPLES):
+                    px = x + (sx + 0.5) / SAMPLES - half
+                    py = y + (sy + 0.5) / SAMPLES - half
+                    # Back into the arrow's own frame
+                    if inside(ARROW, px * c + py * s, -px * s + py * c):
+                        n += 1
+            if 2 * n >= SAMPLES * SAMPLES:
+                pages[y // 8][x] |= 1 << (y % 8)
+    return [b for page in pages for b in page]
+
+
+def generate():
+    out = [
+        "/* Generated by scripts/nav_arrows.py, do not edit */",
+        "",
+        "#define NAV_ARROW_GEN_SIZE %d" % SIZE,
+        "#define NAV_ARROW_GEN_DIRS %d" % DIRS,
+        "",
+        "static const uint8_t nav_arrow_sprites[%d][%d] = {" % (DIRS, SIZE * SIZE // 8),
+    ]
+    for k in range(DIRS):
+        data = sprite(k)
+        out.append("\t{ /* %.2f deg */" % (k * 360.0 / DIRS))
+        for i in range(0, len(data), 12):
+            out.append("\t\t" + " ".join("0x%02x," % b for b in data[i:i + 12]))
+        out.append("\t},")
+    out.append("};")
+    return "\n".join(out) + "\n"
+
+
+def write(path):
+    text = generate()
+    try:
+        with open(path) as f:
+            if f.read() == text:
+                return
+    except IOError:
+        pass
+    d = os.path.dirname(path)
+    if d and not os.path.isdir(d):
+        os.makedirs(d)
+    with open(path, "w") as f:
+        f.write(text)
+
+
+try:
+    Import("env")  # noqa: F821, only defined under PlatformIO
+except NameError:
+    if __name__ == "__main__":
+        write(sys.argv[1])
+else:
+    gen = os.path.join(env.subst("$BUILD_DIR"), "gen")  # noqa: F821
+    write(os.path.join(gen, "nav_arrows_data.h"))
+    env.Append(CPPPATH=[gen])  # noqa: F821
@@ -0,0 +1,109 @@
+/*
+ * Battery state from background voltage samples, see battery.h
+ */
+
+#include "battery.h"
+
+#include <string.h>
+
+/* Open-circuit voltage against charge, highest first */
+static const struct {
+	float v;
+	float pct;
+} discharge[] = {
+	{ 4.20f, 100 }, { 4.15f, 95 }, { 4.11f, 90 }, { 4.08f, 85 }, { 4.02f, 80 },
+	{ 3.98f, 75 },  { 3.95f, 70 }, { 3.91f, 65 }, { 3.87f, 60 }, { 3.85f, 55 },
+	{ 3.84f, 50 },  { 3.82f, 45 }, { 3.80f, 40 }, { 3.79f, 35 }, { 3.77f, 30 },
+	{ 3.75f, 25 },  { 3.73f, 20 }, { 3.71f, 15 }, { 3.69f, 10 }, { 3.61f, 5 },
+	{ 3.00f, 0 },
+};
+
+#define DISCHARGE_POINTS (sizeof(discharge) / sizeof(discharge[0]))
+
+void battery_model_init(struct battery_model *m)
+{
+	memset(m, 0, sizeof(*m));
+}
+
+/* Returns -1 below BATTERY_MIN_V, where the reading is not a cell */
+float battery_percent_from_v(float ocv)
+{
+	if (ocv < BATTERY_MIN_V)
+		return -1;
+	if (ocv >= discharge[0].v)
+		return 100;
+
+	for (unsigned i = 1; i < DISCHARGE_POINTS; i++) {
+		if (ocv >= discharge[i].v) {
+			float span = discharge[i - 1].v - discharge[i].v;
+			float t = (ocv - discharge[i].v) / span;
+			return discharge[i].pct + t * (discharge[i - 1].pct - discharge[i].pct);
+		}
+	}
+	return 0;
+}
+
+float battery_model_ocv(const struct battery_model *m)
+{
+	return m->v_ema + m->load_ma / 1000.0f * BATTERY_R_INTERNAL;
+}
+
+float battery_model_percent(const struct battery_model *m)
+{
+	if (!m->primed)
+		return -1;
+	return battery_percent_from_v(battery_model_ocv(m));
+}
+
+static void update_drain(struct battery_model *m, uint32_t ms)
+{
+	float pct = battery_model_percent(m);
+
+	if (pct < 0) {
+		m->have_ref = false;
+		m->drain_pct_h = 0;
+		return;
+	}
+	if (!m->have_ref) {
+		m->ref_pct = pct;
+		m->ref_ms = ms;
+		m->have_ref = true;
+		return;
+	}
+	if (ms - m->ref_ms < BATTERY_RATE_WINDOW_MS)
+		return;
+
+	float rate = (m->ref_pct - pct) / ((ms - m->ref_ms) / 3600000.0f);
+	if (rate < -BATTERY_CHARGE_PCT_H)
+		m->drain_pct_h = 0; /* Charging */
+	else if (rate <= 0)
+		; /* Flat part of the curve or noise, keep the last rate */
+	else if (m->drain_pct_h > 0)
+		m->drain_pct_h = 0.5f * m->drain_pct_h + 0.5f * rate;
+	else
+		m->drain_pct_h = rate;
+	m->ref_pct = pct;
+	m->ref_ms = ms;
+}
+
+void battery_model_sample(struct battery_model *m, float volts, float load_ma, uint32_t ms)
+{
+	if (!m->primed) {
+		m->v_ema = volts;
+		m->primed = true;
+	} else {
+		m->v_ema += BATTERY_EMA_ALPHA * (volts - m->v_ema);
+	}
+	m->load_ma = load_ma;
+	update_drain(m, ms);
+}
+
+/* Hours left at the measured drain, or -1 while that is unknown */
+float battery_model_runtime_h(const struct battery_model *m)
+{
+	float pct = battery_model_percent(m);
+
+	if (pct < 0 || m->drain_pct_h <= 0)
+		return -1;
+	return pct / m->drain_pct_h;
+}
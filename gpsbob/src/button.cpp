@@ -0,0 +1,85 @@
+/*
+ * Button gestures from debounced edges, see button.h
+ */
+
+#include "button.h"
+
+void button_init(struct button *b, uint32_t double_ms, uint32_t long_ms)
+{
+	b->double_us = double_ms * 1000;
+	b->long_us = long_ms * 1000;
+	b->down = false;
+	b->presses = 0;
+	b->start_us = b->down_us = b->up_us = b->held_us = 0;
+	b->head.store(0, std::memory_order_relaxed);
+	b->tail.store(0, std::memory_order_relaxed);
+	b->dropped = 0;
+}
+
+static void emit(struct button *b, enum button_gesture g, uint32_t now_us)
+{
+	uint32_t head = b->head.load(std::memory_order_relaxed);
+	struct button_event *ev;
+
+	b->presses = 0;
+	if (head - b->tail.load(std::memory_order_acquire) == BUTTON_QUEUE) {
+		b->dropped++;
+		return;
+	}
+	ev = &b->ring[head % BUTTON_QUEUE];
+	ev->gesture = g;
+	ev->held_ms = b->held_us / 1000;
+	ev->start_us = b->start_us;
+	ev->done_us = now_us;
+	b->head.store(head + 1, std::memory_order_release);
+}
+
+uint32_t button_sample(struct button *b, bool pressed, uint32_t edge_us, uint32_t now_us)
+{
+	if (pressed != b->down) {
+		b->down = pressed;
+		if (pressed) {
+			if (b->presses == 0)
+				b->start_us = edge_us;
+			b->down_us = edge_us;
+		} else {
+			b->held_us = edge_us - b->down_us;
+			b->up_us = edge_us;
+			if (b->held_us >= b->long_us)
+				emit(b, BUTTON_LONG, now_us);
+			else if (++b->presses == 2)
+				emit(b, BUTTON_DOUBLE, now_us);
+		}
+	}
+
+	if (b->down || b->presses == 0)
+		return 0;
+
+	uint32_t waited = now_us - b->up_us;
+
+	if (waited < b->double_us)
+		return b->double_us - waited;
+	emit(b, BUTTON_SINGLE, now_us);
+	return 0;
+}
+
+bool button_get(struct button *b, struct button_event *ev)
+{
+	uint32_t tail = b->tail.load(std::memory_order_relaxed);
+
+	if (tail == b->head.load(std::memory_order_acquire))
+		return false;
+	*ev = b->ring[tail % BUTTON_QUEUE];
+	b->tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+const char *button_gesture_name(enum button_gesture g)
+{
+	switch (g) {
+	case BUTTON_SINGLE: return "single";
+	case BUTTON_DOUBLE: return "double";
+	case BUTTON_LONG:   return "long";
+	default:            return "?";
+	}
+}
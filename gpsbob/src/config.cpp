@@ -0,0 +1,328 @@
+/*
+ * Device settings, see config.h
+ */
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "config.h"
+
+struct gps_config config;
+static uint32_t synced_mtime;
+static uint32_t synced_size;
+
+void config_defaults(struct gps_config *c)
+{
+	c->timezone_offset_hours = 0;  /* Default UTC */
+	c->log_interval = 30000;       /* default 30 seconds */
+	c->log_distance = 10;
+	c->log_heading = 20;
+	c->log_max_gap = 300000;       /* default 5 minutes */
+	c->live_interval = 5000;       /* default 5 seconds */
+	c->gps_baud = 9600;            /* Receiver factory default */
+	c->sd_mhz = 20;                /* Falls back to 4 MHz if the card fails */
+	c->sd_mmc = false;
+	c->gate_sats = 4;
+	c->gate_hdop = 5.0f;           /* Same as the trip computer's limit */
+	c->gate_age = 2000;
+	c->gate_fixq = true;
+	c->gate_kmh = 300;
+	strcpy(c->wifi_ssid, "GPS_BOB"); /* Default SSID */
+	strcpy(c->wifi_pass, "12345678"); /* Default password */
+	c->waypoint_A_lat = 0.0;
+	c->waypoint_A_lng = 0.0;
+	c->waypoint_B_lat = 0.0;
+	c->waypoint_B_lng = 0.0;
+	strcpy(c->route_file, "/route.gpx");
+	c->arrive_radius = 20;
+	c->filter_display = false;
+	c->filter_log = false;  /* Keep the raw track for later processing */
+	c->filter_nav = true;   /* Steadier bearing when standing still */
+}
+
+static char *trim(char *s)
+{
+	while (*s == ' ' || *s == '\t')
+		s++;
+	size_t n = strlen(s);
+	while (n && (s[n - 1] == ' ' || s[n - 1] == '\t' || s[n - 1] == '\r' || s[n - 1] == '\n'))
+		s[--n] = '\0';
+	return s;
+}
+
+/* Seconds from the file, ms in RAM; anything below one second is ignored */
+static bool set_interval(int *dst, const char *value)
+{
+	int interval = atof(value) * 1000;
+	if (interval < 1000)
+		return false;
+	*dst = interval;
+	return true;
+}
+
+static bool set_flag(bool *dst, const char *value)
+{
+	if (strcmp(value, "0") && strcmp(value, "1"))
+		return false;
+	*dst = value[0] == '1';
+	return true;
+}
+
+static bool set_waypoint(double *dst, const char *value)
+{
+	double v = atof(value);
+	if (v == 0)
+		return false;
+	*dst = v;
+	return true;
+}
+
+/*
+ * Applies one key=value pair. Returns false for unknown keys and rejected
+ * values, which leave the current setting untouched.
+ */
+bool config_set(struct gps_config *c, const char *key, const char *value)
+{
+	if (!strcmp(key, "timezone")) {
+		c->timezone_offset_hours = atoi(value);
+	} else if (!strcmp(key, "ssid")) {
+		if (!*value || strlen(value) >= sizeof(c->wifi_ssid))
+			return false;
+		strcpy(c->wifi_ssid, value);
+	} else if (!strcmp(key, "password")) {
+		if (strlen(value) < 8 || strlen(value) >= sizeof(c->wifi_pass))
+			return false; /* Password too short, keep the current one */
+		strcpy(c->wifi_pass, value);
+	} else if (!strcmp(key, "log_interval")) {
+		return set_interval(&c->log_interval, value);
+	} else if (!strcmp(key, "log_distance")) {
+		if (atoi(value) < 0)
+			return false;
+		c->log_distance = atoi(value);
+	} else if (!strcmp(key, "log_heading")) {
+		if (atoi(value) < 1 || atoi(value) > 180)
+			return false;
+		c->log_heading = atoi(value);
+	} else if (!strcmp(key, "log_max_gap")) {
+		return set_interval(&c->log_max_gap, value);
+	} else if (!strcmp(key, "live_interval")) {
+		return set_interval(&c->live_interval, value);
+	} else if (!strcmp(key, "gps_baud")) {
+		if (atoi(value) < 4800 || atoi(value) > 921600)
+			return false;
+		c->gps_baud = atoi(value);
+	} else if (!strcmp(key, "sd_mhz")) {
+		if (atoi(value) < 1 || atoi(value) > 80)
+			return false;
+		c->sd_mhz = atoi(value);
+	} else if (!strcmp(key, "sd_mmc")) {
+		return set_flag(&c->sd_mmc, value);
+	} else if (!strcmp(key, "gate_sats")) {
+		if (atoi(value) < 0 || atoi(value) > 32)
+			return false;
+		c->gate_sats = atoi(value);
+	} else if (!strcmp(key, "gate_hdop")) {
+		if (atof(value) < 0.5 || atof(value) > 50)
+			return false;
+		c->gate_hdop = atof(value);
+	} else if (!strcmp(key, "gate_age")) {
+		return set_interval(&c->gate_age, value);
+	} else if (!strcmp(key, "gate_fixq")) {
+		return set_flag(&c->gate_fixq, value);
+	} else if (!strcmp(key, "gate_kmh")) {
+		if (atoi(value) < 0)
+			return false;
+		c->gate_kmh = atoi(value);
+	} else if (!strcmp(key, "Latitude_A")) {
+		return set_waypoint(&c->waypoint_A_lat, value);
+	} else if (!strcmp(key, "Longitude_A")) {
+		return set_waypoint(&c->waypoint_A_lng, value);
+	} else if (!strcmp(key, "Latitude_B")) {
+		return set_waypoint(&c->waypoint_B_lat, value);
+	} else if (!strcmp(key, "Longitude_B")) {
+		return set_waypoint(&c->waypoint_B_lng, value);
+	} else if (!strcmp(key, "route")) {
+		if (value[0] != '/' || strlen(value) >= sizeof(c->route_file))
+			return false;
+		strcpy(c->route_file, value);
+	} else if (!strcmp(key, "arrive_radius")) {
+		if (atoi(value) < 1)
+			return false;
+		c->arrive_radius = atoi(value);
+	} else if (!strcmp(key, "filter_display")) {
+		return set_flag(&c->filter_display, value);
+	} else if (!strcmp(key, "filter_log")) {
+		return set_flag(&c->filter_log, value);
+	} else if (!strcmp(key, "filter_nav")) {
+		return set_flag(&c->filter_nav, value);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// === NVS ===
+static bool nvs_store(const struct gps_config *c, uint32_t mtime, uint32_t size)
+{
+	Preferences prefs;
+	struct config_record rec;
+
+	if (!prefs.begin(CONFIG_NVS_NAMESPACE, false))
+		return false;
+	rec.version = CONFIG_VERSION;
+	rec.size = sizeof(rec.cfg);
+	rec.src_mtime = mtime;
+	rec.src_size = size;
+	rec.cfg = *c;
+	bool ok = prefs.putBytes(CONFIG_NVS_KEY, &rec, sizeof(rec)) == sizeof(rec);
+	prefs.end();
+
+	if (ok) {
+		synced_mtime = mtime;
+		synced_size = size;
+	}
+	return ok;
+}
+
+/*
+ * Fills config from NVS, falling back to the defaults when there is no
+ * record or it was written by a different firmware layout.
+ */
+bool config_begin(void)
+{
+	Preferences prefs;
+	struct config_record rec;
+	bool ok = false;
+
+	config_defaults(&config);
+	synced_mtime = 0;
+	synced_size = 0;
+	if (!prefs.begin(CONFIG_NVS_NAMESPACE, true))
+		return false;
+	if (prefs.getBytesLength(CONFIG_NVS_KEY) == sizeof(rec) &&
+	    prefs.getBytes(CONFIG_NVS_KEY, &rec, sizeof(rec)) == sizeof(rec) &&
+	    rec.version == CONFIG_VERSION && rec.size == sizeof(rec.cfg)) {
+		config = rec.cfg;
+		synced_mtime = rec.src_mtime;
+		synced_size = rec.src_size;
+		ok = true;
+	}
+	prefs.end();
+	return ok;
+}
+
+static bool file_stamp(fs::FS &fs, uint32_t *mtime, uint32_t *size)
+{
+	fs::File f = fs.open(CONFIG_PATH, FILE_READ);
+	if (!f)
+		return false;
+	*mtime = (uint32_t)f.getLastWrite();
+	*size = f.size();
+	f.close();
+	return true;
+}
+
+/*
+ * Reconciles NVS with config.txt once the card is available. Returns true
+ * when settings were imported from the card, so the caller can redraw.
+ */
+bool config_sync(fs::FS &fs)
+{
+	uint32_t mtime, size;
+
+	if (!fs.exists(CONFIG_PATH) && !fs.exists(CONFIG_TEMP_PATH)) {
+		config_save(fs, &config); /* Export so there is a file to edit */
+		return false;
+	}
+	if (fs.exists(CONFIG_PATH) && file_stamp(fs, &mtime, &size) &&
+	    mtime == synced_mtime && size == synced_size)
+		return false;
+
+	if (!config_load(fs))
+		return false;
+	if (file_stamp(fs, &mtime, &size))
+		nvs_store(&config, mtime, size);
+	return true;
+}
+
+// === config.txt ===
+/*
+ * Loads config.txt over the defaults. If a save was interrupted between
+ * removing the old file and renaming the new one, the temporary copy is
+ * picked up instead.
+ */
+bool config_load(fs::FS &fs)
+{
+	config_defaults(&config);
+
+	bool recovered = false;
+	if (!fs.exists(CONFIG_PATH)) {
+		if (!fs.exists(CONFIG_TEMP_PATH))
+			return false; /* No config.txt found, using defaults */
+		recovered = true;
+	}
+	const char *path = recovered ? CONFIG_TEMP_PATH : CONFIG_PATH;
+
+	fs::File f = fs.open(path, FILE_READ);
+	if (!f)
+		return false;
+
+	char line[CONFIG_LINE_MAX];
+	while (f.available()) {
+		size_t n = f.readBytesUntil('\n', line, sizeof(line) - 1);
+		line[n] = '\0';
+
+		char *eq = strchr(line, '=');
+		if (!eq)
+			continue;
+		*eq = '\0';
+		config_set(&config, trim(line), trim(eq + 1));
+	}
+	f.close();
+
+	if (recovered)
+		fs.rename(CONFIG_TEMP_PATH, CONFIG_PATH);
+	return true;
+}
+
+/* Writes every setting of c in one pass, then swaps the file into place */
+bool config_save(fs::FS &fs, const struct gps_config *c)
+{
+	fs::File f = fs.open(CONFIG_TEMP_PATH, FILE_WRITE);
+	if (!f)
+		return false;
+
+	f.printf("ssid=%s\n", c->wifi_ssid);
+	f.printf("password=%s\n", c->wifi_pass);
+	f.printf("timezone=%d\n", c->timezone_offset_hours);
+	f.printf("log_interval=%g\n", c->log_interval / 1000.0);
+	f.printf("log_distance=%d\n", c->log_distance);
+	f.printf("log_heading=%d\n", c->log_heading);
+	f.printf("log_max_gap=%g\n", c->log_max_gap / 1000.0);
+	f.printf("live_interval=%g\n", c->live_interval / 1000.0);
+	f.printf("gps_baud=%d\n", c->gps_baud);
+	f.printf("sd_mhz=%d\n", c->sd_mhz);
+	f.printf("sd_mmc=%d\n", c->sd_mmc);
+	f.printf("gate_sats=%d\n", c->gate_sats);
+	f.printf("gate_hdop=%g\n", c->gate_hdop);
+	f.printf("gate_age=%g\n", c->gate_age / 1000.0);
+	f.printf("gate_fixq=%d\n", c->gate_fixq);
+	f.printf("gate_kmh=%d\n", c->gate_kmh);
+	f.printf("Latitude_A=%.6f\n", c->waypoint_A_lat);
+	f.printf("Longitude_A=%.6f\n", c->waypoint_A_lng);
+	f.printf("Latitude_B=%.6f\n", c->waypoint_B_lat);
+	f.printf("Longitude_B=%.6f\n", c->waypoint_B_lng);
+	f.printf("route=%s\n", c->route_file);
+	f.printf("arrive_radius=%d\n", c->arrive_radius);
+	f.printf("filter_display=%d\n", c->filter_display);
+	f.printf("filter_log=%d\n", c->filter_log);
+	f.printf("filter_nav=%d\n", c->filter_nav);
+	f.close();
+
+	fs.remove(CONFIG_PATH);
+	if (!fs.rename(CONFIG_TEMP_PATH, CONFIG_PATH))
+		return false;
+
+	uint32_t mtime = 0, size = 0;
+	file_stamp(fs, &mtime, &size);
+	return nvs_store(c, mtime, size);
+}
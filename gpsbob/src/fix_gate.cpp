@@ -0,0 +1,82 @@
+/*
+ * Fix quality gate, see fix_gate.h
+ */
+
+#include "fix_gate.h"
+#include "geo.h"
+
+#include <string.h>
+
+void fix_gate_reset(struct fix_gate *g)
+{
+	memset(g, 0, sizeof(*g));
+}
+
+static bool real_fix(uint8_t quality)
+{
+	return quality >= FIX_QUALITY_GPS && quality <= FIX_QUALITY_FLOAT_RTK;
+}
+
+static enum fix_verdict judge(struct fix_gate *g, const struct fix_gate_limits *lim,
+			      const struct fix_sample *s)
+{
+	if (!s->has_fix)
+		return FIX_NO_FIX;
+	if (lim->check_quality && !real_fix(s->quality))
+		return FIX_QUALITY;
+	if (s->sats < lim->min_sats)
+		return FIX_SATS;
+	if (s->hdop <= 0 || s->hdop > lim->max_hdop)
+		return FIX_HDOP;
+	if (s->age_ms > lim->max_age_ms)
+		return FIX_AGE;
+
+	if (lim->max_kmh > 0 && g->have_ref && s->ms != g->ref_ms) {
+		float dist = geo_distance_m(g->ref_lat, g->ref_lng, s->lat, s->lng);
+		float kmh = dist / ((s->ms - g->ref_ms) / 1000.0f) * 3.6f;
+
+		if (kmh > lim->max_kmh && ++g->jumps < FIX_GATE_RESEED)
+			return FIX_JUMP;
+	}
+	return FIX_ACCEPTED;
+}
+
+/* Judges one fix and counts the verdict; accepted fixes become the reference */
+enum fix_verdict fix_gate_check(struct fix_gate *g, const struct fix_gate_limits *lim,
+				const struct fix_sample *s)
+{
+	enum fix_verdict v = judge(g, lim, s);
+
+	g->count[v]++;
+	if (v == FIX_ACCEPTED) {
+		g->ref_lat = s->lat;
+		g->ref_lng = s->lng;
+		g->ref_ms = s->ms;
+		g->have_ref = true;
+		g->jumps = 0;
+	}
+	return v;
+}
+
+uint32_t fix_gate_rejected(const struct fix_gate *g)
+{
+	uint32_t n = 0;
+
+	for (int v = FIX_ACCEPTED + 1; v < FIX_VERDICTS; v++)
+		n += g->count[v];
+	return n;
+}
+
+const char *fix_verdict_name(enum fix_verdict v)
+{
+	switch (v) {
+	case FIX_ACCEPTED: return "accepted";
+	case FIX_NO_FIX:   return "no fix";
+	case FIX_QUALITY:  return "quality";
+	case FIX_SATS:     return "sats";
+	case FIX_HDOP:     return "hdop";
+	case FIX_AGE:      return "age";
+	case FIX_JUMP:     return "jump";
+	default:           return "?";
+	}
+}
@@ -0,0 +1,68 @@
+/*
+ * Lock-free latest fix, see fix_snapshot.h
+ */
+
+#include <string.h>
+#include "fix_snapshot.h"
+
+#if defined(ESP_PLATFORM)
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#else
+#include <thread>
+#endif
+
+void fix_snapshot_init(struct fix_snapshot *s)
+{
+	s->seq.store(0, std::memory_order_relaxed);
+	for (size_t i = 0; i < FIX_SNAPSHOT_WORDS; i++)
+		s->words[i].store(0, std::memory_order_relaxed);
+}
+
+void fix_publish(struct fix_snapshot *s, const struct fix_data *d)
+{
+	uint32_t w[FIX_SNAPSHOT_WORDS] = { 0 };
+	uint32_t seq = s->seq.load(std::memory_order_relaxed);
+
+	memcpy(w, d, sizeof(*d));
+	s->seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (size_t i = 0; i < FIX_SNAPSHOT_WORDS; i++)
+		s->words[i].store(w[i], std::memory_order_relaxed);
+	s->seq.store(seq + 2, std::memory_order_release);
+}
+
+/*
+ * Between retries. The web task has the higher priority, so on the
+ * loop's core a reader that only spun would keep the interrupted writer
+ * from ever finishing; a tick's sleep lets it run.
+ */
+static void back_off(void)
+{
+#if defined(ESP_PLATFORM)
+	vTaskDelay(1);
+#else
+	std::this_thread::yield();
+#endif
+}
+
+bool fix_read(const struct fix_snapshot *s, struct fix_data *d)
+{
+	uint32_t w[FIX_SNAPSHOT_WORDS];
+	uint32_t before, after;
+	bool retry = false;
+
+	do {
+		if (retry)
+			back_off();
+		retry = true;
+		before = s->seq.load(std::memory_order_acquire);
+		for (size_t i = 0; i < FIX_SNAPSHOT_WORDS; i++)
+			w[i] = s->words[i].load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		after = s->seq.load(std::memory_order_relaxed);
+	} while ((before & 1) || before != after);
+
+	memcpy(d, w, sizeof(*d));
+	return before != 0;
+}
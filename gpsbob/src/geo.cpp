@@ -0,0 +1,77 @@
+/*
+ * Distance and bearing on the navigation hot path, see geo.h
+ */
+
+#include "geo.h"
+
+#include <math.h>
+
+#define DEG_TO_RAD 0.017453292519943295
+#define RAD_TO_DEG 57.29577951308232
+#define DEG_TO_RAD_F 0.017453292519943295f
+#define RAD_TO_DEG_F 57.29577951308232f
+
+// === Accurate path ===
+double geo_haversine_m(double lat1, double lng1, double lat2, double lng2)
+{
+	double dlat = (lat2 - lat1) * DEG_TO_RAD;
+	double dlng = (lng2 - lng1) * DEG_TO_RAD;
+	double a = sin(dlat / 2) * sin(dlat / 2) +
+		   cos(lat1 * DEG_TO_RAD) * cos(lat2 * DEG_TO_RAD) *
+		   sin(dlng / 2) * sin(dlng / 2);
+	return 2 * GEO_EARTH_RADIUS_M * atan2(sqrt(a), sqrt(1 - a));
+}
+
+double geo_initial_course_deg(double lat1, double lng1, double lat2, double lng2)
+{
+	double dlng = (lng2 - lng1) * DEG_TO_RAD;
+	lat1 *= DEG_TO_RAD;
+	lat2 *= DEG_TO_RAD;
+	double y = sin(dlng) * cos(lat2);
+	double x = cos(lat1) * sin(lat2) - sin(lat1) * cos(lat2) * cos(dlng);
+	double deg = atan2(y, x) * RAD_TO_DEG;
+	return deg < 0 ? deg + 360.0 : deg;
+}
+
+// === Selection ===
+/*
+ * Fills in distance and initial bearing from point 1 to point 2, picking
+ * the float path whenever it is within the bounds documented in geo.h.
+ */
+void geo_vector(double lat1, double lng1, double lat2, double lng2, struct geo_vector *v)
+{
+	double dlng_deg = lng2 - lng1;
+
+	if (dlng_deg > 180.0)
+		dlng_deg -= 360.0;
+	else if (dlng_deg < -180.0)
+		dlng_deg += 360.0;
+
+	float mid = (float)(lat1 + lat2) * 0.5f;
+	float dy = (float)(lat2 - lat1) * DEG_TO_RAD_F;
+	float dx = (float)dlng_deg * DEG_TO_RAD_F * cosf(mid * DEG_TO_RAD_F);
+	float d = sqrtf(dx * dx + dy * dy) * (float)GEO_EARTH_RADIUS_M;
+
+	if (d <= GEO_FAST_MAX_M && fabsf(mid) <= (float)GEO_FAST_MAX_LAT) {
+		float course = atan2f(dx, dy) * RAD_TO_DEG_F;
+		v->dist_m = d;
+		v->course_deg = course < 0 ? course + 360.0f : course;
+		return;
+	}
+	v->dist_m = (float)geo_haversine_m(lat1, lng1, lat2, lng2);
+	v->course_deg = (float)geo_initial_course_deg(lat1, lng1, lat2, lng2);
+}
+
+float geo_distance_m(double lat1, double lng1, double lat2, double lng2)
+{
+	struct geo_vector v;
+	geo_vector(lat1, lng1, lat2, lng2, &v);
+	return v.dist_m;
+}
+
+float geo_course_deg(double lat1, double lng1, double lat2, double lng2)
+{
+	struct geo_vector v;
+	geo_vector(lat1, lng1, lat2, lng2, &v);
+	return v.course_deg;
+}
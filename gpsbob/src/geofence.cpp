@@ -0,0 +1,318 @@
+/*
+ * Circle and polygon geofences, see geofence.h
+ */
+
+#include "geofence.h"
+#include "geo.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEG_TO_RAD 0.017453292519943295
+#define GEOFENCE_LINE_MAX 96
+
+void geofence_init(struct geofence_set *s)
+{
+	memset(s, 0, sizeof(*s));
+}
+
+void geofence_free(struct geofence_set *s)
+{
+	free(s->fence);
+	free(s->vert);
+	geofence_init(s);
+}
+
+// === Building ===
+static struct geofence *new_fence(struct geofence_set *s, const char *name)
+{
+	if (s->count == GEOFENCE_MAX)
+		return NULL;
+	if (s->count == s->cap) {
+		uint16_t cap = s->cap ? s->cap * 2 : 16;
+		if (cap > GEOFENCE_MAX)
+			cap = GEOFENCE_MAX;
+		struct geofence *f = (struct geofence *)realloc(s->fence, cap * sizeof(*f));
+		if (!f)
+			return NULL;
+		s->fence = f;
+		s->cap = cap;
+	}
+
+	struct geofence *f = &s->fence[s->count];
+	memset(f, 0, sizeof(*f));
+	strncpy(f->name, name, GEOFENCE_NAME_MAX - 1);
+	return f;
+}
+
+static bool push_vertex(struct geofence_set *s, int32_t lat_e7, int32_t lng_e7)
+{
+	if (s->nvert == GEOFENCE_MAX_VERTS)
+		return false;
+	if (s->nvert == s->vcap) {
+		uint32_t cap = s->vcap ? s->vcap * 2 : 64;
+		if (cap > GEOFENCE_MAX_VERTS)
+			cap = GEOFENCE_MAX_VERTS;
+		struct geofence_vertex *v =
+			(struct geofence_vertex *)realloc(s->vert, cap * sizeof(*v));
+		if (!v)
+			return false;
+		s->vert = v;
+		s->vcap = cap;
+	}
+	s->vert[s->nvert].lat_e7 = lat_e7;
+	s->vert[s->nvert].lng_e7 = lng_e7;
+	s->nvert++;
+	return true;
+}
+
+bool geofence_add_circle(struct geofence_set *s, const char *name, double lat, double lng,
+			 float radius_m)
+{
+	if (lat < -90 || lat > 90 || lng < -180 || lng > 180 || radius_m <= 0)
+		return false;
+
+	struct geofence *f = new_fence(s, name);
+	if (!f)
+		return false;
+
+	double cos_lat = cos(lat * DEG_TO_RAD);
+	if (cos_lat < 0.01)
+		cos_lat = 0.01;
+	int32_t dlat = (int32_t)(radius_m / GEO_METERS_PER_DEG * 1e7) + 1;
+	int32_t dlng = (int32_t)(radius_m / (GEO_METERS_PER_DEG * cos_lat) * 1e7) + 1;
+
+	f->type = GEOFENCE_CIRCLE;
+	f->radius_m = radius_m;
+	f->centre.lat_e7 = (int32_t)lround(lat * 1e7);
+	f->centre.lng_e7 = (int32_t)lround(lng * 1e7);
+	f->min_lat = f->centre.lat_e7 - dlat;
+	f->max_lat = f->centre.lat_e7 + dlat;
+	f->min_lng = f->centre.lng_e7 - dlng;
+	f->max_lng = f->centre.lng_e7 + dlng;
+	s->count++;
+	return true;
+}
+
+/* Turns the vertices from first to the end of the pool into a fence */
+static bool finish_poly(struct geofence_set *s, const char *name, uint32_t first)
+{
+	uint32_t count = s->nvert - first;
+	struct geofence *f = count >= 3 && count <= UINT16_MAX ? new_fence(s, name) : NULL;
+
+	if (!f) {
+		s->nvert = first;
+		return false;
+	}
+	f->type = GEOFENCE_POLY;
+	f->first = first;
+	f->count = count;
+	f->min_lat = f->max_lat = s->vert[first].lat_e7;
+	f->min_lng = f->max_lng = s->vert[first].lng_e7;
+	for (uint32_t i = first + 1; i < s->nvert; i++) {
+		const struct geofence_vertex *v = &s->vert[i];
+		if (v->lat_e7 < f->min_lat) f->min_lat = v->lat_e7;
+		if (v->lat_e7 > f->max_lat) f->max_lat = v->lat_e7;
+		if (v->lng_e7 < f->min_lng) f->min_lng = v->lng_e7;
+		if (v->lng_e7 > f->max_lng) f->max_lng = v->lng_e7;
+	}
+	s->count++;
+	return true;
+}
+
+bool geofence_add_poly(struct geofence_set *s, const char *name,
+		       const struct geofence_vertex *v, uint16_t count)
+{
+	uint32_t first = s->nvert;
+
+	for (uint16_t i = 0; i < count; i++) {
+		if (!push_vertex(s, v[i].lat_e7, v[i].lng_e7)) {
+			s->nvert = first;
+			return false;
+		}
+	}
+	return finish_poly(s, name, first);
+}
+
+// === Parsing ===
+struct fence_parser {
+	struct geofence_set *s;
+	bool in_poly;
+	bool poly_ok; /* All vertices of the open polygon fitted */
+	uint32_t first;
+	char name[GEOFENCE_NAME_MAX];
+};
+
+/* Splits off the next comma-separated field, NUL terminating it */
+static char *next_field(char **p)
+{
+	char *start = *p;
+	char *comma;
+
+	if (!start)
+		return NULL;
+	comma = strchr(start, ',');
+	if (comma) {
+		*comma = '\0';
+		*p = comma + 1;
+	} else {
+		*p = NULL;
+	}
+	return start;
+}
+
+static void fence_line(struct fence_parser *fp, char *line)
+{
+	char *p = line;
+	char *end;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (*p == '\0' || *p == '#')
+		return;
+
+	if (fp->in_poly) {
+		if (!strncmp(p, "end", 3)) {
+			if (fp->poly_ok)
+				finish_poly(fp->s, fp->name, fp->first);
+			else
+				fp->s->nvert = fp->first;
+			fp->in_poly = false;
+			return;
+		}
+		double lat = strtod(p, &end);
+		if (end == p || *end != ',')
+			return;
+		char *lng_start = end + 1;
+		double lng = strtod(lng_start, &end);
+		if (end == lng_start || lat < -90 || lat > 90 || lng < -180 || lng > 180)
+			return;
+		if (!push_vertex(fp->s, (int32_t)lround(lat * 1e7), (int32_t)lround(lng * 1e7)))
+			fp->poly_ok = false;
+		return;
+	}
+
+	char *kind = next_field(&p);
+	char *name = next_field(&p);
+	if (!name)
+		return;
+
+	if (!strcmp(kind, "circle")) {
+		char *lat = next_field(&p);
+		char *lng = next_field(&p);
+		char *radius = next_field(&p);
+		if (radius)
+			geofence_add_circle(fp->s, name, atof(lat), atof(lng), atof(radius));
+	} else if (!strcmp(kind, "poly")) {
+		memset(fp->name, 0, sizeof(fp->name));
+		strncpy(fp->name, name, GEOFENCE_NAME_MAX - 1);
+		fp->in_poly = true;
+		fp->poly_ok = true;
+		fp->first = fp->s->nvert;
+	}
+}
+
+/* Appends the fences read from a fence file and returns the total count */
+uint16_t geofence_parse(struct geofence_set *s, track_read_fn read, void *ctx)
+{
+	struct fence_parser fp;
+	uint8_t chunk[256];
+	char buf[GEOFENCE_LINE_MAX];
+	size_t len = 0;
+	bool overflow = false;
+	size_t n;
+
+	memset(&fp, 0, sizeof(fp));
+	fp.s = s;
+	while ((n = read(ctx, chunk, sizeof(chunk))) > 0) {
+		for (size_t i = 0; i < n; i++) {
+			char c = (char)chunk[i];
+
+			if (c == '\n') {
+				buf[len] = '\0';
+				if (!overflow)
+					fence_line(&fp, buf);
+				overflow = false;
+				len = 0;
+			} else if (c == '\r') {
+				continue;
+			} else if (len < sizeof(buf) - 1) {
+				buf[len++] = c;
+			} else {
+				overflow = true;
+			}
+		}
+	}
+	if (len && !overflow) {
+		buf[len] = '\0';
+		fence_line(&fp, buf);
+	}
+	if (fp.in_poly)
+		s->nvert = fp.first; /* Unterminated polygon */
+	return s->count;
+}
+
+// === Evaluation ===
+bool geofence_contains(const struct geofence_set *s, const struct geofence *f,
+		       int32_t lat_e7, int32_t lng_e7)
+{
+	if (f->type == GEOFENCE_CIRCLE)
+		return geo_distance_m(f->centre.lat_e7 / 1e7, f->centre.lng_e7 / 1e7,
+				      lat_e7 / 1e7, lng_e7 / 1e7) <= f->radius_m;
+
+	const struct geofence_vertex *v = &s->vert[f->first];
+	bool in = false;
+
+	for (uint32_t i = 0, j = f->count - 1; i < f->count; j = i++) {
+		if ((v[i].lat_e7 > lat_e7) == (v[j].lat_e7 > lat_e7))
+			continue;
+		double x = v[i].lng_e7 + (double)((int64_t)v[j].lng_e7 - v[i].lng_e7) *
+			   ((int64_t)lat_e7 - v[i].lat_e7) /
+			   ((int64_t)v[j].lat_e7 - v[i].lat_e7);
+		if (lng_e7 < x)
+			in = !in;
+	}
+	return in;
+}
+
+/*
+ * Runs one fix through every fence and fills ev with up to max confirmed
+ * entries and exits. Returns how many were stored. A crossing that finds
+ * ev full is left unconfirmed and reported on a later fix, so no event is
+ * lost.
+ */
+int geofence_update(struct geofence_set *s, double lat, double lng,
+		    struct geofence_event *ev, int max)
+{
+	int32_t lat_e7 = (int32_t)lround(lat * 1e7);
+	int32_t lng_e7 = (int32_t)lround(lng * 1e7);
+	int n = 0;
+
+	for (uint16_t i = 0; i < s->count; i++) {
+		struct geofence *f = &s->fence[i];
+		bool in = lat_e7 >= f->min_lat && lat_e7 <= f->max_lat &&
+			  lng_e7 >= f->min_lng && lng_e7 <= f->max_lng;
+
+		if (in) {
+			s->bbox_hits++;
+			in = geofence_contains(s, f, lat_e7, lng_e7);
+		}
+		if (in == f->inside) {
+			f->pending = 0;
+			continue;
+		}
+		if (f->pending + 1 < GEOFENCE_CONFIRM) {
+			f->pending++;
+			continue;
+		}
+		if (n >= max)
+			continue;
+		f->inside = in;
+		f->pending = 0;
+		ev[n].fence = i;
+		ev[n].entered = in;
+		n++;
+	}
+	return n;
+}
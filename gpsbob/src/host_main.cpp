@@ -0,0 +1,659 @@
+/*
+ * Entry point of the native build (pio run -e native).
+ *
+ * The firmware's portable modules compiled for the host, driven from the
+ * command line. It does what /export does on the device, turns a
+ * RAW_MODE capture back into the receiver's byte stream, and checks or
+ * repairs the logs on a card:
+ *
+ *   gpsbob <csv|gpx|geojson|kml> [tolerance m] < log.csv > track.gpx
+ *   gpsbob raw < raw_1_0.raw > capture.nmea
+ *   gpsbob scan [-r] <dir or file>... > report.txt
+ *   gpsbob merge <csv|gpx|geojson|kml|stats> <dir or file>... > all.gpx
+ *   gpsbob metrics [csv|gpx|geojson|kml] < log.csv > metrics.txt
+ *
+ * scan walks the paths for .csv and .gpx files, maps each one and checks
+ * it with log_scan on one thread per core. -r replaces every damaged file
+ * with its repair through a temporary file and rename(), so a file is
+ * either the original or the complete repair. A card image has to be
+ * mounted first (mount -o loop,ro for a check, rw to repair).
+ *
+ * merge reads every CSV log under the paths, one file per thread, merges
+ * them in time order and writes one track, formatted in parallel chunks.
+ * Each directory counts as one unit; per unit and day it prints points,
+ * distance, moving time and top speed (to stdout with "stats", which
+ * writes no track, otherwise to stderr).
+ *
+ * metrics needs the profiling counters (pio run -e native_profile). It
+ * runs the log through the /export path, charged to the web section with
+ * one chunk per loop, and prints the counters as /metrics serves them.
+ * The host has no heap figures, those read 0.
+ */
+
+/* Unit tests bring their own main(), see test/README */
+#if defined(GPSBOB_NATIVE) && !defined(PIO_UNIT_TESTING)
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "log_scan.h"
+#include "profile.h"
+#include "raw_capture.h"
+#include "track_merge.h"
+#include "track_format.h"
+#include "track_simplify.h"
+
+static size_t stdin_read(void *ctx, uint8_t *buf, size_t len)
+{
+	return fread(buf, 1, len, (FILE *)ctx);
+}
+
+static size_t stdout_write(void *ctx, const uint8_t *buf, size_t len)
+{
+	return fwrite(buf, 1, len, (FILE *)ctx);
+}
+
+static int unpack_raw(void)
+{
+	struct raw_unpack_stats st;
+
+	raw_unpack(stdin_read, stdin, stdout_write, stdout, &st);
+	fprintf(stderr, "%lu blocks, %lu bytes, %lu overruns, %lu missing blocks, %lu bytes skipped\n",
+		(unsigned long)st.blocks, (unsigned long)st.bytes, (unsigned long)st.overruns,
+		(unsigned long)st.gaps, (unsigned long)st.skipped);
+	return st.overruns || st.gaps ? 1 : 0;
+}
+
+// === Files and workers ===
+struct mapped_file {
+	const uint8_t *data; /* NULL for an empty file */
+	size_t size;
+};
+
+static const char *map_file(const char *path, struct mapped_file *f)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	f->data = NULL;
+	f->size = 0;
+	if (fd < 0)
+		return "cannot open";
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return "cannot stat";
+	}
+	f->size = st.st_size;
+	if (f->size) {
+		void *p = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (p == MAP_FAILED) {
+			close(fd);
+			return "cannot map";
+		}
+		madvise(p, f->size, MADV_SEQUENTIAL);
+		f->data = (const uint8_t *)p;
+	}
+	close(fd); /* The mapping outlives the descriptor */
+	return NULL;
+}
+
+static void unmap_file(struct mapped_file *f)
+{
+	if (f->data)
+		munmap((void *)f->data, f->size);
+	f->data = NULL;
+}
+
+/* The .csv and .gpx files under path, or path itself */
+static void collect_logs(const std::string &path, std::vector<std::string> &paths)
+{
+	struct stat st;
+	enum track_fmt fmt;
+	DIR *dir;
+	struct dirent *de;
+
+	if (stat(path.c_str(), &st) != 0)
+		return;
+	if (S_ISREG(st.st_mode)) {
+		if (log_scan_fmt(path.c_str(), &fmt))
+			paths.push_back(path);
+		return;
+	}
+	if (!S_ISDIR(st.st_mode) || !(dir = opendir(path.c_str())))
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.') /* Also skips the macOS ._ droppings */
+			continue;
+		collect_logs(path + "/" + de->d_name, paths);
+	}
+	closedir(dir);
+}
+
+static unsigned worker_count(size_t jobs)
+{
+	unsigned n = std::thread::hardware_concurrency();
+
+	if (n == 0)
+		n = 1;
+	if (jobs && n > jobs)
+		n = jobs;
+	return n;
+}
+
+/* Calls fn(i) for every i below n, spread over one thread per core */
+template <class Fn>
+static void parallel_for(size_t n, Fn fn)
+{
+	std::vector<std::thread> workers;
+	std::atomic<size_t> next(0);
+	unsigned threads = worker_count(n);
+
+	for (unsigned i = 0; i < threads; i++) {
+		workers.emplace_back([&]() {
+			size_t j;
+			while ((j = next++) < n)
+				fn(j);
+		});
+	}
+	for (auto &w : workers)
+		w.join();
+}
+
+static double seconds_since(const struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+// === Log scan ===
+struct scan_job {
+	std::string path;
+	enum track_fmt fmt;
+	size_t size;
+	struct log_scan result;
+	const char *error; /* NULL when the file was read (and repaired) */
+	bool repaired;
+};
+
+static size_t fd_write(void *ctx, const void *buf, size_t len)
+{
+	int fd = *(int *)ctx;
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t n = write(fd, (const uint8_t *)buf + done, len - done);
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+/* Writes the repair next to the file, then renames it over the original */
+static const char *scan_repair(struct scan_job *job, const uint8_t *data)
+{
+	std::string tmp = job->path + ".tmp";
+	struct log_scan again;
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	bool ok;
+
+	if (fd < 0)
+		return "cannot create temporary file";
+	ok = log_scan_buf(job->fmt, data, job->size, &again, fd_write, &fd);
+	ok = fsync(fd) == 0 && ok;
+	ok = close(fd) == 0 && ok;
+	if (!ok || rename(tmp.c_str(), job->path.c_str()) != 0) {
+		unlink(tmp.c_str());
+		return "write failed";
+	}
+	job->repaired = true;
+	return NULL;
+}
+
+static void scan_one(struct scan_job *job, bool repair)
+{
+	struct mapped_file f;
+
+	if ((job->error = map_file(job->path.c_str(), &f)) != NULL)
+		return;
+	job->size = f.size;
+	log_scan_buf(job->fmt, f.data, f.size, &job->result, NULL, NULL);
+	if (repair && job->result.dirty)
+		job->error = scan_repair(job, f.data);
+	unmap_file(&f);
+}
+
+static void scan_report(const struct scan_job *job)
+{
+	const struct log_scan *s = &job->result;
+
+	printf("%s: ", job->path.c_str());
+	if (job->error && !s->dirty) {
+		printf("error, %s\n", job->error);
+		return;
+	}
+	printf("%u records", s->records);
+	if (!s->header_ok)
+		printf(", no header");
+	if (s->bad)
+		printf(", %u bad", s->bad);
+	if (s->footers)
+		printf(", %u footers mid-file", s->footers);
+	if (s->torn)
+		printf(", %lu bytes torn", (unsigned long)s->torn);
+	if (job->fmt == TRACK_FMT_CSV && s->end + s->torn < job->size)
+		printf(", %lu bytes preallocated", (unsigned long)(job->size - s->end - s->torn));
+	if (job->fmt == TRACK_FMT_GPX && !s->closed)
+		printf(", not closed");
+	if (job->error)
+		printf(", error, %s", job->error);
+	else if (job->repaired)
+		printf(", repaired");
+	printf("\n");
+}
+
+static int scan_logs(int argc, char **argv)
+{
+	std::vector<std::string> paths;
+	std::vector<struct scan_job> jobs;
+	struct timespec t0;
+	bool repair = false;
+	unsigned long long bytes = 0, records = 0, bad = 0;
+	unsigned damaged = 0, repaired = 0, errors = 0;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "-r"))
+			repair = true;
+		else
+			collect_logs(argv[i], paths);
+	}
+	jobs.resize(paths.size());
+	for (size_t i = 0; i < paths.size(); i++) {
+		jobs[i].path = paths[i];
+		log_scan_fmt(paths[i].c_str(), &jobs[i].fmt);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	parallel_for(jobs.size(), [&](size_t i) { scan_one(&jobs[i], repair); });
+	double secs = seconds_since(&t0);
+
+	for (const auto &job : jobs) {
+		bytes += job.size;
+		records += job.result.records;
+		bad += job.result.bad;
+		if (job.error)
+			errors++;
+		if (job.repaired)
+			repaired++;
+		if (job.result.dirty || job.error) {
+			damaged++;
+			scan_report(&job);
+		}
+	}
+
+	fprintf(stderr, "%lu files, %.1f MB, %llu records, %llu bad, %u damaged, %u repaired, %u errors\n"
+		"%.2f s on %u threads, %.0f MB/s\n",
+		(unsigned long)jobs.size(), bytes / 1e6, records, bad, damaged, repaired, errors,
+		secs, worker_count(jobs.size()), secs > 0 ? bytes / 1e6 / secs : 0.0);
+	return errors || damaged > repaired ? 1 : 0;
+}
+
+// === Log merge ===
+#define MERGE_CHUNK 65536 /* Points per formatting job */
+
+struct merge_file {
+	std::string path;
+	uint16_t unit;
+	std::vector<struct merge_point> points;
+	uint32_t bad;
+	const char *error;
+};
+
+static bool merge_cmp(const struct merge_point &a, const struct merge_point &b)
+{
+	return merge_before(&a, &b);
+}
+
+/* Parses one log into a sorted run, the way /export reads it */
+static void merge_read(struct merge_file *f)
+{
+	struct mapped_file m;
+	const char *p, *end, *nul;
+	struct merge_point pt;
+
+	if ((f->error = map_file(f->path.c_str(), &m)) != NULL)
+		return;
+	p = (const char *)m.data;
+	end = p + m.size;
+	if ((nul = (const char *)memchr(p, '\0', m.size)) != NULL)
+		end = nul; /* Preallocated tail */
+
+	f->points.reserve(m.size / 48);
+	while (p < end) {
+		const char *nl = (const char *)memchr(p, '\n', end - p);
+
+		if (!nl)
+			break; /* Torn last record */
+		if (merge_parse_csv(p, nl + 1 - p, f->unit, &pt))
+			f->points.push_back(pt);
+		else if (*p >= '0' && *p <= '9') /* Not the header or a blank line */
+			f->bad++;
+		p = nl + 1;
+	}
+	unmap_file(&m);
+
+	if (!std::is_sorted(f->points.begin(), f->points.end(), merge_cmp))
+		std::sort(f->points.begin(), f->points.end(), merge_cmp);
+}
+
+struct merge_cursor {
+	const struct merge_point *at;
+	const struct merge_point *end;
+};
+
+/* Heap order for std::push_heap(), which keeps the largest on top */
+static bool merge_cursor_after(const struct merge_cursor &a, const struct merge_cursor &b)
+{
+	return merge_before(b.at, a.at);
+}
+
+/*
+ * Merges the sorted runs into out in one pass. Points sampled from every
+ * run split the time line into parts of about MERGE_CHUNK points; each
+ * part is a k-way merge of its slice of every run into its own place in
+ * out, so the parts run in parallel.
+ */
+static void merge_runs(const std::vector<std::vector<struct merge_point>> &runs,
+		       std::vector<struct merge_point> &out)
+{
+	std::vector<struct merge_point> split;
+	size_t total = 0;
+
+	for (const auto &run : runs) {
+		total += run.size();
+		for (size_t i = MERGE_CHUNK / 2; i < run.size(); i += MERGE_CHUNK)
+			split.push_back(run[i]);
+	}
+	std::sort(split.begin(), split.end(), merge_cmp);
+	out.resize(total);
+
+	/* cut[p][r]: where part p starts in run r */
+	size_t parts = split.size() + 1;
+	std::vector<std::vector<size_t>> cut(parts + 1, std::vector<size_t>(runs.size()));
+	std::vector<size_t> offset(parts + 1);
+	for (size_t r = 0; r < runs.size(); r++) {
+		cut[parts][r] = runs[r].size();
+		for (size_t p = 1; p < parts; p++)
+			cut[p][r] = std::lower_bound(runs[r].begin(), runs[r].end(),
+						     split[p - 1], merge_cmp) - runs[r].begin();
+	}
+	for (size_t p = 1; p <= parts; p++) {
+		offset[p] = 0;
+		for (size_t r = 0; r < runs.size(); r++)
+			offset[p] += cut[p][r];
+	}
+
+	parallel_for(parts, [&](size_t p) {
+		std::vector<struct merge_cursor> heap;
+		struct merge_point *dst = out.data() + offset[p];
+
+		for (size_t r = 0; r < runs.size(); r++) {
+			if (cut[p][r] < cut[p + 1][r])
+				heap.push_back({ runs[r].data() + cut[p][r], runs[r].data() + cut[p + 1][r] });
+		}
+		std::make_heap(heap.begin(), heap.end(), merge_cursor_after);
+		while (!heap.empty()) {
+			std::pop_heap(heap.begin(), heap.end(), merge_cursor_after);
+			struct merge_cursor &c = heap.back();
+			*dst++ = *c.at++;
+			if (c.at == c.end)
+				heap.pop_back();
+			else
+				std::push_heap(heap.begin(), heap.end(), merge_cursor_after);
+		}
+	});
+}
+
+static void merge_days(const std::vector<struct merge_point> &pts, size_t units,
+		       std::vector<struct merge_day> &days)
+{
+	std::map<std::pair<int32_t, uint16_t>, struct merge_day> by_day;
+	std::vector<const struct merge_point *> last(units, NULL);
+	std::vector<struct merge_day *> cur(units, NULL);
+
+	for (const auto &p : pts) {
+		int32_t day = merge_local_day(&p);
+		struct merge_day *d = cur[p.unit];
+
+		if (!d || d->day != day) {
+			d = &by_day[std::make_pair(day, p.unit)];
+			d->day = day;
+			d->unit = p.unit;
+			cur[p.unit] = d;
+		}
+		merge_day_add(d, last[p.unit], &p);
+		last[p.unit] = &p;
+	}
+	for (const auto &kv : by_day)
+		days.push_back(kv.second);
+}
+
+static void merge_report(FILE *out, const std::vector<struct merge_day> &days,
+			 const std::vector<std::string> &units)
+{
+	struct track_point t;
+
+	fprintf(out, "%-10s %9s %9s %9s %8s  %s\n",
+		"date", "points", "km", "moving", "max km/h", "unit");
+	for (const auto &d : days) {
+		t.offset_hours = 0;
+		track_set_local(&t, (int64_t)d.day * 86400);
+		t.local[10] = '\0';
+		fprintf(out, "%-10s %9u %9.2f %3u:%02u:%02u %8.1f  %s\n",
+			t.local, d.points, d.distance_m / 1000, d.moving_s / 3600,
+			d.moving_s / 60 % 60, d.moving_s % 60, d.max_kmh, units[d.unit].c_str());
+	}
+}
+
+/* Formats MERGE_CHUNK points per job, a batch in parallel, and writes them in order */
+static void merge_write(enum track_fmt fmt, const std::vector<struct merge_point> &pts)
+{
+	size_t chunks = (pts.size() + MERGE_CHUNK - 1) / MERGE_CHUNK;
+	size_t batch = worker_count(chunks) * 2;
+	std::vector<std::string> out(batch);
+
+	fputs(track_fmt_header(fmt), stdout);
+	for (size_t first = 0; first < chunks; first += batch) {
+		size_t n = chunks - first < batch ? chunks - first : batch;
+
+		parallel_for(n, [&](size_t i) {
+			size_t from = (first + i) * MERGE_CHUNK;
+			size_t to = from + MERGE_CHUNK < pts.size() ? from + MERGE_CHUNK : pts.size();
+			struct track_point tp;
+			char buf[TRACK_OUT_MAX];
+
+			out[i].clear();
+			for (size_t j = from; j < to; j++) {
+				merge_track_point(&pts[j], &tp);
+				out[i].append(buf, track_format_point(fmt, &tp, (uint32_t)j, buf, sizeof(buf)));
+			}
+		});
+		for (size_t i = 0; i < n; i++)
+			fwrite(out[i].data(), 1, out[i].size(), stdout);
+	}
+	fputs(track_fmt_footer(fmt), stdout);
+}
+
+/*
+ * Every CSV log under the paths, merged in time order with duplicates
+ * dropped. A unit is the directory a log was found in.
+ */
+static int merge_logs(const char *fmt_name, int argc, char **argv)
+{
+	std::vector<std::string> paths, units;
+	std::map<std::string, uint16_t> unit_index;
+	std::vector<struct merge_file> files;
+	std::vector<std::vector<struct merge_point>> runs;
+	std::vector<struct merge_point> pts;
+	std::vector<struct merge_day> days;
+	struct timespec t0;
+	double t_read, t_merge, t_stats, t_write = 0;
+	bool stats_only = !strcmp(fmt_name, "stats");
+	enum track_fmt fmt = stats_only ? TRACK_FMT_CSV : track_fmt_from_name(fmt_name);
+	unsigned long long bad = 0, parsed = 0;
+	unsigned errors = 0;
+
+	if (fmt == TRACK_FMT_INVALID) {
+		fprintf(stderr, "merge: unknown format %s\n", fmt_name);
+		return 2;
+	}
+	for (int i = 0; i < argc; i++)
+		collect_logs(argv[i], paths);
+	std::sort(paths.begin(), paths.end()); /* Units in name order, the first copy wins */
+	for (const auto &path : paths) {
+		enum track_fmt f;
+		size_t slash = path.rfind('/');
+		std::string unit = slash == std::string::npos ? "." : path.substr(0, slash);
+		struct merge_file mf = {};
+
+		if (!log_scan_fmt(path.c_str(), &f) || f != TRACK_FMT_CSV)
+			continue;
+		if (!unit_index.count(unit)) {
+			unit_index[unit] = (uint16_t)units.size();
+			units.push_back(unit);
+		}
+		mf.path = path;
+		mf.unit = unit_index[unit];
+		files.push_back(mf);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	parallel_for(files.size(), [&](size_t i) { merge_read(&files[i]); });
+	t_read = seconds_since(&t0);
+
+	for (auto &f : files) {
+		if (f.error) {
+			fprintf(stderr, "%s: %s\n", f.path.c_str(), f.error);
+			errors++;
+		}
+		bad += f.bad;
+		parsed += f.points.size();
+		runs.push_back(std::move(f.points));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	merge_runs(runs, pts);
+	runs.clear();
+	pts.erase(std::unique(pts.begin(), pts.end(),
+			      [](const struct merge_point &a, const struct merge_point &b) {
+				      return merge_same(&a, &b);
+			      }), pts.end());
+	t_merge = seconds_since(&t0);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	merge_days(pts, units.size(), days);
+	t_stats = seconds_since(&t0);
+	merge_report(stats_only ? stdout : stderr, days, units);
+
+	if (!stats_only) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		merge_write(fmt, pts);
+		fflush(stdout);
+		t_write = seconds_since(&t0);
+	}
+
+	fprintf(stderr, "%lu files from %lu units, %llu points, %llu duplicates, %llu bad, %u errors\n",
+		(unsigned long)files.size(), (unsigned long)units.size(), (unsigned long long)pts.size(),
+		parsed - pts.size(), bad, errors);
+	fprintf(stderr, "%u threads: read %.2f s (%.1f M points/s), merge %.2f s, stats %.2f s",
+		worker_count(files.size()), t_read, t_read > 0 ? parsed / 1e6 / t_read : 0.0,
+		t_merge, t_stats);
+	if (!stats_only)
+		fprintf(stderr, ", %s %.2f s (%.1f M points/s)", track_fmt_name(fmt), t_write,
+			t_write > 0 ? pts.size() / 1e6 / t_write : 0.0);
+	fprintf(stderr, "\n");
+	return errors ? 1 : 0;
+}
+
+#if GPSBOB_PROFILE
+static int export_metrics(enum track_fmt fmt)
+{
+	static char text[PROF_TEXT_MAX];
+	struct prof_mem mem = { 0, 0, 0, 0 };
+	struct track_transcoder tc;
+	uint8_t out[TRACK_OUT_MAX];
+	size_t n;
+
+	prof_init(0);
+	track_transcoder_init(&tc, fmt, stdin_read, stdin);
+	do {
+		PROF_LOOP();
+		PROF_SCOPE(PROF_WEB);
+		n = track_transcode(&tc, out, sizeof(out));
+	} while (n > 0);
+	fwrite(text, 1, prof_prometheus(text, sizeof(text), &mem), stdout);
+	return 0;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	struct track_transcoder tc;
+	struct track_simplify simplify;
+	uint8_t out[TRACK_OUT_MAX];
+	size_t n;
+
+	if (argc > 1 && !strcmp(argv[1], "raw"))
+		return unpack_raw();
+	if (argc > 2 && !strcmp(argv[1], "scan"))
+		return scan_logs(argc - 2, argv + 2);
+	if (argc > 3 && !strcmp(argv[1], "merge"))
+		return merge_logs(argv[2], argc - 3, argv + 3);
+	if (argc > 1 && !strcmp(argv[1], "metrics")) {
+#if GPSBOB_PROFILE
+		enum track_fmt mfmt = track_fmt_from_name(argc > 2 ? argv[2] : "gpx");
+		if (mfmt != TRACK_FMT_INVALID)
+			return export_metrics(mfmt);
+#else
+		fprintf(stderr, "%s: built without GPSBOB_PROFILE, see pio run -e native_profile\n",
+			argv[0]);
+		return 2;
+#endif
+	}
+
+	enum track_fmt fmt = track_fmt_from_name(argc > 1 ? argv[1] : NULL);
+	if (fmt == TRACK_FMT_INVALID) {
+		fprintf(stderr, "usage: %s <csv|gpx|geojson|kml> [tolerance m] < log.csv\n"
+			"       %s raw < capture.raw\n"
+			"       %s scan [-r] <dir or file>...\n"
+			"       %s merge <csv|gpx|geojson|kml|stats> <dir or file>...\n"
+			"       %s metrics [csv|gpx|geojson|kml] < log.csv\n",
+			argv[0], argv[0], argv[0], argv[0], argv[0]);
+		return 2;
+	}
+
+	track_transcoder_init(&tc, fmt, stdin_read, stdin);
+	if (argc > 2 && atof(argv[2]) > 0) {
+		track_simplify_init(&simplify, atof(argv[2]));
+		track_transcoder_simplify(&tc, &simplify);
+	}
+	while ((n = track_transcode(&tc, out, sizeof(out))) > 0)
+		fwrite(out, 1, n, stdout);
+	return 0;
+}
+
+#endif /* GPSBOB_NATIVE && !PIO_UNIT_TESTING */
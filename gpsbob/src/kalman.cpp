@@ -0,0 +1,119 @@
+/*
+ * Constant-velocity Kalman filter, see kalman.h
+ */
+
+#include "kalman.h"
+#include "geo.h"
+
+#include <math.h>
+#include <string.h>
+
+#define DEG_TO_RAD 0.017453292519943295
+
+void kalman_reset(struct kalman *k)
+{
+	memset(k, 0, sizeof(*k));
+}
+
+static void set_origin(struct kalman *k, double lat, double lng)
+{
+	k->lat0 = lat;
+	k->lng0 = lng;
+	k->m_per_deg_lng = (float)(GEO_METERS_PER_DEG * cos(lat * DEG_TO_RAD));
+	if (k->m_per_deg_lng < 1.0f)
+		k->m_per_deg_lng = 1.0f;
+}
+
+static void axis_start(struct kalman_axis *a, float z, float r)
+{
+	a->pos = z;
+	a->vel = 0;
+	a->p00 = r;
+	a->p01 = 0;
+	a->p11 = KALMAN_INIT_MPS * KALMAN_INIT_MPS;
+}
+
+static void axis_predict(struct kalman_axis *a, float dt)
+{
+	float q = KALMAN_ACCEL_MPS2 * KALMAN_ACCEL_MPS2;
+	float dt2 = dt * dt;
+
+	a->pos += a->vel * dt;
+	a->p00 += dt * (2 * a->p01 + dt * a->p11) + q * dt2 * dt2 / 4;
+	a->p01 += dt * a->p11 + q * dt2 * dt / 2;
+	a->p11 += q * dt2;
+}
+
+static void axis_correct(struct kalman_axis *a, float z, float r)
+{
+	float s = a->p00 + r;
+	float k0 = a->p00 / s;
+	float k1 = a->p01 / s;
+	float y = z - a->pos;
+
+	a->pos += k0 * y;
+	a->vel += k1 * y;
+	a->p11 -= k1 * a->p01;
+	a->p01 -= k0 * a->p01;
+	a->p00 -= k0 * a->p00;
+}
+
+/* Moves the origin onto the estimate so the float offsets stay small */
+static void recentre(struct kalman *k)
+{
+	double lat, lng;
+
+	kalman_position(k, &lat, &lng);
+	set_origin(k, lat, lng);
+	k->east.pos = 0;
+	k->north.pos = 0;
+}
+
+void kalman_update(struct kalman *k, double lat, double lng, float hdop, uint32_t ms)
+{
+	float sigma = (hdop > 0 ? hdop : 5.0f) * KALMAN_UERE_M;
+	float r = sigma * sigma;
+
+	if (!k->valid || ms - k->last_ms > KALMAN_MAX_GAP_MS) {
+		set_origin(k, lat, lng);
+		axis_start(&k->east, 0, r);
+		axis_start(&k->north, 0, r);
+		k->last_ms = ms;
+		k->valid = true;
+		return;
+	}
+
+	float dt = (ms - k->last_ms) / 1000.0f;
+	k->last_ms = ms;
+
+	double dlng = lng - k->lng0;
+	if (dlng > 180.0)
+		dlng -= 360.0;
+	else if (dlng < -180.0)
+		dlng += 360.0;
+	float ze = (float)dlng * k->m_per_deg_lng;
+	float zn = (float)((lat - k->lat0) * GEO_METERS_PER_DEG);
+
+	axis_predict(&k->east, dt);
+	axis_predict(&k->north, dt);
+	axis_correct(&k->east, ze, r);
+	axis_correct(&k->north, zn, r);
+
+	if (fabsf(k->east.pos) > KALMAN_RECENTRE_M || fabsf(k->north.pos) > KALMAN_RECENTRE_M)
+		recentre(k);
+}
+
+void kalman_position(const struct kalman *k, double *lat, double *lng)
+{
+	*lat = k->lat0 + k->north.pos / GEO_METERS_PER_DEG;
+	*lng = k->lng0 + k->east.pos / k->m_per_deg_lng;
+	if (*lng > 180.0)
+		*lng -= 360.0;
+	else if (*lng < -180.0)
+		*lng += 360.0;
+}
+
+float kalman_speed_mps(const struct kalman *k)
+{
+	return sqrtf(k->east.vel * k->east.vel + k->north.vel * k->north.vel);
+}
@@ -0,0 +1,49 @@
+/*
+ * Preallocated log files, see log_file.h
+ */
+
+#include "log_file.h"
+#include "track_format.h"
+
+/*
+ * Logical end of a file of size bytes: every byte before it is a record
+ * byte, every byte from it on is NUL. A file that does not end in NUL,
+ * e.g. one written before preallocation, is all records.
+ *
+ * Power lost mid-record can leave the head of a record in a written
+ * sector, so the end is moved back to just after the last line break.
+ */
+uint32_t log_file_end(log_read_at_fn read_at, void *ctx, uint32_t size)
+{
+	uint32_t lo = 0, hi = size;
+	uint8_t c, tail[TRACK_LINE_MAX];
+
+	if (size == 0 || read_at(ctx, size - 1, &c, 1) != 1 || c != 0)
+		return size;
+	hi = size - 1;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (read_at(ctx, mid, &c, 1) != 1)
+			return lo;
+		if (c == 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	uint32_t from = lo > sizeof(tail) ? lo - sizeof(tail) : 0;
+	size_t n = read_at(ctx, from, tail, lo - from);
+	while (n && tail[n - 1] != '\n')
+		n--;
+	return n ? from + n : from;
+}
+
+/* Size the file needs so len more bytes fit at end, in whole extents */
+uint32_t log_file_size_for(uint32_t end, uint32_t size, size_t len)
+{
+	/* Keep one NUL after the last record so the end is never ambiguous */
+	while (end + len >= size)
+		size += LOG_FILE_EXTENT;
+	return size;
+}
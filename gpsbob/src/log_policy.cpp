@@ -0,0 +1,52 @@
+/*
+ * Motion-aware log sampling, see log_policy.h
+ */
+
+#include "log_policy.h"
+#include "geo.h"
+
+#include <math.h>
+#include <string.h>
+
+void log_policy_reset(struct log_policy *p)
+{
+	memset(p, 0, sizeof(*p));
+}
+
+/* Whether (lat, lng) at ms should be logged, given the last logged point */
+bool log_policy_due(const struct log_policy *p, double lat, double lng, uint32_t ms,
+		    float dist_m, float heading_deg, uint32_t max_gap_ms)
+{
+	struct geo_vector v;
+
+	if (!p->have_last || ms - p->ms >= max_gap_ms)
+		return true;
+
+	geo_vector(p->lat, p->lng, lat, lng, &v);
+	if (v.dist_m >= dist_m)
+		return true;
+	if (!p->have_course || v.dist_m < LOG_POLICY_TURN_M)
+		return false;
+
+	float turn = fabsf(v.course_deg - p->course_deg);
+	if (turn > 180.0f)
+		turn = 360.0f - turn;
+	return turn >= heading_deg;
+}
+
+/* Records that (lat, lng) was written */
+void log_policy_commit(struct log_policy *p, double lat, double lng, uint32_t ms)
+{
+	if (p->have_last) {
+		struct geo_vector v;
+		geo_vector(p->lat, p->lng, lat, lng, &v);
+		if (v.dist_m >= LOG_POLICY_TURN_M) {
+			p->course_deg = v.course_deg;
+			p->have_course = true;
+		}
+	}
+	p->lat = lat;
+	p->lng = lng;
+	p->ms = ms;
+	p->have_last = true;
+}
@@ -0,0 +1,383 @@
+/*
+ * Log integrity check and repair, see log_scan.h
+ */
+
+#include "log_scan.h"
+#include "log_file.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define GPX_HEADER_MAX 4096 /* The header must end within this many bytes */
+
+struct mem_file {
+	const uint8_t *data;
+	size_t len;
+};
+
+/* Repaired output: adjacent kept spans are merged, so a clean run is one write */
+struct scan_out {
+	log_write_fn write;
+	void *ctx;
+	const uint8_t *from;
+	size_t len;
+	bool ok;
+};
+
+static size_t mem_read_at(void *ctx, uint32_t offset, void *buf, size_t len)
+{
+	struct mem_file *f = (struct mem_file *)ctx;
+
+	if (offset >= f->len)
+		return 0;
+	if (len > f->len - offset)
+		len = f->len - offset;
+	memcpy(buf, f->data + offset, len);
+	return len;
+}
+
+static void out_flush(struct scan_out *o)
+{
+	if (o->len && o->write(o->ctx, o->from, o->len) != o->len)
+		o->ok = false;
+	o->len = 0;
+}
+
+static void out_span(struct scan_out *o, const uint8_t *p, size_t len)
+{
+	if (!o->write || !len)
+		return;
+	if (o->len && o->from + o->len == p) {
+		o->len += len;
+		return;
+	}
+	out_flush(o);
+	o->from = p;
+	o->len = len;
+}
+
+static void out_str(struct scan_out *o, const char *s)
+{
+	size_t len = strlen(s);
+
+	if (!o->write)
+		return;
+	out_flush(o);
+	if (o->write(o->ctx, s, len) != len)
+		o->ok = false;
+}
+
+/* Line without the surrounding blanks and line break, as [*b, *e) */
+static void trim(const uint8_t *p, const uint8_t *end, const uint8_t **b, const uint8_t **e)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	while (end > p && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+	*b = p;
+	*e = end;
+}
+
+static bool starts(const uint8_t *b, const uint8_t *e, const char *s)
+{
+	size_t n = strlen(s);
+
+	return (size_t)(e - b) >= n && !memcmp(b, s, n);
+}
+
+static bool equals(const uint8_t *b, const uint8_t *e, const char *s)
+{
+	return (size_t)(e - b) == strlen(s) && !memcmp(b, s, e - b);
+}
+
+/* The footer as a line, without its line break */
+static bool is_gpx_footer(const uint8_t *b, const uint8_t *e)
+{
+	const char *f = track_fmt_footer(TRACK_FMT_GPX);
+	size_t n = strlen(f);
+
+	while (n && (f[n - 1] == '\n' || f[n - 1] == '\r'))
+		n--;
+	return (size_t)(e - b) == n && !memcmp(b, f, n);
+}
+
+static bool valid_position(double lat, double lng)
+{
+	return lat >= -90.0 && lat <= 90.0 && lng >= -180.0 && lng <= 180.0;
+}
+
+// === CSV ===
+/* "YYYY-MM-DD HH:MM:SS," at p, checked by shape only */
+static bool stamp_at(const uint8_t *p, const uint8_t *end)
+{
+	static const char shape[] = "dddd-dd-dd dd:dd:dd,";
+
+	if ((size_t)(end - p) < sizeof(shape) - 1)
+		return false;
+	for (size_t i = 0; i < sizeof(shape) - 1; i++) {
+		if (shape[i] == 'd' ? p[i] < '0' || p[i] > '9' : p[i] != shape[i])
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Strict number: optional sign, digits, optional fraction, and nothing
+ * else up to the next comma or the line break. Returns the end of the
+ * field or NULL; the value is only good enough for a range check.
+ */
+static const uint8_t *csv_number(const uint8_t *p, const uint8_t *end, double *value)
+{
+	double v = 0, scale = 1;
+	bool neg = false, digits = false, frac = false;
+
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+	for (; p < end && *p != ',' && *p != '\r' && *p != '\n'; p++) {
+		if (*p >= '0' && *p <= '9') {
+			v = v * 10 + (*p - '0');
+			if (frac)
+				scale *= 10;
+			digits = true;
+		} else if (*p == '.' && !frac) {
+			frac = true;
+		} else {
+			return NULL;
+		}
+	}
+	*value = (neg ? -v : v) / scale;
+	return digits ? p : NULL;
+}
+
+/*
+ * track_parse_csv() takes the longest number at the start of each field,
+ * which is right for export but lets a torn record that ran into the next
+ * one through. Here every column after the stamp must be a number and
+ * nothing else, so whatever passes also parses there, with no strtod()
+ * in the loop.
+ */
+static bool csv_record_ok(const uint8_t *p, size_t len)
+{
+	const uint8_t *end = p + len;
+	double v[5];
+
+	if (!stamp_at(p, end))
+		return false;
+	p += 20;
+	for (int i = 0; i < 5; i++) {
+		if (!(p = csv_number(p, end, &v[i])))
+			return false;
+		if (i < 4 && (p == end || *p++ != ','))
+			return false;
+	}
+	while (p < end && (*p == '\r' || *p == '\n'))
+		p++;
+	return p == end && valid_position(v[0], v[1]);
+}
+
+/* The whole record at the end of a line that starts with a torn one, or NULL */
+static const uint8_t *csv_salvage(const uint8_t *p, size_t len)
+{
+	const uint8_t *end = p + len;
+
+	for (const uint8_t *q = p + 1; q < end; q++) {
+		if (*q >= '0' && *q <= '9' && stamp_at(q, end))
+			return csv_record_ok(q, end - q) ? q : NULL;
+	}
+	return NULL;
+}
+
+static void scan_csv(const uint8_t *data, size_t len, struct log_scan *s, struct scan_out *o)
+{
+	struct mem_file f = { data, len };
+	const uint8_t *p = data;
+	const uint8_t *lim;
+	const uint8_t *b, *e;
+
+	/* Same rule as the firmware at boot: up to the NUL tail, whole lines only */
+	lim = data + (len > UINT32_MAX ? len : log_file_end(mem_read_at, &f, (uint32_t)len));
+
+	while (p < lim) {
+		const uint8_t *nl = (const uint8_t *)memchr(p, '\n', lim - p);
+		size_t n;
+
+		if (!nl)
+			break;
+		n = nl + 1 - p;
+		if (p == data) {
+			trim(p, nl + 1, &b, &e);
+			if (equals(b, e, TRACK_CSV_HEADER)) {
+				s->header_ok = true;
+				out_span(o, p, n);
+				p = nl + 1;
+				continue;
+			}
+			out_str(o, track_fmt_header(TRACK_FMT_CSV));
+		}
+		if (csv_record_ok(p, n)) {
+			s->records++;
+			out_span(o, p, n);
+		} else {
+			const uint8_t *q = csv_salvage(p, n);
+
+			s->bad++;
+			if (q) {
+				s->records++;
+				out_span(o, q, nl + 1 - q);
+			}
+		}
+		p = nl + 1;
+	}
+	if (p == data)
+		out_str(o, track_fmt_header(TRACK_FMT_CSV));
+
+	/* Whatever follows up to the first NUL is the head of a lost record */
+	s->end = p - data;
+	const uint8_t *nul = (const uint8_t *)memchr(p, '\0', data + len - p);
+	s->torn = (nul ? nul : data + len) - p;
+	s->dirty = !s->header_ok || s->bad || s->end != len;
+}
+
+// === GPX ===
+static bool gpx_point_ok(const uint8_t *p, size_t len)
+{
+	char line[TRACK_LINE_MAX];
+	const uint8_t *nl = (const uint8_t *)memchr(p, '\n', len);
+	size_t n = nl ? nl - p : len;
+	const char *lat, *lon;
+	char *end;
+	double la, lo;
+
+	if (memchr(p, '\0', len) || n >= sizeof(line))
+		return false;
+	memcpy(line, p, n);
+	line[n] = '\0';
+
+	lat = strstr(line, "lat=\"");
+	lon = strstr(line, "lon=\"");
+	if (!lat || !lon)
+		return false;
+	la = strtod(lat + 5, &end);
+	if (*end != '"')
+		return false;
+	lo = strtod(lon + 5, &end);
+	if (*end != '"')
+		return false;
+	return valid_position(la, lo);
+}
+
+static void scan_gpx(const uint8_t *data, size_t len, struct log_scan *s, struct scan_out *o)
+{
+	const uint8_t *p = data;
+	const uint8_t *lim = data + len;
+	const uint8_t *block = NULL; /* Start of the open <trkpt> */
+	const uint8_t *b, *e;
+	uint32_t pending = 0;        /* Footers since the last record */
+
+	/* Everything up to the line that opens the segment is the header */
+	for (const uint8_t *q = data; q < lim && q < data + GPX_HEADER_MAX; ) {
+		const uint8_t *nl = (const uint8_t *)memchr(q, '\n', lim - q);
+
+		if (!nl)
+			break;
+		trim(q, nl + 1, &b, &e);
+		if (e - b >= 8 && !memcmp(e - 8, "<trkseg>", 8)) {
+			s->header_ok = true;
+			p = nl + 1;
+			break;
+		}
+		q = nl + 1;
+	}
+	if (s->header_ok)
+		out_span(o, data, p - data);
+	else
+		out_str(o, track_fmt_header(TRACK_FMT_GPX));
+
+	while (p < lim) {
+		const uint8_t *nl = (const uint8_t *)memchr(p, '\n', lim - p);
+
+		if (!nl)
+			break;
+		trim(p, nl + 1, &b, &e);
+		if (b == e) {
+			/* Blank line */
+		} else if (starts(b, e, "<trkpt")) {
+			if (block)
+				s->bad++;
+			block = p;
+		} else if (starts(b, e, "</trkpt>")) {
+			if (block && gpx_point_ok(block, nl + 1 - block)) {
+				s->records++;
+				s->footers += pending;
+				pending = 0;
+				out_span(o, block, nl + 1 - block);
+			} else {
+				s->bad++;
+			}
+			block = NULL;
+		} else if (block) {
+			/* <time> and anything else inside the point */
+		} else if (is_gpx_footer(b, e)) {
+			pending++;
+		} else {
+			s->bad++;
+		}
+		p = nl + 1;
+	}
+
+	s->end = (block ? block : p) - data;
+	if (p < lim) {
+		trim(p, lim, &b, &e);
+		if (!block && is_gpx_footer(b, e))
+			pending++;
+		else
+			s->torn = lim - (block ? block : p);
+	} else if (block) {
+		s->torn = lim - block;
+	}
+
+	/* A second footer in a row carries nothing, drop it like a bad line */
+	if (pending > 1)
+		s->bad += pending - 1;
+	s->closed = pending > 0;
+	out_str(o, track_fmt_footer(TRACK_FMT_GPX));
+	s->dirty = !s->header_ok || s->bad || s->footers || s->torn || !s->closed;
+}
+
+// === Entry points ===
+/* Picks the layout from the file name, false for files that are not logs */
+bool log_scan_fmt(const char *name, enum track_fmt *fmt)
+{
+	const char *dot = strrchr(name, '.');
+
+	if (!dot)
+		return false;
+	if (!strcasecmp(dot, ".csv"))
+		*fmt = TRACK_FMT_CSV;
+	else if (!strcasecmp(dot, ".gpx"))
+		*fmt = TRACK_FMT_GPX;
+	else
+		return false;
+	return true;
+}
+
+/*
+ * Checks len bytes of a log. With write set, also streams the repaired
+ * file through it, even when nothing needed changing. Returns false if a
+ * write came up short.
+ */
+bool log_scan_buf(enum track_fmt fmt, const uint8_t *data, size_t len,
+		  struct log_scan *s, log_write_fn write, void *ctx)
+{
+	struct scan_out o = { write, ctx, NULL, 0, true };
+
+	memset(s, 0, sizeof(*s));
+	if (fmt == TRACK_FMT_GPX)
+		scan_gpx(data, len, s, &o);
+	else
+		scan_csv(data, len, s, &o);
+	if (o.write)
+		out_flush(&o);
+	return o.ok;
+}
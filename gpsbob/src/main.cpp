@@ -10,50 +10,106 @@
 
 #include <Wire.h>
 #include <SPI.h>
-#include <SD.h>
 #include <WiFi.h>
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include <Adafruit_GFX.h>
-#include <Adafruit_SSD1306.h>
 #include <TinyGPSPlus.h>
 #include "driver/rtc_io.h"
-#include <Adafruit_SH110X.h>
+#include "esp_timer.h"
+#include <memory>
+#include <mutex>
+#include "board.h"
+#include "oled.h"
+#include "track_format.h"
+#include "track_simplify.h"
+#include "config.h"
+#include "route.h"
+#include "poi_index.h"
+#include "trip.h"
+#include "kalman.h"
+#include "log_policy.h"
+#include "geofence.h"
+#include "battery.h"
+#include "profile.h"
+#include "fix_snapshot.h"
+#include "fix_gate.h"
+#include "sd_sched.h"
+#include "log_file.h"
+#include "raw_capture.h"
+#include "storage.h"
+#include "nav_arrow.h"
+#include "button.h"
+#include <unistd.h>
 
 // === PINS ===
-// SDA D4 For reference, definition not needed
-// SCL D5 For reference, definition not needed
-#define SD_CS D3 /* SD Card Chip Select */
-#define GPS_RX D7
-#define GPS_TX D6
-#define BUTTON_PIN GPIO_NUM_2
-#define BATTERY_PIN 36 /* ADC, GPIO36 (VP) is commonly used for battery voltage sensing */
+// Per board variant, see board.h
 
 // === DISPLAY ===
 #define SCREEN_WIDTH 128
 #define SCREEN_HEIGHT 64
-#define SCREEN_ADDRESS 0x3C
-// Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, -1);
-Adafruit_SH1106G display = Adafruit_SH1106G(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, -1);
+paged_oled<oled_panel, SCREEN_WIDTH, SCREEN_HEIGHT> display(&Wire);
 
 // === Logging SD Card ===
+#define SD_TASK_STACK 8192
+#define SD_TASK_PRIO 2 /* Above loop(), so a queued log commit runs at once */
+struct sd_sched sd_bus; /* Every card access goes through here, see sd_sched.h */
+struct storage_test storage_test; /* Last self-test, see /storage */
 fs::File csv_file;
-fs::File gpx_file;
-bool gpx_header_written = false;
-bool csv_header_written = false;
-int timezone_offset_hours = 0; /* Default UTC */
-int log_interval = 30000;    /* default 30 seconds */
-int live_interval = 5000;    /* default 5 seconds */
+String csv_path;            /* Of csv_file */
+uint32_t csv_end;           /* Logical end, see log_file.h */
+uint32_t csv_size;          /* Preallocated */
+unsigned long csv_sync_ms;  /* Last flush */
+struct log_policy log_policy; /* Last logged point, for adaptive logging */
+
+// === Points of interest ===
+#define POI_CSV_PATH "/poi.csv"
+#define POI_IDX_PATH "/poi.idx"
+#define POI_IDX_TEMP "/poi.tmp"
+#define POI_MAX_RANGE_M 50000
+fs::File poi_file;
+struct poi_index poi;
+
+// === Geofences ===
+#define FENCE_PATH "/fences.txt"
+#define FENCE_LOG_PATH "/fence_events.csv"
+#define FENCE_LOG_HEADER "_timestamp(UTC),Event,Fence,Latitude,Longitude"
+#define FENCE_RECENT 16
+#define MARK_PATH "/marks.csv"
+#define MARK_HEADER "_timestamp(UTC),Latitude,Longitude,Mode"
+struct geofence_set fences;
+struct fence_recent {
+	char utc[21];
+	char name[GEOFENCE_NAME_MAX];
+	bool entered;
+} fence_recent[FENCE_RECENT]; /* Ring of the latest events for /fences */
+uint32_t fence_events = 0;
+std::mutex fence_lock; /* loop() changes fences and the ring, /fences reads them */
+volatile bool fences_reload_due = false; /* Set by POST /fences, done by loop() */
+volatile bool route_reload_due = false;  /* Set by config_apply(), done by loop() */
+uint16_t mark_count = 0; /* Dropped since boot */
+
+// === Raw capture ===
+#define RAW_ARM_MS 3000 /* Passing through RAW_MODE does not start a file */
+struct raw_capture *raw; /* Only allocated while capturing */
+fs::File raw_file;
+String raw_path;
+struct sd_job raw_job; /* Block write in flight, see raw_flush() */
+const uint8_t *raw_block;
+size_t raw_block_len;
+bool raw_busy = false;
+uint32_t raw_overruns_seen;
+unsigned long raw_mode_ms; /* When RAW_MODE was entered */
+const char *raw_error; /* Why raw_start() failed; not retried until RAW_MODE is entered again */
+uint16_t raw_session = 0;
 
 // === GPS ===
-HardwareSerial gpsSerial(0);
+HardwareSerial gpsSerial(board::gps_uart);
+#define GPS_RX_BUFFER 4096 /* 350 ms at 115200 baud, covers an SD write or a full redraw */
+volatile uint32_t gps_overruns; /* Counted by the UART driver's error callback */
 TinyGPSPlus gps;
 
 // ====== GPS INFO =====
-double waypoint_A_lat = 0.0;
-double waypoint_A_lng = 0.0;
-double waypoint_B_lat = 0.0;
-double waypoint_B_lng = 0.0;
 int fix_state = 0;
 int fix_start = 0;
 int fix_Time = 0;
@@ -72,46 +128,70 @@ unsigned long last_bat_time = 0;
 int last_fix_time = 0;
 int last_sats = 0;
 double last_hdop = 0.0;
+float last_course = 0.0f;  /* Course over ground, degrees */
+bool last_moving = false;  /* last_course is meaningful */
+unsigned long last_sentence_ms = 0; /* millis() when the last NMEA sentence completed */
+struct kalman kf; /* Fed with every fix, see fix_feed() */
+struct fix_gate fix_gate; /* Judges every fix first, see fix_accept() */
+double kf_lat = 0.0;
+double kf_lng = 0.0;
+struct fix_snapshot fix_shared; /* Published by update_gps_data() for the web server */
 
 // === Wi-Fi ===
 AsyncWebServer server(80);
-String wifi_ssid = "GPS_BOB"; /* Default SSID */
-String wifi_pass = "12345678"; /* Default password */
+struct gps_config config_pending; /* Saved by a web POST, applied by loop() */
+std::mutex config_lock; /* loop() writes config under it, web handlers copy it */
+volatile bool config_due = false;
+AsyncEventSource live_events("/live");
+uint32_t live_frame_id = 0;
 bool wifi_started = false;
 
 // === Sleep & Modes ===
 
 RTC_DATA_ATTR int boot_count = 0;
+RTC_DATA_ATTR struct trip trip; /* Survives deep sleep, not power loss */
+volatile bool trip_reset_due = false; /* Set by /trip/reset, done by loop() */
 enum Mode {
     INFO_MODE,
     LIVE_MODE,
     LOG_MODE,
-    NAV_MODE_A,
-    NAV_MODE_B,
-    WIFI_MODE
+    NAV_MODE,
+    TRIP_MODE,
+    WIFI_MODE,
+    RAW_MODE
 };
-uint32_t button_press_time = 0;
 const uint16_t long_press_ms = 3000; /* Long press length, 3 seconds */
-const uint16_t debounce_ms = 50;
+const uint16_t debounce_ms = 20; /* Level sampled this long after the first edge */
+const uint16_t double_press_ms = 250; /* Second press within this: double */
+struct button button; /* Gestures, fed from the timers below */
+esp_timer_handle_t button_settle_timer;  /* Armed by the first edge of a bounce */
+esp_timer_handle_t button_gesture_timer; /* Ends the wait for a second press */
+volatile bool button_armed = false;
+volatile uint32_t button_edge_us;
 bool sleep_enabled = false;
-bool button_was_pressed = false;
 Mode current_mode = INFO_MODE; /* Default Start_Mode */
-Mode last_mode = WIFI_MODE;
 bool update_display = true;
 bool first_load = true;
 int bat_ind = 0;
+float bat_runtime_h = -1; /* From the measured drain, -1 while unknown */
+unsigned long boot_screen_ms = 0; /* Reset to first screen, shown in INFO_MODE */
+#if GPSBOB_PROFILE
+const uint16_t profile_press_ms = 1000; /* Held this long in INFO_MODE: profile page */
+bool profile_page = false;
+#endif
 
 // ___ FUNCTION DECLARATIONS ________________________________________________________________
 
 // === Battery Utilities ===
+float battery_read(void);
+void battery_sample(void *arg);
+void battery_begin(void);
+float battery_load_ma(void);
 float battery_voltage(void);
-int battery_percentage(float v);
 void battery_update(void);
 void battery_display(void);
-
-// === Config Management ===
-void load_config(void); 
-bool replace_config_line(const char *filename, const String &key, const String &newValue);
+void power_check(void);
+void enter_sleep(const char *message);
 
 // === Date & Time conversion ===
 String to_iso8601(TinyGPSDate date, TinyGPSTime time); 
@@ -122,23 +202,71 @@ String gps_date_stamp(TinyGPSDate date);
 void display_text(const String &text, int size, bool clear = false, bool excute = false);
 void display_gps_data(const String &title);
 void display_nav_data(const String &title);
+void display_trip_data(const String &title);
 void display_info(void);
+void display_flush(void);
+#if GPSBOB_PROFILE
+void prof_mem_read(struct prof_mem *mem);
+void display_profile(void);
+#endif
+
+// === Navigation ===
+void route_load(void);
+size_t poi_file_write(void *ctx, const void *buf, size_t len);
+bool poi_build(uint32_t src_mtime, uint32_t src_size);
+void poi_load(void);
+void fences_load(void);
+void fence_check(double lat, double lng);
 
 // === Log File Handling===
 const char* mode_to_string(Mode mode);
 void open_log_files(const String &dateStr, const String &mode_name); 
+bool log_grow(uint32_t size);
+void log_append(const char *line);
+void log_truncate(const String &path, uint32_t end);
+void log_recover(void);
+uint32_t log_share(const String &path);
+bool log_due(void);
+String log_title(void);
 void log_data(void); 
-void close_gpx(void); 
+void close_log_files(void); 
 
 // === Webserver===
+struct gps_config config_copy(void);
+bool config_submit(const struct gps_config *c);
+void config_apply(void);
+size_t file_read(void *ctx, uint8_t *buf, size_t len);
+size_t file_read_at(void *ctx, uint32_t offset, void *buf, size_t len);
+void sd_task(void *arg);
+void storage_test_task(void *arg);
+void live_push(void);
 void start_wifi_server(void); 
 void stop_wifi_server(void);
 
 // === Button Handling ===
+void button_begin(void);
+void button_isr(void);
+void button_wait(uint32_t us);
+void button_settled(void *arg);
+void button_timeout(void *arg);
 void handle_button(void); 
+void mark_drop(void);
+
+// === Raw capture ===
+void raw_start(void);
+void raw_stop(void);
+void raw_run(void);
+void raw_flush(bool force);
+void raw_write_block(void *ctx);
+void display_raw_data(void);
 
 // === GPS Utilities===
+void gps_begin(void);
 void update_gps_data(void);
+bool fix_accept(void);
+void fix_feed(void);
+void fix_position(bool filtered, double *lat, double *lng);
+size_t fix_json(const struct fix_data *f, char *buf, size_t len);
 void gps_fix_test(void); /* for testing only, not used in final product */
 int gps_fix_check(void);
 
@@ -148,34 +276,108 @@ int gps_fix_check(void);
 void setup(void)
 {
 	++boot_count;
-
-	esp_sleep_enable_ext0_wakeup(BUTTON_PIN, 0); /* 1 = High, 0 = Low */
-	pinMode(BUTTON_PIN, INPUT_PULLUP);
-	gpsSerial.begin(9600, SERIAL_8N1, GPS_RX, GPS_TX);
-
-	// display.begin(SSD1306_SWITCHCAPVCC, SCREEN_ADDRESS);
-    display.begin(SCREEN_ADDRESS, true);
+#if GPSBOB_PROFILE
+	prof_init(ESP.getCpuFreqMHz());
+#endif
+	if (trip_valid(&trip))
+		trip_resume(&trip);
+	else
+		trip_reset(&trip);
+
+	esp_sleep_enable_ext0_wakeup(board::button, 0); /* 1 = High, 0 = Low */
+	pinMode(board::button, INPUT_PULLUP);
+	button_begin();
+
+	display.start(board::oled_addr);
 	display.setTextColor(WHITE);
-	
-  while (!SD.begin(SD_CS))
-		display_text("Error\nSD Error\nCheck if installed and Reset", 1, true, true);
-	
-  load_config();
+
+	// Settings come from NVS so the first screen does not wait for the card
+	config_begin();
+	gps_begin();
 	current_mode = INFO_MODE;
+	battery_begin();
 	battery_update();
+	boot_screen_ms = millis();
+	display_info();
+
+	while (!storage_begin(&config))
+		display_text("Error\nSD Error\nCheck if installed and Reset", 1, true, true);
+	sd_sched_init(&sd_bus);
+	xTaskCreate(sd_task, "sd", SD_TASK_STACK, NULL, SD_TASK_PRIO, NULL);
+	log_recover();
+
+	config_sync(storage_fs());
+	route_load();
+	poi_load();
+	fences_load();
 	display_info();
 }
 
 // === Main Loop ===
 void loop(void)
 {
+	PROF_LOOP();
+
 	handle_button();
+	power_check();
+
+	// Web requests only flag changes to state loop() updates on every fix
+	if (config_due)
+		config_apply();
+	if (trip_reset_due) {
+		trip_reset_due = false;
+		trip_reset(&trip);
+	}
+	if (fences_reload_due) {
+		fences_reload_due = false;
+		fences_load();
+	}
+	if (route_reload_due) {
+		route_reload_due = false;
+		route_load();
+	}
+
+	if (current_mode == INFO_MODE) {
+#if GPSBOB_PROFILE
+		if (profile_page && millis() - last_live_time >= 1000) {
+			display_profile();
+			last_live_time = millis();
+		}
+#endif
+		return;
+	}
 
-	if (current_mode == WIFI_MODE || current_mode == INFO_MODE)
+	if (current_mode == RAW_MODE) {
+		if (!raw && !raw_error && millis() - raw_mode_ms >= RAW_ARM_MS)
+			raw_start();
+		if (raw)
+			raw_run();
+		if (millis() - last_live_time >= 1000) {
+			display_raw_data();
+			last_live_time = millis();
+		}
 		return;
+	}
 
     int gps_check = gps_fix_check();
-
+	if (gps_check == 1 && !fix_accept())
+		gps_check = 3; /* Rejected: everything keeps the last good fix */
+	if (gps_check == 1)
+		fix_feed();
+
+	// Wi-Fi keeps following the receiver: fixes go out on /live and the
+	// LOG_MODE track carries on, see log_data()
+	if (current_mode == WIFI_MODE) {
+		if (gps_check != 1)
+			return;
+		update_gps_data();
+		live_push();
+		if (log_due()) {
+			log_data();
+			last_log_time = millis();
+		}
+		return;
+	}
 
 	if (gps_check == 0) {
 		fix_start = millis();
@@ -186,11 +388,11 @@ void loop(void)
 		case LOG_MODE:
 			display_gps_data("Log Mode - Last");
 			break;
-		case NAV_MODE_A:
-			display_nav_data("NAV Mode - Last");
+		case NAV_MODE:
+			display_nav_data("NAV - Last");
 			break;
-        case NAV_MODE_B:
-			display_nav_data("NAV Mode - Last");
+		case TRIP_MODE:
+			display_trip_data("TRIP - Last");
 			break;
 		}
         update_display = false;
@@ -208,54 +410,51 @@ void loop(void)
 
 	switch (current_mode) {
 	case LIVE_MODE:
-		if ((millis() - last_live_time >= live_interval) || first_load) {
+		if ((millis() - last_live_time >= config.live_interval) || first_load) {
             update_display = true;
 			update_gps_data();
-			display_gps_data("LIVE Freq:" + String(live_interval / 1000) + " s ");
+			display_gps_data("LIVE Freq:" + String(config.live_interval / 1000) + " s ");
 			last_live_time = millis();
 			first_load = false;
 		}
 		break;
 
 	case LOG_MODE:
-		if ((millis() - last_log_time >= log_interval) || first_load) {
-            update_display = true;
+		// Checked every second, log_due() decides whether the fix is kept
+		if ((millis() - last_live_time >= 1000) || first_load) {
 			update_gps_data();
-			display_gps_data("LOG Freq: " + String(log_interval / 1000) + " s ");
-			log_data();
-			last_log_time = millis();
+			last_live_time = millis();
+			if (log_due() || first_load) {
+				update_display = true;
+				display_gps_data(log_title());
+				log_data();
+				last_log_time = millis();
+			}
 			first_load = false;
 		}
 		break;
 
-	case NAV_MODE_A:
+	case NAV_MODE:
 		if ((millis() - last_live_time >= 1000) || first_load) {
             update_display = true;
 			update_gps_data();
-			display_nav_data("NAV A");
+			display_nav_data("NAV");
 			last_live_time = millis();
-			// first_load = false;
-		}
-		if (millis() - last_log_time >= log_interval || first_load) {
-            log_data();
-			last_log_time = millis();   
+			if (log_due() || first_load) {
+				log_data();
+				last_log_time = millis();
+			}
 		}
         first_load = false;
 		break;
-        
-    case NAV_MODE_B:
+
+	case TRIP_MODE:
 		if ((millis() - last_live_time >= 1000) || first_load) {
             update_display = true;
-			update_gps_data();
-			display_nav_data("NAV B");
+			display_trip_data("TRIP");
 			last_live_time = millis();
-			// first_load = false;
-		}
-		if (millis() - last_log_time >= log_interval || first_load) {
-            log_data();
-			last_log_time = millis();   
+			first_load = false;
 		}
-        first_load = false;
 		break;
 	}
 }
@@ -263,65 +462,116 @@ void loop(void)
 // ___ FUNCTIONS ________________________________________________________________
 
 // === Battery Utilities ===
-float battery_voltage(void)
+#define BATTERY_SAMPLE_US 1000000
+#define BATTERY_CHECK_MS 10000
+#define BATTERY_LOW_PCT 10
+#define BATTERY_LOW_MIN 20      /* Runtime left that turns Wi-Fi off */
+#define BATTERY_CRITICAL_PCT 3
+#define BATTERY_CRITICAL_MIN 5  /* Runtime left that forces deep sleep */
+
+/* Rough draw per consumer for load compensation, mA */
+#define LOAD_BASE_MA 45   /* MCU, display, GPS */
+#define LOAD_WIFI_MA 110
+
+struct battery_model battery;
+portMUX_TYPE battery_mux = portMUX_INITIALIZER_UNLOCKED;
+esp_timer_handle_t battery_timer;
+
+/* One blocking burst, only used to prime the model at boot */
+float battery_read(void)
 {
 	uint32_t Vbatt = 0;
 	int i;
 	for (i = 0; i < 16; i++)
-		Vbatt = Vbatt + analogReadMilliVolts(BATTERY_PIN); // ADC with correction
+		Vbatt = Vbatt + analogReadMilliVolts(board::battery_adc); // ADC with correction
 	return 2 * Vbatt / 16 / 1000.0;     // attenuation ratio 1/2, mV --> V
 }
 
-int battery_percentage(float v)
-{
-	if (v >= 4.2)
-		return 100;
-	else if (v > 4.15)
-		return 95;
-	else if (v > 4.11)
-		return 90;
-	else if (v > 4.08)
-		return 85;
-	else if (v > 4.02)
-		return 80;
-	else if (v > 3.98)
-		return 75;
-	else if (v > 3.95)
-		return 70;
-	else if (v > 3.91)
-		return 65;
-	else if (v > 3.87)
-		return 60;
-	else if (v > 3.85)
-		return 55;
-	else if (v > 3.84)
-		return 50;
-	else if (v > 3.82)
-		return 45;
-	else if (v > 3.80)
-		return 40;
-	else if (v > 3.79)
-		return 35;
-	else if (v > 3.77)
-		return 30;
-	else if (v > 3.75)
-		return 25;
-	else if (v > 3.73)
-		return 20;
-	else if (v > 3.71)
-		return 15;
-	else if (v > 3.69)
-		return 10;
-	else if (v > 3.61)
-		return 5;
-	else if (v > 3.00)
-		return 0;
-	return -1;
+float battery_load_ma(void)
+{
+	return LOAD_BASE_MA + (wifi_started ? LOAD_WIFI_MA : 0);
+}
+
+/* esp_timer callback: a single conversion per second into the average */
+void battery_sample(void *arg)
+{
+	float v = 2 * analogReadMilliVolts(board::battery_adc) / 1000.0;
+	float load = battery_load_ma();
+	uint32_t now = millis();
+
+	portENTER_CRITICAL(&battery_mux);
+	battery_model_sample(&battery, v, load, now);
+	portEXIT_CRITICAL(&battery_mux);
+}
+
+void battery_begin(void)
+{
+	const esp_timer_create_args_t args = {
+		.callback = battery_sample,
+		.arg = NULL,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "battery",
+		.skip_unhandled_events = true,
+	};
+
+	battery_model_init(&battery);
+	battery_model_sample(&battery, battery_read(), battery_load_ma(), millis());
+	if (esp_timer_create(&args, &battery_timer) == ESP_OK)
+		esp_timer_start_periodic(battery_timer, BATTERY_SAMPLE_US);
+}
+
+/* Smoothed terminal voltage, does not touch the ADC */
+float battery_voltage(void)
+{
+	portENTER_CRITICAL(&battery_mux);
+	float v = battery.v_ema;
+	portEXIT_CRITICAL(&battery_mux);
+	return v;
 }
 
 void battery_update(void)
 {
-	bat_ind = battery_percentage(battery_voltage());
+	struct battery_model m;
+
+	portENTER_CRITICAL(&battery_mux);
+	m = battery;
+	portEXIT_CRITICAL(&battery_mux);
+
+	float pct = battery_model_percent(&m);
+	bat_ind = pct < 0 ? -1 : (int)(pct + 0.5f);
+	bat_runtime_h = battery_model_runtime_h(&m);
+}
+
+/*
+ * Turns Wi-Fi off when the charge or the predicted runtime gets low and
+ * puts the device to sleep before the cell is run flat. Nothing happens
+ * without a cell reading, e.g. on USB power without a battery.
+ */
+void power_check(void)
+{
+	static unsigned long last_check = 0;
+
+	if (millis() - last_check < BATTERY_CHECK_MS)
+		return;
+	last_check = millis();
+
+	battery_update();
+	if (bat_ind < 0)
+		return;
+
+	float runtime_min = bat_runtime_h * 60;
+	bool known = bat_runtime_h >= 0;
+
+	if (bat_ind <= BATTERY_CRITICAL_PCT || (known && runtime_min < BATTERY_CRITICAL_MIN)) {
+		enter_sleep("Battery empty\nEntering Sleep...\nCharge, then press\nButton to Wake up");
+	}
+	if (current_mode == WIFI_MODE &&
+	    (bat_ind <= BATTERY_LOW_PCT || (known && runtime_min < BATTERY_LOW_MIN))) {
+		stop_wifi_server();
+		current_mode = LOG_MODE;
+		first_load = true;
+		display_text("Battery low\nWi-Fi off, logging", 1, true, true);
+	}
 }
 
 void battery_display(void)
@@ -343,124 +593,6 @@ void battery_display(void)
 		display.drawLine(cell_xstart, 0, cell_xstart + cell_width, cell_height - 1, WHITE);
 }
 
-// === Config Management ===
-void load_config(void) 
-{
-	if (!SD.exists("/config.txt")) {
-		// Serial.println("No config.txt found, using defaults");
-		return;
-	}
-
-	fs::File config = SD.open("/config.txt", FILE_READ);
-	if (!config) {
-		// Serial.println("Failed to open config.txt");
-		return;
-	}
-
-	while (config.available()) {
-		String line = config.readStringUntil('\n');
-		line.trim();
-
-		if (line.startsWith("timezone=")) {
-			String val = line.substring(9);
-			timezone_offset_hours = val.toInt();
-			// Serial.print("Loaded timezone offset: ");
-			// Serial.println(timezone_offset_hours);
-		}
-		else if (line.startsWith("ssid=")) {
-			wifi_ssid = line.substring(5);
-			wifi_ssid.trim();
-			// Serial.print("Loaded SSID: ");
-			// Serial.println(wifi_ssid);
-		}
-		else if (line.startsWith("password=")) {
-			wifi_pass = line.substring(9);
-			wifi_pass.trim();
-			if (wifi_pass.length() < 8) {
-				// Serial.println("Password too short, using default");
-				wifi_pass = "12345678";
-			} else {
-				// Serial.print("Loaded password: ");
-				// Serial.println(wifi_pass);
-			}
-		} 
-		else if (line.startsWith("log_interval=")) {
-			String val = line.substring(13);
-			int interval = val.toFloat() * 1000;
-			if (interval >= 1000) log_interval = interval;
-			// Serial.print("Loaded log interval: ");
-			// Serial.print(log_interval / 1000);
-			// Serial.println(" seconds");
-		}
-		else if (line.startsWith("live_interval=")) {
-			String val = line.substring(14);
-			int interval = val.toFloat() * 1000;
-			if (interval >= 1000) live_interval = interval;
-			// Serial.print("Loaded live interval: ");
-			// Serial.print(live_interval / 1000);
-			// Serial.println(" seconds");
-		}
-		else if (line.startsWith("Latitude_A=")) {
-			String val = line.substring(9);
-			double wayLat = val.toDouble() ;
-			if (wayLat != 0) waypoint_A_lat = wayLat;
-			// Serial.print("Loaded Waypoint Latitude: ");
-			// Serial.println(waypoint_A_lat,6);
-		}
-		else if (line.startsWith("Longitude_A=")) {
-			String val = line.substring(10);
-			double wayLng = val.toDouble() ;
-			if (wayLng != 0) waypoint_A_lng = wayLng;
-			// Serial.print("Loaded Waypoint Longitude: ");
-			// Serial.println(waypoint_A_lng,6);
-		}
-        else if (line.startsWith("Latitude_B=")) {
-			String val = line.substring(9);
-			double wayLat = val.toDouble() ;
-			if (wayLat != 0) waypoint_B_lat = wayLat;
-			// Serial.print("Loaded Waypoint Latitude: ");
-			// Serial.println(waypoint_A_lat,6);
-		}
-		else if (line.startsWith("Longitude_B=")) {
-			String val = line.substring(10);
-			double wayLng = val.toDouble() ;
-			if (wayLng != 0) waypoint_B_lng = wayLng;
-			// Serial.print("Loaded Waypoint Longitude: ");
-			// Serial.println(waypoint_A_lng,6);
-		}
-	}
-	config.close();
-}
-
-bool replace_config_line(const char* filename, const String& key, const String& newValue) 
-{
-	File original = SD.open(filename, FILE_READ);
-	if (!original) return false;
-
-	File temp = SD.open("/temp.txt", FILE_WRITE);
-	if (!temp) {
-		original.close();
-		return false;
-	}
-
-	while (original.available()) {
-		String line = original.readStringUntil('\n');
-		line.trim(); // Remove \r and whitespace
-		if (line.startsWith(key + "=")) {
-			temp.println(key + "=" + newValue);
-		} else {
-			temp.println(line);
-		}
-	}
-
-	original.close();
-	temp.close();
-
-	SD.remove(filename);
-	SD.rename("/temp.txt", filename);
-	return true;
-}
-
 // === Date & Time conversion ===
 String to_iso8601(TinyGPSDate date, TinyGPSTime time) 
 {
@@ -570,15 +702,20 @@ void display_text(const String &text, int size, bool clear, bool excute)
 	
 	display.setTextSize(size);
 	display.println(text);
-	if (excute) display.display();
+	if (excute) display_flush();
 }
 
 
 
 void display_gps_data(const String &title)
 {
+    PROF_SCOPE(PROF_RENDER);
     if (update_display == false)
         return;
+
+    double lat, lng;
+    fix_position(config.filter_display, &lat, &lng);
+
     display.clearDisplay();
     display.setCursor(0, 0);
     display.setTextSize(1);
@@ -586,124 +723,417 @@ void display_gps_data(const String &title)
     battery_display();
     display.println(title);
     display.println(last_timestamp);
-    display.println("Lat");
+    display.println(config.filter_display ? "Lat (filtered)" : "Lat");
     display.setTextSize(2);
     display.setCursor(2, display.getCursorY());
-    if (last_lat >= 0 && last_lat < 100) display.print("  ");
-    if (last_lat < 0 && last_lat > -100) display.print(" ");
-    display.println(last_lat, 5);
+    if (lat >= 0 && lat < 100) display.print("  ");
+    if (lat < 0 && lat > -100) display.print(" ");
+    display.println(lat, 5);
     display.setTextSize(1);
     display.println("Lon");
     display.setTextSize(2);
     display.setCursor(2, display.getCursorY());
-    if (last_lng >= 0 && last_lng < 100) display.print("  ");
-    if (last_lng < 0 && last_lng > -100) display.print(" ");
-    display.println(last_lng, 5);
-    display.display();
+    if (lng >= 0 && lng < 100) display.print("  ");
+    if (lng < 0 && lng > -100) display.print(" ");
+    display.println(lng, 5);
+    display_flush();
     update_display = false;
 }
 
+/*
+ * Distance and bearing to the active waypoint in large print, with the
+ * remaining distance along the route and the bearing to its end above.
+ * The arrow points at the waypoint relative to the direction of travel;
+ * below walking pace the course is noise, so it turns north-up and says so.
+ */
 void display_nav_data(const String &title)
 {
+    PROF_SCOPE(PROF_RENDER);
     if (update_display == false)
         return;
-    
-    double way_lat = 0.0;
-    double way_lng = 0.0;    
-
-    if (current_mode == NAV_MODE_A) {
-        way_lat = waypoint_A_lat;
-        way_lng = waypoint_A_lng;
-    } else if (current_mode == NAV_MODE_B) {
-        way_lat = waypoint_B_lat;
-        way_lng = waypoint_B_lng;
-    }
 
-    
-    double distance = TinyGPSPlus::distanceBetween(last_lat, last_lng,  way_lat,  way_lng);
-    double course_to_waypoint = TinyGPSPlus::courseTo(last_lat, last_lng,  way_lat,  way_lng);
-    const char *cardinal = TinyGPSPlus::cardinal(course_to_waypoint);
-    
+    struct route_status st;
+    char buffer[24];
+    double lat, lng;
+
+    fix_position(config.filter_nav, &lat, &lng);
+
     display.clearDisplay();
     display.setCursor(0, 0);
     display.setTextSize(1);
     display.setTextColor(WHITE);
     battery_display();
-    display.println(title);
-    display.println(last_timestamp);
-    char buffer[16];
+
+    if (!route_update(&route, lat, lng, config.arrive_radius, &st)) {
+        display.println(title);
+        display.println(last_timestamp);
+        display.println("");
+        display.println("No route loaded");
+        display.println(config.route_file);
+        display_flush();
+        update_display = false;
+        return;
+    }
+
+    double distance = st.active_dist_m;
+    double course_to_waypoint = st.active_deg;
+
+    display.print(title);
+    display.printf(" %u/%u", st.active + 1, st.count);
+    display.println(st.arrived ? " END" : "");
+
+    struct poi_hit near;
+    if (poi_nearest(&poi, lat, lng, &near, 1, POI_MAX_RANGE_M) == 1) {
+        char name[POI_NAME_MAX + 1];
+        memcpy(name, near.rec.name, POI_NAME_MAX);
+        name[POI_NAME_MAX] = '\0';
+        if (near.dist_m < 10000)
+            sprintf(buffer, "%-12.12s%6.0fm", name[0] ? name : "POI", near.dist_m);
+        else
+            sprintf(buffer, "%-12.12s%5.1fkm", name[0] ? name : "POI", near.dist_m / 1000.0);
+        display.println(buffer);
+    } else {
+        display.println(last_timestamp);
+    }
+    if (st.final_dist_m < 1000)
+        sprintf(buffer, "End %5.0f m", st.final_dist_m);
+    else
+        sprintf(buffer, "End %6.1f km", st.final_dist_m / 1000.0);
+    display.print(buffer);
+    sprintf(buffer, " %3.0f %s", st.final_deg, TinyGPSPlus::cardinal(st.final_deg));
+    display.println(buffer);
+
     if (distance < 1000)
         sprintf(buffer, "%5.f m", distance);
     else if (distance < 10000000)
         sprintf(buffer, " %6.1f km", distance / 1000.0);
-    else {
+    else
         sprintf(buffer, ">10,000 km");
-        display.printf("%8.4f, %8.4f",  way_lat,  way_lng);
-        display.println("");
-        display.setCursor((display.width() - (10 * 12)) / 2, display.getCursorY() + 4);
-        display.setTextSize(2);
-        display.println(buffer);
-        display.setCursor((display.width() - (7 * 12)) / 2, display.getCursorY() + 4);
-        display.print("Nav OFF");
-        display.display();
-        return;
-    }
-    display.printf("%8.4f, %8.4f",  way_lat,  way_lng);
-    display.println("");
-    display.setCursor(0, display.getCursorY() + 4);
+    display.setCursor(0, 26);
     display.setTextSize(2);
     display.print(buffer);
+
+    /* Bearing bottom left, the arrow in the 24 px square right of it */
+    sprintf(buffer, "%4.0f", course_to_waypoint);
+    display.setCursor(0, 46);
+    display.print(buffer);
+    display.drawCircle(display.getCursorX() + 2, 47, 3, WHITE);
+    display.setTextSize(1);
+    display.setCursor(display.getCursorX() + 10, 50);
+    display.print(TinyGPSPlus::cardinal(course_to_waypoint));
+    if (!last_moving) {
+        display.setCursor(SCREEN_WIDTH - NAV_ARROW_SIZE - 8, SCREEN_HEIGHT - NAV_ARROW_SIZE);
+        display.print("N");
+    }
+    nav_arrow_draw(display.getBuffer(), SCREEN_WIDTH, SCREEN_HEIGHT,
+                   SCREEN_WIDTH - NAV_ARROW_SIZE, SCREEN_HEIGHT - NAV_ARROW_SIZE,
+                   course_to_waypoint - (last_moving ? last_course : 0.0f));
+    display_flush();
+    update_display = false;
+}
+
+/* Totals since the last reset, kept across deep sleep */
+void display_trip_data(const String &title)
+{
+    PROF_SCOPE(PROF_RENDER);
+    if (update_display == false)
+        return;
+
+    char buffer[24];
+    uint32_t moving_s = trip.moving_ms / 1000;
+    uint32_t stopped_s = trip.stopped_ms / 1000;
+
+    display.clearDisplay();
+    display.setCursor(0, 0);
     display.setTextSize(1);
-    display.println("");
-    int x = display.getCursorX();
-    int y = display.getCursorY();
-    display.setCursor(x, y + 4);
-    sprintf(buffer, " %5.0f", course_to_waypoint);
-    display.println("");
+    display.setTextColor(WHITE);
+    battery_display();
+    display.println(title);
+
+    display.setCursor(0, display.getCursorY() + 2);
     display.setTextSize(2);
-    display.print(buffer);
-    x = display.getCursorX();
-    y = display.getCursorY();
-    display.drawCircle(x + 2, y - 1, 3, WHITE);
+    if (trip.distance_m < 100000)
+        sprintf(buffer, "%7.2f km", trip.distance_m / 1000.0);
+    else
+        sprintf(buffer, "%7.0f km", trip.distance_m / 1000.0);
+    display.println(buffer);
     display.setTextSize(1);
-    x = display.getCursorX();
-    y = display.getCursorY();
-    display.println("");
-    display.setCursor(x, (display.getCursorY() + y) / 2);
-    display.print(" (");
-    display.print(cardinal);
-    display.print(")");
-    display.display();
+    display.setCursor(0, display.getCursorY() + 2);
+
+    sprintf(buffer, "Move %2lu:%02lu:%02lu", (unsigned long)(moving_s / 3600),
+            (unsigned long)(moving_s / 60 % 60), (unsigned long)(moving_s % 60));
+    display.print(buffer);
+    display.println(trip.moving ? " >" : "");
+    sprintf(buffer, "Stop %2lu:%02lu:%02lu", (unsigned long)(stopped_s / 3600),
+            (unsigned long)(stopped_s / 60 % 60), (unsigned long)(stopped_s % 60));
+    display.println(buffer);
+    sprintf(buffer, "Avg %5.1f Max %5.1f", trip_avg_kmh(&trip), trip.max_kmh);
+    display.println(buffer);
+    sprintf(buffer, "Up %5.0f m Dn %5.0f m", trip.ascent_m, trip.descent_m);
+    display.println(buffer);
+    display_flush();
     update_display = false;
 }
 
 void display_info(void) 
 {
-	display_text("Info Mode      ", 1, true);
+	PROF_SCOPE(PROF_RENDER);
+	display_text("Info  boot " + String(boot_screen_ms) + "ms", 1, true);
 	display.print("Bat: ");
 	display.print(battery_voltage(), 2);
-	display.println(" V");
+	display.print(" V");
+	if (bat_runtime_h >= 0)
+		display.printf(" %.1fh", bat_runtime_h);
+	display.println("");
+
+	display.printf("TZ %+d  Live %d s\n", config.timezone_offset_hours,
+		       config.live_interval / 1000);
+
+	if (config.log_distance > 0) {
+		display.printf("Log: %dm %ddeg %ds\n", config.log_distance, config.log_heading,
+			       config.log_max_gap / 1000);
+	} else {
+		display.print("Log interval: ");
+		display.print(config.log_interval / 1000);
+		display.println(" s");
+	}
 
-	display.print("Timezone offset: ");
-	display.println(timezone_offset_hours);
+	display.printf("Fix: %lu ok %lu rejected\n", (unsigned long)fix_gate.count[FIX_ACCEPTED],
+		       (unsigned long)fix_gate_rejected(&fix_gate));
 
-	display.print("Log interval: ");
-	display.print(log_interval / 1000);
-	display.println(" s");
+	display.printf("SD: %s %.0f MHz\n", storage_bus_name(), storage_info()->freq_khz / 1000.0);
 
-	display.print("Live interval: ");
-	display.print(live_interval / 1000);
-	display.println(" s");
+	char buffer [24];
 
-	char buffer [20];
+	display.print("Route: ");
+	display.println(config.route_file);
+	sprintf(buffer, " %u pts %8.1f km", route.count, route_total_m(&route) / 1000.0);
+	display.print(buffer);
+	battery_display();
+	display_flush();
+}
+
+void display_flush(void)
+{
+	PROF_SCOPE(PROF_FLUSH);
+	display.flush();
+}
+
+#if GPSBOB_PROFILE
+void prof_mem_read(struct prof_mem *mem)
+{
+	mem->heap_free = ESP.getFreeHeap();
+	mem->heap_min = ESP.getMinFreeHeap();
+	mem->psram_free = ESP.getFreePsram();
+	mem->psram_min = ESP.getMinFreePsram();
+}
 
-	display.println("Waypoint A (B not shown)");
-	sprintf(buffer, " Lat: %11.6f", waypoint_A_lat);
+/* Hidden page: hold the button for a second in INFO_MODE */
+void display_profile(void)
+{
+	struct prof_mem mem;
+	char buffer[24];
+
+	prof_mem_read(&mem);
+	display_text("Profile avg/max us", 1, true);
+	for (int i = 0; i < PROF_COUNT; i++) {
+		const struct prof_counter *c = &prof.counter[i];
+		float avg = c->calls ? prof_us(c->cycles) / c->calls : 0;
+		sprintf(buffer, "%-6s %6.0f %7.0f", prof_name((enum prof_id)i), avg, prof_us(c->max));
+		display.println(buffer);
+	}
+	sprintf(buffer, "loop %6.0f %7.0f",
+		prof.loops ? prof_us(prof.loop_cycles) / prof.loops : 0, prof_us(prof.loop_max));
 	display.println(buffer);
-	sprintf(buffer, " Lon: %11.6f", waypoint_A_lng);
+	sprintf(buffer, "heap %4luk ps %5luk", (unsigned long)(mem.heap_min / 1024),
+		(unsigned long)(mem.psram_min / 1024));
 	display.print(buffer);
-	battery_display();
-	display.display();
+	display_flush();
+}
+#endif
+
+// === Navigation ===
+/*
+ * Loads the configured route file. Without one, waypoints A and B from the
+ * settings page form a two-point route. Only at boot and when those
+ * settings change: reloading starts over at the first waypoint.
+ */
+void route_load(void)
+{
+	route_clear(&route);
+
+	sd_sched_run(&sd_bus, SD_LOOP, [] {
+		fs::File f = storage_fs().open(config.route_file, FILE_READ);
+		if (f) {
+			String path = config.route_file;
+			route_parse(&route, path.endsWith(".csv") ? ROUTE_SRC_CSV : ROUTE_SRC_GPX,
+				    file_read, &f);
+			f.close();
+		}
+	});
+	if (route.count > 0)
+		return;
+
+	if (config.waypoint_A_lat != 0 || config.waypoint_A_lng != 0)
+		route_add(&route, config.waypoint_A_lat, config.waypoint_A_lng);
+	if (config.waypoint_B_lat != 0 || config.waypoint_B_lng != 0)
+		route_add(&route, config.waypoint_B_lat, config.waypoint_B_lng);
+	route_finish(&route);
+}
+
+size_t poi_file_write(void *ctx, const void *buf, size_t len)
+{
+	fs::File *file = (fs::File *)ctx;
+	return file->write((const uint8_t *)buf, len);
+}
+
+/*
+ * Rebuilds poi.idx from poi.csv. All records are held in memory for the
+ * sort, in PSRAM when the board has it.
+ */
+bool poi_build(uint32_t src_mtime, uint32_t src_size)
+{
+	fs::File src = storage_fs().open(POI_CSV_PATH, FILE_READ);
+	if (!src)
+		return false;
+
+	uint32_t lines = 1;
+	uint8_t chunk[512];
+	size_t n;
+	while ((n = src.read(chunk, sizeof(chunk))) > 0) {
+		for (size_t i = 0; i < n; i++)
+			lines += chunk[i] == '\n';
+	}
+
+	size_t bytes = lines * sizeof(struct poi_record);
+	struct poi_record *recs = (struct poi_record *)(psramFound() ? ps_malloc(bytes) : malloc(bytes));
+	if (!recs) {
+		src.close();
+		return false;
+	}
+
+	uint32_t count = 0;
+	char line[96];
+	src.seek(0);
+	while (src.available() && count < lines) {
+		size_t len = src.readBytesUntil('\n', line, sizeof(line));
+		if (poi_parse_csv(line, len, &recs[count]))
+			count++;
+	}
+	src.close();
+
+	poi_sort(recs, count);
+	fs::File out = storage_fs().open(POI_IDX_TEMP, FILE_WRITE);
+	bool ok = out && poi_write(recs, count, src_mtime, src_size, poi_file_write, &out);
+	if (out)
+		out.close();
+	free(recs);
+
+	if (ok) {
+		storage_fs().remove(POI_IDX_PATH);
+		ok = storage_fs().rename(POI_IDX_TEMP, POI_IDX_PATH);
+	}
+	return ok;
+}
+
+/* Opens poi.idx, rebuilding it first when poi.csv has changed */
+void poi_load(void)
+{
+	bool have_src = false, fresh = false;
+	uint32_t src_mtime = 0, src_size = 0;
+
+	sd_sched_run(&sd_bus, SD_LOOP, [&] {
+		poi_close(&poi);
+		if (poi_file)
+			poi_file.close();
+
+		fs::File src = storage_fs().open(POI_CSV_PATH, FILE_READ);
+		if (!src)
+			return;
+		have_src = true;
+		src_mtime = (uint32_t)src.getLastWrite();
+		src_size = src.size();
+		src.close();
+
+		poi_file = storage_fs().open(POI_IDX_PATH, FILE_READ);
+		fresh = poi_file && poi_open(&poi, file_read_at, &poi_file) &&
+			poi.hdr.src_mtime == src_mtime && poi.hdr.src_size == src_size;
+		if (fresh)
+			return;
+		poi_close(&poi);
+		if (poi_file)
+			poi_file.close();
+	});
+	if (!have_src || fresh)
+		return;
+
+	display_text("Indexing POI...", 1, true, true);
+	sd_sched_run(&sd_bus, SD_LOOP, [&] {
+		if (!poi_build(src_mtime, src_size))
+			return;
+		poi_file = storage_fs().open(POI_IDX_PATH, FILE_READ);
+		if (poi_file && !poi_open(&poi, file_read_at, &poi_file))
+			poi_file.close();
+	});
+}
+
+void fences_load(void)
+{
+	std::lock_guard<std::mutex> lock(fence_lock);
+
+	geofence_free(&fences);
+
+	sd_sched_run(&sd_bus, SD_LOOP, [] {
+		fs::File f = storage_fs().open(FENCE_PATH, FILE_READ);
+		if (!f)
+			return;
+		geofence_parse(&fences, file_read, &f);
+		f.close();
+	});
+}
+
+/*
+ * Runs a fix through the fences and appends confirmed entries and exits
+ * to FENCE_LOG_PATH, one short CSV line each.
+ */
+void fence_check(double lat, double lng)
+{
+	struct geofence_event ev[4];
+	std::unique_lock<std::mutex> lock(fence_lock);
+	int n = geofence_update(&fences, lat, lng, ev, 4);
+
+	if (n == 0)
+		return;
+
+	PROF_SCOPE(PROF_SD);
+	String utc = to_iso8601(gps.date, gps.time);
+
+	for (int i = 0; i < n; i++) {
+		const struct geofence *fence = &fences.fence[ev[i].fence];
+		struct fence_recent *r = &fence_recent[fence_events++ % FENCE_RECENT];
+
+		snprintf(r->utc, sizeof(r->utc), "%s", utc.c_str());
+		memcpy(r->name, fence->name, GEOFENCE_NAME_MAX);
+		r->entered = ev[i].entered;
+	}
+	lock.unlock();
+
+	uint32_t end = fence_events;
+	sd_sched_run(&sd_bus, SD_LOG, [&] {
+		bool new_file = !storage_fs().exists(FENCE_LOG_PATH);
+		fs::File f = storage_fs().open(FENCE_LOG_PATH, FILE_APPEND);
+
+		if (!f)
+			return;
+		if (new_file)
+			f.println(FENCE_LOG_HEADER);
+		for (uint32_t i = end - n; i < end; i++) {
+			const struct fence_recent *r = &fence_recent[i % FENCE_RECENT];
+			f.printf("%s,%s,%s,%.6f,%.6f\n", r->utc, r->entered ? "enter" : "exit",
+				 r->name, lat, lng);
+		}
+		f.close();
+	});
 }
 
 // === Log File Handling===
@@ -713,9 +1143,10 @@ const char* mode_to_string(Mode mode)
         case INFO_MODE:   return "INFO_MODE";
         case LIVE_MODE:   return "LIVE_MODE";
         case LOG_MODE:    return "LOG_MODE";
-        case NAV_MODE_A:  return "NAV_MODE_A";
-        case NAV_MODE_B:  return "NAV_MODE_B";
+        case NAV_MODE:    return "NAV_MODE";
+        case TRIP_MODE:   return "TRIP_MODE";
         case WIFI_MODE:   return "WIFI_MODE";
+        case RAW_MODE:    return "RAW_MODE";
         default:          return "UNKNOWN_MODE";
     }
 }
@@ -724,98 +1155,322 @@ void open_log_files(const String &dateStr, const String &mode_name)
 {
 	current_date_str = dateStr;
 
-	String csvName = "/log_" + mode_name + dateStr + ".csv";
-	bool newFile_csv = !SD.exists(csvName);
-	csv_file = SD.open(csvName, FILE_APPEND);
-	csv_header_written = newFile_csv;
-
-	if (csv_file && csv_header_written) {
-		csv_file.println("_timestamp(_local),Latitude,Longitude,Satilites,HDOP,OffsetUTC");
-		csv_file.flush();
-	}
+	sd_sched_run(&sd_bus, SD_LOG, [&] {
+		csv_path = "/log_" + mode_name + dateStr + ".csv";
+		bool new_file = !storage_fs().exists(csv_path);
+		csv_file = storage_fs().open(csv_path, new_file ? "w+" : "r+");
+		if (!csv_file)
+			return;
 
-	String gpxName = "/track_" + mode_name + dateStr + ".gpx";
-	bool newFile_gpx = !SD.exists(gpxName);
-	gpx_file = SD.open(gpxName, FILE_APPEND);
-	gpx_header_written = newFile_gpx;
-
-	if (gpx_file && gpx_header_written) {
-		gpx_file.println("<?xml version=\"1.0\" encoding=\"UTF-8\"?>");
-		gpx_file.println("<gpx version=\"1.1\" creator=\"ESP32 Logger\"");
-		gpx_file.println(" xmlns=\"http://www.topografix.com/GPX/1/1\"");
-		gpx_file.println(" xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"");
-		gpx_file.println(" xsi:schemaLocation=\"http://www.topografix.com/GPX/1/1");
-		gpx_file.println(" http://www.topografix.com/GPX/1/1/gpx.xsd\">");
-		gpx_file.println("<trk><name>GPSBOB Log</name><trkseg>");
-		gpx_file.flush();
-	}
+		csv_size = csv_file.size();
+		csv_end = log_file_end(file_read_at, &csv_file, csv_size);
+		csv_file.seek(csv_end);
+		if (new_file)
+			log_append(TRACK_CSV_HEADER);
+	});
 }
 
-void log_data() 
+/*
+ * Extends the open log to size with zeros and syncs, so that the
+ * allocation and the new size are on the card before records go in.
+ */
+bool log_grow(uint32_t size)
 {
-// 	String csvName = "/log_" + mode_name + dateStr + ".csv";
-//     String gpxName = "/track_" + mode_name + dateStr + ".gpx";
-    
-    // if (today != current_date_str) {
-	// 	close_gpx();
-	// 	open_log_files(today, mode_to_string(current_mode));
-	// }
-
-    if ((current_mode != last_mode) || (today != current_date_str)) {
-		close_gpx();
-		open_log_files(today, mode_to_string(current_mode));
-        current_mode = last_mode;   
+	static const uint8_t zero[512] = { 0 };
+
+	if (!csv_file.seek(csv_size))
+		return false;
+	while (csv_size < size) {
+		size_t n = csv_file.write(zero, sizeof(zero));
+		if (n == 0)
+			break;
+		csv_size += n;
 	}
+	csv_file.flush();
+	csv_sync_ms = millis();
+	return csv_file.seek(csv_end) && csv_size >= size;
+}
 
-	String csv =  last_timestamp + "," +
-				String(last_lat, 6) + "," +
-				String(last_lng, 6) + "," +
-				String(last_sats) + "," +
-				String(last_hdop, 2) + "," +
-				String(timezone_offset_hours);
+/* Writes one record at the logical end, see log_file.h */
+void log_append(const char *line)
+{
+	size_t len = strlen(line) + 2; /* println() adds CR LF */
+	uint32_t size = log_file_size_for(csv_end, csv_size, len);
 
-	if (csv_file) {
-		csv_file.println(csv);
+	if (!csv_file || (size > csv_size && !log_grow(size)))
+		return;
+	csv_end += csv_file.println(line);
+	if (millis() - csv_sync_ms >= LOG_FILE_SYNC_MS) {
 		csv_file.flush();
+		csv_sync_ms = millis();
 	}
-
-	if (gpx_file) {
-		gpx_file.print("<trkpt lat=\"");
-		gpx_file.print(last_lat, 6);
-		gpx_file.print("\" lon=\"");
-		gpx_file.print(last_lng, 6);
-		gpx_file.println("\">");
-		gpx_file.print("  <time>");
-		gpx_file.print(last_utc);
-		gpx_file.println("</time>");
-		gpx_file.println("</trkpt>");
-		gpx_file.flush();
-	}
-
 }
 
-void close_gpx(void) 
+/* Cuts a log that was closed, or lost power, down to its records */
+void log_truncate(const String &path, uint32_t end)
 {
-	if (gpx_file) {
-		gpx_file.println("</trkseg></trk></gpx>");
-		gpx_file.flush();
-		gpx_file.close();
-	}
+	truncate((storage_mount() + path).c_str(), end);
 }
 
-// === Webserver===
-void start_wifi_server(void) 
+/*
+ * Boot pass over the logs: one that still has a preallocated tail was
+ * not closed, so it is truncated now.
+ */
+void log_recover(void)
 {
-	if (wifi_started) return;
-	wifi_started = true;
+	sd_sched_run(&sd_bus, SD_LOOP, [] {
+		File root = storage_fs().open("/");
+		if (!root)
+			return;
 
-	WiFi.softAP(wifi_ssid.c_str(), wifi_pass.c_str());
-	IPAddress IP = WiFi.softAPIP();
-	// Serial.print("AP IP address: ");
-	// Serial.println(IP);
+		File file = root.openNextFile();
+		while (file) {
+			String path = "/" + String(file.name());
+			uint32_t size = file.size();
+			uint32_t end = size;
+
+			if (path.startsWith("/log_") && path.endsWith(".csv"))
+				end = log_file_end(file_read_at, &file, size);
+			file.close();
+			if (end < size)
+				log_truncate(path, end);
+			file = root.openNextFile();
+		}
+	});
+}
+
+/*
+ * Lets another handle read the open log up to its last record. Returns
+ * the logical size of path, or 0 when it is not the open log.
+ */
+uint32_t log_share(const String &path)
+{
+	if (!csv_file || path != csv_path)
+		return 0;
+	csv_file.flush();
+	csv_sync_ms = millis();
+	return csv_end;
+}
+
+/*
+ * Whether the fix from the last update_gps_data() should be logged: every
+ * log_interval, or by motion when log_distance is set (see log_policy.h).
+ */
+bool log_due(void)
+{
+	if (config.log_distance <= 0)
+		return millis() - last_log_time >= config.log_interval;
+
+	double lat, lng;
+	fix_position(config.filter_log, &lat, &lng);
+	return log_policy_due(&log_policy, lat, lng, millis(), config.log_distance,
+			      config.log_heading, config.log_max_gap);
+}
+
+String log_title(void)
+{
+	if (config.log_distance <= 0)
+		return "LOG Freq: " + String(config.log_interval / 1000) + " s ";
+	return "LOG Auto: " + String(config.log_distance) + " m ";
+}
+
+/*
+ * Only the CSV log is written to the card, other formats are produced from
+ * it on download by /export.
+ *
+ * Wi-Fi only adds a UI on top of logging: its points go to the LOG_MODE
+ * file, so switching between the two does not split the track.
+ */
+void log_data() 
+{
+	static Mode file_mode = WIFI_MODE;
+	Mode mode = current_mode == WIFI_MODE ? LOG_MODE : current_mode;
+	struct track_point pt;
+	char csv[TRACK_CSV_MAX];
+
+	snprintf(pt.local, sizeof(pt.local), "%s", last_timestamp.c_str());
+	fix_position(config.filter_log, &pt.lat, &pt.lng);
+	pt.sats = last_sats;
+	pt.hdop = last_hdop;
+	pt.offset_hours = config.timezone_offset_hours;
+	track_csv_line(&pt, csv, sizeof(csv));
+
+	/* One job, so a date change does not let a download in between */
+	sd_sched_run(&sd_bus, SD_LOG, [&] {
+		PROF_SCOPE(PROF_SD);
+		if ((mode != file_mode) || (today != current_date_str)) {
+			close_log_files();
+			open_log_files(today, mode_to_string(mode));
+			file_mode = mode;
+		}
+		log_append(csv);
+	});
+	log_policy_commit(&log_policy, pt.lat, pt.lng, millis());
+}
+
+void close_log_files(void) 
+{
+	sd_sched_run(&sd_bus, SD_LOG, [] {
+		if (csv_file) {
+			csv_file.flush();
+			csv_file.close();
+			log_truncate(csv_path, csv_end);
+		}
+	});
+}
+
+/* Owns the card, see sd_sched.h */
+void sd_task(void *arg)
+{
+	sd_sched_worker(&sd_bus);
+	vTaskDelete(NULL);
+}
+
+/* Started from /storage, takes a few seconds of card time */
+void storage_test_task(void *arg)
+{
+	storage_selftest(&sd_bus, &storage_test);
+	vTaskDelete(NULL);
+}
+
+// === Webserver===
+/* Web task: the settings as last saved, for a page or to edit */
+struct gps_config config_copy(void)
+{
+	std::lock_guard<std::mutex> lock(config_lock);
+	return config_due ? config_pending : config;
+}
+
+/* Web task: saves c and hands it to loop() */
+bool config_submit(const struct gps_config *c)
+{
+	bool saved;
+
+	sd_sched_run(&sd_bus, SD_WEB, [&] { saved = config_save(storage_fs(), c); });
+	if (!saved)
+		return false;
+	std::lock_guard<std::mutex> lock(config_lock);
+	config_pending = *c;
+	config_due = true;
+	return true;
+}
+
+/* loop(): takes over what config_submit() handed in */
+void config_apply(void)
+{
+	std::lock_guard<std::mutex> lock(config_lock);
+	const struct gps_config *c = &config_pending;
+
+	config_due = false;
+	if (strcmp(c->route_file, config.route_file) ||
+	    c->waypoint_A_lat != config.waypoint_A_lat || c->waypoint_A_lng != config.waypoint_A_lng ||
+	    c->waypoint_B_lat != config.waypoint_B_lat || c->waypoint_B_lng != config.waypoint_B_lng)
+		route_reload_due = true;
+	config = *c;
+}
+
+/* A file read by a response, closed when the response is destroyed */
+struct file_stream {
+	fs::File file;
+
+	~file_stream()
+	{
+		sd_sched_run(&sd_bus, SD_WEB, [this] {
+			if (file)
+				file.close();
+		});
+	}
+};
+
+/* Per-request state for /export */
+struct export_stream {
+	struct file_stream src;
+	struct track_transcoder tc;
+	struct track_simplify simplify;
+};
+
+/* Type of a file served from the card by its extension */
+const char *content_type(const String &path)
+{
+	int dot = path.lastIndexOf('.');
+
+	if (dot >= 0) {
+		enum track_fmt fmt = track_fmt_from_name(path.c_str() + dot + 1);
+		if (fmt != TRACK_FMT_INVALID)
+			return track_fmt_mime(fmt);
+	}
+	if (path.endsWith(".txt"))
+		return "text/plain";
+	return "application/octet-stream";
+}
+
+/* track_read_fn over an open fs::File */
+size_t file_read(void *ctx, uint8_t *buf, size_t len)
+{
+	fs::File *file = (fs::File *)ctx;
+	return file->read(buf, len);
+}
+
+/* poi_read_at_fn and log_read_at_fn over an open fs::File */
+size_t file_read_at(void *ctx, uint32_t offset, void *buf, size_t len)
+{
+	fs::File *file = (fs::File *)ctx;
+	size_t n = 0;
+
+	sd_sched_run(&sd_bus, SD_LOOP, [&] {
+		if (file->seek(offset))
+			n = file->read((uint8_t *)buf, len);
+	});
+	return n;
+}
+
+/*
+ * JSON of a fix, as sent on /live and by GET /fix. "age" is the time in ms
+ * from the end of the NMEA sentence to now, "ms" the device clock at
+ * sentence end so clients can measure the rest of the path from
+ * successive frames.
+ */
+size_t fix_json(const struct fix_data *f, char *buf, size_t len)
+{
+	int n = snprintf(buf, len,
+			 "{\"t\":\"%s\",\"lat\":%.6f,\"lng\":%.6f,\"sats\":%ld,\"hdop\":%.2f,"
+			 "\"ms\":%lu,\"age\":%lu,\"n\":%lu}",
+			 f->utc, f->lat, f->lng, (long)f->sats, f->hdop,
+			 (unsigned long)f->sentence_ms, millis() - f->sentence_ms,
+			 (unsigned long)f->count);
+	return n < 0 ? 0 : (size_t)n;
+}
+
+/*
+ * Sends the current fix to every /live client. The frame is encoded once
+ * and shared by all connections.
+ */
+void live_push(void)
+{
+	if (!wifi_started || live_events.count() == 0)
+		return;
+
+	struct fix_data f;
+	char frame[192];
+
+	fix_read(&fix_shared, &f);
+	fix_json(&f, frame, sizeof(frame));
+	live_events.send(frame, "fix", ++live_frame_id);
+}
+
+void start_wifi_server(void) 
+{
+	if (wifi_started) return;
+	wifi_started = true;
+
+	WiFi.softAP(config.wifi_ssid, config.wifi_pass);
+	IPAddress IP = WiFi.softAPIP();
+	// Serial.print("AP IP address: ");
+	// Serial.println(IP);
 
 	// Root route
 	server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
+		PROF_SCOPE(PROF_WEB);
 		String html = R"rawliteral(
 			<!DOCTYPE html>
 			<html>
@@ -853,43 +1508,54 @@ void start_wifi_server(void)
 			</head>
 			<body>
 				<h2>GPS BOB</h2>
+				<a class='button' href='/live.html'>Live</a>
 				<a class='button' href='/waypoint'>Waypoint</a>
 				<a class='button' href='/settings'>Settings</a>
+				<a class='button' href='/fences'>Geofences</a>
+				<a class='button' href='/storage'>Storage</a>
+				<form method='POST' action='/trip/reset'>
+					<input type='submit' class='button' value='Reset trip'>
+				</form>
 				<ul>
 		)rawliteral";
 
-		File root = SD.open("/");
-		if (!root) {
+		bool listed = false;
+		sd_sched_run(&sd_bus, SD_WEB, [&] {
+			File root = storage_fs().open("/");
+			if (!root)
+				return;
+			listed = true;
+
+			File file = root.openNextFile();
+			while (file) {
+				String name = file.name();
+				html += "<li><a href='/" + name + "'>" + name + "</a>";
+				if (name.endsWith(".csv")) {
+					html += " <a href='/export?file=/" + name + "&fmt=gpx'>gpx</a>";
+					html += " <a href='/export?file=/" + name + "&fmt=geojson'>geojson</a>";
+					html += " <a href='/export?file=/" + name + "&fmt=kml'>kml</a>";
+					html += " <a href='/export?file=/" + name + "&fmt=gpx&tol=10'>gpx (10 m)</a>";
+				}
+				html += "</li>";
+				file = root.openNextFile();
+			}
+		});
+		if (!listed) {
 			request->send(500, "text/plain", "Failed to open SD root");
 			return;
 		}
-
-		File file = root.openNextFile();
-		while (file) {
-			html += "<li><a href='/" + String(file.name()) + "'>" + String(file.name()) + "</a></li>";
-			file = root.openNextFile();
-		}
 		html += "</ul>";
 		request->send(200, "text/html", html);
 	});
 
 		// Waypoint GET
 	server.on("/waypoint", HTTP_GET, [](AsyncWebServerRequest *request) {
-		File f = SD.open("/config.txt");
-		if (!f) {
-			request->send(500, "text/plain", "Failed to open Waypoint file");
-			return;
-		}
-
-		String WayLatA = "0", WayLngA = "0", WayLatB = "0", WayLngB = "0";
-		while (f.available()) {
-			String line = f.readStringUntil('\n');
-			if (line.startsWith("Latitude_A=")) WayLatA = line.substring(11);
-			if (line.startsWith("Longitude_A=")) WayLngA = line.substring(12);
-            if (line.startsWith("Latitude_B=")) WayLatB = line.substring(11);
-			if (line.startsWith("Longitude_B=")) WayLngB = line.substring(12);
-		}
-		f.close();
+		PROF_SCOPE(PROF_WEB);
+		struct gps_config c = config_copy();
+		String WayLatA = String(c.waypoint_A_lat, 6);
+		String WayLngA = String(c.waypoint_A_lng, 6);
+		String WayLatB = String(c.waypoint_B_lat, 6);
+		String WayLngB = String(c.waypoint_B_lng, 6);
 
 		String html = R"rawliteral(
 			<!DOCTYPE html>
@@ -930,6 +1596,10 @@ void start_wifi_server(void)
 				<h2>Waypoints</h2>
 				<form method='POST' action='/waypoint'>
 		)rawliteral";
+            html += "<h4>Route</h4>";
+			html += "Route file (GPX or CSV): <input name='route' value='" + String(c.route_file) + "'><br>";
+			html += "Arrival radius (m): <input name='arrive' value='" + String(c.arrive_radius) + "'><br>";
+			html += "<p>" + String(route.count) + " waypoints loaded. Without a route file, A and B are used.</p>";
             html += "<h4>Waypoint A</h4>";
 			html += "Latitude: <input name='WayLatA' value='" + WayLatA + "'><br>";
 			html += "Longitude: <input name='WayLngA' value='" + WayLngA + "'><br>";
@@ -946,50 +1616,194 @@ void start_wifi_server(void)
 
 // Config: POST
 	server.on("/waypoint", HTTP_POST, [](AsyncWebServerRequest *request) {
-		String WayLatA  = request->getParam("WayLatA", true)->value();
-		String WayLngA  = request->getParam("WayLngA", true)->value();
-		String WayLatB  = request->getParam("WayLatB", true)->value();
-		String WayLngB  = request->getParam("WayLngB", true)->value();
-		// Serial.println("Writing new waypoint:");
-		// Serial.println("LAT: " + WayLat);
-		// Serial.println("LNG: " + WayLng);
-
-		replace_config_line("/config.txt", "Latitude_A", WayLatA.c_str());
-		replace_config_line("/config.txt", "Longitude_A", WayLngA.c_str());
-        replace_config_line("/config.txt", "Latitude_B", WayLatB.c_str());
-		replace_config_line("/config.txt", "Longitude_B", WayLngB.c_str());
-		// SD.remove("/config.txt");
-		// File f = SD.open("/config.txt", FILE_WRITE);
-
-		// if (!f) {
-		//   request->send(500, "text/plain", "Failed to save waypoint");
-		//   return;
-		// }
-		// f.printf("Latitude=%s\n", WayLat.c_str());
-		// f.printf("Longitude=%s\n", WayLng.c_str());
-		// f.close();
+		PROF_SCOPE(PROF_WEB);
+		const char *fields[][2] = {
+			{ "WayLatA", "Latitude_A" },
+			{ "WayLngA", "Longitude_A" },
+			{ "WayLatB", "Latitude_B" },
+			{ "WayLngB", "Longitude_B" },
+			{ "route", "route" },
+			{ "arrive", "arrive_radius" },
+		};
+		struct gps_config c = config_copy();
+		for (auto &field : fields) {
+			if (request->hasParam(field[0], true))
+				config_set(&c, field[1], request->getParam(field[0], true)->value().c_str());
+		}
+		if (!config_submit(&c)) {
+			request->send(500, "text/plain", "Failed to save waypoint");
+			return;
+		}
 
 		request->redirect("/waypoint");
 	});
 
-	// Settings GET
-	server.on("/settings", HTTP_GET, [](AsyncWebServerRequest *request) {
-		File f = SD.open("/config.txt");
-		if (!f) {
-			request->send(500, "text/plain", "Failed to open Settings file");
-			return;
-		}
+	// Geofences GET: current state and the latest events
+	server.on("/fences", HTTP_GET, [](AsyncWebServerRequest *request) {
+		PROF_SCOPE(PROF_WEB);
+		String html = R"rawliteral(
+			<!DOCTYPE html>
+			<html>
+			<head>
+				<meta name='viewport' content='width=device-width, initial-scale=1'>
+				<style>
+					body { 
+						font-family: sans-serif; 
+						padding: 1em; 
+					}
+					td {
+						padding: 0.2em 0.5em;
+					}
+					.button {
+						display: inline-block;
+						width: 100%;
+						padding: 0.5em;
+						margin: 1em 0 0 0;
+						font-size: 1em;
+						background: #007bff;
+						color: white;
+						border: none;
+						border-radius: 5px;
+						text-align: center;
+						text-decoration: none;
+					}
+				</style>
+			</head>
+			<body>
+				<h2>Geofences</h2>
+		)rawliteral";
+			std::unique_lock<std::mutex> lock(fence_lock);
+			html += "<p>" + String(fences.count) + " fences from " FENCE_PATH "</p>";
+			html += "<h4>Inside</h4><ul>";
+			for (uint16_t i = 0; i < fences.count; i++) {
+				if (fences.fence[i].inside)
+					html += "<li>" + String(fences.fence[i].name) + "</li>";
+			}
+			html += "</ul><h4>Latest events</h4><table>";
+			uint32_t shown = fence_events < FENCE_RECENT ? fence_events : FENCE_RECENT;
+			for (uint32_t i = 0; i < shown; i++) {
+				const struct fence_recent *r = &fence_recent[(fence_events - 1 - i) % FENCE_RECENT];
+				html += "<tr><td>" + String(r->utc) + "</td><td>" + (r->entered ? "enter" : "exit");
+				html += "</td><td>" + String(r->name) + "</td></tr>";
+			}
+			html += "</table>";
+			lock.unlock();
+			html += "<a class='button' href='" FENCE_LOG_PATH "'>Event log</a>";
+			html += "<form method='POST' action='/fences'>";
+			html += "<input type='submit' class='button' value='Reload fences'>";
+			html += "</form>";
+			html += "<a class='button' href='/'>Main Menu</a>";
+			html += "</body></html>";
+
+		request->send(200, "text/html", html);
+	});
+
+	// Storage GET: backend, clock and the last self-test
+	server.on("/storage", HTTP_GET, [](AsyncWebServerRequest *request) {
+		PROF_SCOPE(PROF_WEB);
+		const struct storage_info *info = storage_info();
+		const struct storage_test *t = &storage_test;
+		String html = R"rawliteral(
+			<!DOCTYPE html>
+			<html>
+			<head>
+				<meta name='viewport' content='width=device-width, initial-scale=1'>
+				<style>
+					body { 
+						font-family: sans-serif; 
+						padding: 1em; 
+					}
+					td {
+						padding: 0.2em 0.5em;
+					}
+					.button {
+						display: inline-block;
+						width: 100%;
+						padding: 0.5em;
+						margin: 1em 0 0 0;
+						font-size: 1em;
+						background: #007bff;
+						color: white;
+						border: none;
+						border-radius: 5px;
+						text-align: center;
+						text-decoration: none;
+					}
+				</style>
+			</head>
+			<body>
+				<h2>Storage</h2>
+		)rawliteral";
+			html += "<table>";
+			html += "<tr><td>Bus</td><td>" + String(storage_bus_name()) + "</td></tr>";
+			html += "<tr><td>Clock</td><td>" + String(info->freq_khz / 1000.0, 1) + " MHz";
+			html += info->fallback ? " (configured clock failed)" : "";
+			html += "</td></tr>";
+			html += "<tr><td>Card</td><td>" + String((uint32_t)(info->card_bytes >> 20)) + " MB</td></tr>";
+			html += "</table><h4>Self-test</h4>";
+			if (t->running) {
+				html += "<p>Running...</p>";
+			} else if (!t->done) {
+				html += "<p>Not run yet.</p>";
+			} else if (!t->ok) {
+				html += "<p>Failed.</p>";
+			} else {
+				html += "<table>";
+				html += "<tr><td>Sequential write</td><td>" + String(t->write_kbs, 0) + " KB/s</td></tr>";
+				html += "<tr><td>Random read</td><td>" + String(t->read_iops, 0) + " IOPS, ";
+				html += String(t->read_kbs, 0) + " KB/s</td></tr>";
+				html += "<tr><td>64 B append + flush</td><td>" + String(t->append_per_s, 0) + "/s, ";
+				html += "max " + String(t->append_max_ms, 1) + " ms</td></tr>";
+				html += "</table>";
+			}
+			html += "<form method='POST' action='/storage'>";
+			html += "<input type='submit' class='button' value='Run self-test'>";
+			html += "</form>";
+			html += "<a class='button' href='/'>Main Menu</a>";
+			html += "</body></html>";
 
-		String ssid = "", pass = "", tz = "0", log = "0", live = "0";
-		while (f.available()) {
-			String line = f.readStringUntil('\n');
-			if (line.startsWith("ssid=")) ssid = line.substring(5);
-			if (line.startsWith("password=")) pass = line.substring(9);
-			if (line.startsWith("timezone=")) tz = line.substring(9);
-			if (line.startsWith("log_interval=")) log = line.substring(13);
-			if (line.startsWith("live_interval=")) live = line.substring(14);
+		request->send(200, "text/html", html);
+	});
+
+	// Storage POST: start the self-test on its own task
+	server.on("/storage", HTTP_POST, [](AsyncWebServerRequest *request) {
+		PROF_SCOPE(PROF_WEB);
+		if (!storage_test.running) {
+			storage_test.running = true;
+			xTaskCreate(storage_test_task, "sdtest", 4096, NULL, 1, NULL);
 		}
-		f.close();
+		request->redirect("/storage");
+	});
+
+	// Geofences POST: reload the fence file
+	server.on("/fences", HTTP_POST, [](AsyncWebServerRequest *request) {
+		PROF_SCOPE(PROF_WEB);
+		fences_reload_due = true;
+		request->redirect("/fences");
+	});
+
+	// Trip: POST, zeroes the trip computer
+	server.on("/trip/reset", HTTP_POST, [](AsyncWebServerRequest *request) {
+		PROF_SCOPE(PROF_WEB);
+		trip_reset_due = true;
+		request->redirect("/");
+	});
+
+	// Settings GET
+	server.on("/settings", HTTP_GET, [](AsyncWebServerRequest *request) {
+		PROF_SCOPE(PROF_WEB);
+		struct gps_config c = config_copy();
+		String ssid = c.wifi_ssid;
+		String pass = c.wifi_pass;
+		String tz = String(c.timezone_offset_hours);
+		String log = String(c.log_interval / 1000.0, 1);
+		String live = String(c.live_interval / 1000.0, 1);
+		const char *consumers[][2] = {
+			{ "filter_display", "Display position" },
+			{ "filter_log", "Logged position" },
+			{ "filter_nav", "Navigation position" },
+		};
+		bool filtered[] = { c.filter_display, c.filter_log, c.filter_nav };
 
 		String html = R"rawliteral(
 				 <!DOCTYPE html>
@@ -1035,7 +1849,31 @@ void start_wifi_server(void)
 			html += "Password: <input name='password' value='" + pass + "'><br>";
 			html += "Timezone Offset: <input name='tz' value='" + tz + "'><br>";
 			html += "Log Interval (seconds): <input name='log' value='" + log + "'><br>";
+			html += "Log Distance (m, 0 = use interval): <input name='log_distance' value='" + String(c.log_distance) + "'><br>";
+			html += "Log Turn (degrees): <input name='log_heading' value='" + String(c.log_heading) + "'><br>";
+			html += "Log Max Gap (seconds): <input name='log_max_gap' value='" + String(c.log_max_gap / 1000) + "'><br>";
 			html += "Live Update (seconds): <input name='live' value='" + live + "'><br>";
+			html += "GPS Baud (next boot): <input name='gps_baud' value='" + String(c.gps_baud) + "'><br>";
+			html += "SD SPI MHz (next boot): <input name='sd_mhz' value='" + String(c.sd_mhz) + "'><br>";
+			html += "SD over SDMMC (next boot, 0/1): <input name='sd_mmc' value='" + String(c.sd_mmc) + "'><br>";
+			html += "<h4>Fix gate</h4>";
+			html += "Min satellites: <input name='gate_sats' value='" + String(c.gate_sats) + "'><br>";
+			html += "Max HDOP: <input name='gate_hdop' value='" + String(c.gate_hdop, 1) + "'><br>";
+			html += "Max fix age (seconds): <input name='gate_age' value='" + String(c.gate_age / 1000.0, 1) + "'><br>";
+			html += "Require GPS/DGPS/RTK fix (0/1): <input name='gate_fixq' value='" + String(c.gate_fixq) + "'><br>";
+			html += "Max speed between fixes (km/h, 0 = off): <input name='gate_kmh' value='" + String(c.gate_kmh) + "'><br>";
+			html += "<p>";
+			for (int v = 0; v < FIX_VERDICTS; v++) {
+				html += String(v ? ", " : "") + fix_verdict_name((enum fix_verdict)v) + " ";
+				html += String(fix_gate.count[v]);
+			}
+			html += "</p>";
+			for (int i = 0; i < 3; i++) {
+				html += String(consumers[i][1]) + ": <select name='" + consumers[i][0] + "'>";
+				html += String("<option value='0'") + (filtered[i] ? "" : " selected") + ">Raw</option>";
+				html += String("<option value='1'") + (filtered[i] ? " selected" : "") + ">Filtered</option>";
+				html += "</select><br>";
+			}
 			html += "<input type='submit' class='button' value='Save'>";
 			html += "</form>";
 			html += "<a class='button' href='/'>Main Menu</a>";
@@ -1046,95 +1884,350 @@ void start_wifi_server(void)
 
 // Config: POST
 	server.on("/settings", HTTP_POST, [](AsyncWebServerRequest *request) {
-		String ssid    = request->getParam("ssid", true)->value();
-		String pass    = request->getParam("password", true)->value();
-		String tz      = request->getParam("tz", true)->value();
-		String log     = request->getParam("log", true)->value();
-		String live    = request->getParam("live", true)->value();
-
-		// Serial.println("Writing new config:");
-		// Serial.println("SSID: " + ssid);
-		// Serial.println("PASS: " + pass);
-		// Serial.println("TZ: " + tz);
-		// Serial.println("LOG: " + log);
-		// Serial.println("LIVE: " + live);
-		// Serial.println("LAT: " + WayLat);
-		// Serial.println("LNG: " + WayLng);
-
-        replace_config_line("/config.txt", "ssid",  ssid.c_str());
-		replace_config_line("/config.txt", "password", pass.c_str());
-        replace_config_line("/config.txt", "timezone", tz.c_str());
-        replace_config_line("/config.txt", "log_interval", log.c_str());
-		replace_config_line("/config.txt", "live_interval", live.c_str());
+		PROF_SCOPE(PROF_WEB);
+		const char *fields[][2] = {
+			{ "ssid", "ssid" },
+			{ "password", "password" },
+			{ "tz", "timezone" },
+			{ "log", "log_interval" },
+			{ "log_distance", "log_distance" },
+			{ "log_heading", "log_heading" },
+			{ "log_max_gap", "log_max_gap" },
+			{ "live", "live_interval" },
+			{ "gps_baud", "gps_baud" },
+			{ "sd_mhz", "sd_mhz" },
+			{ "sd_mmc", "sd_mmc" },
+			{ "gate_sats", "gate_sats" },
+			{ "gate_hdop", "gate_hdop" },
+			{ "gate_age", "gate_age" },
+			{ "gate_fixq", "gate_fixq" },
+			{ "gate_kmh", "gate_kmh" },
+			{ "filter_display", "filter_display" },
+			{ "filter_log", "filter_log" },
+			{ "filter_nav", "filter_nav" },
+		};
+		struct gps_config c = config_copy();
+		for (auto &field : fields) {
+			if (request->hasParam(field[0], true))
+				config_set(&c, field[1], request->getParam(field[0], true)->value().c_str());
+		}
+		if (!config_submit(&c)) {
+			request->send(500, "text/plain", "Failed to save settings");
+			return;
+		}
 
 		request->redirect("/settings");
 	});
 
-	// Serve all static files from SD
-	server.serveStatic("/", SD, "/");
+	// Export: GET, converts a CSV log while streaming it out, tol (metres)
+	// optionally thins the track in the same pass
+	server.on("/export", HTTP_GET, [](AsyncWebServerRequest *request) {
+		PROF_SCOPE(PROF_WEB);
+		if (!request->hasParam("file")) {
+			request->send(400, "text/plain", "Missing file parameter");
+			return;
+		}
+		String fname = request->getParam("file")->value();
+		if (!fname.startsWith("/")) fname = "/" + fname;
+		if (fname.indexOf("..") >= 0 || !fname.endsWith(".csv")) {
+			request->send(400, "text/plain", "Only CSV logs can be exported");
+			return;
+		}
+
+		String fmt_name = request->hasParam("fmt") ? request->getParam("fmt")->value() : "csv";
+		enum track_fmt fmt = track_fmt_from_name(fmt_name.c_str());
+		if (fmt == TRACK_FMT_INVALID) {
+			request->send(400, "text/plain", "fmt must be gpx, geojson, kml or csv");
+			return;
+		}
 
-	// 404 handler
+		std::shared_ptr<export_stream> stream = std::make_shared<export_stream>();
+		sd_sched_run(&sd_bus, SD_WEB, [&] {
+			log_share(fname);
+			stream->src.file = storage_fs().open(fname, FILE_READ);
+		});
+		if (!stream->src.file) {
+			request->send(404, "text/plain", "File not found: " + fname);
+			return;
+		}
+		track_transcoder_init(&stream->tc, fmt, file_read, &stream->src.file);
+
+		float tol = request->hasParam("tol") ? request->getParam("tol")->value().toFloat() : 0.0;
+		if (tol > 0) {
+			track_simplify_init(&stream->simplify, tol);
+			track_transcoder_simplify(&stream->tc, &stream->simplify);
+		}
+
+		AsyncWebServerResponse *response = request->beginChunkedResponse(track_fmt_mime(fmt),
+			[stream](uint8_t *buffer, size_t max_len, size_t index) -> size_t {
+				PROF_SCOPE(PROF_WEB);
+				size_t n = 0;
+				if (max_len > SD_WEB_SLICE)
+					max_len = SD_WEB_SLICE;
+				sd_sched_run(&sd_bus, SD_WEB, [&] {
+					n = track_transcode(&stream->tc, buffer, max_len);
+				});
+				return n;
+			});
+		String out_name = fname.substring(1, fname.length() - 4) + "." + track_fmt_ext(fmt);
+		response->addHeader("Content-Disposition", "attachment; filename=\"" + out_name + "\"");
+		request->send(response);
+	});
+
+	// Fix: GET, latest fix as JSON. Reads the snapshot, never loop() state
+	server.on("/fix", HTTP_GET, [](AsyncWebServerRequest *request) {
+		PROF_SCOPE(PROF_WEB);
+		struct fix_data f;
+		char json[192];
+
+		if (!fix_read(&fix_shared, &f)) {
+			request->send(503, "text/plain", "No fix yet");
+			return;
+		}
+		fix_json(&f, json, sizeof(json));
+		request->send(200, "application/json", json);
+	});
+
+	// SD: GET, card access latency per class, see sd_sched.h
+	server.on("/sd", HTTP_GET, [](AsyncWebServerRequest *request) {
+		PROF_SCOPE(PROF_WEB);
+		char text[320];
+
+		sd_sched_report(&sd_bus, text, sizeof(text));
+		request->send(200, "text/plain", text);
+	});
+
+	// Live: GET, page following the /live event stream
+	server.on("/live.html", HTTP_GET, [](AsyncWebServerRequest *request) {
+		PROF_SCOPE(PROF_WEB);
+		String html = R"rawliteral(
+			<!DOCTYPE html>
+			<html>
+			<head>
+				<meta name='viewport' content='width=device-width, initial-scale=1'>
+				<style>
+					body { 
+						font-family: sans-serif; 
+						padding: 1em; 
+					}
+					.button {
+						display: inline-block;
+						width: 100%;
+						padding: 0.5em;
+						margin: 1em 0 0 0;
+						font-size: 1em;
+						background: #007bff;
+						color: white;
+						border: none;
+						border-radius: 5px;
+						text-align: center;
+						text-decoration: none;
+					}
+				</style>
+			</head>
+			<body>
+				<h2>Live</h2>
+				<pre id='fix'>Waiting for fix...</pre>
+				<a class='button' href='/'>Main Menu</a>
+				<script>
+					var last = null;
+					function show(f) {
+						document.getElementById('fix').textContent =
+							f.t + '\n' +
+							'Lat  ' + f.lat.toFixed(6) + '\n' +
+							'Lon  ' + f.lng.toFixed(6) + '\n' +
+							'Sats ' + f.sats + '  HDOP ' + f.hdop + '\n' +
+							'Device latency ' + f.age + ' ms\n' +
+							'Jitter vs device ' + (last ? last.gap.toFixed(0) : 0) + ' ms';
+					}
+					fetch('/fix').then(function(r) {
+						if (r.ok && !last)
+							r.json().then(function(f) { if (!last) show(f); });
+					});
+					var src = new EventSource('/live');
+					src.addEventListener('fix', function(e) {
+						var f = JSON.parse(e.data);
+						var now = performance.now();
+						var gap = last ? (now - last.rx) - (f.ms - last.ms) : 0;
+						last = { rx: now, ms: f.ms, gap: gap };
+						show(f);
+					});
+				</script>
+			</body>
+			</html>
+		)rawliteral";
+		request->send(200, "text/html", html);
+	});
+
+	server.addHandler(&live_events);
+
+#if GPSBOB_PROFILE
+	// Metrics: GET, profiling counters in Prometheus text format
+	server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+		struct prof_mem mem;
+		std::unique_ptr<char[]> text(new char[PROF_TEXT_MAX]);
+
+		prof_mem_read(&mem);
+		prof_prometheus(text.get(), PROF_TEXT_MAX, &mem);
+		request->send(200, "text/plain; version=0.0.4", text.get());
+	});
+#endif
+
+	// Files: GET /<name> from the card, one slice per job, else 404
 	server.onNotFound([](AsyncWebServerRequest *request) {
-		request->send(404, "text/plain", "Not found");
+		PROF_SCOPE(PROF_WEB);
+		String path = request->url();
+		size_t size = 0;
+
+		if (request->method() != HTTP_GET) {
+			request->send(404, "text/plain", "Not found");
+			return;
+		}
+		std::shared_ptr<file_stream> stream = std::make_shared<file_stream>();
+		sd_sched_run(&sd_bus, SD_WEB, [&] {
+			uint32_t open_size = log_share(path);
+			stream->file = storage_fs().open(path, FILE_READ);
+			if (stream->file && !stream->file.isDirectory())
+				size = open_size ? open_size : stream->file.size();
+		});
+		if (!stream->file || stream->file.isDirectory()) {
+			request->send(404, "text/plain", "File not found: " + path);
+			return;
+		}
+		AsyncWebServerResponse *response = request->beginResponse(content_type(path), size,
+			[stream](uint8_t *buffer, size_t max_len, size_t index) -> size_t {
+				size_t n = 0;
+				if (max_len > SD_WEB_SLICE)
+					max_len = SD_WEB_SLICE;
+				sd_sched_run(&sd_bus, SD_WEB, [&] {
+					n = stream->file.read(buffer, max_len);
+				});
+				return n;
+			});
+		request->send(response);
 	});
 
 	server.begin();
 
 	display.print("\nSSID:");
-	display.println(wifi_ssid);
+	display.println(config.wifi_ssid);
 	display.print("Password:");
-	display.println(wifi_pass);
+	display.println(config.wifi_pass);
 	display.print("Addr: ");
 	display.println(IP);
 	display.print("\nWIFI Enabled");
-	display.display();
+	display_flush();
 }
 
 void stop_wifi_server(void) 
 {
 	if (!wifi_started) return;
+	live_events.close();
+	server.removeHandler(&live_events);
 	WiFi.softAPdisconnect(true);
 	server.end();
 	wifi_started = false;
 }
 
 // === Button Handling ===
-void handle_button(void) 
+/*
+ * The button is read from interrupts, not polled by loop(): the first edge
+ * of a bounce is timestamped here and arms a one-shot timer that samples
+ * the settled level debounce_ms later. Both timers dispatch from the
+ * esp_timer task, so button_sample() has a single caller, and loop() only
+ * takes finished gestures off the queue. A press made while loop() is
+ * stuck in an SD flush or a display transfer is therefore neither missed
+ * nor mismeasured, it just waits to be acted on.
+ */
+void button_begin(void)
 {
-	static unsigned long lastChange = 0;
-	bool pressed = digitalRead(BUTTON_PIN) == LOW;
+	const esp_timer_create_args_t settle = {
+		.callback = button_settled,
+		.arg = NULL,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "button",
+		.skip_unhandled_events = false,
+	};
+	const esp_timer_create_args_t gesture = {
+		.callback = button_timeout,
+		.arg = NULL,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "gesture",
+		.skip_unhandled_events = false,
+	};
+
+	button_init(&button, double_press_ms, long_press_ms);
+	esp_timer_create(&settle, &button_settle_timer);
+	esp_timer_create(&gesture, &button_gesture_timer);
+	attachInterrupt(board::button, button_isr, CHANGE);
+}
 
-	if (pressed && !button_was_pressed && millis() - lastChange > debounce_ms) {
-		button_press_time = millis();
-		button_was_pressed = true;
-		lastChange = millis();
-	}
+void IRAM_ATTR button_isr(void)
+{
+	if (button_armed)
+		return; /* Bouncing, the timer samples once it has settled */
+	button_armed = true;
+	button_edge_us = micros();
+	esp_timer_start_once(button_settle_timer, debounce_ms * 1000);
+}
+
+void button_wait(uint32_t us)
+{
+	esp_timer_stop(button_gesture_timer);
+	if (us)
+		esp_timer_start_once(button_gesture_timer, us);
+}
 
-	if (!pressed && button_was_pressed) {
-		button_was_pressed = false;
-		unsigned long pressDuration = millis() - button_press_time;
+void button_settled(void *arg)
+{
+	uint32_t edge_us = button_edge_us;
 
-		if (pressDuration > long_press_ms) {
+	button_armed = false; /* Before reading, so a later edge samples again */
+	bool pressed = digitalRead(board::button) == LOW;
+	button_wait(button_sample(&button, pressed, edge_us, micros()));
+}
+
+void button_timeout(void *arg)
+{
+	uint32_t now = micros();
+
+	button_wait(button_sample(&button, button.down, now, now));
+}
+
+/* Short press cycles the mode, double press drops a mark, long press sleeps */
+void handle_button(void) 
+{
+	struct button_event ev;
+
+	while (button_get(&button, &ev)) {
+		if (ev.gesture == BUTTON_LONG) {
 			// Long press → toggle sleep
 			sleep_enabled = !sleep_enabled;
 			// Serial.println(sleep_enabled ? "Entering Deep Sleep" : "Waking up");
-			if (sleep_enabled) {
-				display_text("Sleep Mode\nEntering Sleep...\nPress Button to Wake up", 1, true, true);
-				gpsSerial.end();
-				stop_wifi_server();
-				delay(3000);
-				display_text("", 1, true, true);
-				esp_deep_sleep_start();
-			}
+			if (sleep_enabled)
+				enter_sleep("Sleep Mode\nEntering Sleep...\nPress Button to Wake up");
+		} else if (ev.gesture == BUTTON_DOUBLE) {
+			mark_drop();
+#if GPSBOB_PROFILE
+		} else if (current_mode == INFO_MODE && ev.held_ms > profile_press_ms) {
+			profile_page = !profile_page;
+			if (profile_page)
+				display_profile();
+			else
+				display_info();
+#endif
 		} else {
 			// Short press → cycle mode
-            last_mode = current_mode;
-			current_mode = (Mode)((current_mode + 1) % 5);
+#if GPSBOB_PROFILE
+			profile_page = false;
+#endif
+			if (current_mode == RAW_MODE)
+				raw_stop();
+			current_mode = (Mode)((current_mode + 1) % (RAW_MODE + 1));
 			switch (current_mode) {
 			case INFO_MODE:
 				stop_wifi_server();
 				battery_update();
-				load_config();
 				display_info();
 				// Serial.println("Switch to INFO");
 				break;
@@ -1153,17 +2246,16 @@ void handle_button(void)
 				first_load = true;
 				break;
 
-			case NAV_MODE_A:		
+			case NAV_MODE:		
 				stop_wifi_server();
 				battery_update();
-				// Serial.println("Switch to NAV A");
+				// Serial.println("Switch to NAV");
 				first_load = true;
 				break;
 
-            case NAV_MODE_B:		
+			case TRIP_MODE:
 				stop_wifi_server();
 				battery_update();
-				// Serial.println("Switch to NAV B");
 				first_load = true;
 				break;
 			
@@ -1174,24 +2266,323 @@ void handle_button(void)
 				start_wifi_server();
 				// Serial.println("Switch to WIFI");
 				break;
+
+			case RAW_MODE:
+				stop_wifi_server();
+				raw_mode_ms = millis();
+				raw_error = NULL;
+				display_raw_data();
+				break;
 			}
 			update_display = true;
 		}
 	}
 }
 
+/*
+ * Appends the last accepted fix to MARK_PATH and says so on the bottom
+ * line, over whatever the current mode shows until it redraws.
+ */
+void mark_drop(void)
+{
+	struct fix_data f;
+	bool have_fix = fix_read(&fix_shared, &f);
+	bool saved = false;
+
+	if (have_fix) {
+		PROF_SCOPE(PROF_SD);
+		sd_sched_run(&sd_bus, SD_LOG, [&] {
+			bool new_file = !storage_fs().exists(MARK_PATH);
+			fs::File file = storage_fs().open(MARK_PATH, FILE_APPEND);
+
+			if (!file)
+				return;
+			if (new_file)
+				file.println(MARK_HEADER);
+			file.printf("%s,%.6f,%.6f,%s\n", f.utc, f.lat, f.lng,
+				    mode_to_string(current_mode));
+			file.close();
+			saved = true;
+		});
+	}
+
+	display.fillRect(0, SCREEN_HEIGHT - 8, SCREEN_WIDTH, 8, BLACK);
+	display.setCursor(0, SCREEN_HEIGHT - 8);
+	display.setTextSize(1);
+	if (saved)
+		display.printf("Mark %u saved", ++mark_count);
+	else
+		display.print(have_fix ? "Mark not saved" : "No fix to mark");
+	display_flush();
+}
+
+void enter_sleep(const char *message)
+{
+	raw_stop();
+	close_log_files();
+	display_text(message, 1, true, true);
+	gpsSerial.end();
+	stop_wifi_server();
+	if (battery_timer)
+		esp_timer_stop(battery_timer);
+	delay(3000);
+	display_text("", 1, true, true);
+	esp_deep_sleep_start();
+}
+
+// === Raw capture ===
+/* Opens a capture file; called once RAW_MODE has been kept for RAW_ARM_MS */
+void raw_start(void)
+{
+	size_t bytes = sizeof(struct raw_capture);
+
+	raw_path = "/raw_" + String(boot_count) + "_" + String(raw_session++) + ".raw";
+	raw = (struct raw_capture *)(psramFound() ? ps_malloc(bytes) : malloc(bytes));
+	if (!raw) {
+		raw_error = "Out of memory";
+		return;
+	}
+	raw_capture_init(raw);
+	raw_overruns_seen = gps_overruns;
+	sd_sched_run(&sd_bus, SD_LOG, [] { raw_file = storage_fs().open(raw_path, FILE_APPEND); });
+	if (!raw_file) {
+		/* Nothing to capture into, so do not pretend to */
+		raw_error = "Cannot open file";
+		free(raw);
+		raw = NULL;
+	}
+}
+
+/* Writes what is left and closes the file */
+void raw_stop(void)
+{
+	if (!raw)
+		return;
+	do {
+		raw_flush(true);
+		if (raw_busy)
+			delay(1);
+	} while (raw_busy);
+	sd_sched_run(&sd_bus, SD_LOG, [] {
+		if (raw_file)
+			raw_file.close();
+	});
+	free(raw);
+	raw = NULL;
+}
+
+/*
+ * RAW_MODE: whatever the UART holds goes into the capture block in one
+ * read. The bytes are also run through the parser so that the page can
+ * show the receiver state and the trip keeps counting.
+ */
+void raw_run(void)
+{
+	size_t room;
+	uint8_t *buf = raw_capture_buf(raw, &room);
+	int avail = gpsSerial.available();
+
+	if (buf && avail > 0) {
+		PROF_SCOPE(PROF_GPS);
+		size_t n = gpsSerial.read(buf, (size_t)avail < room ? (size_t)avail : room);
+
+		for (size_t i = 0; i < n; i++) {
+			if (gps.encode(buf[i]))
+				last_sentence_ms = millis();
+		}
+		raw_capture_put(raw, n, millis());
+		/* Only a completed GGA/RMC pair that passes the gate, as in loop() */
+		if (gps.speed.isUpdated() && gps.satellites.isUpdated() && fix_accept())
+			fix_feed();
+	}
+
+	uint32_t overruns = gps_overruns;
+	if (overruns != raw_overruns_seen) {
+		raw_capture_overrun(raw, overruns - raw_overruns_seen);
+		raw_overruns_seen = overruns;
+	}
+	raw_flush(false);
+}
+
+/* Runs on the SD task */
+void raw_write_block(void *ctx)
+{
+	PROF_SCOPE(PROF_SD);
+	if (raw_file) {
+		raw_file.write(raw_block, raw_block_len);
+		raw_file.flush();
+	}
+}
+
+/*
+ * Hands the next due block to the SD task without waiting for it, so the
+ * other block keeps filling while the card is busy.
+ */
+void raw_flush(bool force)
+{
+	if (raw_busy) {
+		if (!sd_sched_done(&sd_bus, &raw_job))
+			return;
+		raw_capture_written(raw);
+		raw_busy = false;
+	}
+
+	raw_block = raw_capture_take(raw, millis(), force, &raw_block_len);
+	if (!raw_block)
+		return;
+	raw_job.fn = raw_write_block;
+	raw_job.ctx = NULL;
+	raw_job.cls = SD_LOG;
+	raw_busy = true;
+	sd_sched_submit(&sd_bus, &raw_job);
+}
+
+void display_raw_data(void)
+{
+	PROF_SCOPE(PROF_RENDER);
+	char buffer[24];
+
+	display.clearDisplay();
+	display.setCursor(0, 0);
+	display.setTextSize(1);
+	display.setTextColor(WHITE);
+	battery_display();
+	if (raw_error) {
+		display.println("RAW - Error");
+		display.println(raw_error);
+		display.println(raw_path);
+		display_flush();
+		return;
+	}
+	if (!raw) {
+		display.println("RAW - Starting...");
+		display.println("Press to skip");
+		display_flush();
+		return;
+	}
+	display.println("RAW Capture");
+	display.println(raw_path);
+	sprintf(buffer, "%lu kB %lu blk", (unsigned long)(raw->bytes / 1024),
+		(unsigned long)raw->blocks);
+	display.println(buffer);
+	sprintf(buffer, "Overruns %lu", (unsigned long)raw->overruns_total);
+	display.println(buffer);
+	sprintf(buffer, "%d baud Sats %lu", config.gps_baud, (unsigned long)gps.satellites.value());
+	display.println(buffer);
+	display_flush();
+}
+
 // === GPS Utilities===
+/*
+ * The RX buffer is sized for RAW_MODE at high rates; it has to be set
+ * before begin().
+ */
+void gps_begin(void)
+{
+	gpsSerial.setRxBufferSize(GPS_RX_BUFFER);
+	gpsSerial.begin(config.gps_baud, SERIAL_8N1, board::gps_rx, board::gps_tx);
+	gpsSerial.onReceiveError([](hardwareSerial_error_t err) {
+		if (err == UART_BUFFER_FULL_ERROR || err == UART_FIFO_OVF_ERROR)
+			gps_overruns++;
+	});
+}
+
 void update_gps_data(void)
 {
     TinyGPSDate date = gps.date;
     TinyGPSTime time = gps.time;
     today = gps_date_stamp(date);
     last_utc = to_iso8601(date, time);
-	last_timestamp = to_iso8601_local(date, time, timezone_offset_hours);
+	last_timestamp = to_iso8601_local(date, time, config.timezone_offset_hours);
 	last_lat = gps.location.lat();
 	last_lng = gps.location.lng();
+	if (kf.valid) {
+		kalman_position(&kf, &kf_lat, &kf_lng);
+	} else {
+		kf_lat = last_lat;
+		kf_lng = last_lng;
+	}
 	last_sats = gps.satellites.value();
 	last_hdop = gps.hdop.hdop();
+	last_moving = gps.course.isValid() && gps.speed.kmph() >= TRIP_START_KMH;
+	if (last_moving)
+		last_course = gps.course.deg();
+
+	struct fix_data f;
+	static uint32_t published;
+
+	snprintf(f.utc, sizeof(f.utc), "%s", last_utc.c_str());
+	snprintf(f.local, sizeof(f.local), "%s", last_timestamp.c_str());
+	f.lat = last_lat;
+	f.lng = last_lng;
+	f.kf_lat = kf_lat;
+	f.kf_lng = kf_lng;
+	f.hdop = last_hdop;
+	f.sats = last_sats;
+	f.sentence_ms = last_sentence_ms;
+	f.count = ++published;
+	fix_publish(&fix_shared, &f);
+}
+
+/*
+ * Runs the quality gate on a fix the receiver just completed. Reading the
+ * values clears TinyGPSPlus' updated flags, so each fix is judged once
+ * and a rejected one is not seen again by gps_fix_check().
+ */
+bool fix_accept(void)
+{
+	struct fix_gate_limits lim;
+	struct fix_sample s;
+
+	lim.min_sats = config.gate_sats;
+	lim.max_hdop = config.gate_hdop;
+	lim.max_age_ms = config.gate_age;
+	lim.check_quality = config.gate_fixq;
+	lim.max_kmh = config.gate_kmh;
+
+	s.has_fix = gps.location.isUpdated() && gps.location.isValid();
+	s.lat = gps.location.lat();
+	s.lng = gps.location.lng();
+	s.quality = gps.location.FixQuality() - '0';
+	s.sats = gps.satellites.value();
+	s.hdop = gps.hdop.isValid() ? gps.hdop.hdop() : 0;
+	s.age_ms = gps.location.age();
+	s.ms = millis();
+	/* Only to clear speed's updated flag, which gps_fix_check() also waits for */
+	(void)gps.speed.kmph();
+	return fix_gate_check(&fix_gate, &lim, &s) == FIX_ACCEPTED;
+}
+
+/*
+ * Feeds every accepted position to the filter and the trip computer,
+ * independently of how often the current mode refreshes the display or
+ * the log.
+ */
+void fix_feed(void)
+{
+	struct trip_fix f;
+
+	f.lat = gps.location.lat();
+	f.lng = gps.location.lng();
+	f.alt_valid = gps.altitude.isValid();
+	f.alt_m = gps.altitude.meters();
+	f.speed_kmh = gps.speed.kmph();
+	f.hdop = gps.hdop.hdop();
+	f.ms = millis();
+	kalman_update(&kf, f.lat, f.lng, f.hdop, f.ms);
+	trip_update(&trip, &f);
+
+	double lat = f.lat, lng = f.lng;
+	if (config.filter_nav)
+		kalman_position(&kf, &lat, &lng);
+	fence_check(lat, lng);
+}
+
+/* Position of the last update_gps_data(), raw or filtered per consumer */
+void fix_position(bool filtered, double *lat, double *lng)
+{
+	*lat = filtered ? kf_lat : last_lat;
+	*lng = filtered ? kf_lng : last_lng;
 }
 
 void gps_fix_test(void) 
@@ -1221,7 +2612,7 @@ void gps_fix_test(void)
 				TinyGPSDate date = gps.date;
 				TinyGPSTime time = gps.time;
 
-				String isoTime_local = to_iso8601_local(date, time, timezone_offset_hours);
+				String isoTime_local = to_iso8601_local(date, time, config.timezone_offset_hours);
 				
 				display.println(isoTime_local);
 				display.print("Lat:  ");
@@ -1230,7 +2621,7 @@ void gps_fix_test(void)
 				display.println(gps.location.lng(), 5);
 				display.print("Sats: ");
 				display.println(gps.satellites.value());
-				display.display();
+				display_flush();
 				fix_state++;
 				return;
 			}
@@ -1240,8 +2631,10 @@ void gps_fix_test(void)
 
 int gps_fix_check(void) 
 {
+	PROF_SCOPE(PROF_GPS);
 	if (gpsSerial.available() > 0) {
-    gps.encode(gpsSerial.read());
+    if (gps.encode(gpsSerial.read()))
+        last_sentence_ms = millis();
     if (gps.speed.isUpdated() && gps.satellites.isUpdated()) return 1; //ensures that GGA and RMC sentences have been received
     return 3; // GPS data is available but not updated
   }
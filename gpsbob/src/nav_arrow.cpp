@@ -0,0 +1,50 @@
+/*
+ * Heading arrow for the NAV screen, see nav_arrow.h
+ */
+
+#include "nav_arrow.h"
+
+#include <math.h>
+#include <stddef.h>
+
+#include "nav_arrows_data.h" /* Generated, see scripts/nav_arrows.py */
+
+static_assert(NAV_ARROW_GEN_SIZE == NAV_ARROW_SIZE && NAV_ARROW_GEN_DIRS == NAV_ARROW_DIRS,
+	      "nav_arrows.py and nav_arrow.h disagree");
+static_assert(NAV_ARROW_SIZE % 8 == 0, "sprites are whole pages");
+
+int nav_arrow_index(float deg)
+{
+	int i = (int)lroundf(deg * (NAV_ARROW_DIRS / 360.0f));
+
+	i %= NAV_ARROW_DIRS;
+	return i < 0 ? i + NAV_ARROW_DIRS : i;
+}
+
+const uint8_t *nav_arrow_sprite(int index)
+{
+	return nav_arrow_sprites[index];
+}
+
+void nav_arrow_draw(uint8_t *buf, int width, int height, int x, int y, float deg)
+{
+	const uint8_t *src = nav_arrow_sprites[nav_arrow_index(deg)];
+	int shift = y & 7;
+	int page = y >> 3; /* Floor, also for negative y */
+	int pages = height / 8;
+	int x0 = x < 0 ? -x : 0;
+	int x1 = x + NAV_ARROW_SIZE > width ? width - x : NAV_ARROW_SIZE;
+
+	for (int p = 0; p < NAV_ARROW_SIZE / 8; p++, page++, src += NAV_ARROW_SIZE) {
+		uint8_t *top = page >= 0 && page < pages ? buf + page * width : NULL;
+		uint8_t *bottom = shift && page + 1 >= 0 && page + 1 < pages ?
+				  buf + (page + 1) * width : NULL;
+
+		if (top)
+			for (int c = x0; c < x1; c++)
+				top[x + c] |= (uint8_t)(src[c] << shift);
+		if (bottom)
+			for (int c = x0; c < x1; c++)
+				bottom[x + c] |= (uint8_t)(src[c] >> (8 - shift));
+	}
+}
@@ -0,0 +1,274 @@
+/*
+ * On-card spatial index for points of interest, see poi_index.h
+ */
+
+#include "poi_index.h"
+#include "geo.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEG_TO_RAD 0.017453292519943295
+#define POI_START_RADIUS_M 500.0f
+
+// === Keys ===
+static uint32_t spread16(uint32_t v)
+{
+	v &= 0xffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+static uint32_t q_lat(double lat)
+{
+	double q = (lat + 90.0) / 180.0 * 65536.0;
+	return q < 0 ? 0 : q > 65535 ? 65535 : (uint32_t)q;
+}
+
+static uint32_t q_lng(double lng)
+{
+	double q = (lng + 180.0) / 360.0 * 65536.0;
+	return q < 0 ? 0 : q > 65535 ? 65535 : (uint32_t)q;
+}
+
+static uint32_t morton(uint32_t qlat, uint32_t qlng)
+{
+	return spread16(qlng) | (spread16(qlat) << 1);
+}
+
+uint32_t poi_key(double lat, double lng)
+{
+	return morton(q_lat(lat), q_lng(lng));
+}
+
+// === Building ===
+bool poi_parse_csv(const char *line, size_t len, struct poi_record *rec)
+{
+	char buf[96];
+	char *end;
+
+	if (len == 0 || len >= sizeof(buf))
+		return false;
+	memcpy(buf, line, len);
+	buf[len] = '\0';
+
+	double lat = strtod(buf, &end);
+	if (end == buf || *end != ',' || lat < -90 || lat > 90)
+		return false;
+	char *p = end + 1;
+	double lng = strtod(p, &end);
+	if (end == p || lng < -180 || lng > 180)
+		return false;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->lat_e7 = (int32_t)lround(lat * 1e7);
+	rec->lng_e7 = (int32_t)lround(lng * 1e7);
+	rec->key = poi_key(lat, lng);
+	if (*end == ',') {
+		p = end + 1;
+		size_t n = strcspn(p, "\r\n");
+		if (n > POI_NAME_MAX)
+			n = POI_NAME_MAX;
+		memcpy(rec->name, p, n);
+	}
+	return true;
+}
+
+static int cmp_key(const void *a, const void *b)
+{
+	uint32_t ka = ((const struct poi_record *)a)->key;
+	uint32_t kb = ((const struct poi_record *)b)->key;
+	return ka < kb ? -1 : ka > kb;
+}
+
+void poi_sort(struct poi_record *recs, uint32_t count)
+{
+	qsort(recs, count, sizeof(*recs), cmp_key);
+}
+
+/* Writes header, block key table and records; recs must already be sorted */
+bool poi_write(const struct poi_record *recs, uint32_t count, uint32_t src_mtime,
+	       uint32_t src_size, poi_write_fn write, void *ctx)
+{
+	struct poi_header hdr;
+
+	memcpy(hdr.magic, POI_MAGIC, 4);
+	hdr.version = POI_VERSION;
+	hdr.rec_size = sizeof(struct poi_record);
+	hdr.count = count;
+	hdr.blocks = (count + POI_BLOCK_RECS - 1) / POI_BLOCK_RECS;
+	hdr.src_mtime = src_mtime;
+	hdr.src_size = src_size;
+	if (write(ctx, &hdr, sizeof(hdr)) != sizeof(hdr))
+		return false;
+
+	for (uint32_t b = 0; b < hdr.blocks; b++) {
+		uint32_t key = recs[b * POI_BLOCK_RECS].key;
+		if (write(ctx, &key, sizeof(key)) != sizeof(key))
+			return false;
+	}
+	for (uint32_t i = 0; i < count; i += POI_BLOCK_RECS) {
+		size_t n = count - i < POI_BLOCK_RECS ? count - i : POI_BLOCK_RECS;
+		if (write(ctx, &recs[i], n * sizeof(*recs)) != n * sizeof(*recs))
+			return false;
+	}
+	return true;
+}
+
+// === Querying ===
+bool poi_open(struct poi_index *idx, poi_read_at_fn read_at, void *ctx)
+{
+	memset(idx, 0, sizeof(*idx));
+	idx->read_at = read_at;
+	idx->ctx = ctx;
+
+	if (read_at(ctx, 0, &idx->hdr, sizeof(idx->hdr)) != sizeof(idx->hdr) ||
+	    memcmp(idx->hdr.magic, POI_MAGIC, 4) || idx->hdr.version != POI_VERSION ||
+	    idx->hdr.rec_size != sizeof(struct poi_record) ||
+	    idx->hdr.blocks != (idx->hdr.count + POI_BLOCK_RECS - 1) / POI_BLOCK_RECS)
+		return false;
+
+	size_t table = idx->hdr.blocks * sizeof(uint32_t);
+	idx->block_key = (uint32_t *)malloc(table ? table : 1);
+	if (!idx->block_key)
+		return false;
+	if (read_at(ctx, sizeof(idx->hdr), idx->block_key, table) != table) {
+		poi_close(idx);
+		return false;
+	}
+	idx->data_offset = sizeof(idx->hdr) + table;
+	return true;
+}
+
+void poi_close(struct poi_index *idx)
+{
+	free(idx->block_key);
+	idx->block_key = NULL;
+	idx->hdr.count = 0;
+	idx->hdr.blocks = 0;
+	idx->cache_valid = false;
+}
+
+static uint32_t block_len(const struct poi_index *idx, uint32_t b)
+{
+	uint32_t left = idx->hdr.count - b * POI_BLOCK_RECS;
+	return left < POI_BLOCK_RECS ? left : POI_BLOCK_RECS;
+}
+
+static bool load_block(struct poi_index *idx, uint32_t b)
+{
+	if (idx->cache_valid && idx->cache_block == b)
+		return true;
+
+	size_t len = block_len(idx, b) * sizeof(struct poi_record);
+	uint32_t off = idx->data_offset + b * POI_BLOCK_RECS * sizeof(struct poi_record);
+	idx->cache_valid = idx->read_at(idx->ctx, off, idx->cache, len) == len;
+	idx->cache_block = b;
+	idx->blocks_read++;
+	return idx->cache_valid;
+}
+
+/*
+ * Last block whose first key is < key, or the first block. Records equal
+ * to key can end a block whose successor starts with that same key, so
+ * the block starting at key is not early enough.
+ */
+static uint32_t find_block(const struct poi_index *idx, uint32_t key)
+{
+	uint32_t lo = 0, hi = idx->hdr.blocks;
+
+	while (hi - lo > 1) {
+		uint32_t mid = (lo + hi) / 2;
+		if (idx->block_key[mid] < key)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Keeps hits sorted by distance, dropping the furthest once n are held */
+static int insert_hit(struct poi_hit *hits, int found, int n, const struct poi_record *rec,
+		      float dist)
+{
+	if (found == n && dist >= hits[n - 1].dist_m)
+		return found;
+
+	int i = found < n ? found++ : n - 1;
+	while (i > 0 && hits[i - 1].dist_m > dist) {
+		hits[i] = hits[i - 1];
+		i--;
+	}
+	hits[i].rec = *rec;
+	hits[i].dist_m = dist;
+	return found;
+}
+
+static int scan_range(struct poi_index *idx, uint32_t lo, uint32_t hi, double lat,
+		      double lng, float cos_lat, float radius, struct poi_hit *hits,
+		      int found, int n)
+{
+	for (uint32_t b = find_block(idx, lo); b < idx->hdr.blocks; b++) {
+		if (idx->block_key[b] > hi || !load_block(idx, b))
+			break;
+		for (uint32_t i = 0; i < block_len(idx, b); i++) {
+			const struct poi_record *rec = &idx->cache[i];
+			if (rec->key < lo || rec->key > hi)
+				continue;
+			float dy = (float)((rec->lat_e7 / 1e7 - lat) * GEO_METERS_PER_DEG);
+			float dx = (float)((rec->lng_e7 / 1e7 - lng) * GEO_METERS_PER_DEG) * cos_lat;
+			float d = sqrtf(dx * dx + dy * dy);
+			if (d <= radius)
+				found = insert_hit(hits, found, n, rec, d);
+		}
+	}
+	return found;
+}
+
+/*
+ * Fills hits with up to n points nearest to (lat, lng), closest first, and
+ * returns how many were found within max_m. Distances are equirectangular.
+ */
+int poi_nearest(struct poi_index *idx, double lat, double lng, struct poi_hit *hits,
+		int n, float max_m)
+{
+	float cos_lat = cosf((float)(lat * DEG_TO_RAD));
+	float radius = POI_START_RADIUS_M;
+	int found = 0;
+
+	if (!idx->block_key || idx->hdr.count == 0 || n <= 0)
+		return 0;
+	if (cos_lat < 0.01f)
+		cos_lat = 0.01f;
+
+	for (;;) {
+		if (radius > max_m)
+			radius = max_m;
+		double dlat = radius / GEO_METERS_PER_DEG;
+		double dlng = radius / (GEO_METERS_PER_DEG * cos_lat);
+		uint32_t lat_lo = q_lat(lat - dlat), lat_hi = q_lat(lat + dlat);
+		uint32_t lng_lo = q_lng(lng - dlng), lng_hi = q_lng(lng + dlng);
+		uint32_t span = lat_hi - lat_lo > lng_hi - lng_lo ? lat_hi - lat_lo : lng_hi - lng_lo;
+		uint32_t bits = 0;
+
+		while (bits < 16 && (1u << bits) <= span)
+			bits++;
+
+		found = 0;
+		for (uint32_t cy = lat_lo >> bits; cy <= lat_hi >> bits; cy++) {
+			for (uint32_t cx = lng_lo >> bits; cx <= lng_hi >> bits; cx++) {
+				uint32_t lo = morton(cy << bits, cx << bits);
+				uint64_t hi = (uint64_t)lo + (1ull << (2 * bits)) - 1;
+				found = scan_range(idx, lo, hi > 0xffffffffu ? 0xffffffffu : (uint32_t)hi,
+						   lat, lng, cos_lat, radius, hits, found, n);
+			}
+		}
+		if (found == n || radius >= max_m)
+			return found;
+		radius *= 4;
+	}
+}
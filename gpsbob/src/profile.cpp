@@ -0,0 +1,140 @@
+/*
+ * Runtime profiling counters, see profile.h
+ */
+
+#include "profile.h"
+
+#if GPSBOB_PROFILE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(ESP_PLATFORM)
+#include "esp_cpu.h"
+#else
+#include <time.h>
+#endif
+
+struct prof_stats prof;
+
+static const char *const names[PROF_COUNT] = {
+	"gps", "render", "flush", "sd", "web",
+};
+
+/* CPU cycles on the device, nanoseconds (a 1000 MHz "CPU") on the host */
+uint32_t prof_cycles(void)
+{
+#if defined(ESP_PLATFORM)
+	return esp_cpu_get_ccount();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+#endif
+}
+
+void prof_init(uint32_t cpu_mhz)
+{
+	memset(&prof, 0, sizeof(prof));
+	prof.cpu_mhz = cpu_mhz ? cpu_mhz : 1000;
+}
+
+void prof_add(enum prof_id id, uint32_t cycles)
+{
+	struct prof_counter *c = &prof.counter[id];
+
+	c->calls++;
+	c->cycles += cycles;
+	if (cycles > c->max)
+		c->max = cycles;
+}
+
+void prof_loop(uint32_t cycles)
+{
+	uint32_t us = cycles / prof.cpu_mhz;
+	int bucket = 0;
+
+	while (bucket < PROF_LOOP_BUCKETS - 1 && us >= (2u << bucket))
+		bucket++;
+	prof.loop_hist[bucket]++;
+	prof.loops++;
+	prof.loop_cycles += cycles;
+	if (cycles > prof.loop_max)
+		prof.loop_max = cycles;
+}
+
+const char *prof_name(enum prof_id id)
+{
+	return names[id];
+}
+
+float prof_us(uint64_t cycles)
+{
+	return (float)cycles / prof.cpu_mhz;
+}
+
+struct text {
+	char *buf;
+	size_t len;
+	size_t used;
+};
+
+static void put(struct text *t, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (t->used >= t->len)
+		return;
+	va_start(ap, fmt);
+	int n = vsnprintf(t->buf + t->used, t->len - t->used, fmt, ap);
+	va_end(ap);
+	if (n > 0)
+		t->used += (size_t)n < t->len - t->used ? (size_t)n : t->len - t->used - 1;
+}
+
+/* Prometheus text exposition of everything above, returns its length */
+size_t prof_prometheus(char *buf, size_t len, const struct prof_mem *mem)
+{
+	struct text t = { buf, len, 0 };
+	double sec = 1e-6 / prof.cpu_mhz;
+	uint32_t cum = 0;
+
+	if (len)
+		buf[0] = '\0';
+
+	put(&t, "# TYPE gpsbob_section_calls_total counter\n");
+	for (int i = 0; i < PROF_COUNT; i++)
+		put(&t, "gpsbob_section_calls_total{section=\"%s\"} %lu\n", names[i],
+		    (unsigned long)prof.counter[i].calls);
+	put(&t, "# TYPE gpsbob_section_seconds_total counter\n");
+	for (int i = 0; i < PROF_COUNT; i++)
+		put(&t, "gpsbob_section_seconds_total{section=\"%s\"} %.6f\n", names[i],
+		    prof.counter[i].cycles * sec);
+	put(&t, "# TYPE gpsbob_section_max_seconds gauge\n");
+	for (int i = 0; i < PROF_COUNT; i++)
+		put(&t, "gpsbob_section_max_seconds{section=\"%s\"} %.6f\n", names[i],
+		    prof.counter[i].max * sec);
+
+	put(&t, "# TYPE gpsbob_loop_seconds histogram\n");
+	for (int i = 0; i < PROF_LOOP_BUCKETS - 1; i++) {
+		cum += prof.loop_hist[i];
+		put(&t, "gpsbob_loop_seconds_bucket{le=\"%g\"} %lu\n", (2u << i) * 1e-6,
+		    (unsigned long)cum);
+	}
+	put(&t, "gpsbob_loop_seconds_bucket{le=\"+Inf\"} %lu\n", (unsigned long)prof.loops);
+	put(&t, "gpsbob_loop_seconds_sum %.6f\n", prof.loop_cycles * sec);
+	put(&t, "gpsbob_loop_seconds_count %lu\n", (unsigned long)prof.loops);
+
+	put(&t, "# TYPE gpsbob_heap_free_bytes gauge\n");
+	put(&t, "gpsbob_heap_free_bytes %lu\n", (unsigned long)mem->heap_free);
+	put(&t, "# TYPE gpsbob_heap_min_free_bytes gauge\n");
+	put(&t, "gpsbob_heap_min_free_bytes %lu\n", (unsigned long)mem->heap_min);
+	put(&t, "# TYPE gpsbob_psram_free_bytes gauge\n");
+	put(&t, "gpsbob_psram_free_bytes %lu\n", (unsigned long)mem->psram_free);
+	put(&t, "# TYPE gpsbob_psram_min_free_bytes gauge\n");
+	put(&t, "gpsbob_psram_min_free_bytes %lu\n", (unsigned long)mem->psram_min);
+	return t.used;
+}
+
+#endif /* GPSBOB_PROFILE */
@@ -0,0 +1,146 @@
+/*
+ * Raw receiver capture, see raw_capture.h
+ */
+
+#include <string.h>
+#include "raw_capture.h"
+
+static void block_reset(struct raw_block *b)
+{
+	b->used = sizeof(struct raw_block_header);
+}
+
+void raw_capture_init(struct raw_capture *c)
+{
+	memset(c, 0, sizeof(*c));
+	block_reset(&c->block[0]);
+	block_reset(&c->block[1]);
+	c->pending = -1;
+}
+
+/*
+ * Where the next UART bytes go and how many fit. NULL when the block
+ * being filled is full and the other one is still waiting for the card;
+ * the UART buffer has to hold the bytes until raw_capture_written().
+ */
+uint8_t *raw_capture_buf(struct raw_capture *c, size_t *room)
+{
+	struct raw_block *b = &c->block[c->fill];
+
+	*room = RAW_BLOCK_SIZE - b->used;
+	return *room ? b->data + b->used : NULL;
+}
+
+/* n bytes were read into raw_capture_buf() at device time ms */
+void raw_capture_put(struct raw_capture *c, size_t n, uint32_t ms)
+{
+	struct raw_block *b = &c->block[c->fill];
+
+	if (n == 0)
+		return;
+	if (b->used == sizeof(struct raw_block_header))
+		c->first_ms = ms;
+	b->used += n;
+	c->bytes += n;
+}
+
+/* The UART overran n times, noted in the next block handed out */
+void raw_capture_overrun(struct raw_capture *c, uint32_t n)
+{
+	c->overruns = c->overruns + n > 0xFFFF ? 0xFFFF : c->overruns + n;
+	c->overruns_total += n;
+}
+
+/*
+ * The block to write next, if one is due: full, RAW_FLUSH_MS old, or not
+ * empty and force set. Filling continues in the other block. Returns NULL
+ * while the previous block is still pending.
+ */
+const uint8_t *raw_capture_take(struct raw_capture *c, uint32_t ms, bool force, size_t *len)
+{
+	struct raw_block *b = &c->block[c->fill];
+	size_t payload = b->used - sizeof(struct raw_block_header);
+	struct raw_block_header hdr;
+
+	if (c->pending >= 0 || payload == 0)
+		return NULL;
+	if (!force && b->used < RAW_BLOCK_SIZE && ms - c->first_ms < RAW_FLUSH_MS)
+		return NULL;
+
+	memcpy(hdr.magic, RAW_MAGIC, sizeof(hdr.magic));
+	hdr.ms = c->first_ms;
+	hdr.seq = c->seq++;
+	hdr.len = (uint16_t)payload;
+	hdr.overruns = c->overruns;
+	memcpy(b->data, &hdr, sizeof(hdr));
+	c->overruns = 0;
+	c->blocks++;
+
+	*len = b->used;
+	c->pending = c->fill;
+	c->fill ^= 1;
+	block_reset(&c->block[c->fill]);
+	return b->data;
+}
+
+/* The block from raw_capture_take() is on the card, its buffer is free */
+void raw_capture_written(struct raw_capture *c)
+{
+	c->pending = -1;
+}
+
+static size_t read_full(raw_read_fn read, void *ctx, uint8_t *buf, size_t len)
+{
+	size_t got = 0, n;
+
+	while (got < len && (n = read(ctx, buf + got, len - got)) > 0)
+		got += n;
+	return got;
+}
+
+/*
+ * Writes the receiver output of a capture file without the block headers.
+ * Anything that is not a valid block, e.g. a torn last block, is skipped
+ * byte by byte until the next magic.
+ */
+void raw_unpack(raw_read_fn read, void *in, raw_write_fn write, void *out,
+		struct raw_unpack_stats *st)
+{
+	uint8_t buf[512];
+	struct raw_block_header hdr;
+	size_t have = 0;
+	bool first = true;
+	uint32_t next_seq = 0;
+
+	memset(st, 0, sizeof(*st));
+	for (;;) {
+		have += read_full(read, in, (uint8_t *)&hdr + have, sizeof(hdr) - have);
+		if (have < sizeof(hdr)) {
+			st->skipped += have;
+			return;
+		}
+		if (memcmp(hdr.magic, RAW_MAGIC, 4) || hdr.len > RAW_PAYLOAD_MAX) {
+			memmove(&hdr, (uint8_t *)&hdr + 1, --have);
+			st->skipped++;
+			continue;
+		}
+		have = 0;
+
+		if (!first && hdr.seq != next_seq)
+			st->gaps += hdr.seq - next_seq;
+		first = false;
+		next_seq = hdr.seq + 1;
+		st->blocks++;
+		st->overruns += hdr.overruns;
+
+		/* A torn last block still yields what made it to the card */
+		for (size_t left = hdr.len; left; ) {
+			size_t n = read_full(read, in, buf, left < sizeof(buf) ? left : sizeof(buf));
+			if (n == 0)
+				return;
+			write(out, buf, n);
+			st->bytes += n;
+			left -= n;
+		}
+	}
+}
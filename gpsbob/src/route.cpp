@@ -0,0 +1,230 @@
+/*
+ * Multi-waypoint route, see route.h
+ */
+
+#include "route.h"
+#include "geo.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct route route;
+
+static double pt_lat(const struct route_point *p)
+{
+	return p->lat_e7 / 1e7;
+}
+
+static double pt_lng(const struct route_point *p)
+{
+	return p->lng_e7 / 1e7;
+}
+
+// === Building ===
+void route_clear(struct route *r)
+{
+	r->count = 0;
+	r->active = 0;
+	r->truncated = false;
+}
+
+bool route_add(struct route *r, double lat, double lng)
+{
+	if (lat < -90 || lat > 90 || lng < -180 || lng > 180)
+		return false;
+	if (r->count == ROUTE_MAX_POINTS) {
+		r->truncated = true;
+		return false;
+	}
+	r->pt[r->count].lat_e7 = (int32_t)lround(lat * 1e7);
+	r->pt[r->count].lng_e7 = (int32_t)lround(lng * 1e7);
+	r->count++;
+	return true;
+}
+
+/*
+ * Precomputes the per-leg data, call once after the last route_add(). Legs
+ * are summed in double precision since this runs once per load.
+ */
+void route_finish(struct route *r)
+{
+	r->active = 0;
+	if (r->count == 0)
+		return;
+
+	r->cum_m[0] = 0;
+	r->leg_deg[0] = 0;
+	for (uint16_t i = 1; i < r->count; i++) {
+		const struct route_point *a = &r->pt[i - 1];
+		const struct route_point *b = &r->pt[i];
+		r->cum_m[i] = r->cum_m[i - 1] +
+			      geo_haversine_m(pt_lat(a), pt_lng(a), pt_lat(b), pt_lng(b));
+		r->leg_deg[i] = geo_initial_course_deg(pt_lat(a), pt_lng(a), pt_lat(b), pt_lng(b));
+	}
+}
+
+double route_total_m(const struct route *r)
+{
+	return r->count ? r->cum_m[r->count - 1] : 0.0;
+}
+
+// === Parsing ===
+static bool gpx_attr(const char *tag, const char *name, double *out)
+{
+	const char *p = tag;
+	size_t n = strlen(name);
+
+	while ((p = strstr(p, name)) != NULL) {
+		if (p > tag && (p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\n') &&
+		    p[n] == '=' && (p[n + 1] == '"' || p[n + 1] == '\'')) {
+			char *end;
+			*out = strtod(p + n + 2, &end);
+			return end != p + n + 2;
+		}
+		p += n;
+	}
+	return false;
+}
+
+static void gpx_tag(struct route *r, const char *tag)
+{
+	double lat, lng;
+
+	if (strncmp(tag, "rtept", 5) && strncmp(tag, "wpt", 3) && strncmp(tag, "trkpt", 5))
+		return;
+	if (gpx_attr(tag, "lat", &lat) && gpx_attr(tag, "lon", &lng))
+		route_add(r, lat, lng);
+}
+
+/* Accepts the logger's own CSV records as well as bare "lat,lng[,...]" lines */
+static void csv_line(struct route *r, const char *line, size_t len)
+{
+	struct track_point pt;
+	char buf[TRACK_LINE_MAX];
+	char *end;
+
+	if (track_parse_csv(line, len, &pt)) {
+		route_add(r, pt.lat, pt.lng);
+		return;
+	}
+	if (len >= sizeof(buf))
+		return;
+	memcpy(buf, line, len);
+	buf[len] = '\0';
+
+	double lat = strtod(buf, &end);
+	if (end == buf || *end != ',')
+		return;
+	char *lng_start = end + 1;
+	double lng = strtod(lng_start, &end);
+	if (end == lng_start)
+		return;
+	route_add(r, lat, lng);
+}
+
+/*
+ * Replaces the route with the points read from a GPX or CSV source and
+ * returns how many were kept.
+ */
+uint16_t route_parse(struct route *r, enum route_source src, track_read_fn read, void *ctx)
+{
+	uint8_t chunk[256];
+	char buf[ROUTE_TAG_MAX];
+	size_t len = 0;
+	bool in_tag = false;
+	bool overflow = false;
+	size_t n;
+
+	route_clear(r);
+	while ((n = read(ctx, chunk, sizeof(chunk))) > 0) {
+		for (size_t i = 0; i < n; i++) {
+			char c = (char)chunk[i];
+
+			if (src == ROUTE_SRC_GPX) {
+				if (c == '<') {
+					in_tag = true;
+					overflow = false;
+					len = 0;
+				} else if (c == '>' && in_tag) {
+					in_tag = false;
+					buf[len] = '\0';
+					if (!overflow)
+						gpx_tag(r, buf);
+				} else if (in_tag) {
+					if (len < sizeof(buf) - 1)
+						buf[len++] = c;
+					else
+						overflow = true;
+				}
+			} else {
+				if (c == '\n') {
+					if (!overflow)
+						csv_line(r, buf, len);
+					overflow = false;
+					len = 0;
+				} else if (len < sizeof(buf) - 1) {
+					buf[len++] = c;
+				} else {
+					overflow = true;
+				}
+			}
+		}
+	}
+	if (src == ROUTE_SRC_CSV && len && !overflow)
+		csv_line(r, buf, len);
+
+	route_finish(r);
+	return r->count;
+}
+
+// === Navigation ===
+/*
+ * Updates the active waypoint for a new position and fills in distances and
+ * bearings. A waypoint counts as reached inside the arrival radius, or once
+ * it has been passed along its inbound leg while within four radii.
+ */
+bool route_update(struct route *r, double lat, double lng, double arrive_m,
+		  struct route_status *st)
+{
+	struct geo_vector v;
+
+	memset(st, 0, sizeof(*st));
+	if (r->count == 0)
+		return false;
+
+	for (;;) {
+		const struct route_point *a = &r->pt[r->active];
+		geo_vector(lat, lng, pt_lat(a), pt_lng(a), &v);
+		if (r->active + 1 >= r->count)
+			break;
+
+		bool reached = v.dist_m <= arrive_m;
+		if (!reached && r->active > 0 && v.dist_m <= 4 * arrive_m) {
+			double out = geo_course_deg(pt_lat(a), pt_lng(a), lat, lng);
+			double diff = fabs(out - r->leg_deg[r->active]);
+			if (diff > 180.0)
+				diff = 360.0 - diff;
+			reached = diff < 90.0;
+		}
+		if (!reached)
+			break;
+		r->active++;
+		st->advanced = true;
+	}
+
+	const struct route_point *a = &r->pt[r->active];
+	const struct route_point *last = &r->pt[r->count - 1];
+
+	st->active = r->active;
+	st->count = r->count;
+	st->active_lat = pt_lat(a);
+	st->active_lng = pt_lng(a);
+	st->active_dist_m = v.dist_m;
+	st->active_deg = v.course_deg;
+	st->final_dist_m = v.dist_m + (r->cum_m[r->count - 1] - r->cum_m[r->active]);
+	st->final_deg = r->active + 1 == r->count ?
+			st->active_deg : geo_course_deg(lat, lng, pt_lat(last), pt_lng(last));
+	st->arrived = r->active + 1 == r->count && v.dist_m <= arrive_m;
+	return true;
+}
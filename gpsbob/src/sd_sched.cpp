@@ -0,0 +1,212 @@
+/*
+ * SD card access scheduler, see sd_sched.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "sd_sched.h"
+
+#if defined(ESP_PLATFORM)
+#include "esp_timer.h"
+#else
+#include <time.h>
+#endif
+
+static const char *const names[SD_CLASS_COUNT] = { "log", "loop", "web" };
+
+static thread_local bool in_worker;
+
+uint32_t sd_sched_now_us(void)
+{
+#if defined(ESP_PLATFORM)
+	return (uint32_t)esp_timer_get_time();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000000ull + ts.tv_nsec / 1000);
+#endif
+}
+
+void sd_sched_init(struct sd_sched *s)
+{
+	memset(s->head, 0, sizeof(s->head));
+	memset(s->tail, 0, sizeof(s->tail));
+	memset(s->stats, 0, sizeof(s->stats));
+	s->running = false;
+	s->stopping = false;
+}
+
+/* Called with the lock held */
+static void account(struct sd_class_stats *st, uint32_t wait, uint32_t busy)
+{
+	int bucket = 0;
+
+	while (bucket < SD_HIST_BUCKETS - 1 && wait >= (2u << bucket))
+		bucket++;
+	st->wait_hist[bucket]++;
+	st->jobs++;
+	st->wait_us += wait;
+	if (wait > st->wait_max_us)
+		st->wait_max_us = wait;
+	st->busy_us += busy;
+	if (busy > st->busy_max_us)
+		st->busy_max_us = busy;
+}
+
+/* Called with the lock held, which it drops while running the job */
+static void run_here(struct sd_sched *s, struct sd_job *job, std::unique_lock<std::mutex> &lock)
+{
+	lock.unlock();
+	uint32_t start = sd_sched_now_us();
+	job->fn(job->ctx);
+	uint32_t busy = sd_sched_now_us() - start;
+	lock.lock();
+	account(&s->stats[job->cls], 0, busy);
+	job->done = true;
+}
+
+/* Queues job with the lock held, false when it has to run directly */
+static bool enqueue(struct sd_sched *s, struct sd_job *job)
+{
+	enum sd_class cls = job->cls;
+
+	job->done = false;
+	job->next = NULL;
+	if (!s->running || in_worker)
+		return false;
+	job->queued_us = sd_sched_now_us();
+	if (s->tail[cls])
+		s->tail[cls]->next = job;
+	else
+		s->head[cls] = job;
+	s->tail[cls] = job;
+	s->work.notify_one();
+	return true;
+}
+
+void sd_sched_call(struct sd_sched *s, enum sd_class cls, sd_job_fn fn, void *ctx)
+{
+	std::unique_lock<std::mutex> lock(s->lock);
+	struct sd_job job = { fn, ctx, cls, 0, false, NULL };
+
+	if (!enqueue(s, &job)) {
+		run_here(s, &job, lock);
+		return;
+	}
+	s->done.wait(lock, [&job] { return job.done; });
+}
+
+/* fn, ctx and cls of job are set by the caller */
+void sd_sched_submit(struct sd_sched *s, struct sd_job *job)
+{
+	std::unique_lock<std::mutex> lock(s->lock);
+
+	if (!enqueue(s, job))
+		run_here(s, job, lock);
+}
+
+bool sd_sched_done(struct sd_sched *s, const struct sd_job *job)
+{
+	std::lock_guard<std::mutex> lock(s->lock);
+
+	return job->done;
+}
+
+static struct sd_job *next_job(struct sd_sched *s)
+{
+	for (int cls = 0; cls < SD_CLASS_COUNT; cls++) {
+		struct sd_job *job = s->head[cls];
+
+		if (!job)
+			continue;
+		s->head[cls] = job->next;
+		if (!s->head[cls])
+			s->tail[cls] = NULL;
+		return job;
+	}
+	return NULL;
+}
+
+/* Runs jobs until sd_sched_stop(), on the task that owns the card */
+void sd_sched_worker(struct sd_sched *s)
+{
+	std::unique_lock<std::mutex> lock(s->lock);
+
+	in_worker = true;
+	s->running = true;
+	for (;;) {
+		struct sd_job *job = next_job(s);
+
+		if (!job) {
+			if (s->stopping)
+				break;
+			s->work.wait(lock);
+			continue;
+		}
+		lock.unlock();
+		uint32_t start = sd_sched_now_us();
+		job->fn(job->ctx);
+		uint32_t busy = sd_sched_now_us() - start;
+		lock.lock();
+		account(&s->stats[job->cls], start - job->queued_us, busy);
+		job->done = true;
+		s->done.notify_all();
+	}
+	s->running = false;
+	in_worker = false;
+}
+
+/* Lets the worker return once the queue is empty */
+void sd_sched_stop(struct sd_sched *s)
+{
+	std::lock_guard<std::mutex> lock(s->lock);
+
+	s->stopping = true;
+	s->work.notify_one();
+}
+
+const char *sd_class_name(enum sd_class cls)
+{
+	return names[cls];
+}
+
+/* Upper bound of the bucket holding the pct-th percentile wait */
+uint32_t sd_sched_wait_pct_us(const struct sd_class_stats *st, float pct)
+{
+	uint32_t rank = (uint32_t)(st->jobs * pct / 100.0f + 0.5f);
+	uint32_t seen = 0;
+
+	if (!st->jobs)
+		return 0;
+	for (int i = 0; i < SD_HIST_BUCKETS - 1; i++) {
+		seen += st->wait_hist[i];
+		if (seen >= rank)
+			return 2u << i;
+	}
+	return st->wait_max_us;
+}
+
+/* One line per class, as served on /sd */
+size_t sd_sched_report(struct sd_sched *s, char *buf, size_t len)
+{
+	std::lock_guard<std::mutex> lock(s->lock);
+	size_t used = 0;
+
+	if (len)
+		buf[0] = '\0';
+	for (int cls = 0; cls < SD_CLASS_COUNT && used < len; cls++) {
+		const struct sd_class_stats *st = &s->stats[cls];
+		int n = snprintf(buf + used, len - used,
+				 "%-4s jobs %lu  wait avg %lu p99 <%lu max %lu us  card avg %lu max %lu us\n",
+				 names[cls], (unsigned long)st->jobs,
+				 (unsigned long)(st->jobs ? st->wait_us / st->jobs : 0),
+				 (unsigned long)sd_sched_wait_pct_us(st, 99),
+				 (unsigned long)st->wait_max_us,
+				 (unsigned long)(st->jobs ? st->busy_us / st->jobs : 0),
+				 (unsigned long)st->busy_max_us);
+		if (n < 0)
+			break;
+		used += (size_t)n < len - used ? (size_t)n : len - used - 1;
+	}
+	return used;
+}
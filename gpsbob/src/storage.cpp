@@ -0,0 +1,167 @@
+/*
+ * SD card backend, see storage.h
+ */
+
+#include <Arduino.h>
+#include <SD.h>
+#include <SPI.h>
+#include "board.h"
+#include "storage.h"
+
+#if defined(GPSBOB_SDMMC_WIDTH)
+#include <SD_MMC.h>
+#endif
+
+static struct storage_info info;
+
+#if defined(GPSBOB_SDMMC_WIDTH)
+static bool begin_sdmmc(const struct gps_config *c)
+{
+	bool one_bit = GPSBOB_SDMMC_WIDTH == 1;
+
+	if (one_bit)
+		SD_MMC.setPins(board::sdmmc_clk, board::sdmmc_cmd, board::sdmmc_d0);
+	else
+		SD_MMC.setPins(board::sdmmc_clk, board::sdmmc_cmd, board::sdmmc_d0,
+			       board::sdmmc_d1, board::sdmmc_d2, board::sdmmc_d3);
+	if (!SD_MMC.begin("/sdcard", one_bit, false, c->sd_mhz * 1000))
+		return false;
+	info.bus = STORAGE_SDMMC;
+	info.width = GPSBOB_SDMMC_WIDTH;
+	info.freq_khz = c->sd_mhz * 1000;
+	info.card_bytes = SD_MMC.cardSize();
+	return true;
+}
+#endif
+
+/* Mounts the card, first as configured, then on SPI at the safe clock */
+bool storage_begin(const struct gps_config *c)
+{
+#if defined(GPSBOB_SDMMC_WIDTH)
+	if (c->sd_mmc && begin_sdmmc(c))
+		return true;
+#endif
+	info.bus = STORAGE_SPI;
+	info.width = 1;
+	info.fallback = false;
+	info.freq_khz = c->sd_mhz * 1000;
+	if (!SD.begin(board::sd_cs, SPI, c->sd_mhz * 1000000)) {
+		SD.end();
+		info.fallback = true;
+		info.freq_khz = STORAGE_SPI_SAFE_HZ / 1000;
+		if (!SD.begin(board::sd_cs, SPI, STORAGE_SPI_SAFE_HZ))
+			return false;
+	}
+	info.card_bytes = SD.cardSize();
+	return true;
+}
+
+fs::FS &storage_fs(void)
+{
+#if defined(GPSBOB_SDMMC_WIDTH)
+	if (info.bus == STORAGE_SDMMC)
+		return SD_MMC;
+#endif
+	return SD;
+}
+
+/* Where the VFS mounted the card, for POSIX calls such as truncate() */
+const char *storage_mount(void)
+{
+	return info.bus == STORAGE_SDMMC ? "/sdcard" : "/sd";
+}
+
+const struct storage_info *storage_info(void)
+{
+	return &info;
+}
+
+const char *storage_bus_name(void)
+{
+	if (info.bus == STORAGE_SPI)
+		return "SPI";
+	return info.width == 4 ? "SDMMC 4-bit" : "SDMMC 1-bit";
+}
+
+// === Self-test ===
+struct test_run {
+	struct sd_sched *s;
+	fs::File f;
+	uint8_t *buf;
+	uint32_t busy_us; /* Card time of the current phase */
+	uint32_t max_us;
+	bool ok;
+};
+
+/* One scheduler job, timed on the card side so queueing is not counted */
+template <class F>
+static void step(struct test_run *r, F f)
+{
+	sd_sched_run(r->s, SD_WEB, [&] {
+		uint32_t start = micros();
+		if (!f())
+			r->ok = false;
+		uint32_t us = micros() - start;
+		r->busy_us += us;
+		if (us > r->max_us)
+			r->max_us = us;
+	});
+}
+
+static void phase(struct test_run *r)
+{
+	r->busy_us = 0;
+	r->max_us = 0;
+}
+
+static float per_s(uint32_t n, uint32_t us)
+{
+	return us ? n * 1e6f / us : 0;
+}
+
+void storage_selftest(struct sd_sched *s, struct storage_test *t)
+{
+	struct test_run r = { s, fs::File(), NULL, 0, 0, true };
+	fs::FS &fs = storage_fs();
+
+	t->running = true;
+	t->done = false;
+	r.buf = (uint8_t *)malloc(STORAGE_TEST_CHUNK);
+	if (!r.buf) {
+		t->ok = false;
+		t->running = false;
+		return;
+	}
+	for (size_t i = 0; i < STORAGE_TEST_CHUNK; i++)
+		r.buf[i] = (uint8_t)(i * 31 + 7);
+
+	step(&r, [&] { r.f = fs.open(STORAGE_TEST_PATH, FILE_WRITE); return (bool)r.f; });
+	phase(&r);
+	for (uint32_t off = 0; r.ok && off < STORAGE_TEST_BYTES; off += STORAGE_TEST_CHUNK)
+		step(&r, [&] { return r.f.write(r.buf, STORAGE_TEST_CHUNK) == STORAGE_TEST_CHUNK; });
+	step(&r, [&] { r.f.flush(); r.f.close(); return true; });
+	t->write_kbs = per_s(STORAGE_TEST_BYTES / 1024, r.busy_us);
+
+	step(&r, [&] { r.f = fs.open(STORAGE_TEST_PATH, FILE_READ); return (bool)r.f; });
+	phase(&r);
+	for (int i = 0; r.ok && i < STORAGE_TEST_READS; i++) {
+		uint32_t off = (esp_random() % (STORAGE_TEST_BYTES / 512)) * 512;
+		step(&r, [&] { return r.f.seek(off) && r.f.read(r.buf, 512) == 512; });
+	}
+	step(&r, [&] { r.f.close(); return true; });
+	t->read_iops = per_s(STORAGE_TEST_READS, r.busy_us);
+	t->read_kbs = t->read_iops / 2;
+
+	step(&r, [&] { r.f = fs.open(STORAGE_TEST_PATH, FILE_APPEND); return (bool)r.f; });
+	phase(&r);
+	for (int i = 0; r.ok && i < STORAGE_TEST_APPENDS; i++)
+		step(&r, [&] { bool ok = r.f.write(r.buf, 64) == 64; r.f.flush(); return ok; });
+	t->append_per_s = per_s(STORAGE_TEST_APPENDS, r.busy_us);
+	t->append_max_ms = r.max_us / 1000.0f;
+	step(&r, [&] { r.f.close(); return fs.remove(STORAGE_TEST_PATH); });
+
+	free(r.buf);
+	t->ok = r.ok;
+	t->done = true;
+	t->running = false;
+}
@@ -0,0 +1,442 @@
+/*
+ * Track record formats, see track_format.h
+ */
+
+#include "track_format.h"
+#include "track_simplify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+	STAGE_HEADER,
+	STAGE_BODY,
+	STAGE_FOOTER,
+	STAGE_DONE
+};
+
+static const char gpx_header[] =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	"<gpx version=\"1.1\" creator=\"ESP32 Logger\"\n"
+	" xmlns=\"http://www.topografix.com/GPX/1/1\"\n"
+	" xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\n"
+	" xsi:schemaLocation=\"http://www.topografix.com/GPX/1/1\n"
+	" http://www.topografix.com/GPX/1/1/gpx.xsd\">\n"
+	"<trk><name>GPSBOB Log</name><trkseg>\n";
+static const char gpx_footer[] = "</trkseg></trk></gpx>\n";
+
+static const char geojson_header[] = "{\"type\":\"FeatureCollection\",\"features\":[\n";
+static const char geojson_footer[] = "]}\n";
+
+static const char kml_header[] =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	"<kml xmlns=\"http://www.opengis.net/kml/2.2\"><Document>"
+	"<name>GPSBOB Log</name><Placemark><name>Track</name>"
+	"<LineString><tessellate>1</tessellate><coordinates>\n";
+static const char kml_footer[] = "</coordinates></LineString></Placemark></Document></kml>\n";
+
+static const char csv_header[] = TRACK_CSV_HEADER "\r\n";
+
+// === Format names ===
+enum track_fmt track_fmt_from_name(const char *name)
+{
+	if (!name || !*name || !strcmp(name, "csv"))
+		return TRACK_FMT_CSV;
+	if (!strcmp(name, "gpx"))
+		return TRACK_FMT_GPX;
+	if (!strcmp(name, "geojson") || !strcmp(name, "json"))
+		return TRACK_FMT_GEOJSON;
+	if (!strcmp(name, "kml"))
+		return TRACK_FMT_KML;
+	return TRACK_FMT_INVALID;
+}
+
+const char *track_fmt_name(enum track_fmt fmt)
+{
+	switch (fmt) {
+	case TRACK_FMT_CSV:     return "csv";
+	case TRACK_FMT_GPX:     return "gpx";
+	case TRACK_FMT_GEOJSON: return "geojson";
+	case TRACK_FMT_KML:     return "kml";
+	default:                return "invalid";
+	}
+}
+
+const char *track_fmt_mime(enum track_fmt fmt)
+{
+	switch (fmt) {
+	case TRACK_FMT_CSV:     return "text/csv";
+	case TRACK_FMT_GPX:     return "application/gpx+xml";
+	case TRACK_FMT_GEOJSON: return "application/geo+json";
+	case TRACK_FMT_KML:     return "application/vnd.google-earth.kml+xml";
+	default:                return "text/plain";
+	}
+}
+
+const char *track_fmt_ext(enum track_fmt fmt)
+{
+	switch (fmt) {
+	case TRACK_FMT_GEOJSON: return "geojson";
+	default:                return track_fmt_name(fmt);
+	}
+}
+
+const char *track_fmt_header(enum track_fmt fmt)
+{
+	switch (fmt) {
+	case TRACK_FMT_CSV:     return csv_header;
+	case TRACK_FMT_GPX:     return gpx_header;
+	case TRACK_FMT_GEOJSON: return geojson_header;
+	case TRACK_FMT_KML:     return kml_header;
+	default:                return "";
+	}
+}
+
+const char *track_fmt_footer(enum track_fmt fmt)
+{
+	switch (fmt) {
+	case TRACK_FMT_GPX:     return gpx_footer;
+	case TRACK_FMT_GEOJSON: return geojson_footer;
+	case TRACK_FMT_KML:     return kml_footer;
+	default:                return "";
+	}
+}
+
+// === Records ===
+int track_csv_line(const struct track_point *pt, char *buf, size_t len)
+{
+	return snprintf(buf, len, "%s,%.6f,%.6f,%d,%.2f,%d",
+			pt->local, pt->lat, pt->lng, pt->sats, pt->hdop,
+			pt->offset_hours);
+}
+
+/*
+ * Splits one CSV record into a track_point. Header lines, blank lines and
+ * anything that does not carry all six columns are rejected.
+ */
+bool track_parse_csv(const char *line, size_t len, struct track_point *pt)
+{
+	char buf[TRACK_LINE_MAX];
+	char *field[6];
+	char *p;
+	char *end;
+	int n = 0;
+
+	while (len && (line[len - 1] == '\r' || line[len - 1] == '\n' || line[len - 1] == ' '))
+		len--;
+	if (len == 0 || len >= sizeof(buf) || line[0] < '0' || line[0] > '9')
+		return false;
+
+	memcpy(buf, line, len);
+	buf[len] = '\0';
+
+	p = buf;
+	field[n++] = p;
+	while ((p = strchr(p, ',')) != NULL && n < 6) {
+		*p++ = '\0';
+		field[n++] = p;
+	}
+	if (n != 6 || strlen(field[0]) >= sizeof(pt->local))
+		return false;
+
+	strcpy(pt->local, field[0]);
+	pt->lat = strtod(field[1], &end);
+	if (end == field[1])
+		return false;
+	pt->lng = strtod(field[2], &end);
+	if (end == field[2])
+		return false;
+	pt->sats = atoi(field[3]);
+	pt->hdop = (float)atof(field[4]);
+	pt->offset_hours = atoi(field[5]);
+	return true;
+}
+
+/* Days since 1970-01-01 for a proleptic Gregorian date (Hinnant's algorithm) */
+static long days_from_civil(long y, unsigned m, unsigned d)
+{
+	y -= m <= 2;
+	long era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = (unsigned)(y - era * 400);
+	unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (long)doe - 719468;
+}
+
+static void civil_from_days(long z, int *y, int *m, int *d)
+{
+	z += 719468;
+	long era = (z >= 0 ? z : z - 146096) / 146097;
+	unsigned doe = (unsigned)(z - era * 146097);
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+
+	*d = (int)(doy - (153 * mp + 2) / 5 + 1);
+	*m = (int)(mp < 10 ? mp + 3 : mp - 9);
+	*y = (int)(yoe + era * 400 + (*m <= 2));
+}
+
+static int digits(const char *s, int n)
+{
+	int v = 0;
+
+	while (n--)
+		v = v * 10 + (*s++ - '0');
+	return v;
+}
+
+static void put_digits(char *s, unsigned v, int n)
+{
+	while (n--) {
+		s[n] = (char)('0' + v % 10);
+		v /= 10;
+	}
+}
+
+/* "YYYY-MM-DD HH:MM:SS" as logged, without sscanf() */
+static bool parse_stamp(const char *s, int *y, int *mo, int *d, int *h, int *mi, int *sec)
+{
+	static const char shape[] = "dddd-dd-dd dd:dd:dd";
+
+	for (size_t i = 0; i < sizeof(shape); i++) {
+		if (shape[i] == 'd' ? s[i] < '0' || s[i] > '9' : s[i] != shape[i])
+			return false;
+	}
+	*y = digits(s, 4);
+	*mo = digits(s + 5, 2);
+	*d = digits(s + 8, 2);
+	*h = digits(s + 11, 2);
+	*mi = digits(s + 14, 2);
+	*sec = digits(s + 17, 2);
+	return true;
+}
+
+/*
+ * Recovers the UTC time of a record from its local stamp and offset, in
+ * seconds since 1970. The arithmetic is done on a linear day count, so
+ * local stamps that rolled past midnight without carrying into the date
+ * are still mapped correctly.
+ */
+bool track_utc_time(const struct track_point *pt, int64_t *utc)
+{
+	int y, mo, d, h, mi, s;
+
+	if (!parse_stamp(pt->local, &y, &mo, &d, &h, &mi, &s) &&
+	    sscanf(pt->local, "%d-%d-%d %d:%d:%d", &y, &mo, &d, &h, &mi, &s) != 6)
+		return false;
+	if (mo < 1 || mo > 12)
+		return false;
+
+	int64_t t = (int64_t)days_from_civil(y, (unsigned)mo, 1) + d - 1;
+	*utc = t * 86400 + (int64_t)(h - pt->offset_hours) * 3600 + mi * 60 + s;
+	return true;
+}
+
+/* Inverse of track_utc_time(): fills in local from utc and offset_hours */
+void track_set_local(struct track_point *pt, int64_t utc)
+{
+	int64_t t = utc + (int64_t)pt->offset_hours * 3600;
+	long days = (long)(t >= 0 ? t / 86400 : (t - 86399) / 86400);
+	unsigned sec = (unsigned)(t - (int64_t)days * 86400);
+	int y, mo, d;
+
+	civil_from_days(days, &y, &mo, &d);
+	if (y < 0 || y > 9999) /* The field is four digits wide */
+		y = 0;
+	memcpy(pt->local, "0000-00-00 00:00:00", sizeof(pt->local));
+	put_digits(pt->local, (unsigned)y, 4);
+	put_digits(pt->local + 5, (unsigned)mo, 2);
+	put_digits(pt->local + 8, (unsigned)d, 2);
+	put_digits(pt->local + 11, sec / 3600, 2);
+	put_digits(pt->local + 14, sec / 60 % 60, 2);
+	put_digits(pt->local + 17, sec % 60, 2);
+}
+
+bool track_utc_iso8601(const struct track_point *pt, char *buf, size_t len)
+{
+	int64_t t;
+	int y, mo, d;
+
+	if (!track_utc_time(pt, &t))
+		return false;
+
+	long days = (long)(t >= 0 ? t / 86400 : (t - 86399) / 86400);
+	long sec = (long)(t - (long long)days * 86400);
+	civil_from_days(days, &y, &mo, &d);
+
+	snprintf(buf, len, "%04d-%02d-%02dT%02ld:%02ld:%02ldZ",
+		 y, mo, d, sec / 3600, (sec / 60) % 60, sec % 60);
+	return true;
+}
+
+// === Streaming conversion ===
+static size_t format_header(enum track_fmt fmt, char *buf, size_t len)
+{
+	return snprintf(buf, len, "%s", track_fmt_header(fmt));
+}
+
+static size_t format_footer(enum track_fmt fmt, char *buf, size_t len)
+{
+	return snprintf(buf, len, "%s", track_fmt_footer(fmt));
+}
+
+/* One point as a body element of fmt; index 0 is the first of the file */
+size_t track_format_point(enum track_fmt fmt, const struct track_point *pt,
+			  uint32_t index, char *buf, size_t len)
+{
+	char utc[24];
+	int n = 0;
+
+	switch (fmt) {
+	case TRACK_FMT_CSV:
+		n = track_csv_line(pt, buf, len);
+		if (n > 0 && (size_t)n + 2 < len)
+			n += snprintf(buf + n, len - n, "\r\n");
+		break;
+	case TRACK_FMT_GPX:
+		if (!track_utc_iso8601(pt, utc, sizeof(utc)))
+			utc[0] = '\0';
+		n = snprintf(buf, len,
+			     "<trkpt lat=\"%.6f\" lon=\"%.6f\">\n"
+			     "  <time>%s</time>\n"
+			     "</trkpt>\n",
+			     pt->lat, pt->lng, utc);
+		break;
+	case TRACK_FMT_GEOJSON:
+		if (!track_utc_iso8601(pt, utc, sizeof(utc)))
+			utc[0] = '\0';
+		n = snprintf(buf, len,
+			     "%s{\"type\":\"Feature\",\"geometry\":{\"type\":\"Point\","
+			     "\"coordinates\":[%.6f,%.6f]},\"properties\":{\"time\":\"%s\","
+			     "\"sats\":%d,\"hdop\":%.2f}}\n",
+			     index ? "," : "", pt->lng, pt->lat, utc, pt->sats, pt->hdop);
+		break;
+	case TRACK_FMT_KML:
+		n = snprintf(buf, len, "%.6f,%.6f,0\n", pt->lng, pt->lat);
+		break;
+	default:
+		break;
+	}
+	return n > 0 && (size_t)n < len ? (size_t)n : 0;
+}
+
+void track_transcoder_init(struct track_transcoder *t, enum track_fmt fmt,
+			   track_read_fn read, void *ctx)
+{
+	memset(t, 0, sizeof(*t));
+	t->fmt = fmt;
+	t->read = read;
+	t->ctx = ctx;
+	t->stage = STAGE_HEADER;
+}
+
+/* Routes points through a simplifier, s must outlive the transcoder */
+void track_transcoder_simplify(struct track_transcoder *t, struct track_simplify *s)
+{
+	t->simplify = s;
+}
+
+/*
+ * Pulls the next complete line out of the input window. Returns false once
+ * the input is exhausted; an unterminated trailing line is treated as torn
+ * and never returned. A NUL ends the input too: it is the unused,
+ * preallocated tail of a log that is still open (see log_file.h).
+ */
+static bool next_line(struct track_transcoder *t)
+{
+	for (;;) {
+		if (t->in_pos == t->in_len) {
+			if (t->in_eof)
+				return false;
+			t->in_len = t->read(t->ctx, t->in, sizeof(t->in));
+			t->in_pos = 0;
+			if (t->in_len == 0) {
+				t->in_eof = true;
+				return false;
+			}
+		}
+
+		while (t->in_pos < t->in_len) {
+			char c = (char)t->in[t->in_pos++];
+
+			if (c == '\0') {
+				t->in_pos = t->in_len;
+				t->in_eof = true;
+				return false;
+			}
+			if (c == '\n') {
+				bool ok = !t->line_overflow;
+				t->line_overflow = false;
+				if (ok)
+					return true;
+				t->line_len = 0;
+				continue;
+			}
+			if (t->line_len < sizeof(t->line) - 1)
+				t->line[t->line_len++] = c;
+			else
+				t->line_overflow = true;
+		}
+	}
+}
+
+/*
+ * Fills dst with up to max bytes of converted output and returns how many
+ * were written. A return of 0 means the conversion is complete.
+ */
+size_t track_transcode(struct track_transcoder *t, uint8_t *dst, size_t max)
+{
+	size_t written = 0;
+
+	while (written < max) {
+		if (t->out_pos < t->out_len) {
+			size_t n = t->out_len - t->out_pos;
+			if (n > max - written)
+				n = max - written;
+			memcpy(dst + written, t->out + t->out_pos, n);
+			t->out_pos += n;
+			written += n;
+			continue;
+		}
+		t->out_pos = 0;
+		t->out_len = 0;
+
+		if (t->stage == STAGE_HEADER) {
+			t->out_len = format_header(t->fmt, t->out, sizeof(t->out));
+			t->stage = STAGE_BODY;
+		} else if (t->stage == STAGE_BODY) {
+			struct track_point pt;
+			struct track_point kept;
+
+			t->line_len = 0;
+			if (!next_line(t)) {
+				t->stage = STAGE_FOOTER;
+				if (t->simplify && track_simplify_finish(t->simplify, &kept))
+					t->out_len = track_format_point(t->fmt, &kept, t->points,
+									t->out, sizeof(t->out));
+				if (t->out_len)
+					t->points++;
+				continue;
+			}
+			if (!track_parse_csv(t->line, t->line_len, &pt))
+				continue;
+			if (t->simplify) {
+				if (!track_simplify_push(t->simplify, &pt, &kept))
+					continue;
+				pt = kept;
+			}
+			t->out_len = track_format_point(t->fmt, &pt, t->points,
+							t->out, sizeof(t->out));
+			if (t->out_len)
+				t->points++;
+		} else if (t->stage == STAGE_FOOTER) {
+			t->out_len = format_footer(t->fmt, t->out, sizeof(t->out));
+			t->stage = STAGE_DONE;
+		} else {
+			break;
+		}
+	}
+	return written;
+}
@@ -0,0 +1,156 @@
+/*
+ * Log merging and daily statistics, see track_merge.h
+ */
+
+#include "track_merge.h"
+#include "geo.h"
+#include "trip.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STAMP_LEN 19 /* "YYYY-MM-DD HH:MM:SS" */
+
+/*
+ * Decimal as an integer in units of 10^-scale, ending at the next comma or
+ * the end of the line; digits past the scale are dropped. Anything else,
+ * or more than 10 integer digits, fails.
+ */
+static const char *fixed_number(const char *p, const char *end, int scale, int64_t *value)
+{
+	int64_t v = 0;
+	int whole = 0, frac = -1;
+	bool neg = false;
+
+	if (p < end && *p == '-') {
+		neg = true;
+		p++;
+	}
+	for (; p < end && *p != ','; p++) {
+		unsigned c = (unsigned)(*p - '0');
+
+		if (c <= 9) {
+			if (frac < 0) {
+				whole++;
+			} else if (frac < scale) {
+				frac++;
+			} else {
+				continue;
+			}
+			v = v * 10 + c;
+		} else if (*p == '.' && frac < 0) {
+			frac = 0;
+		} else {
+			return NULL;
+		}
+	}
+	if (whole == 0 || whole > 10)
+		return NULL;
+	for (frac = frac < 0 ? 0 : frac; frac < scale; frac++)
+		v *= 10;
+	*value = neg ? -v : v;
+	return p;
+}
+
+/* The layout track_csv_line() writes, or false to take the slow path */
+static bool parse_fast(const char *line, const char *end, struct merge_point *m)
+{
+	struct track_point pt;
+	int64_t v[5];
+	const char *p = line + STAMP_LEN;
+	static const int scale[5] = { 6, 6, 0, 2, 0 };
+
+	if (end - line <= STAMP_LEN || *p++ != ',')
+		return false;
+	for (int i = 0; i < 5; i++) {
+		if (!(p = fixed_number(p, end, scale[i], &v[i])))
+			return false;
+		if (i < 4 && (p == end || *p++ != ','))
+			return false;
+	}
+	if (p != end || llabs(v[0]) > 90000000 || llabs(v[1]) > 180000000 ||
+	    v[2] < 0 || v[2] > 255 || v[3] < 0 || v[3] > 65535 || v[4] < -24 || v[4] > 24)
+		return false;
+
+	memcpy(pt.local, line, STAMP_LEN);
+	pt.local[STAMP_LEN] = '\0';
+	pt.offset_hours = (int)v[4];
+	if (!track_utc_time(&pt, &m->utc))
+		return false;
+	m->lat_e6 = (int32_t)v[0];
+	m->lng_e6 = (int32_t)v[1];
+	m->sats = (uint8_t)v[2];
+	m->hdop_c = (uint16_t)v[3];
+	m->offset_hours = (int8_t)v[4];
+	return true;
+}
+
+bool merge_parse_csv(const char *line, size_t len, uint16_t unit, struct merge_point *m)
+{
+	struct track_point pt;
+	const char *end = line + len;
+
+	while (end > line && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' '))
+		end--;
+	m->unit = unit;
+	if (parse_fast(line, end, m))
+		return true;
+
+	if (!track_parse_csv(line, len, &pt) || !track_utc_time(&pt, &m->utc))
+		return false;
+	if (fabs(pt.lat) > 90 || fabs(pt.lng) > 180)
+		return false;
+	m->lat_e6 = (int32_t)lround(pt.lat * 1e6);
+	m->lng_e6 = (int32_t)lround(pt.lng * 1e6);
+	m->sats = pt.sats < 0 ? 0 : pt.sats > 255 ? 255 : (uint8_t)pt.sats;
+	m->hdop_c = pt.hdop < 0 ? 0 : pt.hdop > 655 ? 65535 : (uint16_t)lroundf(pt.hdop * 100);
+	m->offset_hours = (int8_t)pt.offset_hours;
+	return true;
+}
+
+void merge_track_point(const struct merge_point *m, struct track_point *pt)
+{
+	pt->lat = m->lat_e6 / 1e6;
+	pt->lng = m->lng_e6 / 1e6;
+	pt->sats = m->sats;
+	pt->hdop = m->hdop_c / 100.0f;
+	pt->offset_hours = m->offset_hours;
+	track_set_local(pt, m->utc);
+}
+
+int32_t merge_local_day(const struct merge_point *m)
+{
+	int64_t t = m->utc + (int64_t)m->offset_hours * 3600;
+
+	return (int32_t)(t >= 0 ? t / 86400 : (t - 86399) / 86400);
+}
+
+/*
+ * Adds p to the day it falls on. prev is the unit's previous point or
+ * NULL; a step that crosses midnight counts for the later day.
+ */
+void merge_day_add(struct merge_day *d, const struct merge_point *prev,
+		   const struct merge_point *p)
+{
+	const uint16_t max_hdop = (uint16_t)(TRIP_MAX_HDOP * 100);
+	int64_t dt;
+
+	d->points++;
+	if (!prev || prev->hdop_c > max_hdop || p->hdop_c > max_hdop)
+		return;
+	dt = p->utc - prev->utc;
+	if (dt <= 0 || dt > MERGE_MAX_GAP_S)
+		return;
+
+	float dist = geo_distance_m(prev->lat_e6 / 1e6, prev->lng_e6 / 1e6,
+				    p->lat_e6 / 1e6, p->lng_e6 / 1e6);
+	float kmh = dist / dt * 3.6f;
+
+	if (kmh < TRIP_START_KMH)
+		return;
+	d->moving_s += (uint32_t)dt;
+	d->distance_m += dist;
+	if (kmh > d->max_kmh)
+		d->max_kmh = kmh;
+}
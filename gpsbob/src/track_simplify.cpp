@@ -0,0 +1,105 @@
+/*
+ * One-pass track simplification, see track_simplify.h
+ */
+
+#include "track_simplify.h"
+#include "geo.h"
+
+#include <math.h>
+#include <string.h>
+
+#define DEG_TO_RAD_F 0.017453292519943295f
+
+void track_simplify_init(struct track_simplify *s, float tol_m)
+{
+	memset(s, 0, sizeof(*s));
+	s->tol_m = tol_m;
+}
+
+static void project(const struct track_simplify *s, const struct track_point *pt,
+		    float *x, float *y)
+{
+	*x = (float)((pt->lng - s->anchor.lng) * GEO_METERS_PER_DEG) * s->cos_lat;
+	*y = (float)((pt->lat - s->anchor.lat) * GEO_METERS_PER_DEG);
+}
+
+static void set_anchor(struct track_simplify *s, const struct track_point *pt)
+{
+	s->anchor = *pt;
+	s->cos_lat = cosf((float)pt->lat * DEG_TO_RAD_F);
+	s->count = 0;
+}
+
+/* Squared distance from (px, py) to the segment origin -> (bx, by) */
+static float seg_dist2(float px, float py, float bx, float by)
+{
+	float len2 = bx * bx + by * by;
+	float t = 0.0f;
+
+	if (len2 > 0.0f) {
+		t = (px * bx + py * by) / len2;
+		if (t < 0.0f)
+			t = 0.0f;
+		else if (t > 1.0f)
+			t = 1.0f;
+	}
+	float dx = px - t * bx;
+	float dy = py - t * by;
+	return dx * dx + dy * dy;
+}
+
+/*
+ * Feeds the next point. Returns true with *out set when a point has to be
+ * kept; at most one point is released per call.
+ */
+bool track_simplify_push(struct track_simplify *s, const struct track_point *pt,
+			 struct track_point *out)
+{
+	float x, y;
+
+	s->points_in++;
+	if (s->tol_m <= 0.0f || !s->have_anchor) {
+		set_anchor(s, pt);
+		s->have_anchor = true;
+		*out = *pt;
+		s->points_out++;
+		return true;
+	}
+
+	project(s, pt, &x, &y);
+
+	bool keep_last = s->count == TRACK_SIMPLIFY_WINDOW;
+	float tol2 = s->tol_m * s->tol_m;
+	for (uint8_t i = 0; i < s->count && !keep_last; i++)
+		keep_last = seg_dist2(s->wx[i], s->wy[i], x, y) > tol2;
+
+	if (!keep_last) {
+		s->wx[s->count] = x;
+		s->wy[s->count] = y;
+		s->count++;
+		s->last = *pt;
+		s->have_last = true;
+		return false;
+	}
+
+	*out = s->last;
+	s->points_out++;
+	set_anchor(s, &s->last);
+	project(s, pt, &x, &y);
+	s->wx[0] = x;
+	s->wy[0] = y;
+	s->count = 1;
+	s->last = *pt;
+	return true;
+}
+
+/* Releases the final point of the track if it has not been kept yet */
+bool track_simplify_finish(struct track_simplify *s, struct track_point *out)
+{
+	if (s->tol_m <= 0.0f || !s->have_last || s->count == 0)
+		return false;
+	*out = s->last;
+	s->count = 0;
+	s->points_out++;
+	return true;
+}
@@ -0,0 +1,117 @@
+/*
+ * Trip computer, see trip.h
+ */
+
+#include "trip.h"
+#include "geo.h"
+
+#include <string.h>
+
+bool trip_valid(const struct trip *t)
+{
+	return t->magic == TRIP_MAGIC && t->version == TRIP_VERSION;
+}
+
+void trip_reset(struct trip *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->magic = TRIP_MAGIC;
+	t->version = TRIP_VERSION;
+}
+
+/* Keeps the totals but starts over from the next fix, e.g. after waking up */
+void trip_resume(struct trip *t)
+{
+	t->have_anchor = false;
+	t->alt_valid = false;
+	t->moving = false;
+}
+
+static void set_anchor(struct trip *t, const struct trip_fix *f)
+{
+	t->anchor_lat = f->lat;
+	t->anchor_lng = f->lng;
+	t->have_anchor = true;
+}
+
+static void update_altitude(struct trip *t, const struct trip_fix *f, float gate)
+{
+	if (!f->alt_valid)
+		return;
+	if (!t->alt_valid) {
+		t->alt_ref = f->alt_m;
+		t->alt_valid = true;
+		return;
+	}
+
+	float diff = f->alt_m - t->alt_ref;
+	float step = gate * TRIP_VERT_FACTOR;
+
+	if (diff >= step) {
+		t->ascent_m += diff;
+		t->alt_ref = f->alt_m;
+	} else if (diff <= -step) {
+		t->descent_m -= diff;
+		t->alt_ref = f->alt_m;
+	}
+}
+
+/*
+ * Distance only accumulates while moving. While stopped the anchor stays
+ * where the stop began, so the first metres of the next start are still
+ * counted once moving is detected.
+ */
+void trip_update(struct trip *t, const struct trip_fix *f)
+{
+	bool good = f->hdop > 0 && f->hdop <= TRIP_MAX_HDOP;
+
+	if (!t->have_anchor || f->ms - t->last_ms > TRIP_MAX_GAP_MS) {
+		t->last_ms = f->ms;
+		t->moving = false;
+		if (good) {
+			set_anchor(t, f);
+			t->alt_valid = false;
+			update_altitude(t, f, 0);
+		}
+		return;
+	}
+
+	uint32_t dt = f->ms - t->last_ms;
+	t->last_ms = f->ms;
+
+	if (good) {
+		if (!t->moving && f->speed_kmh >= TRIP_START_KMH)
+			t->moving = true;
+		else if (t->moving && f->speed_kmh < TRIP_STOP_KMH)
+			t->moving = false;
+	}
+	if (t->moving)
+		t->moving_ms += dt;
+	else
+		t->stopped_ms += dt;
+
+	if (!good)
+		return;
+
+	float gate = f->hdop * TRIP_UERE_M;
+	if (gate < TRIP_MIN_STEP_M)
+		gate = TRIP_MIN_STEP_M;
+
+	if (t->moving) {
+		float d = geo_distance_m(t->anchor_lat, t->anchor_lng, f->lat, f->lng);
+		if (d >= gate) {
+			t->distance_m += d;
+			set_anchor(t, f);
+		}
+		if (f->speed_kmh > t->max_kmh)
+			t->max_kmh = f->speed_kmh;
+	}
+	update_altitude(t, f, gate);
+}
+
+float trip_avg_kmh(const struct trip *t)
+{
+	if (t->moving_ms == 0)
+		return 0;
+	return t->distance_m / (t->moving_ms / 1000.0f) * 3.6f;
+}
@@ -0,0 +1,358 @@
+/*
+ * button: gestures from settled levels and edge times, a long press ending
+ * a pending single, and the event ring when loop() does not drain it.
+ * Then a discrete-event stand-in for the firmware: bouncing presses, the
+ * edge interrupt, the settle and gesture timers and a loop() that stalls
+ * on display transfers and SD flushes, against polling the level once per
+ * loop() iteration as handle_button() did before.
+ */
+
+#include <unity.h>
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "button.h"
+
+#define DOUBLE_MS 250
+#define LONG_MS 3000
+#define DEBOUNCE_US 20000
+#define MS 1000
+
+static struct button b;
+
+void setUp(void)
+{
+	button_init(&b, DOUBLE_MS, LONG_MS);
+}
+
+void tearDown(void) {}
+
+static uint32_t rng = 1;
+
+static uint32_t urand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+/* Uniform in [lo, hi] */
+static uint32_t range(uint32_t lo, uint32_t hi)
+{
+	return lo + urand() % (hi - lo + 1);
+}
+
+/* A press at t_ms held for held_ms, sampled when each level has settled */
+static uint32_t press(uint32_t t_ms, uint32_t held_ms)
+{
+	button_sample(&b, true, t_ms * MS, t_ms * MS + DEBOUNCE_US);
+	return button_sample(&b, false, (t_ms + held_ms) * MS, (t_ms + held_ms) * MS + DEBOUNCE_US);
+}
+
+void test_single(void)
+{
+	struct button_event ev;
+
+	TEST_ASSERT_EQUAL_UINT32(DOUBLE_MS * MS - DEBOUNCE_US, press(1000, 120));
+	TEST_ASSERT_FALSE(button_get(&b, &ev));
+	/* Early timer: wait for the rest */
+	TEST_ASSERT_EQUAL_UINT32(30 * MS, button_sample(&b, false, 1340 * MS, 1340 * MS));
+	TEST_ASSERT_FALSE(button_get(&b, &ev));
+	TEST_ASSERT_EQUAL_UINT32(0, button_sample(&b, false, 1370 * MS, 1370 * MS));
+	TEST_ASSERT_TRUE(button_get(&b, &ev));
+	TEST_ASSERT_EQUAL(BUTTON_SINGLE, ev.gesture);
+	TEST_ASSERT_EQUAL_UINT32(120, ev.held_ms);
+	TEST_ASSERT_EQUAL_UINT32(1000 * MS, ev.start_us);
+	TEST_ASSERT_EQUAL_UINT32(1370 * MS, ev.done_us);
+	TEST_ASSERT_FALSE(button_get(&b, &ev));
+	TEST_ASSERT_EQUAL_UINT32(0, button_sample(&b, false, 2000 * MS, 2000 * MS));
+}
+
+void test_double(void)
+{
+	struct button_event ev;
+
+	TEST_ASSERT_NOT_EQUAL(0, press(1000, 100));
+	/* Second press inside the window ends the gesture on its release */
+	TEST_ASSERT_EQUAL_UINT32(0, press(1200, 90));
+	TEST_ASSERT_TRUE(button_get(&b, &ev));
+	TEST_ASSERT_EQUAL(BUTTON_DOUBLE, ev.gesture);
+	TEST_ASSERT_EQUAL_UINT32(90, ev.held_ms);
+	TEST_ASSERT_EQUAL_UINT32(1000 * MS, ev.start_us);
+	TEST_ASSERT_FALSE(button_get(&b, &ev));
+	/* No single follows */
+	TEST_ASSERT_EQUAL_UINT32(0, button_sample(&b, false, 3000 * MS, 3000 * MS));
+	TEST_ASSERT_FALSE(button_get(&b, &ev));
+}
+
+/* Measured from the edges, however late the level is sampled */
+void test_long(void)
+{
+	struct button_event ev;
+
+	button_sample(&b, true, 1000 * MS, 1000 * MS + DEBOUNCE_US);
+	TEST_ASSERT_EQUAL_UINT32(0, button_sample(&b, false, 4000 * MS, 4900 * MS));
+	TEST_ASSERT_TRUE(button_get(&b, &ev));
+	TEST_ASSERT_EQUAL(BUTTON_LONG, ev.gesture);
+	TEST_ASSERT_EQUAL_UINT32(LONG_MS, ev.held_ms);
+	TEST_ASSERT_EQUAL_UINT32(4900 * MS, ev.done_us);
+	/* One ms short of long, sampled late, is still a press */
+	TEST_ASSERT_NOT_EQUAL(0, press(10000, LONG_MS - 1));
+	TEST_ASSERT_FALSE(button_get(&b, &ev));
+}
+
+void test_long_ends_pending_single(void)
+{
+	struct button_event ev;
+
+	TEST_ASSERT_NOT_EQUAL(0, press(1000, 100));
+	TEST_ASSERT_EQUAL_UINT32(0, press(1200, 3500));
+	TEST_ASSERT_TRUE(button_get(&b, &ev));
+	TEST_ASSERT_EQUAL(BUTTON_LONG, ev.gesture);
+	TEST_ASSERT_EQUAL_UINT32(3500, ev.held_ms);
+	TEST_ASSERT_EQUAL_UINT32(1000 * MS, ev.start_us);
+	/* The first press is not reported as well */
+	TEST_ASSERT_EQUAL_UINT32(0, button_sample(&b, false, 9000 * MS, 9000 * MS));
+	TEST_ASSERT_FALSE(button_get(&b, &ev));
+	/* And the next press starts a gesture of its own */
+	press(10000, 100);
+	button_sample(&b, false, 11000 * MS, 11000 * MS);
+	TEST_ASSERT_TRUE(button_get(&b, &ev));
+	TEST_ASSERT_EQUAL(BUTTON_SINGLE, ev.gesture);
+	TEST_ASSERT_EQUAL_UINT32(10000 * MS, ev.start_us);
+}
+
+/* Full ring: newer events are dropped and counted, the queued ones kept */
+void test_ring_full(void)
+{
+	struct button_event ev;
+
+	for (int i = 0; i < BUTTON_QUEUE + 3; i++) {
+		press(1000 * (i + 1), 100 + i);
+		button_sample(&b, false, (1000 * (i + 1) + 500) * MS, (1000 * (i + 1) + 500) * MS);
+	}
+	TEST_ASSERT_EQUAL_UINT32(3, b.dropped);
+	for (int i = 0; i < BUTTON_QUEUE; i++) {
+		TEST_ASSERT_TRUE(button_get(&b, &ev));
+		TEST_ASSERT_EQUAL_UINT32(100 + i, ev.held_ms);
+	}
+	TEST_ASSERT_FALSE(button_get(&b, &ev));
+	/* Room again */
+	press(70000, 200);
+	button_sample(&b, false, 71000 * MS, 71000 * MS);
+	TEST_ASSERT_TRUE(button_get(&b, &ev));
+	TEST_ASSERT_EQUAL_UINT32(200, ev.held_ms);
+	TEST_ASSERT_EQUAL_UINT32(3, b.dropped);
+}
+
+void test_names(void)
+{
+	TEST_ASSERT_EQUAL_STRING("single", button_gesture_name(BUTTON_SINGLE));
+	TEST_ASSERT_EQUAL_STRING("double", button_gesture_name(BUTTON_DOUBLE));
+	TEST_ASSERT_EQUAL_STRING("long", button_gesture_name(BUTTON_LONG));
+}
+
+// === Simulation: gestures during loop() stalls ===
+#define GESTURES 3000
+
+struct edge {
+	uint64_t us;
+	bool down;
+};
+
+struct gesture {
+	enum button_gesture kind;
+	uint64_t start_us;
+	uint64_t release_us; /* Last release */
+};
+
+static std::vector<struct edge> edges;
+static std::vector<uint64_t> presses; /* Each physical press */
+
+/* A transition with up to 8 bounce edges over its first few ms */
+static void transition(uint64_t us, bool down)
+{
+	int n = range(0, 4) * 2;
+
+	for (int i = 0; i < n; i++, us += range(100, 1200))
+		edges.push_back({ us, i % 2 ? !down : down });
+	edges.push_back({ us, down });
+}
+
+static void phys_press(uint64_t us, uint32_t held_ms)
+{
+	presses.push_back(us);
+	transition(us, true);
+	transition(us + held_ms * MS, false);
+}
+
+static bool level_at(uint64_t us)
+{
+	auto it = std::upper_bound(edges.begin(), edges.end(), us,
+				   [](uint64_t t, const struct edge &e) { return t < e.us; });
+	return it != edges.begin() && (it - 1)->down;
+}
+
+static double pct(std::vector<double> v, double p)
+{
+	std::sort(v.begin(), v.end());
+	return v[(size_t)(p * (v.size() - 1))];
+}
+
+void test_gestures_during_stalls(void)
+{
+	std::vector<struct gesture> truth;
+	std::vector<uint64_t> iters;
+	std::vector<struct button_event> got;
+	uint64_t t = 1000 * MS;
+	char msg[160];
+
+	rng = 50;
+	edges.clear();
+	presses.clear();
+	for (int g = 0; g < GESTURES; g++) {
+		struct gesture gs = { BUTTON_SINGLE, t, 0 };
+		uint32_t r = urand() % 10;
+
+		if (r < 5) {
+			uint32_t held = range(60, 600);
+			phys_press(t, held);
+			gs.release_us = t + held * MS;
+		} else if (r < 8) {
+			uint32_t h1 = range(60, 150), gap = range(60, 170), h2 = range(60, 150);
+			phys_press(t, h1);
+			phys_press(t + (h1 + gap) * MS, h2);
+			gs.kind = BUTTON_DOUBLE;
+			gs.release_us = t + (h1 + gap + h2) * MS;
+		} else {
+			uint32_t held = range(LONG_MS + 200, LONG_MS + 1500);
+			phys_press(t, held);
+			gs.kind = BUTTON_LONG;
+			gs.release_us = t + held * MS;
+		}
+		truth.push_back(gs);
+		t = gs.release_us + range(800, 2500) * MS;
+	}
+	uint64_t end = t + 1000 * MS;
+
+	/* loop(): 2-5 ms, a frame to the display every second, SD flushes */
+	for (uint64_t it = 0, frame = 0; it < end;) {
+		uint64_t w = range(2000, 5000);
+
+		iters.push_back(it);
+		if (it - frame >= 1000 * MS) {
+			w += 25 * MS;
+			frame = it;
+		}
+		if (urand() % 100 < 4)
+			w += range(40, 250) * MS;
+		it += w;
+	}
+
+	/*
+	 * The firmware: the first edge arms the settle timer, which samples
+	 * the level; the gesture timer samples it again when asked to; loop()
+	 * drains the ring at the start of each iteration.
+	 */
+	const uint64_t none = UINT64_MAX;
+	uint64_t settle_at = none, gesture_at = none, edge_us = 0;
+	std::vector<double> reaction[3];
+	size_t ei = 0, ii = 0, drained = 0;
+
+	for (;;) {
+		uint64_t te = ei < edges.size() ? edges[ei].us : none;
+		uint64_t ti = ii < iters.size() ? iters[ii] : none;
+		uint64_t now = std::min(std::min(te, ti), std::min(settle_at, gesture_at));
+		uint32_t wait;
+
+		if (now == none)
+			break;
+		if (now == settle_at) {
+			settle_at = none;
+			wait = button_sample(&b, level_at(now), (uint32_t)edge_us, (uint32_t)now);
+			gesture_at = wait ? now + wait : none;
+		} else if (now == gesture_at) {
+			wait = button_sample(&b, b.down, (uint32_t)now, (uint32_t)now);
+			gesture_at = wait ? now + wait : none;
+		} else if (now == te) {
+			if (settle_at == none) {
+				edge_us = now;
+				settle_at = now + DEBOUNCE_US;
+			}
+			ei++;
+		} else {
+			struct button_event ev;
+
+			while (button_get(&b, &ev)) {
+				got.push_back(ev);
+				if (drained < truth.size())
+					reaction[ev.gesture].push_back(
+						(now - truth[drained].release_us) / 1e3);
+				drained++;
+			}
+			ii++;
+		}
+	}
+
+	int wrong = 0;
+	for (size_t i = 0; i < got.size() && i < truth.size(); i++)
+		wrong += got[i].gesture != truth[i].kind ||
+			 got[i].start_us != (uint32_t)truth[i].start_us;
+	for (int k = 0; k < 3; k++) {
+		snprintf(msg, sizeof(msg), "%-6s n=%4zu reaction after release p50 %.1f p99 %.1f max %.1f ms",
+			 button_gesture_name((enum button_gesture)k), reaction[k].size(),
+			 pct(reaction[k], 0.5), pct(reaction[k], 0.99), pct(reaction[k], 1));
+		TEST_MESSAGE(msg);
+	}
+
+	/* Before: the level polled at the start of each iteration */
+	unsigned long last_change = 0;
+	bool was = false;
+	size_t seen = 0;
+	for (uint64_t it : iters) {
+		unsigned long ms = it / MS;
+		bool pressed = level_at(it);
+
+		if (pressed && !was && ms - last_change > 50) {
+			seen++;
+			was = true;
+			last_change = ms;
+		}
+		if (!pressed && was)
+			was = false;
+	}
+	uint64_t stall = 0;
+	for (size_t i = 1; i < iters.size(); i++)
+		stall = std::max(stall, iters[i] - iters[i - 1]);
+
+	snprintf(msg, sizeof(msg), "%d gestures, %zu events, %d wrong, %u dropped; polling saw "
+		 "%zu of %zu presses; loop() stalls up to %.0f ms",
+		 GESTURES, got.size(), wrong, (unsigned)b.dropped, seen, presses.size(), stall / 1e3);
+	TEST_MESSAGE(msg);
+	TEST_ASSERT_EQUAL_INT_MESSAGE(GESTURES, (int)got.size(), msg);
+	TEST_ASSERT_EQUAL_INT_MESSAGE(0, wrong, msg);
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, b.dropped, msg);
+	TEST_ASSERT_TRUE_MESSAGE(seen < presses.size(), msg);
+	/* A single waits for the double window; a reaction for one stall at most */
+	TEST_ASSERT_TRUE_MESSAGE(pct(reaction[BUTTON_SINGLE], 1) * MS <
+				 DEBOUNCE_US + DOUBLE_MS * MS + stall, msg);
+	TEST_ASSERT_TRUE_MESSAGE(pct(reaction[BUTTON_DOUBLE], 1) * MS < DEBOUNCE_US + stall, msg);
+	TEST_ASSERT_TRUE_MESSAGE(pct(reaction[BUTTON_LONG], 1) * MS < DEBOUNCE_US + stall, msg);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_single);
+	RUN_TEST(test_double);
+	RUN_TEST(test_long);
+	RUN_TEST(test_long_ends_pending_single);
+	RUN_TEST(test_ring_full);
+	RUN_TEST(test_names);
+	RUN_TEST(test_gestures_during_stalls);
+	return UNITY_END();
+}
@@ -0,0 +1,234 @@
+/*
+ * fix_gate: each verdict on its own, the first fix taken without a
+ * reference, the reseed after FIX_GATE_RESEED jumps, and 3 h of a drive
+ * with a cold start and random bad fixes.
+ */
+
+#include <unity.h>
+
+#include <stdio.h>
+
+#include "fix_gate.h"
+#include "geo.h"
+
+static const struct fix_gate_limits lim = { 4, 5.0f, 2000, true, 300 };
+static struct fix_gate gate;
+
+void setUp(void)
+{
+	fix_gate_reset(&gate);
+}
+
+void tearDown(void) {}
+
+static uint32_t rng = 1;
+
+static uint32_t urand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static struct fix_sample good(double lat, double lng, uint32_t ms)
+{
+	struct fix_sample s = { true, lat, lng, FIX_QUALITY_GPS, 9, 0.9f, 100, ms };
+
+	return s;
+}
+
+static enum fix_verdict check(const struct fix_sample *s)
+{
+	return fix_gate_check(&gate, &lim, s);
+}
+
+void test_each_verdict(void)
+{
+	struct fix_sample s = good(48, 11, 1000);
+
+	TEST_ASSERT_EQUAL(FIX_ACCEPTED, check(&s));
+
+	s = good(48, 11, 2000);
+	s.has_fix = false;
+	TEST_ASSERT_EQUAL(FIX_NO_FIX, check(&s));
+	s = good(48, 11, 2000);
+	s.quality = FIX_QUALITY_ESTIMATED;
+	TEST_ASSERT_EQUAL(FIX_QUALITY, check(&s));
+	s.quality = FIX_QUALITY_INVALID;
+	TEST_ASSERT_EQUAL(FIX_QUALITY, check(&s));
+	s = good(48, 11, 2000);
+	s.sats = 3;
+	TEST_ASSERT_EQUAL(FIX_SATS, check(&s));
+	s = good(48, 11, 2000);
+	s.hdop = 5.5f;
+	TEST_ASSERT_EQUAL(FIX_HDOP, check(&s));
+	s.hdop = 0; /* Not reported */
+	TEST_ASSERT_EQUAL(FIX_HDOP, check(&s));
+	s = good(48, 11, 2000);
+	s.age_ms = 2001;
+	TEST_ASSERT_EQUAL(FIX_AGE, check(&s));
+	s = good(48.01, 11, 2000); /* 1.1 km in a second */
+	TEST_ASSERT_EQUAL(FIX_JUMP, check(&s));
+
+	for (int v = FIX_ACCEPTED; v < FIX_VERDICTS; v++)
+		TEST_ASSERT_EQUAL_UINT32(v == FIX_QUALITY || v == FIX_HDOP ? 2 : 1, gate.count[v]);
+	TEST_ASSERT_EQUAL_UINT32(8, fix_gate_rejected(&gate));
+	TEST_ASSERT_EQUAL_STRING("jump", fix_verdict_name(FIX_JUMP));
+}
+
+/* Checked in the order documented, the first failing check names the verdict */
+void test_verdict_order(void)
+{
+	struct fix_sample s = good(48, 11, 1000);
+
+	s.quality = FIX_QUALITY_MANUAL;
+	s.sats = 0;
+	s.hdop = 99;
+	TEST_ASSERT_EQUAL(FIX_QUALITY, check(&s));
+	s.quality = FIX_QUALITY_DGPS;
+	TEST_ASSERT_EQUAL(FIX_SATS, check(&s));
+	s.sats = 4;
+	TEST_ASSERT_EQUAL(FIX_HDOP, check(&s));
+	s.hdop = 5;
+	TEST_ASSERT_EQUAL(FIX_ACCEPTED, check(&s));
+}
+
+void test_limits_off(void)
+{
+	struct fix_gate_limits open = lim;
+	struct fix_sample s = good(48, 11, 1000);
+
+	open.check_quality = false;
+	open.max_kmh = 0;
+	TEST_ASSERT_EQUAL(FIX_ACCEPTED, fix_gate_check(&gate, &open, &s));
+	s = good(10, 100, 2000);
+	s.quality = FIX_QUALITY_SIMULATED;
+	TEST_ASSERT_EQUAL(FIX_ACCEPTED, fix_gate_check(&gate, &open, &s));
+}
+
+/* With no reference there is nothing to judge a jump against */
+void test_first_fix_without_reference(void)
+{
+	struct fix_sample s = good(-33.9, 151.2, 5000);
+
+	TEST_ASSERT_FALSE(gate.have_ref);
+	TEST_ASSERT_EQUAL(FIX_ACCEPTED, check(&s));
+	TEST_ASSERT_TRUE(gate.have_ref);
+	TEST_ASSERT_EQUAL_UINT32(5000, gate.ref_ms);
+	/* A rejected fix does not become the reference */
+	s = good(-33.9, 151.2, 6000);
+	s.sats = 2;
+	TEST_ASSERT_EQUAL(FIX_SATS, check(&s));
+	TEST_ASSERT_EQUAL_UINT32(5000, gate.ref_ms);
+}
+
+/* A bad reference from the cold start is replaced after FIX_GATE_RESEED jumps */
+void test_reseed_after_jumps(void)
+{
+	struct fix_sample s = good(48.3, 11, 0); /* 33 km off */
+	uint32_t ms = 1000;
+
+	TEST_ASSERT_EQUAL(FIX_ACCEPTED, check(&s));
+	for (int i = 1; i < FIX_GATE_RESEED; i++, ms += 1000) {
+		s = good(48, 11, ms);
+		TEST_ASSERT_EQUAL(FIX_JUMP, check(&s));
+	}
+	s = good(48, 11, ms);
+	TEST_ASSERT_EQUAL(FIX_ACCEPTED, check(&s));
+	TEST_ASSERT_EQUAL(0, gate.jumps);
+	TEST_ASSERT_EQUAL_UINT32(FIX_GATE_RESEED - 1, gate.count[FIX_JUMP]);
+	/* And the real track goes on from there */
+	s = good(48.0001, 11, ms + 1000);
+	TEST_ASSERT_EQUAL(FIX_ACCEPTED, check(&s));
+}
+
+/* Only jumps in a row count towards the reseed */
+void test_jump_count_restarts(void)
+{
+	struct fix_sample s = good(48, 11, 0);
+	uint32_t ms = 1000;
+
+	TEST_ASSERT_EQUAL(FIX_ACCEPTED, check(&s));
+	for (int round = 0; round < 3; round++) {
+		for (int i = 1; i < FIX_GATE_RESEED; i++, ms += 1000) {
+			s = good(48.05, 11, ms);
+			TEST_ASSERT_EQUAL(FIX_JUMP, check(&s));
+		}
+		s = good(48, 11, ms);
+		ms += 1000;
+		TEST_ASSERT_EQUAL(FIX_ACCEPTED, check(&s));
+	}
+}
+
+// === Simulation: 3 h at 50 km/h ===
+void test_drive_3h(void)
+{
+	uint32_t bad = 0, bad_passed = 0, fine = 0, fine_rejected = 0;
+	double lat = 52.0, lng = 4.0;
+	char msg[160];
+
+	rng = 48;
+	for (uint32_t t = 0; t < 3 * 3600; t++) {
+		struct fix_sample s = good(lat, lng, t * 1000);
+		bool is_bad = true;
+
+		/* Cold start: no fix, estimated, few satellites far off, then one off fix */
+		if (t < 10)
+			s.has_fix = false;
+		else if (t < 15) {
+			s.quality = FIX_QUALITY_ESTIMATED;
+			s.lat += 3;
+		} else if (t < 30) {
+			s.sats = 3;
+			s.hdop = 15;
+			s.lat += 0.5;
+		} else if (t == 30)
+			s.lat += 0.3;
+		else if (urand() % 100 == 0)
+			s.lat += urand() % 2 ? 0.02 : -0.02; /* 2 km multipath jump */
+		else if (urand() % 200 == 0)
+			s.age_ms = 5000;
+		else if (urand() % 300 == 0)
+			s.hdop = 8;
+		else
+			is_bad = false;
+
+		enum fix_verdict v = check(&s);
+		if (is_bad) {
+			bad++;
+			bad_passed += v == FIX_ACCEPTED;
+		} else {
+			fine++;
+			fine_rejected += v != FIX_ACCEPTED;
+		}
+		lat += 50 / 3.6 / GEO_METERS_PER_DEG;
+	}
+
+	snprintf(msg, sizeof(msg), "%u bad fixes, %u passed; %u good, %u rejected "
+		 "(no fix %u, quality %u, sats %u, hdop %u, age %u, jump %u)",
+		 (unsigned)bad, (unsigned)bad_passed, (unsigned)fine, (unsigned)fine_rejected,
+		 (unsigned)gate.count[FIX_NO_FIX], (unsigned)gate.count[FIX_QUALITY],
+		 (unsigned)gate.count[FIX_SATS], (unsigned)gate.count[FIX_HDOP],
+		 (unsigned)gate.count[FIX_AGE], (unsigned)gate.count[FIX_JUMP]);
+	TEST_MESSAGE(msg);
+	/*
+	 * The off fix at t = 30 passes as the first reference; the good
+	 * fixes after it are rejected as jumps until the reseed.
+	 */
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, bad_passed, msg);
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(FIX_GATE_RESEED - 1, fine_rejected, msg);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_each_verdict);
+	RUN_TEST(test_verdict_order);
+	RUN_TEST(test_limits_off);
+	RUN_TEST(test_first_fix_without_reference);
+	RUN_TEST(test_reseed_after_jumps);
+	RUN_TEST(test_jump_count_restarts);
+	RUN_TEST(test_drive_3h);
+	return UNITY_END();
+}
@@ -0,0 +1,121 @@
+/*
+ * fix_snapshot: one writer publishing as fast as it can against three
+ * readers on other threads. Every field of a published fix is derived
+ * from its count, so a torn copy shows up as a field that disagrees.
+ */
+
+#include <unity.h>
+
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+#include "fix_snapshot.h"
+
+#define PUBLISHES 2000000
+#define READERS 3
+
+static struct fix_snapshot snap;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void make_fix(uint32_t n, struct fix_data *d)
+{
+	memset(d, 0, sizeof(*d));
+	snprintf(d->utc, sizeof(d->utc), "U%010u", (unsigned)n);
+	snprintf(d->local, sizeof(d->local), "L%010u", (unsigned)n);
+	d->lat = n * 1e-7;
+	d->lng = -(double)n;
+	d->kf_lat = n + 0.5;
+	d->kf_lng = n * 2.0;
+	d->hdop = (float)(n & 0xffff);
+	d->sats = (int32_t)(n % 97);
+	d->sentence_ms = n * 3;
+	d->count = n;
+}
+
+void test_empty(void)
+{
+	struct fix_data d;
+
+	fix_snapshot_init(&snap);
+	TEST_ASSERT_FALSE(fix_read(&snap, &d));
+	make_fix(1, &d);
+	fix_publish(&snap, &d);
+	memset(&d, 0, sizeof(d));
+	TEST_ASSERT_TRUE(fix_read(&snap, &d));
+	TEST_ASSERT_EQUAL_UINT32(1, d.count);
+	TEST_ASSERT_EQUAL_STRING("U0000000001", d.utc);
+}
+
+struct reader {
+	std::thread thread;
+	uint32_t reads;
+	uint32_t torn;
+	uint32_t backwards;
+};
+
+void test_no_torn_reads(void)
+{
+	struct reader readers[READERS];
+	std::atomic<bool> done(false);
+	char msg[128];
+
+	fix_snapshot_init(&snap);
+	for (auto &r : readers) {
+		r.reads = r.torn = r.backwards = 0;
+		r.thread = std::thread([&r, &done] {
+			uint32_t last = 0;
+
+			while (!done.load(std::memory_order_relaxed)) {
+				struct fix_data d, want;
+
+				if (!fix_read(&snap, &d))
+					continue;
+				make_fix(d.count, &want);
+				if (memcmp(&d, &want, sizeof(d)))
+					r.torn++;
+				if (d.count < last)
+					r.backwards++;
+				last = d.count;
+				r.reads++;
+			}
+		});
+	}
+
+	for (uint32_t n = 1; n <= PUBLISHES; n++) {
+		struct fix_data d;
+
+		make_fix(n, &d);
+		fix_publish(&snap, &d);
+	}
+	done = true;
+
+	for (auto &r : readers)
+		r.thread.join();
+
+	uint32_t reads = 0;
+	for (auto &r : readers) {
+		reads += r.reads;
+		TEST_ASSERT_EQUAL_UINT32(0, r.torn);
+		TEST_ASSERT_EQUAL_UINT32(0, r.backwards);
+		TEST_ASSERT_GREATER_THAN(0, r.reads);
+	}
+	snprintf(msg, sizeof(msg), "%d publishes, %u reads on %d threads, none torn",
+		 PUBLISHES, (unsigned)reads, READERS);
+	TEST_MESSAGE(msg);
+
+	struct fix_data d;
+	TEST_ASSERT_TRUE(fix_read(&snap, &d));
+	TEST_ASSERT_EQUAL_UINT32(PUBLISHES, d.count);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_empty);
+	RUN_TEST(test_no_torn_reads);
+	return UNITY_END();
+}
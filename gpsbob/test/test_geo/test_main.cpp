@@ -0,0 +1,215 @@
+/*
+ * geo: the float fast path against double haversine and TinyGPSPlus'
+ * formulas within the bounds documented in geo.h, the fallback outside
+ * them, and the cost of both paths.
+ */
+
+#include <unity.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "geo.h"
+
+#define PAIRS 500000
+#define DEG_TO_RAD 0.017453292519943295
+#define RAD_TO_DEG 57.29577951308232
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static uint32_t rng = 1;
+
+static double drand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return (rng & 0xffffff) / (double)0x1000000;
+}
+
+/* TinyGPSPlus::distanceBetween() and courseTo(), as in the library */
+static double tgp_distance(double lat1, double long1, double lat2, double long2)
+{
+	double delta = (long1 - long2) * DEG_TO_RAD;
+	double sdlong = sin(delta);
+	double cdlong = cos(delta);
+
+	lat1 *= DEG_TO_RAD;
+	lat2 *= DEG_TO_RAD;
+	double slat1 = sin(lat1), clat1 = cos(lat1);
+	double slat2 = sin(lat2), clat2 = cos(lat2);
+	delta = (clat1 * slat2) - (slat1 * clat2 * cdlong);
+	delta = delta * delta + (clat2 * sdlong) * (clat2 * sdlong);
+	delta = sqrt(delta);
+	double denom = (slat1 * slat2) + (clat1 * clat2 * cdlong);
+	return atan2(delta, denom) * 6372795;
+}
+
+static double tgp_course(double lat1, double long1, double lat2, double long2)
+{
+	double dlon = (long2 - long1) * DEG_TO_RAD;
+
+	lat1 *= DEG_TO_RAD;
+	lat2 *= DEG_TO_RAD;
+	double a1 = sin(dlon) * cos(lat2);
+	double a2 = cos(lat1) * sin(lat2) - sin(lat1) * cos(lat2) * cos(dlon);
+	a2 = atan2(a1, a2);
+	if (a2 < 0.0)
+		a2 += 2 * M_PI;
+	return a2 * RAD_TO_DEG;
+}
+
+static double angle_diff(double a, double b)
+{
+	double d = fmod(fabs(a - b), 360.0);
+
+	return d > 180 ? 360 - d : d;
+}
+
+/* Second point up to max_m away in a random direction */
+static void random_pair(double max_lat, double max_m, double *lat1, double *lng1,
+			double *lat2, double *lng2)
+{
+	double dist = drand() * max_m, dir = drand() * 2 * M_PI;
+
+	*lat1 = (drand() * 2 - 1) * max_lat;
+	*lng1 = (drand() * 2 - 1) * 180;
+	*lat2 = *lat1 + dist * cos(dir) / GEO_METERS_PER_DEG;
+	*lng2 = *lng1 + dist * sin(dir) / (GEO_METERS_PER_DEG * cos(*lat1 * DEG_TO_RAD));
+	if (*lng2 > 180)
+		*lng2 -= 360;
+	else if (*lng2 < -180)
+		*lng2 += 360;
+}
+
+static void check_fast_path(double max_lat, double max_course_err)
+{
+	double worst_d = 0, worst_c = 0, worst_tgp = 0;
+	char msg[128];
+
+	rng = 2024;
+	for (int i = 0; i < PAIRS; i++) {
+		double lat1, lng1, lat2, lng2;
+		struct geo_vector v;
+
+		random_pair(max_lat, GEO_FAST_MAX_M * 0.999, &lat1, &lng1, &lat2, &lng2);
+		geo_vector(lat1, lng1, lat2, lng2, &v);
+
+		double ref = geo_haversine_m(lat1, lng1, lat2, lng2);
+		double dd = fabs(v.dist_m - ref);
+		double dt = fabs(v.dist_m - tgp_distance(lat1, lng1, lat2, lng2));
+		worst_d = dd > worst_d ? dd : worst_d;
+		worst_tgp = dt > worst_tgp ? dt : worst_tgp;
+		/* Below a few metres the bearing is receiver noise anyway */
+		if (ref > 10) {
+			double dc = angle_diff(v.course_deg, tgp_course(lat1, lng1, lat2, lng2));
+			worst_c = dc > worst_c ? dc : worst_c;
+		}
+	}
+	snprintf(msg, sizeof(msg), "up to %.0f deg: distance %.4f m (TinyGPSPlus %.4f m), bearing %.4f deg",
+		 max_lat, worst_d, worst_tgp, worst_c);
+	TEST_MESSAGE(msg);
+	TEST_ASSERT_TRUE_MESSAGE(worst_d < 0.05, msg);
+	TEST_ASSERT_TRUE_MESSAGE(worst_tgp < 0.05, msg);
+	TEST_ASSERT_TRUE_MESSAGE(worst_c < max_course_err, msg);
+}
+
+void test_fast_path_to_60_deg(void) { check_fast_path(60, 0.08); }
+void test_fast_path_to_80_deg(void) { check_fast_path(GEO_FAST_MAX_LAT, 0.26); }
+
+void test_haversine_matches_tinygpsplus(void)
+{
+	rng = 7;
+	for (int i = 0; i < 100000; i++) {
+		double lat1 = (drand() * 2 - 1) * 89, lng1 = (drand() * 2 - 1) * 180;
+		double lat2 = (drand() * 2 - 1) * 89, lng2 = (drand() * 2 - 1) * 180;
+		double d = tgp_distance(lat1, lng1, lat2, lng2);
+
+		TEST_ASSERT_DOUBLE_WITHIN(1e-6 * d + 1e-3, d, geo_haversine_m(lat1, lng1, lat2, lng2));
+		if (d > 1)
+			TEST_ASSERT_TRUE(angle_diff(tgp_course(lat1, lng1, lat2, lng2),
+						    geo_initial_course_deg(lat1, lng1, lat2, lng2)) < 1e-6);
+	}
+}
+
+/* Outside the fast-path bounds geo_vector() is the haversine result */
+static void check_fallback(double lat1, double lng1, double lat2, double lng2)
+{
+	struct geo_vector v;
+
+	geo_vector(lat1, lng1, lat2, lng2, &v);
+	TEST_ASSERT_TRUE(v.dist_m == (float)geo_haversine_m(lat1, lng1, lat2, lng2));
+	TEST_ASSERT_TRUE(v.course_deg == (float)geo_initial_course_deg(lat1, lng1, lat2, lng2));
+}
+
+void test_fallback_near_poles(void)
+{
+	check_fallback(80.5, 10, 80.51, 10.2);
+	check_fallback(85, -120, 85.02, -119.5);
+	check_fallback(-81, 0, -81.01, 0.05);
+	check_fallback(89.9, 0, 89.9, 180); /* Across the pole, a few km */
+}
+
+void test_fallback_beyond_10km(void)
+{
+	check_fallback(48, 11, 48.1, 11);      /* 11 km */
+	check_fallback(0, 0, 0, 1);            /* 111 km */
+	check_fallback(51.5, -0.1, 40.7, -74); /* London - New York */
+}
+
+void test_antimeridian(void)
+{
+	struct geo_vector v;
+
+	geo_vector(0, 179.99, 0, -179.99, &v);
+	TEST_ASSERT_FLOAT_WITHIN(0.05, tgp_distance(0, 179.99, 0, -179.99), v.dist_m);
+	TEST_ASSERT_FLOAT_WITHIN(0.01, 90, v.course_deg);
+	geo_vector(0, -179.99, 0, 179.99, &v);
+	TEST_ASSERT_FLOAT_WITHIN(0.01, 270, v.course_deg);
+}
+
+static double now_s(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void test_bench(void)
+{
+	const int n = 2000000;
+	volatile float sink = 0;
+	char msg[128];
+
+	double t0 = now_s();
+	for (int i = 0; i < n; i++)
+		sink += geo_distance_m(48, 11, 48 + i * 1e-9, 11.01);
+	double fast = (now_s() - t0) / n;
+
+	t0 = now_s();
+	for (int i = 0; i < n; i++)
+		sink += (float)geo_haversine_m(48, 11, 48 + i * 1e-9, 11.01) +
+			(float)geo_initial_course_deg(48, 11, 48 + i * 1e-9, 11.01);
+	double slow = (now_s() - t0) / n;
+
+	snprintf(msg, sizeof(msg), "geo_vector fast path %.1f ns, haversine + course %.1f ns", fast * 1e9,
+		 slow * 1e9);
+	TEST_MESSAGE(msg);
+	TEST_ASSERT_TRUE_MESSAGE(fast < slow, msg);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_fast_path_to_60_deg);
+	RUN_TEST(test_fast_path_to_80_deg);
+	RUN_TEST(test_haversine_matches_tinygpsplus);
+	RUN_TEST(test_fallback_near_poles);
+	RUN_TEST(test_fallback_beyond_10km);
+	RUN_TEST(test_antimeridian);
+	RUN_TEST(test_bench);
+	return UNITY_END();
+}
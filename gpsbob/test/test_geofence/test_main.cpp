@@ -0,0 +1,265 @@
+/*
+ * geofence: parsing, containment against a brute-force test without the
+ * bounding boxes, confirmation of entries and exits, no event lost when
+ * the event buffer is full, and one hour of 10 Hz fixes through 1000
+ * fences.
+ */
+
+#include <unity.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "geo.h"
+#include "geofence.h"
+
+#define DEG_TO_RAD 0.017453292519943295
+#define BENCH_FENCES 1000
+#define BENCH_FIXES (3600 * 10)
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static uint32_t rng = 1;
+
+static double drand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return (rng & 0xffffff) / (double)0x1000000;
+}
+
+struct mem_reader {
+	const char *p;
+	size_t left;
+};
+
+static size_t mem_read(void *ctx, uint8_t *buf, size_t len)
+{
+	struct mem_reader *r = (struct mem_reader *)ctx;
+
+	if (len > r->left)
+		len = r->left;
+	memcpy(buf, r->p, len);
+	r->p += len;
+	r->left -= len;
+	return len;
+}
+
+static double now_s(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Runs the same fix count times, returns the events of the last one */
+static int feed(struct geofence_set *s, double lat, double lng, int count,
+		struct geofence_event *ev, int max)
+{
+	int n = 0;
+
+	while (count--)
+		n = geofence_update(s, lat, lng, ev, max);
+	return n;
+}
+
+void test_parse(void)
+{
+	static const char text[] =
+		"# Home and the yard\n"
+		"circle,home,48.1,11.5,50\n"
+		"\n"
+		"poly,yard\r\n"
+		"48.0,11.0\n"
+		"48.0,11.01\n"
+		"48.01,11.01\n"
+		"end\n"
+		"poly,too short\n"
+		"48.0,11.0\n"
+		"48.0,11.01\n"
+		"end\n"
+		"circle,bad,95,11,10\n"
+		"poly,open\n"
+		"48.2,11.0\n"
+		"48.2,11.1\n"
+		"48.3,11.1\n";
+	struct mem_reader in = { text, sizeof(text) - 1 };
+	struct geofence_set s;
+
+	geofence_init(&s);
+	TEST_ASSERT_EQUAL_UINT16(2, geofence_parse(&s, mem_read, &in));
+	TEST_ASSERT_EQUAL_STRING("home", s.fence[0].name);
+	TEST_ASSERT_EQUAL(GEOFENCE_CIRCLE, s.fence[0].type);
+	TEST_ASSERT_EQUAL_STRING("yard", s.fence[1].name);
+	TEST_ASSERT_EQUAL(GEOFENCE_POLY, s.fence[1].type);
+	TEST_ASSERT_EQUAL_UINT16(3, s.fence[1].count);
+	/* Dropped and unterminated polygons leave no vertices behind */
+	TEST_ASSERT_EQUAL_UINT32(3, s.nvert);
+	geofence_free(&s);
+}
+
+/* Every fence tested without the box, as geofence_update() would without the prefilter */
+void test_box_never_drops_a_fence(void)
+{
+	struct geofence_set s;
+	struct geofence_vertex v[12];
+
+	rng = 37;
+	geofence_init(&s);
+	for (int i = 0; i < 200; i++) {
+		double lat = 48 + drand() * 0.2, lng = 11 + drand() * 0.3;
+
+		if (i % 2) {
+			TEST_ASSERT_TRUE(geofence_add_circle(&s, "c", lat, lng, 20 + drand() * 500));
+			continue;
+		}
+		double r = 0.0005 + drand() * 0.005;
+		for (int k = 0; k < 12; k++) {
+			double a = k * 2 * M_PI / 12, rk = r * (0.4 + drand() * 0.6);
+			v[k].lat_e7 = (int32_t)lround((lat + rk * cos(a)) * 1e7);
+			v[k].lng_e7 = (int32_t)lround((lng + rk * sin(a) * 1.5) * 1e7);
+		}
+		TEST_ASSERT_TRUE(geofence_add_poly(&s, "p", v, 12));
+	}
+
+	int hits = 0;
+	for (int q = 0; q < 20000; q++) {
+		int32_t lat_e7 = (int32_t)lround((47.99 + drand() * 0.22) * 1e7);
+		int32_t lng_e7 = (int32_t)lround((10.99 + drand() * 0.32) * 1e7);
+
+		for (uint16_t i = 0; i < s.count; i++) {
+			const struct geofence *f = &s.fence[i];
+			bool in_box = lat_e7 >= f->min_lat && lat_e7 <= f->max_lat &&
+				      lng_e7 >= f->min_lng && lng_e7 <= f->max_lng;
+
+			if (geofence_contains(&s, f, lat_e7, lng_e7)) {
+				TEST_ASSERT_TRUE(in_box);
+				hits++;
+			}
+		}
+	}
+	TEST_ASSERT_GREATER_THAN(100, hits);
+	geofence_free(&s);
+}
+
+void test_confirm_entry_and_exit(void)
+{
+	struct geofence_set s;
+	struct geofence_event ev[4];
+
+	geofence_init(&s);
+	TEST_ASSERT_TRUE(geofence_add_circle(&s, "home", 48, 11, 50));
+	TEST_ASSERT_EQUAL_INT(0, feed(&s, 48, 11, GEOFENCE_CONFIRM - 1, ev, 4));
+	TEST_ASSERT_FALSE(s.fence[0].inside);
+	TEST_ASSERT_EQUAL_INT(1, feed(&s, 48, 11, 1, ev, 4));
+	TEST_ASSERT_TRUE(s.fence[0].inside);
+	TEST_ASSERT_EQUAL_UINT16(0, ev[0].fence);
+	TEST_ASSERT_TRUE(ev[0].entered);
+
+	/* Jitter across the edge restarts the count */
+	TEST_ASSERT_EQUAL_INT(0, feed(&s, 48.01, 11, GEOFENCE_CONFIRM - 1, ev, 4));
+	TEST_ASSERT_EQUAL_INT(0, feed(&s, 48, 11, 1, ev, 4));
+	TEST_ASSERT_EQUAL_INT(0, feed(&s, 48.01, 11, GEOFENCE_CONFIRM - 1, ev, 4));
+	TEST_ASSERT_EQUAL_INT(1, feed(&s, 48.01, 11, 1, ev, 4));
+	TEST_ASSERT_FALSE(ev[0].entered);
+	TEST_ASSERT_FALSE(s.fence[0].inside);
+	geofence_free(&s);
+}
+
+/* More crossings on one fix than ev holds: the rest come on the next fixes */
+void test_full_event_buffer_loses_nothing(void)
+{
+	struct geofence_set s;
+	struct geofence_event ev[2];
+	int seen[6] = { 0 };
+	char name[8];
+
+	geofence_init(&s);
+	for (int i = 0; i < 6; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		TEST_ASSERT_TRUE(geofence_add_circle(&s, name, 48, 11, 100 + i * 10));
+	}
+	TEST_ASSERT_EQUAL_INT(2, feed(&s, 48, 11, GEOFENCE_CONFIRM, ev, 2));
+	for (int fix = 0; fix < 3; fix++) {
+		if (fix)
+			TEST_ASSERT_EQUAL_INT(2, feed(&s, 48, 11, 1, ev, 2));
+		for (int k = 0; k < 2; k++) {
+			TEST_ASSERT_TRUE(ev[k].entered);
+			seen[ev[k].fence]++;
+		}
+	}
+	for (int i = 0; i < 6; i++) {
+		TEST_ASSERT_EQUAL_INT(1, seen[i]);
+		TEST_ASSERT_TRUE(s.fence[i].inside);
+	}
+	TEST_ASSERT_EQUAL_INT(0, feed(&s, 48, 11, 1, ev, 2));
+	geofence_free(&s);
+}
+
+// === Benchmark: 1000 fences at 10 Hz ===
+void test_bench_1000_fences(void)
+{
+	struct geofence_set s;
+	struct geofence_vertex v[12];
+	struct geofence_event ev[4];
+	double lat = 48.1, lng = 11.15, heading = 0;
+	uint32_t events = 0;
+	char msg[128];
+
+	/* Mixed polygons and circles over a 22 x 22 km area */
+	rng = 1000;
+	geofence_init(&s);
+	for (int i = 0; i < BENCH_FENCES; i++) {
+		double clat = 48 + drand() * 0.2, clng = 11 + drand() * 0.3;
+
+		if (i % 2) {
+			TEST_ASSERT_TRUE(geofence_add_circle(&s, "c", clat, clng, 20 + drand() * 200));
+			continue;
+		}
+		double r = 0.0003 + drand() * 0.002;
+		for (int k = 0; k < 12; k++) {
+			double a = k * 2 * M_PI / 12, rk = r * (0.4 + drand() * 0.6);
+			v[k].lat_e7 = (int32_t)lround((clat + rk * cos(a)) * 1e7);
+			v[k].lng_e7 = (int32_t)lround((clng + rk * sin(a) * 1.5) * 1e7);
+		}
+		TEST_ASSERT_TRUE(geofence_add_poly(&s, "p", v, 12));
+	}
+	TEST_ASSERT_EQUAL_UINT16(BENCH_FENCES, s.count);
+
+	/* An hour of driving around the area at 10 m/s, one fix every 100 ms */
+	s.bbox_hits = 0;
+	double t0 = now_s();
+	for (int i = 0; i < BENCH_FIXES; i++) {
+		heading += (drand() - 0.5) * 0.2;
+		lat += cos(heading) / GEO_METERS_PER_DEG;
+		lng += sin(heading) / (GEO_METERS_PER_DEG * cos(lat * DEG_TO_RAD));
+		if (lat < 48 || lat > 48.2 || lng < 11 || lng > 11.3)
+			heading += M_PI;
+		events += geofence_update(&s, lat, lng, ev, 4);
+	}
+	double dt = (now_s() - t0) / BENCH_FIXES;
+
+	snprintf(msg, sizeof(msg), "%d fences: %.2f us per fix, %.3f exact tests per fix, %u events",
+		 BENCH_FENCES, dt * 1e6, (double)s.bbox_hits / BENCH_FIXES, (unsigned)events);
+	TEST_MESSAGE(msg);
+	/* A 10 Hz fix has 100 ms; the check must be a small part of it */
+	TEST_ASSERT_TRUE_MESSAGE(dt < 100e-6, msg);
+	TEST_ASSERT_TRUE_MESSAGE(s.bbox_hits < (uint32_t)BENCH_FIXES, msg);
+	geofence_free(&s);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_parse);
+	RUN_TEST(test_box_never_drops_a_fence);
+	RUN_TEST(test_confirm_entry_and_exit);
+	RUN_TEST(test_full_event_buffer_loses_nothing);
+	RUN_TEST(test_bench_1000_fences);
+	return UNITY_END();
+}
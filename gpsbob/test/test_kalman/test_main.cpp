@@ -0,0 +1,171 @@
+/*
+ * kalman: on a synthetic 10 Hz track (standing, walking, jogging, a turn)
+ * with receiver noise, the filtered position is closer to the truth than
+ * the raw fixes, and the filter restarts after a gap.
+ */
+
+#include <unity.h>
+
+#include <math.h>
+#include <stdio.h>
+
+#include "geo.h"
+#include "kalman.h"
+
+#define DEG_TO_RAD 0.017453292519943295
+#define NOISE_M 3.0
+#define HDOP 0.9f
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static uint32_t rng = 1;
+
+static double drand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return (rng & 0xffffff) / (double)0x1000000;
+}
+
+/* Box-Muller, unit variance */
+static double gauss(void)
+{
+	double u = drand() + 1e-9, v = drand();
+
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static double error_m(double lat, double lng, double tlat, double tlng)
+{
+	double dlng = fmod(lng - tlng + 540, 360) - 180;
+	double dy = (lat - tlat) * GEO_METERS_PER_DEG;
+	double dx = dlng * GEO_METERS_PER_DEG * cos(tlat * DEG_TO_RAD);
+
+	return sqrt(dx * dx + dy * dy);
+}
+
+struct score {
+	double raw2;
+	double filt2;
+	int n;
+};
+
+/* Moves the true position secs seconds at speed m/s on heading deg, at 10 Hz */
+static void leg(struct kalman *kf, struct score *s, double *lat, double *lng, uint32_t *ms,
+		double secs, double speed, double heading)
+{
+	for (int i = 0; i < secs * 10; i++) {
+		double flat, flng;
+
+		*ms += 100;
+		*lat += speed * 0.1 * cos(heading * DEG_TO_RAD) / GEO_METERS_PER_DEG;
+		*lng += speed * 0.1 * sin(heading * DEG_TO_RAD) /
+			(GEO_METERS_PER_DEG * cos(*lat * DEG_TO_RAD));
+		if (*lng > 180)
+			*lng -= 360;
+
+		double mlat = *lat + NOISE_M * gauss() / GEO_METERS_PER_DEG;
+		double mlng = *lng + NOISE_M * gauss() / (GEO_METERS_PER_DEG * cos(*lat * DEG_TO_RAD));
+
+		kalman_update(kf, mlat, mlng, HDOP, *ms);
+		kalman_position(kf, &flat, &flng);
+		/* Skip the first seconds while the filter converges */
+		if (*ms < 5000)
+			continue;
+		double r = error_m(mlat, mlng, *lat, *lng);
+		double f = error_m(flat, flng, *lat, *lng);
+		s->raw2 += r * r;
+		s->filt2 += f * f;
+		s->n++;
+	}
+}
+
+static void check_score(const char *what, const struct score *s, double ratio)
+{
+	double raw = sqrt(s->raw2 / s->n), filt = sqrt(s->filt2 / s->n);
+	char msg[96];
+
+	snprintf(msg, sizeof(msg), "%s: filtered %.2f m RMS, raw %.2f m RMS", what, filt, raw);
+	TEST_MESSAGE(msg);
+	TEST_ASSERT_TRUE_MESSAGE(filt < raw * ratio, msg);
+}
+
+void test_standing(void)
+{
+	struct kalman kf;
+	struct score s = { 0, 0, 0 };
+	double lat = 48.137, lng = 11.575;
+	uint32_t ms = 0;
+
+	rng = 11;
+	kalman_reset(&kf);
+	leg(&kf, &s, &lat, &lng, &ms, 120, 0, 0);
+	check_score("standing", &s, 0.3);
+	TEST_ASSERT_TRUE(kalman_speed_mps(&kf) < 0.5f);
+}
+
+void test_walk_and_jog(void)
+{
+	struct kalman kf;
+	struct score s = { 0, 0, 0 };
+	double lat = 48.137, lng = 11.575;
+	uint32_t ms = 0;
+
+	rng = 12;
+	kalman_reset(&kf);
+	leg(&kf, &s, &lat, &lng, &ms, 30, 0, 0);
+	leg(&kf, &s, &lat, &lng, &ms, 120, 1.4, 45);
+	leg(&kf, &s, &lat, &lng, &ms, 120, 3.0, 45);
+	leg(&kf, &s, &lat, &lng, &ms, 60, 3.0, 135); /* Right turn */
+	leg(&kf, &s, &lat, &lng, &ms, 60, 1.4, 135);
+	check_score("walk, jog and turn", &s, 0.5);
+	TEST_ASSERT_FLOAT_WITHIN(0.6f, 1.4f, kalman_speed_mps(&kf));
+}
+
+/* Several km on one heading moves the origin; the error must not grow */
+void test_long_run_recentres(void)
+{
+	struct kalman kf;
+	struct score s = { 0, 0, 0 };
+	double lat = 60.0, lng = 179.9, lat0;
+	uint32_t ms = 0;
+
+	rng = 13;
+	kalman_reset(&kf);
+	leg(&kf, &s, &lat, &lng, &ms, 10, 0, 0);
+	lat0 = kf.lat0;
+	leg(&kf, &s, &lat, &lng, &ms, 1200, 10, 80); /* 12 km, across the antimeridian */
+	TEST_ASSERT_TRUE(kf.lat0 != lat0);
+	TEST_ASSERT_TRUE(lng < 0);
+	check_score("12 km at 10 m/s", &s, 0.6);
+}
+
+void test_restart_after_gap(void)
+{
+	struct kalman kf;
+	double lat, lng;
+
+	kalman_reset(&kf);
+	TEST_ASSERT_FALSE(kf.valid);
+	kalman_update(&kf, 48, 11, HDOP, 1000);
+	TEST_ASSERT_TRUE(kf.valid);
+	kalman_update(&kf, 48.0001, 11, HDOP, 2000);
+	/* After the gap the new fix is taken as is */
+	kalman_update(&kf, 49, 12, HDOP, 2000 + KALMAN_MAX_GAP_MS + 1);
+	kalman_position(&kf, &lat, &lng);
+	TEST_ASSERT_DOUBLE_WITHIN(1e-9, 49, lat);
+	TEST_ASSERT_DOUBLE_WITHIN(1e-9, 12, lng);
+	TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0, kalman_speed_mps(&kf));
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_standing);
+	RUN_TEST(test_walk_and_jog);
+	RUN_TEST(test_long_run_recentres);
+	RUN_TEST(test_restart_after_gap);
+	return UNITY_END();
+}
@@ -0,0 +1,319 @@
+/*
+ * log_file: finding the logical end (torn last line, no NUL tail, empty
+ * and all-NUL files), extent sizing, and a FAT-like stand-in that counts
+ * the metadata writes per record of a day's log, appended and flushed per
+ * record as before against the preallocated extents of log_append(), with
+ * power cuts at random points.
+ */
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log_file.h"
+
+#define SECTOR 512
+#define CLUSTER 32768
+#define CARD_MAX (8 << 20)
+#define DAY_S 86400
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static uint32_t rng = 1;
+
+static uint32_t urand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+struct mem_file {
+	const uint8_t *data;
+	uint32_t len;
+	uint32_t reads;
+};
+
+static size_t mem_read_at(void *ctx, uint32_t offset, void *buf, size_t len)
+{
+	struct mem_file *f = (struct mem_file *)ctx;
+
+	f->reads++;
+	if (offset >= f->len)
+		return 0;
+	if (len > f->len - offset)
+		len = f->len - offset;
+	memcpy(buf, f->data + offset, len);
+	return len;
+}
+
+/* Logical end of text followed by nul_tail NUL bytes */
+static uint32_t end_of(const char *text, uint32_t nul_tail, uint32_t *reads)
+{
+	static uint8_t buf[4 * LOG_FILE_EXTENT];
+	uint32_t n = strlen(text);
+	struct mem_file f = { buf, n + nul_tail, 0 };
+
+	memcpy(buf, text, n);
+	memset(buf + n, 0, nul_tail);
+	uint32_t end = log_file_end(mem_read_at, &f, f.len);
+	if (reads)
+		*reads = f.reads;
+	return end;
+}
+
+void test_end_of_empty_file(void)
+{
+	TEST_ASSERT_EQUAL_UINT32(0, end_of("", 0, NULL));
+	TEST_ASSERT_EQUAL_UINT32(0, end_of("", LOG_FILE_EXTENT, NULL));
+}
+
+/* Written before preallocation, or truncated on close: all of it is records */
+void test_end_without_nul_tail(void)
+{
+	TEST_ASSERT_EQUAL_UINT32(8, end_of("a,1\nb,2\n", 0, NULL));
+	TEST_ASSERT_EQUAL_UINT32(7, end_of("a,1\nb,2", 0, NULL));
+}
+
+void test_end_of_preallocated_file(void)
+{
+	uint32_t reads;
+
+	TEST_ASSERT_EQUAL_UINT32(8, end_of("a,1\nb,2\n", LOG_FILE_EXTENT - 8, &reads));
+	/* Bisection, not a scan */
+	TEST_ASSERT_LESS_THAN(24, reads);
+	/* A single NUL left at the end of a full extent */
+	static char full[LOG_FILE_EXTENT];
+	for (int i = 0; i < LOG_FILE_EXTENT - 1; i++)
+		full[i] = i % 16 == 15 ? '\n' : 'x';
+	full[LOG_FILE_EXTENT - 2] = '\n';
+	TEST_ASSERT_EQUAL_UINT32(LOG_FILE_EXTENT - 1, end_of(full, 1, NULL));
+}
+
+/* Power lost mid-record: the partial line is dropped */
+void test_end_drops_torn_last_line(void)
+{
+	TEST_ASSERT_EQUAL_UINT32(8, end_of("a,1\nb,2\nc,", 1000, NULL));
+	TEST_ASSERT_EQUAL_UINT32(0, end_of("a,1", 1000, NULL));
+	TEST_ASSERT_EQUAL_UINT32(10, end_of("a,1\r\nb,2\r\nc,3\r", 1000, NULL));
+}
+
+void test_size_for(void)
+{
+	/* Fits with a NUL to spare */
+	TEST_ASSERT_EQUAL_UINT32(LOG_FILE_EXTENT, log_file_size_for(100, LOG_FILE_EXTENT, 50));
+	TEST_ASSERT_EQUAL_UINT32(LOG_FILE_EXTENT,
+				 log_file_size_for(LOG_FILE_EXTENT - 2, LOG_FILE_EXTENT, 1));
+	/* Would fill the last byte */
+	TEST_ASSERT_EQUAL_UINT32(2 * LOG_FILE_EXTENT,
+				 log_file_size_for(LOG_FILE_EXTENT - 2, LOG_FILE_EXTENT, 2));
+	TEST_ASSERT_EQUAL_UINT32(LOG_FILE_EXTENT, log_file_size_for(0, 0, 1));
+	TEST_ASSERT_EQUAL_UINT32(3 * LOG_FILE_EXTENT,
+				 log_file_size_for(10, LOG_FILE_EXTENT, 2 * LOG_FILE_EXTENT));
+}
+
+// === FAT stand-in ===
+/*
+ * Data goes to the card on sync, a sector at a time. A sync that changed
+ * the file writes its directory entry; one that allocated clusters also
+ * writes the FAT sector in both FAT copies and the FSInfo sector.
+ */
+struct fat_file {
+	uint8_t *cache; /* As the writer sees it */
+	uint8_t *card;  /* Synced */
+	uint32_t size;
+	uint32_t card_size; /* In the directory entry */
+	uint32_t alloc;
+	uint32_t dirty_lo, dirty_hi;
+	bool modified;
+	bool allocated;
+	uint32_t dir, fat, fsinfo, data;
+};
+
+static uint8_t fat_cache[CARD_MAX], fat_card[CARD_MAX];
+static uint32_t fat_used; /* Bytes to clear for the next file */
+
+static void fat_open(struct fat_file *f)
+{
+	memset(fat_cache, 0, fat_used);
+	memset(fat_card, 0, fat_used);
+	fat_used = 0;
+	memset(f, 0, sizeof(*f));
+	f->cache = fat_cache;
+	f->card = fat_card;
+	f->dirty_lo = UINT32_MAX;
+}
+
+static void fat_write(struct fat_file *f, uint32_t off, const void *buf, size_t len)
+{
+	uint32_t lo = off / SECTOR, hi = (off + len - 1) / SECTOR;
+
+	TEST_ASSERT_TRUE(off + len <= CARD_MAX);
+	memcpy(f->cache + off, buf, len);
+	if (lo < f->dirty_lo)
+		f->dirty_lo = lo;
+	if (hi > f->dirty_hi)
+		f->dirty_hi = hi;
+	if (off + len > f->size)
+		f->size = off + len;
+	if (f->size > fat_used)
+		fat_used = f->size;
+	while (f->alloc < f->size) {
+		f->alloc += CLUSTER;
+		f->allocated = true;
+	}
+	f->modified = true;
+}
+
+static void fat_sync(struct fat_file *f)
+{
+	if (!f->modified)
+		return;
+	uint32_t lo = f->dirty_lo * SECTOR, hi = (f->dirty_hi + 1) * SECTOR;
+	memcpy(f->card + lo, f->cache + lo, hi - lo);
+	f->data += f->dirty_hi - f->dirty_lo + 1;
+	if (f->allocated) {
+		f->fat += 2;
+		f->fsinfo++;
+	}
+	f->dir++;
+	f->card_size = f->size;
+	f->modified = f->allocated = false;
+	f->dirty_lo = UINT32_MAX;
+	f->dirty_hi = 0;
+}
+
+static int make_line(uint32_t t, char *line)
+{
+	return sprintf(line, "2025-06-01T%02u:%02u:%02uZ,48.%07u,11.%07u,%u,0.9\r\n",
+		       (unsigned)(t / 3600), (unsigned)(t / 60 % 60), (unsigned)(t % 60),
+		       (unsigned)(urand() % 10000000), (unsigned)(urand() % 10000000),
+		       (unsigned)(urand() % 12 + 4));
+}
+
+/* Day at 1 Hz, each record flushed as the logger did before */
+static void day_append(struct fat_file *f, uint32_t records)
+{
+	char line[96];
+
+	rng = 43;
+	fat_open(f);
+	for (uint32_t t = 0; t < records; t++) {
+		int n = make_line(t, line);
+		fat_write(f, f->size, line, n);
+		fat_sync(f);
+	}
+}
+
+/* As log_grow() and log_append(); returns the logical end */
+static uint32_t day_prealloc(struct fat_file *f, uint32_t records)
+{
+	static const uint8_t zero[LOG_FILE_EXTENT] = { 0 };
+	uint32_t end = 0, sync_ms = 0;
+	char line[96];
+
+	rng = 43;
+	fat_open(f);
+	for (uint32_t t = 0; t < records; t++) {
+		int n = make_line(t, line);
+		uint32_t size = log_file_size_for(end, f->size, n);
+
+		if (size > f->size) {
+			fat_write(f, f->size, zero, size - f->size);
+			fat_sync(f);
+			sync_ms = t * 1000;
+		}
+		fat_write(f, end, line, n);
+		end += n;
+		if (t * 1000 - sync_ms >= LOG_FILE_SYNC_MS) {
+			fat_sync(f);
+			sync_ms = t * 1000;
+		}
+	}
+	return end;
+}
+
+void test_metadata_writes_per_record(void)
+{
+	static struct fat_file before, after;
+	char msg[160];
+
+	day_append(&before, DAY_S);
+	day_prealloc(&after, DAY_S);
+
+	double b = (double)(before.dir + before.fat + before.fsinfo) / DAY_S;
+	double a = (double)(after.dir + after.fat + after.fsinfo) / DAY_S;
+	snprintf(msg, sizeof(msg),
+		 "append+flush: %.3f metadata writes/record (dir %u, FAT %u, FSInfo %u), %u data",
+		 b, (unsigned)before.dir, (unsigned)before.fat, (unsigned)before.fsinfo,
+		 (unsigned)before.data);
+	TEST_MESSAGE(msg);
+	snprintf(msg, sizeof(msg),
+		 "prealloc:     %.3f metadata writes/record (dir %u, FAT %u, FSInfo %u), %u data",
+		 a, (unsigned)after.dir, (unsigned)after.fat, (unsigned)after.fsinfo,
+		 (unsigned)after.data);
+	TEST_MESSAGE(msg);
+	TEST_ASSERT_TRUE_MESSAGE(b > 1.0, msg);
+	TEST_ASSERT_TRUE_MESSAGE(a < 0.15, msg);
+	TEST_ASSERT_TRUE_MESSAGE(after.data < before.data / 2, msg);
+}
+
+/*
+ * Cut the power after a random number of records. What is on the card is
+ * the last sync, plus maybe the first sectors of what was written since.
+ * The end found on it must be a line boundary no more than a sync
+ * interval behind, with every record before it intact.
+ */
+void test_power_cuts(void)
+{
+	static struct fat_file f;
+	static uint8_t image[CARD_MAX];
+	uint32_t worst_lost = 0;
+	char msg[96];
+
+	for (int cut = 0; cut < 200; cut++) {
+		rng = 1000 + cut;
+		uint32_t records = 1 + urand() % 20000;
+		uint32_t torn = urand() % 3 ? 0 : urand() % 80;
+		uint32_t end = day_prealloc(&f, records);
+
+		memcpy(image, f.card, f.card_size);
+		/* Part of the unsynced tail reached the card */
+		const uint8_t *nul = (const uint8_t *)memchr(f.card, 0, f.card_size);
+		uint32_t synced_end = nul ? nul - f.card : f.card_size;
+		if (synced_end < end)
+			memcpy(image + synced_end, f.cache + synced_end,
+			       torn < end - synced_end ? torn : end - synced_end);
+
+		struct mem_file m = { image, f.card_size, 0 };
+		uint32_t got = log_file_end(mem_read_at, &m, f.card_size);
+
+		TEST_ASSERT_TRUE(got <= end);
+		TEST_ASSERT_TRUE(got == 0 || image[got - 1] == '\n');
+		TEST_ASSERT_EQUAL_MEMORY(f.cache, image, got);
+		uint32_t lost = 0;
+		for (uint32_t i = got; i < end; i++)
+			lost += f.cache[i] == '\n';
+		worst_lost = lost > worst_lost ? lost : worst_lost;
+		TEST_ASSERT_LESS_OR_EQUAL(LOG_FILE_SYNC_MS / 1000 + 1, lost);
+	}
+	snprintf(msg, sizeof(msg), "200 power cuts: at most %u records lost", (unsigned)worst_lost);
+	TEST_MESSAGE(msg);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_end_of_empty_file);
+	RUN_TEST(test_end_without_nul_tail);
+	RUN_TEST(test_end_of_preallocated_file);
+	RUN_TEST(test_end_drops_torn_last_line);
+	RUN_TEST(test_size_for);
+	RUN_TEST(test_metadata_writes_per_record);
+	RUN_TEST(test_power_cuts);
+	return UNITY_END();
+}
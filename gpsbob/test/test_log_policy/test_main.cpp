@@ -0,0 +1,249 @@
+/*
+ * log_policy: the distance, heading and max-gap rules one at a time, and
+ * a replay of a parked / driving / walking track comparing fixed-interval
+ * logging with the motion-aware policy on points written and track error.
+ */
+
+#include <unity.h>
+
+#include <math.h>
+#include <stdio.h>
+
+#include "geo.h"
+#include "log_policy.h"
+
+#define DEG_TO_RAD 0.017453292519943295
+#define DIST_M 10.0f
+#define HEADING_DEG 20.0f
+#define MAX_GAP_MS 300000
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static uint32_t rng = 1;
+
+static double drand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return (rng & 0xffffff) / (double)0x1000000;
+}
+
+/* The point dist m away from (lat, lng) on heading deg */
+static void move(double lat, double lng, double dist, double heading, double *olat, double *olng)
+{
+	*olat = lat + dist * cos(heading * DEG_TO_RAD) / GEO_METERS_PER_DEG;
+	*olng = lng + dist * sin(heading * DEG_TO_RAD) / (GEO_METERS_PER_DEG * cos(lat * DEG_TO_RAD));
+}
+
+static bool due(const struct log_policy *p, double lat, double lng, uint32_t ms)
+{
+	return log_policy_due(p, lat, lng, ms, DIST_M, HEADING_DEG, MAX_GAP_MS);
+}
+
+void test_first_fix_is_due(void)
+{
+	struct log_policy p;
+
+	log_policy_reset(&p);
+	TEST_ASSERT_TRUE(due(&p, 48, 11, 0));
+	log_policy_commit(&p, 48, 11, 0);
+	TEST_ASSERT_FALSE(due(&p, 48, 11, 1000));
+}
+
+void test_distance_rule(void)
+{
+	struct log_policy p;
+	double lat, lng;
+
+	log_policy_reset(&p);
+	log_policy_commit(&p, 48, 11, 0);
+	move(48, 11, DIST_M - 0.5, 30, &lat, &lng);
+	TEST_ASSERT_FALSE(due(&p, lat, lng, 1000));
+	move(48, 11, DIST_M + 0.5, 30, &lat, &lng);
+	TEST_ASSERT_TRUE(due(&p, lat, lng, 1000));
+	/* Measured from the last logged point, not the last fix */
+	log_policy_commit(&p, lat, lng, 1000);
+	move(lat, lng, 6, 30, &lat, &lng);
+	TEST_ASSERT_FALSE(due(&p, lat, lng, 2000));
+	move(lat, lng, 6, 30, &lat, &lng);
+	TEST_ASSERT_TRUE(due(&p, lat, lng, 3000));
+}
+
+void test_heading_rule(void)
+{
+	struct log_policy p;
+	double lat, lng, a_lat, a_lng;
+
+	log_policy_reset(&p);
+	log_policy_commit(&p, 48, 11, 0);
+	/* No course yet: a turn cannot be judged */
+	move(48, 11, 8, 90, &lat, &lng);
+	TEST_ASSERT_FALSE(due(&p, lat, lng, 1000));
+
+	move(48, 11, DIST_M + 1, 0, &a_lat, &a_lng); /* Segment heading north */
+	log_policy_commit(&p, a_lat, a_lng, 1000);
+	move(a_lat, a_lng, 8, HEADING_DEG - 5, &lat, &lng);
+	TEST_ASSERT_FALSE(due(&p, lat, lng, 2000));
+	move(a_lat, a_lng, 8, HEADING_DEG + 5, &lat, &lng);
+	TEST_ASSERT_TRUE(due(&p, lat, lng, 2000));
+	move(a_lat, a_lng, 8, 360 - HEADING_DEG - 5, &lat, &lng); /* Left, across north */
+	TEST_ASSERT_TRUE(due(&p, lat, lng, 2000));
+	/* Jitter closer than LOG_POLICY_TURN_M is no turn */
+	move(a_lat, a_lng, LOG_POLICY_TURN_M - 1, 180, &lat, &lng);
+	TEST_ASSERT_FALSE(due(&p, lat, lng, 2000));
+}
+
+void test_short_commit_keeps_course(void)
+{
+	struct log_policy p;
+	double lat, lng, b_lat, b_lng;
+
+	log_policy_reset(&p);
+	log_policy_commit(&p, 48, 11, 0);
+	move(48, 11, 20, 90, &lat, &lng);
+	log_policy_commit(&p, lat, lng, 1000);
+	TEST_ASSERT_TRUE(p.have_course);
+	TEST_ASSERT_FLOAT_WITHIN(0.5f, 90, p.course_deg);
+	/* A heartbeat point at rest must not replace the course */
+	move(lat, lng, 1, 0, &b_lat, &b_lng);
+	log_policy_commit(&p, b_lat, b_lng, 2000);
+	TEST_ASSERT_FLOAT_WITHIN(0.5f, 90, p.course_deg);
+}
+
+void test_max_gap_rule(void)
+{
+	struct log_policy p;
+
+	log_policy_reset(&p);
+	log_policy_commit(&p, 48, 11, 1000);
+	TEST_ASSERT_FALSE(due(&p, 48, 11, 1000 + MAX_GAP_MS - 1));
+	TEST_ASSERT_TRUE(due(&p, 48, 11, 1000 + MAX_GAP_MS));
+	/* Across the millis() wrap */
+	log_policy_commit(&p, 48, 11, 0xffffff00u);
+	TEST_ASSERT_FALSE(due(&p, 48, 11, 0x100));
+	TEST_ASSERT_TRUE(due(&p, 48, 11, 0xffffff00u + MAX_GAP_MS));
+}
+
+// === Benchmark: track replay ===
+#define TRACK_S (90 * 60)
+#define NOISE_M 1.5
+
+static double true_lat[TRACK_S], true_lng[TRACK_S];
+static double fix_lat[TRACK_S], fix_lng[TRACK_S];
+
+/*
+ * 1 Hz: 30 min parked, 30 min winding drive at 8-20 m/s, 30 min walk
+ * with a turn every minute or two.
+ */
+static void make_track(void)
+{
+	double lat = 48.137, lng = 11.575, heading = 0, speed = 0;
+
+	rng = 36;
+	for (int t = 0; t < TRACK_S; t++) {
+		if (t < 1800) {
+			speed = 0;
+		} else if (t < 3600) {
+			speed += (drand() - 0.5) * 2;
+			speed = speed < 8 ? 8 : speed > 20 ? 20 : speed;
+			heading += sin(t / 40.0) * 3;
+		} else {
+			speed = 1.4;
+			if (drand() < 0.01)
+				heading += (drand() - 0.5) * 180;
+		}
+		move(lat, lng, speed, heading, &lat, &lng);
+		true_lat[t] = lat;
+		true_lng[t] = lng;
+		fix_lat[t] = lat + (drand() - 0.5) * 2 * NOISE_M / GEO_METERS_PER_DEG;
+		fix_lng[t] = lng + (drand() - 0.5) * 2 * NOISE_M /
+			(GEO_METERS_PER_DEG * cos(lat * DEG_TO_RAD));
+	}
+}
+
+/* Distance from the true position at t to the straight line between logged points a and b */
+static double track_error(int a, int b, int t)
+{
+	double k = cos(fix_lat[a] * DEG_TO_RAD) * GEO_METERS_PER_DEG;
+	double bx = (fix_lng[b] - fix_lng[a]) * k, by = (fix_lat[b] - fix_lat[a]) * GEO_METERS_PER_DEG;
+	double px = (true_lng[t] - fix_lng[a]) * k, py = (true_lat[t] - fix_lat[a]) * GEO_METERS_PER_DEG;
+	double len2 = bx * bx + by * by;
+	double u = len2 > 0 ? (px * bx + py * by) / len2 : 0;
+
+	u = u < 0 ? 0 : u > 1 ? 1 : u;
+	return hypot(px - u * bx, py - u * by);
+}
+
+struct replay {
+	int points;
+	double mean_m;
+	double max_m;
+};
+
+/* interval_s 0 replays through the policy */
+static void replay(int interval_s, struct replay *r)
+{
+	static int logged[TRACK_S];
+	struct log_policy p;
+	double sum = 0;
+	int n = 0;
+
+	log_policy_reset(&p);
+	for (int t = 0; t < TRACK_S; t++) {
+		bool write = interval_s ? t % interval_s == 0 :
+			due(&p, fix_lat[t], fix_lng[t], t * 1000u);
+		if (write || t == TRACK_S - 1) {
+			logged[n++] = t;
+			log_policy_commit(&p, fix_lat[t], fix_lng[t], t * 1000u);
+		}
+	}
+	r->points = n;
+	r->max_m = 0;
+	for (int k = 1; k < n; k++)
+		for (int t = logged[k - 1]; t < logged[k]; t++) {
+			double e = track_error(logged[k - 1], logged[k], t);
+			sum += e;
+			r->max_m = e > r->max_m ? e : r->max_m;
+		}
+	r->mean_m = sum / (TRACK_S - 1);
+}
+
+void test_replay(void)
+{
+	struct replay every_s, every_30s, adaptive;
+	char msg[96];
+
+	make_track();
+	replay(1, &every_s);
+	replay(30, &every_30s);
+	replay(0, &adaptive);
+
+	snprintf(msg, sizeof(msg), "fixed 1 s:  %5d points, mean error %.1f m, max %.1f m",
+		 every_s.points, every_s.mean_m, every_s.max_m);
+	TEST_MESSAGE(msg);
+	snprintf(msg, sizeof(msg), "fixed 30 s: %5d points, mean error %.1f m, max %.1f m",
+		 every_30s.points, every_30s.mean_m, every_30s.max_m);
+	TEST_MESSAGE(msg);
+	snprintf(msg, sizeof(msg), "adaptive:   %5d points, mean error %.1f m, max %.1f m",
+		 adaptive.points, adaptive.mean_m, adaptive.max_m);
+	TEST_MESSAGE(msg);
+
+	/* Fewer points than every second, with about the same error */
+	TEST_ASSERT_TRUE_MESSAGE(adaptive.points < every_s.points / 2, msg);
+	TEST_ASSERT_TRUE_MESSAGE(adaptive.mean_m < every_s.mean_m + 1.0, msg);
+	TEST_ASSERT_TRUE_MESSAGE(adaptive.max_m < every_30s.max_m / 4, msg);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_first_fix_is_due);
+	RUN_TEST(test_distance_rule);
+	RUN_TEST(test_heading_rule);
+	RUN_TEST(test_short_commit_keeps_course);
+	RUN_TEST(test_max_gap_rule);
+	RUN_TEST(test_replay);
+	return UNITY_END();
+}
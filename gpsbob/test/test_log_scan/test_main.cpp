@@ -0,0 +1,376 @@
+/*
+ * log_scan: each kind of damage the firmware leaves in CSV and GPX logs,
+ * that repair gives the file as it would have been written with the bad
+ * parts left out, that a repaired file scans clean and repairs to itself,
+ * and check throughput against splitting lines with track_parse_csv().
+ */
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+
+#include "log_file.h"
+#include "log_scan.h"
+#include "track_format.h"
+
+#define BENCH_RECORDS 400000
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static uint32_t rng = 1;
+
+static uint32_t urand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static double now_s(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static size_t str_write(void *ctx, const void *buf, size_t len)
+{
+	((std::string *)ctx)->append((const char *)buf, len);
+	return len;
+}
+
+/* Record i of a track as fmt writes it */
+static std::string record(enum track_fmt fmt, uint32_t i)
+{
+	struct track_point pt;
+	char buf[256];
+
+	pt.lat = 48.1 + i * 1e-5;
+	pt.lng = 11.5 - i * 2e-5;
+	pt.sats = 4 + i % 10;
+	pt.hdop = 0.8f + (i % 7) / 10.0f;
+	pt.offset_hours = 2;
+	track_set_local(&pt, 1748736000 + i);
+	track_format_point(fmt, &pt, i, buf, sizeof(buf));
+	return buf;
+}
+
+/* Records [from, to) */
+static std::string records(enum track_fmt fmt, uint32_t from, uint32_t to)
+{
+	std::string s;
+
+	for (uint32_t i = from; i < to; i++)
+		s += record(fmt, i);
+	return s;
+}
+
+static std::string header(enum track_fmt fmt)
+{
+	return fmt == TRACK_FMT_CSV ? TRACK_CSV_HEADER "\r\n" : track_fmt_header(fmt);
+}
+
+static std::string footer(enum track_fmt fmt)
+{
+	return track_fmt_footer(fmt);
+}
+
+static std::string nuls(size_t n)
+{
+	return std::string(n, '\0');
+}
+
+static std::string scan(enum track_fmt fmt, const std::string &in, struct log_scan *s)
+{
+	std::string out;
+
+	TEST_ASSERT_TRUE(log_scan_buf(fmt, (const uint8_t *)in.data(), in.size(), s, str_write, &out));
+	return out;
+}
+
+/*
+ * Scans in, checks it repairs to want, and that want scans clean with the
+ * same records and repairs to itself.
+ */
+static struct log_scan repair(enum track_fmt fmt, const std::string &in, const std::string &want)
+{
+	struct log_scan s, again;
+
+	std::string out = scan(fmt, in, &s);
+	TEST_ASSERT_TRUE(s.dirty);
+	TEST_ASSERT_EQUAL_size_t(want.size(), out.size());
+	TEST_ASSERT_TRUE(out == want);
+
+	std::string twice = scan(fmt, out, &again);
+	TEST_ASSERT_FALSE(again.dirty);
+	TEST_ASSERT_TRUE(again.header_ok);
+	TEST_ASSERT_EQUAL_UINT32(s.records, again.records);
+	TEST_ASSERT_EQUAL_UINT32(0, again.bad);
+	TEST_ASSERT_TRUE(twice == out);
+	return s;
+}
+
+void test_fmt_from_name(void)
+{
+	enum track_fmt fmt;
+
+	TEST_ASSERT_TRUE(log_scan_fmt("/2025-06-01_LOG.csv", &fmt));
+	TEST_ASSERT_EQUAL(TRACK_FMT_CSV, fmt);
+	TEST_ASSERT_TRUE(log_scan_fmt("old.GPX", &fmt));
+	TEST_ASSERT_EQUAL(TRACK_FMT_GPX, fmt);
+	TEST_ASSERT_FALSE(log_scan_fmt("poi.idx", &fmt));
+	TEST_ASSERT_FALSE(log_scan_fmt("config", &fmt));
+}
+
+// === CSV ===
+void test_csv_clean(void)
+{
+	const enum track_fmt csv = TRACK_FMT_CSV;
+	std::string in = header(csv) + records(csv, 0, 50);
+	struct log_scan s;
+
+	TEST_ASSERT_TRUE(scan(csv, in, &s) == in);
+	TEST_ASSERT_FALSE(s.dirty);
+	TEST_ASSERT_EQUAL_UINT32(50, s.records);
+	TEST_ASSERT_EQUAL_size_t(in.size(), s.end);
+	/* Without write it only checks */
+	TEST_ASSERT_TRUE(log_scan_buf(csv, (const uint8_t *)in.data(), in.size(), &s, NULL, NULL));
+	TEST_ASSERT_FALSE(s.dirty);
+}
+
+/* Preallocated and never closed */
+void test_csv_nul_tail(void)
+{
+	const enum track_fmt csv = TRACK_FMT_CSV;
+	std::string good = header(csv) + records(csv, 0, 50);
+	struct log_scan s = repair(csv, good + nuls(LOG_FILE_EXTENT - good.size()), good);
+
+	TEST_ASSERT_EQUAL_UINT32(50, s.records);
+	TEST_ASSERT_EQUAL_UINT32(0, s.bad);
+	TEST_ASSERT_EQUAL_size_t(good.size(), s.end);
+	TEST_ASSERT_EQUAL_size_t(0, s.torn);
+}
+
+/* Power lost in the middle of the last record, with and without the NUL tail */
+void test_csv_torn_last_record(void)
+{
+	const enum track_fmt csv = TRACK_FMT_CSV;
+	std::string good = header(csv) + records(csv, 0, 50);
+	std::string head = record(csv, 50).substr(0, 30);
+	struct log_scan s;
+
+	s = repair(csv, good + head + nuls(LOG_FILE_EXTENT - good.size() - head.size()), good);
+	TEST_ASSERT_EQUAL_UINT32(50, s.records);
+	TEST_ASSERT_EQUAL_size_t(head.size(), s.torn);
+	s = repair(csv, good + head, good);
+	TEST_ASSERT_EQUAL_size_t(head.size(), s.torn);
+}
+
+/* Appended without preallocation: the next boot carried on after a torn record */
+void test_csv_torn_record_fused_into_next(void)
+{
+	const enum track_fmt csv = TRACK_FMT_CSV;
+	std::string in = header(csv) + records(csv, 0, 20) + record(csv, 20).substr(0, 34) +
+			 records(csv, 21, 40);
+	struct log_scan s;
+
+	s = repair(csv, in, header(csv) + records(csv, 0, 20) + records(csv, 21, 40));
+	TEST_ASSERT_EQUAL_UINT32(39, s.records);
+	TEST_ASSERT_EQUAL_UINT32(1, s.bad);
+	/* Torn within the stamp: nothing to salvage in front of the next one */
+	in = header(csv) + records(csv, 0, 20) + record(csv, 20).substr(0, 8) + records(csv, 21, 40);
+	s = repair(csv, in, header(csv) + records(csv, 0, 20) + records(csv, 21, 40));
+	TEST_ASSERT_EQUAL_UINT32(39, s.records);
+}
+
+/* Lines that are not records, including a number that ran into text */
+void test_csv_bad_lines(void)
+{
+	const enum track_fmt csv = TRACK_FMT_CSV;
+	std::string rec = record(csv, 5);
+	std::string fused = rec.substr(0, rec.find("\r\n")) + "x\r\n";
+	std::string in = header(csv) + records(csv, 0, 5) + "garbage\r\n" + fused +
+			 "2025-06-01 12:00:00,91.000000,11.500000,9,0.90,2\r\n" +
+			 header(csv) + records(csv, 6, 10);
+	struct log_scan s;
+
+	s = repair(csv, in, header(csv) + records(csv, 0, 5) + records(csv, 6, 10));
+	TEST_ASSERT_EQUAL_UINT32(9, s.records);
+	TEST_ASSERT_EQUAL_UINT32(4, s.bad);
+}
+
+void test_csv_missing_header(void)
+{
+	const enum track_fmt csv = TRACK_FMT_CSV;
+	struct log_scan s;
+
+	s = repair(csv, records(csv, 0, 10), header(csv) + records(csv, 0, 10));
+	TEST_ASSERT_FALSE(s.header_ok);
+	TEST_ASSERT_EQUAL_UINT32(10, s.records);
+	/* Empty, or nothing but the preallocation */
+	repair(csv, "", header(csv));
+	repair(csv, nuls(LOG_FILE_EXTENT), header(csv));
+}
+
+// === GPX ===
+void test_gpx_clean(void)
+{
+	const enum track_fmt gpx = TRACK_FMT_GPX;
+	std::string in = header(gpx) + records(gpx, 0, 30) + footer(gpx);
+	struct log_scan s;
+
+	TEST_ASSERT_TRUE(scan(gpx, in, &s) == in);
+	TEST_ASSERT_FALSE(s.dirty);
+	TEST_ASSERT_TRUE(s.closed);
+	TEST_ASSERT_EQUAL_UINT32(30, s.records);
+}
+
+/* A reopen appended after the footer */
+void test_gpx_footer_mid_file(void)
+{
+	const enum track_fmt gpx = TRACK_FMT_GPX;
+	std::string in = header(gpx) + records(gpx, 0, 10) + footer(gpx) + records(gpx, 10, 20) +
+			 footer(gpx) + records(gpx, 20, 30) + footer(gpx);
+	struct log_scan s;
+
+	s = repair(gpx, in, header(gpx) + records(gpx, 0, 30) + footer(gpx));
+	TEST_ASSERT_EQUAL_UINT32(2, s.footers);
+	TEST_ASSERT_EQUAL_UINT32(0, s.bad);
+	TEST_ASSERT_TRUE(s.closed);
+}
+
+void test_gpx_missing_footer(void)
+{
+	const enum track_fmt gpx = TRACK_FMT_GPX;
+	struct log_scan s;
+
+	s = repair(gpx, header(gpx) + records(gpx, 0, 10), header(gpx) + records(gpx, 0, 10) + footer(gpx));
+	TEST_ASSERT_FALSE(s.closed);
+	TEST_ASSERT_EQUAL_size_t(0, s.torn);
+	/* Cut inside the footer line */
+	s = repair(gpx, header(gpx) + records(gpx, 0, 10) + footer(gpx).substr(0, 9),
+		   header(gpx) + records(gpx, 0, 10) + footer(gpx));
+	TEST_ASSERT_EQUAL_size_t(9, s.torn);
+}
+
+/* Power lost inside a <trkpt> block, at each line of it */
+void test_gpx_torn_point(void)
+{
+	const enum track_fmt gpx = TRACK_FMT_GPX;
+	std::string good = header(gpx) + records(gpx, 0, 10);
+	std::string pt = record(gpx, 10);
+
+	for (size_t cut = 1; cut < pt.size(); cut += 7) {
+		struct log_scan s = repair(gpx, good + pt.substr(0, cut), good + footer(gpx));
+
+		TEST_ASSERT_EQUAL_UINT32(10, s.records);
+		TEST_ASSERT_EQUAL_size_t(cut, s.torn);
+	}
+}
+
+void test_gpx_bad_points(void)
+{
+	const enum track_fmt gpx = TRACK_FMT_GPX;
+	std::string pt = record(gpx, 10);
+	std::string off = pt;
+	struct log_scan s;
+
+	off.replace(off.find("lat=\"") + 5, 2, "98");
+	std::string in = header(gpx) + records(gpx, 0, 10) + off +
+			 pt.substr(0, pt.find('\n') + 1) + /* <trkpt> never closed */
+			 records(gpx, 11, 15) + "<junk/>\n" + footer(gpx) + footer(gpx);
+
+	s = repair(gpx, in, header(gpx) + records(gpx, 0, 10) + records(gpx, 11, 15) + footer(gpx));
+	TEST_ASSERT_EQUAL_UINT32(14, s.records);
+	TEST_ASSERT_EQUAL_UINT32(4, s.bad); /* Range, unclosed, junk, second footer */
+}
+
+void test_gpx_missing_header(void)
+{
+	const enum track_fmt gpx = TRACK_FMT_GPX;
+	struct log_scan s;
+
+	s = repair(gpx, records(gpx, 0, 10) + footer(gpx), header(gpx) + records(gpx, 0, 10) + footer(gpx));
+	TEST_ASSERT_FALSE(s.header_ok);
+	TEST_ASSERT_EQUAL_UINT32(10, s.records);
+}
+
+// === Benchmark: check throughput ===
+/* The check as it would be with track_parse_csv() on every line */
+static uint32_t parse_csv_lines(const std::string &in)
+{
+	const char *p = in.data(), *end = p + in.size();
+	struct track_point pt;
+	uint32_t n = 0;
+
+	while (p < end) {
+		const char *nl = (const char *)memchr(p, '\n', end - p);
+
+		if (!nl)
+			break;
+		n += track_parse_csv(p, nl + 1 - p, &pt);
+		p = nl + 1;
+	}
+	return n;
+}
+
+void test_bench_check(void)
+{
+	const enum track_fmt csv = TRACK_FMT_CSV;
+	std::string in = header(csv), gpx;
+	struct log_scan s;
+	char msg[160];
+
+	rng = 46;
+	for (uint32_t i = 0; i < BENCH_RECORDS; i++)
+		in += record(csv, urand() % 100000);
+	for (uint32_t i = 0; i < BENCH_RECORDS / 4; i++)
+		gpx += record(TRACK_FMT_GPX, urand() % 100000);
+	gpx = header(TRACK_FMT_GPX) + gpx + footer(TRACK_FMT_GPX);
+
+	double t0 = now_s();
+	log_scan_buf(csv, (const uint8_t *)in.data(), in.size(), &s, NULL, NULL);
+	double t_csv = now_s() - t0;
+	TEST_ASSERT_EQUAL_UINT32(BENCH_RECORDS, s.records);
+
+	t0 = now_s();
+	uint32_t parsed = parse_csv_lines(in);
+	double t_parse = now_s() - t0;
+	TEST_ASSERT_EQUAL_UINT32(BENCH_RECORDS, parsed);
+
+	t0 = now_s();
+	log_scan_buf(TRACK_FMT_GPX, (const uint8_t *)gpx.data(), gpx.size(), &s, NULL, NULL);
+	double t_gpx = now_s() - t0;
+	TEST_ASSERT_EQUAL_UINT32(BENCH_RECORDS / 4, s.records);
+
+	snprintf(msg, sizeof(msg), "check: CSV %.0f MB/s (track_parse_csv %.0f MB/s), GPX %.0f MB/s",
+		 in.size() / t_csv / 1e6, in.size() / t_parse / 1e6, gpx.size() / t_gpx / 1e6);
+	TEST_MESSAGE(msg);
+	TEST_ASSERT_TRUE_MESSAGE(t_csv < t_parse, msg);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_fmt_from_name);
+	RUN_TEST(test_csv_clean);
+	RUN_TEST(test_csv_nul_tail);
+	RUN_TEST(test_csv_torn_last_record);
+	RUN_TEST(test_csv_torn_record_fused_into_next);
+	RUN_TEST(test_csv_bad_lines);
+	RUN_TEST(test_csv_missing_header);
+	RUN_TEST(test_gpx_clean);
+	RUN_TEST(test_gpx_footer_mid_file);
+	RUN_TEST(test_gpx_missing_footer);
+	RUN_TEST(test_gpx_torn_point);
+	RUN_TEST(test_gpx_bad_points);
+	RUN_TEST(test_gpx_missing_header);
+	RUN_TEST(test_bench_check);
+	return UNITY_END();
+}
@@ -0,0 +1,177 @@
+/*
+ * nav_arrow: sprite selection, and the page blit of nav_arrow_draw()
+ * against drawing the same sprite a pixel at a time, with x and y off the
+ * left, top, right and bottom edges and y off a page boundary. Then what
+ * the blit costs against drawBitmap()-style per-pixel drawing.
+ */
+
+#include <unity.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+#include "nav_arrow.h"
+
+#define W 128
+#define H 64
+#define BUF_BYTES (W * H / 8)
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static uint8_t blit[BUF_BYTES], ref[BUF_BYTES];
+
+static void draw_pixel(uint8_t *buf, int x, int y)
+{
+	if (x < 0 || x >= W || y < 0 || y >= H)
+		return;
+	buf[(y / 8) * W + x] |= 1 << (y & 7);
+}
+
+/* One pixel at a time, as the Adafruit drawBitmap() does */
+static void pixel_draw(uint8_t *buf, int x0, int y0, float deg)
+{
+	const uint8_t *s = nav_arrow_sprite(nav_arrow_index(deg));
+
+	for (int y = 0; y < NAV_ARROW_SIZE; y++)
+		for (int x = 0; x < NAV_ARROW_SIZE; x++)
+			if (s[(y / 8) * NAV_ARROW_SIZE + x] >> (y & 7) & 1)
+				draw_pixel(buf, x0 + x, y0 + y);
+}
+
+/* Draws both ways over a pattern and returns whether they agree */
+static bool same_at(int x, int y, float deg)
+{
+	for (int i = 0; i < BUF_BYTES; i++)
+		blit[i] = ref[i] = (uint8_t)(i * 37);
+	nav_arrow_draw(blit, W, H, x, y, deg);
+	pixel_draw(ref, x, y, deg);
+	return !memcmp(blit, ref, BUF_BYTES);
+}
+
+void test_index(void)
+{
+	TEST_ASSERT_EQUAL_INT(0, nav_arrow_index(0));
+	TEST_ASSERT_EQUAL_INT(1, nav_arrow_index(5.7f));
+	TEST_ASSERT_EQUAL_INT(0, nav_arrow_index(354.4f));
+	TEST_ASSERT_EQUAL_INT(NAV_ARROW_DIRS - 1, nav_arrow_index(-5.7f));
+	TEST_ASSERT_EQUAL_INT(0, nav_arrow_index(720));
+	TEST_ASSERT_EQUAL_INT(NAV_ARROW_DIRS / 4, nav_arrow_index(-630));
+	TEST_ASSERT_EQUAL_INT(NAV_ARROW_DIRS / 2, nav_arrow_index(180));
+}
+
+void test_sprites_are_drawn(void)
+{
+	for (int k = 0; k < NAV_ARROW_DIRS; k++) {
+		const uint8_t *s = nav_arrow_sprite(k);
+		int set = 0;
+
+		for (int i = 0; i < NAV_ARROW_BYTES; i++)
+			set += __builtin_popcount(s[i]);
+		TEST_ASSERT_GREATER_THAN(20, set);
+	}
+}
+
+void test_draw_inside(void)
+{
+	TEST_ASSERT_TRUE(same_at(0, 0, 0));
+	TEST_ASSERT_TRUE(same_at(52, 16, 90));
+	TEST_ASSERT_TRUE(same_at(W - NAV_ARROW_SIZE, H - NAV_ARROW_SIZE, 200));
+}
+
+void test_draw_y_off_page(void)
+{
+	for (int y = 1; y < 8; y++)
+		TEST_ASSERT_TRUE(same_at(30, 8 + y, 45));
+	TEST_ASSERT_TRUE(same_at(30, H - NAV_ARROW_SIZE - 3, 45));
+}
+
+void test_draw_negative_x_y(void)
+{
+	TEST_ASSERT_TRUE(same_at(-5, 10, 30));
+	TEST_ASSERT_TRUE(same_at(10, -5, 30));
+	TEST_ASSERT_TRUE(same_at(-13, -11, 300));
+	TEST_ASSERT_TRUE(same_at(-8, -16, 300)); /* Whole pages above */
+	TEST_ASSERT_TRUE(same_at(-(NAV_ARROW_SIZE - 1), -(NAV_ARROW_SIZE - 1), 135));
+}
+
+void test_draw_right_bottom_edge(void)
+{
+	TEST_ASSERT_TRUE(same_at(W - 5, 20, 60));
+	TEST_ASSERT_TRUE(same_at(W - 1, H - 1, 60));
+	TEST_ASSERT_TRUE(same_at(50, H - 13, 250));
+	TEST_ASSERT_TRUE(same_at(W - 7, H - 9, 250));
+}
+
+/* Fully outside draws nothing and writes nothing out of bounds */
+void test_draw_outside(void)
+{
+	static const int at[][2] = {
+		{ -NAV_ARROW_SIZE, 0 }, { 0, -NAV_ARROW_SIZE }, { W, 0 }, { 0, H },
+		{ -100, -100 }, { W + 100, H + 100 },
+	};
+	uint8_t guard[BUF_BYTES + 2 * W];
+
+	for (unsigned i = 0; i < sizeof(at) / sizeof(at[0]); i++) {
+		memset(guard, 0xa5, sizeof(guard));
+		memset(guard + W, 0, BUF_BYTES);
+		nav_arrow_draw(guard + W, W, H, at[i][0], at[i][1], 0);
+		for (int j = 0; j < (int)sizeof(guard); j++)
+			TEST_ASSERT_EQUAL_UINT8(j < W || j >= W + BUF_BYTES ? 0xa5 : 0, guard[j]);
+	}
+}
+
+void test_draw_every_offset(void)
+{
+	int bad = 0, runs = 0;
+	char msg[64];
+
+	for (int y = -30; y < H + 6; y++)
+		for (int x = -30; x < W + 10; x += 7)
+			for (int k = 0; k < NAV_ARROW_DIRS; k += 5, runs++)
+				bad += !same_at(x, y, k * 11.25f);
+	snprintf(msg, sizeof(msg), "%d of %d placements differ", bad, runs);
+	TEST_ASSERT_EQUAL_INT_MESSAGE(0, bad, msg);
+}
+
+// === Benchmark: blit against per-pixel drawing ===
+template <class F> static double ns_per(F f, int n)
+{
+	auto t0 = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < n; i++)
+		f(i);
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+}
+
+void test_bench_blit(void)
+{
+	const int n = 200000;
+	char msg[128];
+
+	double aligned = ns_per([](int i) { nav_arrow_draw(blit, W, H, 104, 40, i * 7.3f); }, n);
+	double shifted = ns_per([](int i) { nav_arrow_draw(blit, W, H, 104, 37, i * 7.3f); }, n);
+	double pixel = ns_per([](int i) { pixel_draw(ref, 104, 40, i * 7.3f); }, n);
+	snprintf(msg, sizeof(msg), "ns/arrow: blit %.1f, blit off page %.1f, per pixel %.1f",
+		 aligned, shifted, pixel);
+	TEST_MESSAGE(msg);
+	/* blit[] and ref[] are read so the draws are not optimized out */
+	TEST_ASSERT_NOT_EQUAL(0, blit[5 * W + 110] | ref[5 * W + 110]);
+	TEST_ASSERT_TRUE_MESSAGE(shifted < pixel / 2, msg);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_index);
+	RUN_TEST(test_sprites_are_drawn);
+	RUN_TEST(test_draw_inside);
+	RUN_TEST(test_draw_y_off_page);
+	RUN_TEST(test_draw_negative_x_y);
+	RUN_TEST(test_draw_right_bottom_edge);
+	RUN_TEST(test_draw_outside);
+	RUN_TEST(test_draw_every_offset);
+	RUN_TEST(test_bench_blit);
+	return UNITY_END();
+}
@@ -0,0 +1,303 @@
+/*
+ * poi_index: nearest-N lookups through the Morton index against a brute
+ * force scan of the same records, and build/query cost for 100k POIs.
+ */
+
+#include <unity.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "geo.h"
+#include "poi_index.h"
+
+#define POI_COUNT 100000
+#define QUERIES 2000
+#define NEAREST 5
+#define MAX_RANGE_M 50000.0f
+#define DEG_TO_RAD 0.017453292519943295
+
+/* poi.idx in memory */
+struct mem_file {
+	uint8_t *data;
+	size_t len;
+	size_t cap;
+	uint32_t reads;
+	uint64_t read_bytes;
+};
+
+static struct poi_record recs[POI_COUNT];
+static struct mem_file idx_file;
+static struct poi_index idx;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static uint32_t rng = 1;
+
+static double drand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return (rng & 0xffffff) / (double)0x1000000;
+}
+
+static size_t mem_write(void *ctx, const void *buf, size_t len)
+{
+	struct mem_file *f = (struct mem_file *)ctx;
+
+	if (f->len + len > f->cap) {
+		f->cap = (f->len + len) * 2;
+		f->data = (uint8_t *)realloc(f->data, f->cap);
+	}
+	memcpy(f->data + f->len, buf, len);
+	f->len += len;
+	return len;
+}
+
+static size_t mem_read_at(void *ctx, uint32_t offset, void *buf, size_t len)
+{
+	struct mem_file *f = (struct mem_file *)ctx;
+
+	if (offset >= f->len)
+		return 0;
+	if (len > f->len - offset)
+		len = f->len - offset;
+	memcpy(buf, f->data + offset, len);
+	f->reads++;
+	f->read_bytes += len;
+	return len;
+}
+
+static double now_s(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+ * Three quarters spread over a 220 x 330 km box, the rest in towns of a
+ * few hundred points each, which is what fills the dense index blocks.
+ */
+static void make_pois(void)
+{
+	char line[64];
+	double town_lat = 0, town_lng = 0;
+
+	rng = 4242;
+	for (int i = 0; i < POI_COUNT; i++) {
+		double lat, lng;
+
+		if (i % 4) {
+			lat = 47 + drand() * 2;
+			lng = 9 + drand() * 4.5;
+		} else {
+			if (i % 1200 == 0) {
+				town_lat = 47 + drand() * 2;
+				town_lng = 9 + drand() * 4.5;
+			}
+			lat = town_lat + (drand() - 0.5) * 0.02;
+			lng = town_lng + (drand() - 0.5) * 0.03;
+		}
+		snprintf(line, sizeof(line), "%.7f,%.7f,poi %d\n", lat, lng, i);
+		TEST_ASSERT_TRUE(poi_parse_csv(line, strlen(line), &recs[i]));
+	}
+}
+
+/* Same equirectangular distance as poi_nearest() */
+static float dist_m(const struct poi_record *r, double lat, double lng)
+{
+	float cos_lat = cosf((float)(lat * DEG_TO_RAD));
+	float dy = (float)((r->lat_e7 / 1e7 - lat) * GEO_METERS_PER_DEG);
+	float dx = (float)((r->lng_e7 / 1e7 - lng) * GEO_METERS_PER_DEG) * cos_lat;
+
+	return sqrtf(dx * dx + dy * dy);
+}
+
+static int brute_nearest(double lat, double lng, float *best, int n, float max_m)
+{
+	int found = 0;
+
+	for (int i = 0; i < POI_COUNT; i++) {
+		float d = dist_m(&recs[i], lat, lng);
+		int j;
+
+		if (d > max_m || (found == n && d >= best[n - 1]))
+			continue;
+		j = found < n ? found++ : n - 1;
+		while (j > 0 && best[j - 1] > d) {
+			best[j] = best[j - 1];
+			j--;
+		}
+		best[j] = d;
+	}
+	return found;
+}
+
+void test_parse_csv(void)
+{
+	struct poi_record r;
+
+	TEST_ASSERT_TRUE(poi_parse_csv("48.1,11.5,Fuel station far away", 30, &r));
+	TEST_ASSERT_EQUAL_INT32(481000000, r.lat_e7);
+	TEST_ASSERT_EQUAL_INT32(115000000, r.lng_e7);
+	TEST_ASSERT_EQUAL_MEMORY("Fuel station", r.name, POI_NAME_MAX);
+	TEST_ASSERT_EQUAL_UINT32(poi_key(48.1, 11.5), r.key);
+	TEST_ASSERT_TRUE(poi_parse_csv("-33.9,151.2\r\n", 13, &r));
+	TEST_ASSERT_EQUAL(0, r.name[0]);
+	TEST_ASSERT_FALSE(poi_parse_csv("lat,lng,name", 12, &r));
+	TEST_ASSERT_FALSE(poi_parse_csv("91,10", 5, &r));
+	TEST_ASSERT_FALSE(poi_parse_csv("10;20", 5, &r));
+	TEST_ASSERT_FALSE(poi_parse_csv("", 0, &r));
+}
+
+void test_build(void)
+{
+	static struct poi_record sorted[POI_COUNT];
+	char msg[96];
+
+	make_pois();
+	double t0 = now_s();
+	memcpy(sorted, recs, sizeof(recs));
+	poi_sort(sorted, POI_COUNT);
+	TEST_ASSERT_TRUE(poi_write(sorted, POI_COUNT, 1, 2, mem_write, &idx_file));
+	double dt = now_s() - t0;
+
+	for (int i = 1; i < POI_COUNT; i++)
+		TEST_ASSERT_TRUE(sorted[i - 1].key <= sorted[i].key);
+	TEST_ASSERT_TRUE(poi_open(&idx, mem_read_at, &idx_file));
+	TEST_ASSERT_EQUAL_UINT32(POI_COUNT, idx.hdr.count);
+	snprintf(msg, sizeof(msg), "sort and write %d POIs: %.1f ms, %lu bytes, %lu B key table",
+		 POI_COUNT, dt * 1000, (unsigned long)idx_file.len,
+		 (unsigned long)(idx.hdr.blocks * sizeof(uint32_t)));
+	TEST_MESSAGE(msg);
+}
+
+static void check_query(double lat, double lng, int n, float max_m)
+{
+	struct poi_hit hits[NEAREST];
+	float best[NEAREST];
+	int got = poi_nearest(&idx, lat, lng, hits, n, max_m);
+	int want = brute_nearest(lat, lng, best, n, max_m);
+	char msg[96];
+
+	snprintf(msg, sizeof(msg), "query %.5f,%.5f n %d", lat, lng, n);
+	TEST_ASSERT_EQUAL_INT_MESSAGE(want, got, msg);
+	for (int k = 0; k < got; k++) {
+		TEST_ASSERT_FLOAT_WITHIN_MESSAGE(1e-3, best[k], hits[k].dist_m, msg);
+		TEST_ASSERT_FLOAT_WITHIN_MESSAGE(1e-3, dist_m(&hits[k].rec, lat, lng),
+						 hits[k].dist_m, msg);
+	}
+}
+
+void test_matches_brute_force(void)
+{
+	rng = 99;
+	for (int q = 0; q < QUERIES; q++) {
+		/* Inside, at the edges of and well outside the populated box */
+		double lat = 46.8 + drand() * 2.4;
+		double lng = 8.8 + drand() * 4.9;
+
+		check_query(lat, lng, 1 + q % NEAREST, MAX_RANGE_M);
+	}
+	check_query(0, 0, NEAREST, MAX_RANGE_M);      /* Nothing in range */
+	check_query(48, 11, NEAREST, 10.0f);          /* Tiny range */
+	check_query(48.5, 10.5, NEAREST, 1000000.0f); /* Range larger than the data */
+}
+
+void test_bench_query(void)
+{
+	struct poi_hit hits[NEAREST];
+	const int rounds = 20000;
+	uint32_t blocks = idx.blocks_read;
+	uint32_t reads = idx_file.reads;
+	char msg[128];
+
+	rng = 7;
+	double t0 = now_s();
+	for (int q = 0; q < rounds; q++) {
+		double lat = 47 + drand() * 2;
+		double lng = 9 + drand() * 4.5;
+
+		TEST_ASSERT_EQUAL_INT(1, poi_nearest(&idx, lat, lng, hits, 1, MAX_RANGE_M));
+	}
+	double dt = now_s() - t0;
+
+	snprintf(msg, sizeof(msg), "nearest of %d: %.1f us/query, %.1f blocks and %.1f reads per query",
+		 POI_COUNT, dt / rounds * 1e6, (double)(idx.blocks_read - blocks) / rounds,
+		 (double)(idx_file.reads - reads) / rounds);
+	TEST_MESSAGE(msg);
+	/* The NAV screen asks once per redraw; each block is a card read */
+	TEST_ASSERT_LESS_THAN(16 * rounds, idx.blocks_read - blocks);
+}
+
+void test_empty_index(void)
+{
+	struct mem_file f = { NULL, 0, 0, 0, 0 };
+	struct poi_index e;
+	struct poi_hit hit;
+
+	TEST_ASSERT_TRUE(poi_write(recs, 0, 0, 0, mem_write, &f));
+	TEST_ASSERT_TRUE(poi_open(&e, mem_read_at, &f));
+	TEST_ASSERT_EQUAL_INT(0, poi_nearest(&e, 48, 11, &hit, 1, MAX_RANGE_M));
+	poi_close(&e);
+	free(f.data);
+}
+
+/*
+ * POIs closer together than the quantisation share a key; with enough of
+ * them the key runs across several blocks. The cell is aligned so that
+ * the query range starts at exactly that key.
+ */
+void test_duplicate_keys_across_blocks(void)
+{
+	static struct poi_record dup[3 * POI_BLOCK_RECS + 8];
+	const uint32_t n = sizeof(dup) / sizeof(dup[0]);
+	const double lat0 = (0x8100 / 65536.0) * 180 - 90;
+	const double lng0 = (0x8200 / 65536.0) * 360 - 180;
+	struct mem_file f = { NULL, 0, 0, 0, 0 };
+	struct poi_index d;
+	struct poi_hit hit;
+	int exact = 0;
+	char line[64];
+
+	rng = 32;
+	for (uint32_t i = 0; i < n; i++) {
+		snprintf(line, sizeof(line), "%.7f,%.7f,dup %u\n", lat0 + 0.0001 + drand() * 0.0025,
+			 lng0 + 0.0001 + drand() * 0.005, (unsigned)i);
+		TEST_ASSERT_TRUE(poi_parse_csv(line, strlen(line), &dup[i]));
+		TEST_ASSERT_EQUAL_UINT32(dup[0].key, dup[i].key);
+	}
+	poi_sort(dup, n);
+	TEST_ASSERT_TRUE(poi_write(dup, n, 0, 0, mem_write, &f));
+	TEST_ASSERT_TRUE(poi_open(&d, mem_read_at, &f));
+	TEST_ASSERT_GREATER_THAN(2, d.hdr.blocks);
+	for (uint32_t i = 0; i < n; i++) {
+		TEST_ASSERT_EQUAL_INT(1, poi_nearest(&d, dup[i].lat_e7 / 1e7, dup[i].lng_e7 / 1e7,
+						     &hit, 1, MAX_RANGE_M));
+		exact += hit.dist_m < 0.01f;
+	}
+	poi_close(&d);
+	free(f.data);
+	TEST_ASSERT_EQUAL_INT(n, exact);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_parse_csv);
+	RUN_TEST(test_build);
+	RUN_TEST(test_matches_brute_force);
+	RUN_TEST(test_bench_query);
+	RUN_TEST(test_empty_index);
+	RUN_TEST(test_duplicate_keys_across_blocks);
+	poi_close(&idx);
+	free(idx_file.data);
+	return UNITY_END();
+}
@@ -0,0 +1,413 @@
+/*
+ * raw_capture: blocks handed out on time and when full, capture files
+ * unpacked back to the exact byte stream, including a torn last block,
+ * missing blocks and junk between blocks, and a replay of the RAW_MODE
+ * loop against a UART ring and a slow card in simulated time.
+ */
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "raw_capture.h"
+
+#define STREAM_MAX (4 << 20)
+#define HDR sizeof(struct raw_block_header)
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static uint32_t rng = 1;
+
+static uint32_t urand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+struct mem_buf {
+	uint8_t *data;
+	size_t len;
+	size_t pos; /* Read position */
+};
+
+static uint8_t stream[STREAM_MAX], card[STREAM_MAX + STREAM_MAX / 64], out[STREAM_MAX];
+static struct raw_capture cap;
+
+static size_t mem_read(void *ctx, uint8_t *buf, size_t len)
+{
+	struct mem_buf *m = (struct mem_buf *)ctx;
+
+	if (len > m->len - m->pos)
+		len = m->len - m->pos;
+	memcpy(buf, m->data + m->pos, len);
+	m->pos += len;
+	return len;
+}
+
+static size_t mem_write(void *ctx, const uint8_t *buf, size_t len)
+{
+	struct mem_buf *m = (struct mem_buf *)ctx;
+
+	memcpy(m->data + m->len, buf, len);
+	m->len += len;
+	return len;
+}
+
+static size_t unpack(const uint8_t *file, size_t len, struct raw_unpack_stats *st)
+{
+	struct mem_buf in = { (uint8_t *)file, len, 0 };
+	struct mem_buf o = { out, 0, 0 };
+
+	raw_unpack(mem_read, &in, mem_write, &o, st);
+	return o.len;
+}
+
+/*
+ * Captures len random bytes arriving in chunks of up to 600 bytes every
+ * 10 ms, each block written at once. Returns the capture file length;
+ * block_at[] gets the file offset of every block.
+ */
+static size_t capture(size_t len, uint32_t *block_at, uint32_t *blocks)
+{
+	struct mem_buf file = { card, 0, 0 };
+	uint32_t ms = 0;
+	size_t fed = 0;
+
+	*blocks = 0;
+	raw_capture_init(&cap);
+	for (size_t i = 0; i < len; i++)
+		stream[i] = (uint8_t)urand();
+	while (fed < len) {
+		size_t chunk = 1 + urand() % 600, room, n;
+		const uint8_t *b;
+
+		if (chunk > len - fed)
+			chunk = len - fed;
+		while (chunk) {
+			uint8_t *buf = raw_capture_buf(&cap, &room);
+
+			TEST_ASSERT_NOT_NULL(buf);
+			n = chunk < room ? chunk : room;
+			memcpy(buf, stream + fed, n);
+			raw_capture_put(&cap, n, ms);
+			fed += n;
+			chunk -= n;
+			if ((b = raw_capture_take(&cap, ms, false, &n)) != NULL) {
+				block_at[(*blocks)++] = file.len;
+				mem_write(&file, b, n);
+				raw_capture_written(&cap);
+			}
+		}
+		ms += 10;
+	}
+	size_t n;
+	const uint8_t *b = raw_capture_take(&cap, ms, true, &n);
+	if (b) {
+		block_at[(*blocks)++] = file.len;
+		mem_write(&file, b, n);
+		raw_capture_written(&cap);
+	}
+	return file.len;
+}
+
+void test_take_when_due(void)
+{
+	size_t room, len;
+	uint8_t *buf;
+
+	raw_capture_init(&cap);
+	TEST_ASSERT_NULL(raw_capture_take(&cap, 5000, true, &len)); /* Nothing captured */
+	buf = raw_capture_buf(&cap, &room);
+	TEST_ASSERT_EQUAL_UINT32(RAW_PAYLOAD_MAX, room);
+	memcpy(buf, "$GP", 3);
+	raw_capture_put(&cap, 3, 100);
+	TEST_ASSERT_NULL(raw_capture_take(&cap, 100 + RAW_FLUSH_MS - 1, false, &len));
+	const uint8_t *b = raw_capture_take(&cap, 100 + RAW_FLUSH_MS, false, &len);
+	TEST_ASSERT_NOT_NULL(b);
+	TEST_ASSERT_EQUAL_UINT32(HDR + 3, len);
+
+	struct raw_block_header hdr;
+	memcpy(&hdr, b, sizeof(hdr));
+	TEST_ASSERT_EQUAL_MEMORY(RAW_MAGIC, hdr.magic, 4);
+	TEST_ASSERT_EQUAL_UINT32(100, hdr.ms);
+	TEST_ASSERT_EQUAL_UINT32(0, hdr.seq);
+	TEST_ASSERT_EQUAL_UINT16(3, hdr.len);
+
+	/* Filling goes on in the other block; a full one waits for the card */
+	buf = raw_capture_buf(&cap, &room);
+	raw_capture_put(&cap, room, 2000);
+	TEST_ASSERT_NULL(raw_capture_buf(&cap, &room));
+	TEST_ASSERT_EQUAL_UINT32(0, room);
+	TEST_ASSERT_NULL(raw_capture_take(&cap, 2000, true, &len));
+	raw_capture_written(&cap);
+	TEST_ASSERT_NOT_NULL(raw_capture_take(&cap, 2000, false, &len));
+	TEST_ASSERT_EQUAL_UINT32(RAW_BLOCK_SIZE, len);
+	TEST_ASSERT_NOT_NULL(raw_capture_buf(&cap, &room));
+}
+
+void test_round_trip(void)
+{
+	static uint32_t block_at[STREAM_MAX / 16];
+	struct raw_unpack_stats st;
+	uint32_t blocks;
+
+	rng = 44;
+	size_t file = capture(1 << 20, block_at, &blocks);
+
+	TEST_ASSERT_EQUAL_UINT32(1 << 20, unpack(card, file, &st));
+	TEST_ASSERT_EQUAL_MEMORY(stream, out, 1 << 20);
+	TEST_ASSERT_EQUAL_UINT32(blocks, st.blocks);
+	TEST_ASSERT_EQUAL_UINT32(1 << 20, st.bytes);
+	TEST_ASSERT_EQUAL_UINT32(0, st.gaps);
+	TEST_ASSERT_EQUAL_UINT32(0, st.skipped);
+}
+
+/* Power lost while the last block was written */
+void test_torn_last_block(void)
+{
+	static uint32_t block_at[STREAM_MAX / 16];
+	struct raw_unpack_stats st;
+	uint32_t blocks;
+
+	rng = 45;
+	size_t file = capture(200000, block_at, &blocks);
+	uint32_t last = block_at[blocks - 1];
+
+	/* Inside the payload: what reached the card comes out */
+	size_t got = unpack(card, last + HDR + 100, &st);
+	TEST_ASSERT_EQUAL_UINT32(last - (blocks - 1) * HDR + 100, got);
+	TEST_ASSERT_EQUAL_MEMORY(stream, out, got);
+	TEST_ASSERT_EQUAL_UINT32(blocks, st.blocks);
+	TEST_ASSERT_EQUAL_UINT32(0, st.skipped);
+
+	/* Inside the header: skipped, the blocks before are intact */
+	got = unpack(card, last + HDR - 3, &st);
+	TEST_ASSERT_EQUAL_UINT32(last - (blocks - 1) * HDR, got);
+	TEST_ASSERT_EQUAL_MEMORY(stream, out, got);
+	TEST_ASSERT_EQUAL_UINT32(blocks - 1, st.blocks);
+	TEST_ASSERT_EQUAL_UINT32(HDR - 3, st.skipped);
+	TEST_ASSERT_TRUE(file > last);
+}
+
+/* Blocks 2, 5 and 6 never reached the card, junk sits where 9 was */
+void test_sequence_gaps_and_junk(void)
+{
+	static uint32_t block_at[STREAM_MAX / 16];
+	static uint8_t holed[sizeof(card)], want[STREAM_MAX];
+	struct raw_unpack_stats st;
+	size_t len = 0, want_len = 0;
+	uint32_t blocks;
+
+	rng = 46;
+	size_t file = capture(150000, block_at, &blocks);
+	TEST_ASSERT_GREATER_THAN(10, blocks);
+	for (uint32_t k = 0; k < blocks; k++) {
+		uint32_t from = block_at[k], to = k + 1 < blocks ? block_at[k + 1] : file;
+
+		if (k == 2 || k == 5 || k == 6)
+			continue;
+		if (k == 9) {
+			memcpy(holed + len, "GRA\0GRAWxx", 10); /* Broken magic, then a bad length */
+			holed[len + 17] = 0xff;
+			holed[len + 18] = 0xff;
+			len += 40;
+			continue;
+		}
+		memcpy(holed + len, card + from, to - from);
+		len += to - from;
+		memcpy(want + want_len, card + from + HDR, to - from - HDR);
+		want_len += to - from - HDR;
+	}
+
+	TEST_ASSERT_EQUAL_UINT32(want_len, unpack(holed, len, &st));
+	TEST_ASSERT_EQUAL_MEMORY(want, out, want_len);
+	TEST_ASSERT_EQUAL_UINT32(4, st.gaps);
+	TEST_ASSERT_EQUAL_UINT32(40, st.skipped);
+	TEST_ASSERT_EQUAL_UINT32(blocks - 4, st.blocks);
+}
+
+void test_overruns_in_next_block(void)
+{
+	struct raw_unpack_stats st;
+	struct mem_buf file = { card, 0, 0 };
+	const uint8_t *b;
+	size_t room, len;
+
+	raw_capture_init(&cap);
+	raw_capture_overrun(&cap, 3);
+	raw_capture_buf(&cap, &room);
+	raw_capture_put(&cap, 10, 0);
+	raw_capture_overrun(&cap, 2);
+	b = raw_capture_take(&cap, 0, true, &len);
+	mem_write(&file, b, len);
+	raw_capture_written(&cap);
+	raw_capture_buf(&cap, &room);
+	raw_capture_put(&cap, 10, 0);
+	b = raw_capture_take(&cap, 0, true, &len);
+	mem_write(&file, b, len);
+
+	unpack(card, file.len, &st);
+	TEST_ASSERT_EQUAL_UINT32(5, st.overruns);
+	TEST_ASSERT_EQUAL_UINT32(5, cap.overruns_total);
+	TEST_ASSERT_EQUAL_UINT32(2, st.blocks);
+}
+
+// === Replay: RAW_MODE loop in simulated time ===
+#define SIM_S 30
+#define UART_RX 4096
+
+struct replay {
+	uint32_t dropped;
+	uint32_t min_room;
+	bool identical;
+};
+
+/* A GGA, RMC, three GSV and a GSA per second, repeated for the stream */
+static size_t nmea_second(int s, char *buf)
+{
+	int n = 0;
+
+	n += sprintf(buf + n, "$GPGGA,%06d.00,4723.1234,N,00832.5678,E,1,09,0.9,412.3,M,47.1,M,,*5B\r\n", s);
+	n += sprintf(buf + n, "$GPRMC,%06d.00,A,4723.1234,N,00832.5678,E,0.13,309.62,181026,,,A*6C\r\n", s);
+	for (int k = 1; k <= 3; k++)
+		n += sprintf(buf + n, "$GPGSV,3,%d,11,03,03,111,00,04,15,270,00,06,01,010,00,13,06,292,00*74\r\n", k);
+	n += sprintf(buf + n, "$GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1*39\r\n");
+	return n;
+}
+
+/*
+ * The receiver fills a UART_RX ring at baud/10 bytes/s; loop() drains it
+ * every millisecond, and for 30 ms every second redraws the display. A
+ * card write takes 2 ms plus 0.25 ms/KB and every 10th one stalls for
+ * 120 ms. With sync the loop waits for each write, as before the writes
+ * went through sd_sched_submit().
+ */
+static void replay(uint32_t baud, bool sync, struct replay *r)
+{
+	static uint8_t ring[UART_RX];
+	struct mem_buf file = { card, 0, 0 };
+	uint64_t sent = 0, done_us = 0, loop_us = 0, stream_len = 0;
+	uint32_t head = 0, count = 0, writes = 0;
+	bool busy = false;
+	char sec[600];
+	size_t sec_len = 0, sec_pos = 0;
+	int s = 0;
+
+	raw_capture_init(&cap);
+	r->dropped = 0;
+	r->min_room = UART_RX;
+	for (uint64_t us = 0; us < SIM_S * 1000000ull; us += 100) {
+		/* Receiver */
+		for (uint64_t due = us * baud / 10 / 1000000; sent < due; sent++) {
+			if (sec_pos == sec_len) {
+				sec_len = nmea_second(s++ % 240000, sec);
+				sec_pos = 0;
+			}
+			uint8_t c = sec[sec_pos++];
+			if (count == UART_RX) {
+				r->dropped++;
+				continue;
+			}
+			stream[stream_len++ % STREAM_MAX] = c;
+			ring[(head + count++) % UART_RX] = c;
+			if (UART_RX - count < r->min_room)
+				r->min_room = UART_RX - count;
+		}
+		if (us < loop_us)
+			continue;
+
+		/* loop() */
+		size_t room, n;
+		uint8_t *buf = raw_capture_buf(&cap, &room);
+		if (buf) {
+			n = count < room ? count : room;
+			for (size_t k = 0; k < n; k++)
+				buf[k] = ring[(head + k) % UART_RX];
+			head = (head + n) % UART_RX;
+			count -= n;
+			raw_capture_put(&cap, n, us / 1000);
+		}
+		if (busy && us >= done_us) {
+			raw_capture_written(&cap);
+			busy = false;
+		}
+		loop_us = us + 1000;
+		const uint8_t *b = busy ? NULL : raw_capture_take(&cap, us / 1000, false, &n);
+		if (b) {
+			uint64_t t = 2000 + n / 4 + (++writes % 10 == 0 ? 120000 : 0);
+			mem_write(&file, b, n);
+			busy = true;
+			done_us = us + t;
+			if (sync)
+				loop_us = done_us;
+		}
+		if (us % 1000000 < 1000)
+			loop_us += 30000;
+	}
+
+	/* Whatever is left in the ring and the blocks */
+	size_t room, n;
+	for (;;) {
+		uint8_t *buf = raw_capture_buf(&cap, &room);
+		if (buf && count) {
+			n = count < room ? count : room;
+			for (size_t k = 0; k < n; k++)
+				buf[k] = ring[(head + k) % UART_RX];
+			head = (head + n) % UART_RX;
+			count -= n;
+			raw_capture_put(&cap, n, SIM_S * 1000);
+		}
+		raw_capture_written(&cap);
+		const uint8_t *b = raw_capture_take(&cap, SIM_S * 1000, true, &n);
+		if (!b)
+			break;
+		mem_write(&file, b, n);
+	}
+
+	struct raw_unpack_stats st;
+	size_t got = unpack(card, file.len, &st);
+	TEST_ASSERT_TRUE(stream_len <= STREAM_MAX);
+	r->identical = got == stream_len && !memcmp(out, stream, got) && !st.gaps && !st.skipped;
+}
+
+static void check_replay(uint32_t baud, bool sync, bool lossless)
+{
+	struct replay r;
+	char msg[128];
+
+	replay(baud, sync, &r);
+	snprintf(msg, sizeof(msg), "%6u %s: %u bytes dropped, min RX headroom %u B%s",
+		 (unsigned)baud, sync ? "sync " : "async", (unsigned)r.dropped, (unsigned)r.min_room,
+		 r.identical ? ", output identical" : "");
+	TEST_MESSAGE(msg);
+	if (lossless) {
+		TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, r.dropped, msg);
+		TEST_ASSERT_TRUE_MESSAGE(r.identical, msg);
+	} else {
+		TEST_ASSERT_GREATER_THAN_MESSAGE(0, r.dropped, msg);
+	}
+}
+
+void test_replay_115200(void) { check_replay(115200, false, true); }
+void test_replay_460800(void) { check_replay(460800, false, true); }
+/* Waiting for the card in loop() cannot keep up at the higher rate */
+void test_replay_460800_sync(void) { check_replay(460800, true, false); }
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_take_when_due);
+	RUN_TEST(test_round_trip);
+	RUN_TEST(test_torn_last_block);
+	RUN_TEST(test_sequence_gaps_and_junk);
+	RUN_TEST(test_overruns_in_next_block);
+	RUN_TEST(test_replay_115200);
+	RUN_TEST(test_replay_460800);
+	RUN_TEST(test_replay_460800_sync);
+	return UNITY_END();
+}
@@ -0,0 +1,337 @@
+/*
+ * track_merge: the fixed-layout parser against the track_parse_csv()
+ * path on logger lines and on everything else, dropping fixes read twice,
+ * local days west of UTC, the gap and HDOP rules of the day statistics,
+ * and parse throughput in points per second.
+ */
+
+#include <unity.h>
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "geo.h"
+#include "track_format.h"
+#include "track_merge.h"
+#include "trip.h"
+
+#define BENCH_POINTS 200000
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static uint32_t rng = 1;
+
+static uint32_t urand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static double drand(void)
+{
+	return (urand() & 0xffffff) / (double)0x1000000;
+}
+
+static double now_s(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* What merge_parse_csv() falls back to, for any line */
+static bool slow_parse(const char *line, uint16_t unit, struct merge_point *m)
+{
+	struct track_point pt;
+
+	if (!track_parse_csv(line, strlen(line), &pt) || !track_utc_time(&pt, &m->utc) ||
+	    fabs(pt.lat) > 90 || fabs(pt.lng) > 180)
+		return false;
+	m->lat_e6 = (int32_t)lround(pt.lat * 1e6);
+	m->lng_e6 = (int32_t)lround(pt.lng * 1e6);
+	m->sats = pt.sats < 0 ? 0 : pt.sats > 255 ? 255 : (uint8_t)pt.sats;
+	m->hdop_c = pt.hdop < 0 ? 0 : pt.hdop > 655 ? 65535 : (uint16_t)lroundf(pt.hdop * 100);
+	m->offset_hours = (int8_t)pt.offset_hours;
+	m->unit = unit;
+	return true;
+}
+
+static bool same_point(const struct merge_point *a, const struct merge_point *b)
+{
+	return a->utc == b->utc && a->lat_e6 == b->lat_e6 && a->lng_e6 == b->lng_e6 &&
+	       a->unit == b->unit && a->hdop_c == b->hdop_c && a->sats == b->sats &&
+	       a->offset_hours == b->offset_hours;
+}
+
+/* A line as the logger writes it */
+static int logger_line(char *buf, size_t len)
+{
+	struct track_point pt;
+	int64_t utc = 1700000000 + (int64_t)(urand() % 100000000);
+
+	pt.lat = (drand() * 2 - 1) * 90;
+	pt.lng = (drand() * 2 - 1) * 180;
+	pt.sats = urand() % 20;
+	pt.hdop = (urand() % 5000) / 100.0f;
+	pt.offset_hours = (int)(urand() % 25) - 12;
+	track_set_local(&pt, utc);
+	return track_csv_line(&pt, buf, len);
+}
+
+void test_fast_matches_slow_on_logger_lines(void)
+{
+	char line[TRACK_LINE_MAX];
+	struct merge_point fast, slow;
+
+	rng = 47;
+	for (int i = 0; i < 100000; i++) {
+		logger_line(line, sizeof(line));
+		if (i % 3 == 0)
+			strcat(line, i % 2 ? "\r\n" : "\n");
+		TEST_ASSERT_TRUE(merge_parse_csv(line, strlen(line), 3, &fast));
+		TEST_ASSERT_TRUE(slow_parse(line, 3, &slow));
+		TEST_ASSERT_TRUE_MESSAGE(same_point(&fast, &slow), line);
+	}
+}
+
+/* Off the fixed layout: same answer, accepted or not */
+void test_fast_matches_slow_elsewhere(void)
+{
+	static const char *lines[] = {
+		"2025-06-01 12:00:00,48.1,11.5,9,0.9,2",            /* Fewer decimals */
+		"2025-06-01 12:00:00,48,-11,9,1,2",                 /* No decimals */
+		"2025-06-01 12:00:00,-0.000001,0.000000,0,0.00,0",
+		"2025-06-01 12:00:00,4.81e1,11.5,9,0.9,2",          /* Only strtod() takes it */
+		"2025-06-01 12:00:00, 48.1,11.5,9,0.9,2",           /* Leading blank */
+		"2025-06-01 12:00:00,90.000000,180.000000,12,0.80,0",
+		"2025-12-31 23:59:59,48.100000,11.500000,9,0.90,-12",
+		"2025-06-01 12:00:00,48.100000,11.500000,9,0.90,2 ",
+		"timestamp,lat,lng,sats,hdop,offset",
+		"",
+		"2025-06-01 12:00:00,48.100000,11.500000,9,0.90",   /* Short */
+		"2025-06-01 12:00:00,90.000001,11.500000,9,0.90,0", /* Out of range */
+		"2025-06-01 12:00:00,48.100000,180.5,9,0.90,0",
+		"2025-13-01 12:00:00,48.100000,11.500000,9,0.90,0", /* No such month */
+		"2025-06-01 12:00,48.100000,11.500000,9,0.90,0",
+		"2025-06-01 12:00:00,48.1x,11.5,9,0.9,2",           /* /export takes it too */
+	};
+
+	for (unsigned i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+		struct merge_point fast, slow;
+		bool f = merge_parse_csv(lines[i], strlen(lines[i]), 1, &fast);
+		bool s = slow_parse(lines[i], 1, &slow);
+
+		TEST_ASSERT_EQUAL_MESSAGE(s, f, lines[i]);
+		if (f)
+			TEST_ASSERT_TRUE_MESSAGE(same_point(&fast, &slow), lines[i]);
+	}
+}
+
+/* Formatting a parsed point gives back the logged line */
+void test_round_trip(void)
+{
+	char line[TRACK_LINE_MAX], again[TRACK_LINE_MAX];
+	struct merge_point m;
+	struct track_point pt;
+
+	rng = 470;
+	for (int i = 0; i < 10000; i++) {
+		logger_line(line, sizeof(line));
+		TEST_ASSERT_TRUE(merge_parse_csv(line, strlen(line), 0, &m));
+		merge_track_point(&m, &pt);
+		track_csv_line(&pt, again, sizeof(again));
+		TEST_ASSERT_EQUAL_STRING(line, again);
+	}
+}
+
+static struct merge_point at(int64_t utc, int32_t lat_e6, int32_t lng_e6, uint16_t unit)
+{
+	struct merge_point m = { utc, lat_e6, lng_e6, unit, 90, 9, 0 };
+
+	return m;
+}
+
+/* The same card read twice, or copied into two unit directories */
+void test_dedupe(void)
+{
+	std::vector<struct merge_point> pts = {
+		at(100, 1, 1, 0), at(101, 2, 2, 0), at(100, 1, 1, 0),
+		at(101, 2, 2, 1), /* Same fix under another unit */
+		at(101, 2, 3, 1), /* Same second, another place: kept */
+		at(99, 0, 0, 2),  at(101, 2, 2, 0),
+	};
+
+	std::sort(pts.begin(), pts.end(), [](const struct merge_point &a, const struct merge_point &b) {
+		return merge_before(&a, &b);
+	});
+	pts.erase(std::unique(pts.begin(), pts.end(),
+			      [](const struct merge_point &a, const struct merge_point &b) {
+				      return merge_same(&a, &b);
+			      }), pts.end());
+	TEST_ASSERT_EQUAL_INT(4, (int)pts.size());
+	TEST_ASSERT_EQUAL_INT32(99, pts[0].utc);
+	TEST_ASSERT_EQUAL_INT32(100, pts[1].utc);
+	TEST_ASSERT_EQUAL_INT32(2, pts[2].lng_e6);
+	TEST_ASSERT_EQUAL_UINT16(0, pts[2].unit); /* Lowest unit kept */
+	TEST_ASSERT_EQUAL_INT32(3, pts[3].lng_e6);
+}
+
+void test_local_day(void)
+{
+	struct merge_point m = at(0, 0, 0, 0);
+
+	/* 2025-06-01 is day 20240 */
+	m.utc = 20240LL * 86400 + 3 * 3600;
+	TEST_ASSERT_EQUAL_INT32(20240, merge_local_day(&m));
+	m.offset_hours = -3;
+	TEST_ASSERT_EQUAL_INT32(20240, merge_local_day(&m));
+	m.offset_hours = -4;
+	TEST_ASSERT_EQUAL_INT32(20239, merge_local_day(&m));
+	m.offset_hours = 12;
+	m.utc = 20240LL * 86400 + 12 * 3600;
+	TEST_ASSERT_EQUAL_INT32(20241, merge_local_day(&m));
+	/* Before the epoch in local time */
+	m.utc = 3600;
+	m.offset_hours = -2;
+	TEST_ASSERT_EQUAL_INT32(-1, merge_local_day(&m));
+	m.utc = 0;
+	m.offset_hours = -24;
+	TEST_ASSERT_EQUAL_INT32(-1, merge_local_day(&m));
+	m.utc = -86400 - 1;
+	m.offset_hours = 0;
+	TEST_ASSERT_EQUAL_INT32(-2, merge_local_day(&m));
+	/* A parsed line lands on its local date */
+	const char *line = "2025-05-31 19:00:00,48.100000,11.500000,9,0.90,-8";
+	TEST_ASSERT_TRUE(merge_parse_csv(line, strlen(line), 0, &m));
+	TEST_ASSERT_EQUAL_INT32(20240LL * 86400 + 3 * 3600, m.utc);
+	TEST_ASSERT_EQUAL_INT32(20239, merge_local_day(&m));
+}
+
+/* 10 m north per second is 36 km/h */
+void test_day_steps(void)
+{
+	const int32_t step_e6 = (int32_t)lround(10 / GEO_METERS_PER_DEG * 1e6);
+	struct merge_day d;
+	struct merge_point a = at(1000, 48000000, 11000000, 0), b;
+
+	memset(&d, 0, sizeof(d));
+	merge_day_add(&d, NULL, &a);
+	TEST_ASSERT_EQUAL_UINT32(1, d.points);
+	TEST_ASSERT_EQUAL_UINT32(0, d.moving_s);
+
+	b = at(1001, a.lat_e6 + step_e6, a.lng_e6, 0);
+	merge_day_add(&d, &a, &b);
+	TEST_ASSERT_EQUAL_UINT32(2, d.points);
+	TEST_ASSERT_EQUAL_UINT32(1, d.moving_s);
+	TEST_ASSERT_FLOAT_WITHIN(0.05, 10.0, d.distance_m);
+	TEST_ASSERT_FLOAT_WITHIN(0.2, 36.0, d.max_kmh);
+
+	/* Longest gap bridged, then one second more */
+	b = at(1000 + MERGE_MAX_GAP_S, a.lat_e6 + 100 * step_e6, a.lng_e6, 0);
+	merge_day_add(&d, &a, &b);
+	TEST_ASSERT_EQUAL_UINT32(1 + MERGE_MAX_GAP_S, d.moving_s);
+	b.utc++;
+	merge_day_add(&d, &a, &b);
+	TEST_ASSERT_EQUAL_UINT32(1 + MERGE_MAX_GAP_S, d.moving_s);
+
+	/* Same second or going back: no step */
+	b = at(1000, a.lat_e6 + step_e6, a.lng_e6, 0);
+	merge_day_add(&d, &a, &b);
+	b.utc = 999;
+	merge_day_add(&d, &a, &b);
+	TEST_ASSERT_EQUAL_UINT32(1 + MERGE_MAX_GAP_S, d.moving_s);
+	TEST_ASSERT_EQUAL_UINT32(6, d.points);
+}
+
+void test_day_hdop_and_speed(void)
+{
+	const uint16_t max_c = (uint16_t)(TRIP_MAX_HDOP * 100);
+	const int32_t step_e6 = (int32_t)lround(10 / GEO_METERS_PER_DEG * 1e6);
+	struct merge_day d;
+	struct merge_point a = at(0, 48000000, 11000000, 0);
+	struct merge_point b = at(1, a.lat_e6 + step_e6, a.lng_e6, 0);
+
+	memset(&d, 0, sizeof(d));
+	a.hdop_c = max_c;
+	b.hdop_c = max_c;
+	merge_day_add(&d, &a, &b); /* At the limit counts */
+	TEST_ASSERT_EQUAL_UINT32(1, d.moving_s);
+	b.hdop_c = max_c + 1;
+	merge_day_add(&d, &a, &b);
+	b.hdop_c = 90;
+	a.hdop_c = max_c + 1;
+	merge_day_add(&d, &a, &b);
+	TEST_ASSERT_EQUAL_UINT32(1, d.moving_s);
+	TEST_ASSERT_FLOAT_WITHIN(0.05, 10.0, d.distance_m);
+
+	/* Walking pace below TRIP_START_KMH is standing still */
+	a.hdop_c = 90;
+	b = at(10, a.lat_e6 + step_e6 / 2, a.lng_e6, 0); /* 1.8 km/h */
+	merge_day_add(&d, &a, &b);
+	TEST_ASSERT_EQUAL_UINT32(1, d.moving_s);
+	TEST_ASSERT_EQUAL_UINT32(4, d.points);
+}
+
+// === Benchmark: parse throughput ===
+void test_bench_parse(void)
+{
+	std::vector<char> text;
+	std::vector<size_t> start;
+	char line[TRACK_LINE_MAX], msg[128];
+	struct merge_point m;
+	uint32_t ok = 0;
+
+	rng = 4700;
+	for (int i = 0; i < BENCH_POINTS; i++) {
+		int n = logger_line(line, sizeof(line));
+
+		start.push_back(text.size());
+		text.insert(text.end(), line, line + n);
+		text.push_back('\n');
+	}
+	start.push_back(text.size());
+
+	double t0 = now_s();
+	for (int i = 0; i < BENCH_POINTS; i++)
+		ok += merge_parse_csv(&text[start[i]], start[i + 1] - start[i], 0, &m);
+	double fast = now_s() - t0;
+
+	t0 = now_s();
+	for (int i = 0; i < BENCH_POINTS; i++) {
+		size_t len = start[i + 1] - start[i];
+
+		memcpy(line, &text[start[i]], len);
+		line[len] = '\0';
+		ok += slow_parse(line, 0, &m);
+	}
+	double slow = now_s() - t0;
+
+	snprintf(msg, sizeof(msg), "%d logger lines: merge_parse_csv %.2f M points/s, "
+		 "track_parse_csv %.2f M points/s", BENCH_POINTS, BENCH_POINTS / fast / 1e6,
+		 BENCH_POINTS / slow / 1e6);
+	TEST_MESSAGE(msg);
+	TEST_ASSERT_EQUAL_UINT32(2 * BENCH_POINTS, ok);
+	TEST_ASSERT_TRUE_MESSAGE(fast < slow, msg);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_fast_matches_slow_on_logger_lines);
+	RUN_TEST(test_fast_matches_slow_elsewhere);
+	RUN_TEST(test_round_trip);
+	RUN_TEST(test_dedupe);
+	RUN_TEST(test_local_day);
+	RUN_TEST(test_day_steps);
+	RUN_TEST(test_day_hdop_and_speed);
+	RUN_TEST(test_bench_parse);
+	return UNITY_END();
+}
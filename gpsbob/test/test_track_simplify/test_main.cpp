@@ -0,0 +1,244 @@
+/*
+ * track_simplify: every dropped point stays within the tolerance of the
+ * line between the kept points around it, and throughput of the /export
+ * path (CSV -> simplify -> GPX) at several tolerances.
+ */
+
+#include <unity.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "geo.h"
+#include "track_format.h"
+#include "track_simplify.h"
+
+#define TRACK_POINTS 20000
+#define DEG_TO_RAD 0.017453292519943295
+
+static struct track_point track[TRACK_POINTS];
+static uint32_t kept[TRACK_POINTS];
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static uint32_t rng = 1;
+
+static float frand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return (rng & 0xffffff) / (float)0x1000000;
+}
+
+/*
+ * A drive at 1 Hz: speed 2-20 m/s, heading drifting with occasional
+ * sharp turns and a metre or two of receiver noise. sats carries the
+ * index so kept points can be traced back.
+ */
+static void make_track(void)
+{
+	double lat = 48.137, lng = 11.575;
+	float heading = 0, speed = 10;
+
+	rng = 12345;
+	for (int i = 0; i < TRACK_POINTS; i++) {
+		struct track_point *pt = &track[i];
+
+		if (frand() < 0.02f)
+			heading += (frand() - 0.5f) * 3.0f;
+		heading += (frand() - 0.5f) * 0.1f;
+		speed += (frand() - 0.5f) * 2;
+		speed = speed < 2 ? 2 : speed > 20 ? 20 : speed;
+		lat += speed * cos(heading) / GEO_EARTH_RADIUS_M / DEG_TO_RAD;
+		lng += speed * sin(heading) / GEO_EARTH_RADIUS_M / DEG_TO_RAD / cos(lat * DEG_TO_RAD);
+
+		pt->lat = lat + (frand() - 0.5f) * 2e-5;
+		pt->lng = lng + (frand() - 0.5f) * 3e-5;
+		pt->sats = i;
+		pt->hdop = 0.9f;
+		pt->offset_hours = 1;
+		track_set_local(pt, 1700000000 + i);
+	}
+}
+
+static uint32_t simplify(float tol, uint32_t *out)
+{
+	struct track_simplify s;
+	struct track_point pt;
+	uint32_t n = 0;
+
+	track_simplify_init(&s, tol);
+	for (int i = 0; i < TRACK_POINTS; i++)
+		if (track_simplify_push(&s, &track[i], &pt))
+			out[n++] = pt.sats;
+	if (track_simplify_finish(&s, &pt))
+		out[n++] = pt.sats;
+	return n;
+}
+
+/* Distance from p to the segment a -> b, in double and independently of the module */
+static double seg_dist_m(const struct track_point *a, const struct track_point *b,
+			 const struct track_point *p)
+{
+	double k = cos(a->lat * DEG_TO_RAD);
+	double bx = (b->lng - a->lng) * DEG_TO_RAD * GEO_EARTH_RADIUS_M * k;
+	double by = (b->lat - a->lat) * DEG_TO_RAD * GEO_EARTH_RADIUS_M;
+	double px = (p->lng - a->lng) * DEG_TO_RAD * GEO_EARTH_RADIUS_M * k;
+	double py = (p->lat - a->lat) * DEG_TO_RAD * GEO_EARTH_RADIUS_M;
+	double len2 = bx * bx + by * by;
+	double t = len2 > 0 ? (px * bx + py * by) / len2 : 0;
+
+	t = t < 0 ? 0 : t > 1 ? 1 : t;
+	return hypot(px - t * bx, py - t * by);
+}
+
+static void check_tolerance(float tol)
+{
+	uint32_t n = simplify(tol, kept);
+	double worst = 0;
+
+	TEST_ASSERT_GREATER_THAN(1, n);
+	TEST_ASSERT_EQUAL_UINT32(0, kept[0]);
+	TEST_ASSERT_EQUAL_UINT32(TRACK_POINTS - 1, kept[n - 1]);
+	for (uint32_t k = 1; k < n; k++) {
+		TEST_ASSERT_GREATER_THAN(kept[k - 1], kept[k]);
+		TEST_ASSERT_LESS_OR_EQUAL(TRACK_SIMPLIFY_WINDOW + 1, kept[k] - kept[k - 1]);
+		for (uint32_t i = kept[k - 1] + 1; i < kept[k]; i++) {
+			double d = seg_dist_m(&track[kept[k - 1]], &track[kept[k]], &track[i]);
+			if (d > worst)
+				worst = d;
+		}
+	}
+
+	char msg[96];
+	snprintf(msg, sizeof(msg), "tol %.1f m: %u of %u points kept, worst %.3f m",
+		 tol, n, TRACK_POINTS, worst);
+	TEST_MESSAGE(msg);
+	/* float projection around the anchor against double here */
+	TEST_ASSERT_TRUE_MESSAGE(worst <= tol * 1.001 + 0.01, msg);
+}
+
+void test_within_1m(void) { check_tolerance(1); }
+void test_within_5m(void) { check_tolerance(5); }
+void test_within_25m(void) { check_tolerance(25); }
+
+void test_zero_tolerance_keeps_everything(void)
+{
+	TEST_ASSERT_EQUAL_UINT32(TRACK_POINTS, simplify(0, kept));
+	for (uint32_t i = 0; i < TRACK_POINTS; i++)
+		TEST_ASSERT_EQUAL_UINT32(i, kept[i]);
+}
+
+void test_straight_line_keeps_ends(void)
+{
+	struct track_simplify s;
+	struct track_point pt, out;
+	uint32_t n = 0;
+
+	memset(&pt, 0, sizeof(pt));
+	track_simplify_init(&s, 2);
+	for (int i = 0; i < 50; i++) {
+		pt.lat = 48 + i * 1e-4;
+		pt.lng = 11;
+		pt.sats = i;
+		if (track_simplify_push(&s, &pt, &out))
+			kept[n++] = out.sats;
+	}
+	if (track_simplify_finish(&s, &out))
+		kept[n++] = out.sats;
+	TEST_ASSERT_EQUAL_UINT32(2, n);
+	TEST_ASSERT_EQUAL_UINT32(0, kept[0]);
+	TEST_ASSERT_EQUAL_UINT32(49, kept[1]);
+}
+
+// === Benchmark: /export path ===
+static char csv[TRACK_POINTS * TRACK_CSV_MAX];
+static size_t csv_len;
+
+struct mem_reader {
+	const char *p;
+	size_t left;
+};
+
+static size_t mem_read(void *ctx, uint8_t *buf, size_t len)
+{
+	struct mem_reader *r = (struct mem_reader *)ctx;
+
+	if (len > r->left)
+		len = r->left;
+	memcpy(buf, r->p, len);
+	r->p += len;
+	r->left -= len;
+	return len;
+}
+
+static double now_s(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void test_bench_export(void)
+{
+	static const float tols[] = { 0, 1, 5, 10, 25 };
+	uint8_t out[TRACK_OUT_MAX];
+	char msg[128];
+
+	csv_len = 0;
+	for (int i = 0; i < TRACK_POINTS; i++) {
+		csv_len += track_csv_line(&track[i], csv + csv_len, sizeof(csv) - csv_len);
+		csv[csv_len++] = '\n';
+	}
+
+	for (unsigned t = 0; t < sizeof(tols) / sizeof(tols[0]); t++) {
+		const int rounds = 5;
+		size_t bytes = 0;
+		uint32_t points = 0;
+		double t0 = now_s();
+
+		for (int r = 0; r < rounds; r++) {
+			struct mem_reader in = { csv, csv_len };
+			struct track_transcoder tc;
+			struct track_simplify s;
+			size_t n;
+
+			track_transcoder_init(&tc, TRACK_FMT_GPX, mem_read, &in);
+			if (tols[t] > 0) {
+				track_simplify_init(&s, tols[t]);
+				track_transcoder_simplify(&tc, &s);
+			}
+			bytes = 0;
+			while ((n = track_transcode(&tc, out, sizeof(out))) > 0)
+				bytes += n;
+			points = tols[t] > 0 ? s.points_out : tc.points;
+		}
+		double dt = (now_s() - t0) / rounds;
+
+		snprintf(msg, sizeof(msg), "tol %4.1f m: %5u points, GPX %7lu bytes, %.2f M points/s in",
+			 tols[t], points, (unsigned long)bytes, TRACK_POINTS / dt / 1e6);
+		TEST_MESSAGE(msg);
+		TEST_ASSERT_GREATER_THAN(0, points);
+		/* A 20k-point log has to export in well under a second */
+		TEST_ASSERT_TRUE_MESSAGE(dt < 0.5, msg);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	make_track();
+	UNITY_BEGIN();
+	RUN_TEST(test_within_1m);
+	RUN_TEST(test_within_5m);
+	RUN_TEST(test_within_25m);
+	RUN_TEST(test_zero_tolerance_keeps_everything);
+	RUN_TEST(test_straight_line_keeps_ends);
+	RUN_TEST(test_bench_export);
+	return UNITY_END();
+}